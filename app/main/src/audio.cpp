@@ -1,4 +1,5 @@
 #include "audio.h"
+#include "record.h"
 #include <cstdio>
 #include <cstring>
 #include <msynth/sound.h>
@@ -8,18 +9,22 @@
 #include <cstddef>
 
 namespace ms::audio {
-	constexpr inline size_t master_buffer_sample_count = 300;
+	constexpr inline size_t master_buffer_sample_count = synth::fx::block_size;
 
 	int16_t master_sample_buffer[2][master_buffer_sample_count * 2]{}; // *2 for stereo panning.
 
-	// TODO: proper interface for this
-	//
-	// + mixers + effects + etc. etc. etc. aaaaaaaaaaaaaaaaaaaaaaaaaa
-	
-	synth::playback::AudioGenerator *active_generator = nullptr;
+	// The root of the effect bus; everything that makes sound ends up mixed in here
+	synth::fx::Bus master;
+	int16_t master_block[master_buffer_sample_count];
+
+	bool running = false;
 
 	int32_t master_volume = INT16_MAX;
 
+	// Blocks started playing since start(), and the cycle count when the last one did
+	volatile uint32_t blocks_played = 0, block_started = 0;
+	constexpr inline uint32_t cycles_per_sample = F_CPU / 44100;
+
 	void dma_interrupt() {
 		if (LL_DMA_IsActiveFlag_TE4(DMA1)) {
 			LL_DMA_ClearFlag_TE4(DMA1);
@@ -30,45 +35,75 @@ namespace ms::audio {
 		else if (!LL_DMA_IsActiveFlag_TC4(DMA1)) return;
 		LL_DMA_ClearFlag_TC4(DMA1);
 
+		// The other buffer just started playing
+		block_started = util::cycles();
+		blocks_played = blocks_played + 1;
+
 		// Generate the next bunch of samples
 		int16_t * buf = LL_DMA_GetCurrentTargetMem(DMA1, LL_DMA_STREAM_4) == LL_DMA_CURRENTTARGETMEM1 ? master_sample_buffer[0] : master_sample_buffer[1];
 
-		if (!active_generator) {
+		if (!running) {
 			memset(buf, 0, master_buffer_sample_count * sizeof(uint16_t) * 2);
 			return;
 		}
 
-		const static auto generate = &synth::playback::AudioGenerator::generate;
-		typedef int16_t (*hoisted_loop_type)(synth::playback::AudioGenerator *);
-		hoisted_loop_type hoisted_loop = (hoisted_loop_type)(active_generator->*generate);
+		master.render(master_block, master_buffer_sample_count);
+		// Recording happens before the volume so the knob doesn't end up in the take
+		record::tap(0).process(master_block, master_buffer_sample_count);
 
-		for (size_t sample = 0; sample < master_buffer_sample_count*2; sample += 2) {
-			int16_t raw = hoisted_loop(active_generator);
-			raw = static_cast<int16_t>((static_cast<int32_t>(raw) * master_volume) / INT16_MAX);
-			buf[sample] = raw;
-			buf[sample+1] = raw;
+		for (size_t sample = 0; sample < master_buffer_sample_count; ++sample) {
+			int16_t raw = static_cast<int16_t>((static_cast<int32_t>(master_block[sample]) * master_volume) / INT16_MAX);
+			buf[sample*2] = raw;
+			buf[sample*2+1] = raw;
 		}
 	}
 
 	void add_source(synth::playback::AudioGenerator *ptr) {
-		active_generator = ptr;
+		master.add_source(ptr);
+	}
+
+	synth::fx::Bus& master_bus() {
+		return master;
 	}
 
 	void stop() {
 		sound::stop_output();
-		active_generator = 0;
+		running = false;
+		master.clear_sources();
 	}
 
 	void start() {
+		blocks_played = 0;
+		block_started = util::cycles();
+		running = true;
 		sound::setup_double_buffer(master_sample_buffer[0], master_sample_buffer[1], master_buffer_sample_count);
 	}
 
 	void init() {
 		puts("Starting sound subsystem");
 		sound::init();
+		// Used to time effect stages (and the sample clock)
+		util::enable_cycle_counter();
 		util::delay(10);
 	}
 
+	uint32_t sample_clock() {
+		uint32_t blocks, started;
+		do {
+			blocks = blocks_played;
+			started = block_started;
+		} while (blocks != blocks_played);
+
+		uint32_t offset = (util::cycles() - started) / cycles_per_sample;
+		if (offset >= master_buffer_sample_count) offset = master_buffer_sample_count - 1;
+		return blocks * master_buffer_sample_count + offset;
+	}
+
+	uint32_t rendered_until() {
+		// The block after the one playing is already in the other buffer
+		return (blocks_played + 2) * master_buffer_sample_count;
+	}
+
 	void set_volume(int16_t max_level) {
 		master_volume = max_level;
 	}
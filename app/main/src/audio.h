@@ -6,6 +6,7 @@
 // collects, and outputs sound.
 
 #include "synth/playback.h"
+#include "synth/fx/bus.h"
 #include <cstddef>
 
 namespace ms::audio {
@@ -13,6 +14,9 @@ namespace ms::audio {
 	// Overloaded for various types of audio
 	void add_source(synth::playback::AudioGenerator *generator);
 
+	// Effects are added to the master bus (or to buses feeding into it)
+	synth::fx::Bus& master_bus();
+
 	void stop();
 	void start();
 
@@ -22,4 +26,11 @@ namespace ms::audio {
 
 	// DMA for audio should be routed here
 	void dma_interrupt();
+
+	// The sample being played right now, counted from start(). Between blocks this is interpolated with the cycle counter, so it's
+	// accurate to about a sample.
+	uint32_t sample_clock();
+
+	// Everything before this sample has already been rendered into the DMA buffers, so anything changed now is heard from here on.
+	uint32_t rendered_until();
 }
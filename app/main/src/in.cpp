@@ -98,6 +98,12 @@ namespace ms::in {
 
 			ms::evt::dispatch(evt);
 		}
+		else if ((data[0] == 0xc0) && length >= 2) {
+			evt.type = evt::MidiEvent::TypeProgramChange;
+			evt.programchange.pc = data[1];
+
+			ms::evt::dispatch(evt);
+		}
 		// TODO: other messages
 	}
 
@@ -1,6 +1,7 @@
 #include "in.h"
 #include "irq.h"
 #include "audio.h"
+#include "record.h"
 
 #include <stdio.h>
 
@@ -8,14 +9,86 @@
 #include <msynth/periphcfg.h>
 #include <msynth/draw.h>
 #include <msynth/lcd.h>
+#include <msynth/util.h>
+#include <msynth/sd.h>
 #include "synth/module.h"
 
 #include "synth/modules/waves.h"
 #include "synth/patch.h"
+#include "synth/bank.h"
 #include "synth/live.h"
+#include "synth/fx/reverb.h"
+#include "synth/stream.h"
+#include "synth/bench.h"
+#include "seq/sequence.h"
+#include "seq/smf.h"
 #include "ui/mgr.h"
 #include "malloc.h"
 
+// Master reverb; the lines go in CCMRAM since main SRAM is mostly taken up by the heap
+CCMBSS int16_t reverb_memory[ms::synth::fx::Reverb::MediumSamples];
+ms::synth::fx::Reverb reverb(reverb_memory, ms::synth::fx::Reverb::MediumSamples);
+
+// The REC button starts and stops recording the master mix to the SD card
+struct RecordButton : ms::evt::EventHandler<ms::evt::KeyEvent> {
+	// Room reserved on the card for each take
+	constexpr static inline uint32_t max_seconds = 10 * 60;
+
+	bool handle(const ms::evt::KeyEvent& evt) override {
+		if (!evt.down || evt.key != periph::ui::button::REC) return false;
+		if (ms::record::recording()) stop();
+		else if (auto result = ms::record::start(1, max_seconds); result != ms::record::status::Ok) {
+			printf("recording failed to start (%d, fat %d)\n", static_cast<int>(result), static_cast<int>(ms::record::fat_error()));
+		}
+		else printf("recording take %u\n", static_cast<unsigned>(ms::record::take()));
+
+		periph::ui::set(periph::ui::led::REC, ms::record::recording());
+		return true;
+	}
+
+	void stop() {
+		auto result = ms::record::stop();
+		const auto& stats = ms::record::stats().tracks[0];
+		printf("take %u done (%d): %u samples, %u overruns, lowest free %u\n", static_cast<unsigned>(ms::record::take()), static_cast<int>(result),
+			static_cast<unsigned>(stats.samples), static_cast<unsigned>(stats.overruns), static_cast<unsigned>(stats.lowest_free));
+		periph::ui::set(periph::ui::led::REC, false);
+	}
+};
+
+// MIDI sequencer: takes are recorded in RAM (spilling to the card if they get long), and songs are played straight off the card
+ms::seq::Take take("SEQSPILL.BIN");
+ms::seq::Sequencer sequencer(take);
+ms::seq::smf::Reader song;
+
+// F1 starts and stops recording a MIDI take; PLAY plays the last take, or SONG.MID off the card if nothing's been recorded
+struct SequencerButtons : ms::evt::EventHandler<ms::evt::KeyEvent> {
+	bool handle(const ms::evt::KeyEvent& evt) override {
+		if (!evt.down) return false;
+
+		if (evt.key == periph::ui::button::F1) {
+			if (sequencer.recording()) {
+				auto result = sequencer.stop();
+				printf("sequence done (%d): %u events, %u bytes, %u dropped\n", static_cast<int>(result), static_cast<unsigned>(take.events()),
+					static_cast<unsigned>(take.bytes()), static_cast<unsigned>(sequencer.stats().dropped));
+			}
+			else sequencer.record();
+		}
+		else if (evt.key == periph::ui::button::PLAY) {
+			if (sequencer.playing()) sequencer.stop();
+			else if (take.events()) sequencer.play(take);
+			else if (fat::volume.mounted || (sd::card.status == sd::init_status::Ok && fat::mount() == fat::status::Ok)) {
+				if (auto result = song.open("SONG.MID"); result == ms::seq::smf::status::Ok) sequencer.play(song);
+				else printf("can't play SONG.MID (%d)\n", static_cast<int>(result));
+			}
+		}
+		else return false;
+
+		periph::ui::set(periph::ui::led::F1, sequencer.recording());
+		periph::ui::set(periph::ui::led::PLAY, sequencer.playing());
+		return true;
+	}
+};
+
 int main() {
 	// Setup debug UART
 	periph::setup_dbguart();
@@ -67,19 +140,29 @@ int main() {
 	ms::in::init();
 	status("Initializing sound...");
 	ms::audio::init();
+#ifdef MSYNTH_BENCH
+	status("Running benchmarks...");
+	ms::synth::bench::run();
+#endif
 	status("Setting up UI...");
 	util::delay(100); // TODO: remove me when there's more loading tasks... lol
 	ms::ui::ui_16_font = ui_font; // set ui font
 	status("Loading settings...");
 
 	// TODO: read previous UI state / serialize UI state and start the correct UI
-	// TODO: check if we need to start the SD card
+	if (sd::inserted()) {
+		status("Starting SD card...");
+		if (auto result = sd::init_card(); result != sd::init_status::Ok) printf("sd card init failed (%d)\n", static_cast<int>(result));
+	}
 	
 	status("Loading patch...");
 
-	// temp: setup a synth
-	ms::synth::Patch patch;
-	{
+	ms::synth::bank::Entry program = ms::synth::bank::load("patches/default");
+	if (!program) {
+		program.patch = std::make_unique<ms::synth::Patch>();
+		ms::synth::Patch &patch = *program.patch;
+
+		// temp: setup a synth
 		ms::synth::mod::SqwWave x;
 		ms::synth::mod::SqwWave::Cfg x_config;
 
@@ -103,15 +186,24 @@ int main() {
 		patch.link_modules(ms::synth::predef::ModuleRefGlobalIn, vibrato, ms::synth::predef::GlobalInPitchIdx, 2);
 		// Hook up output of vibrato to frequency
 		patch.link_modules(vibrato, sqw1, 0, 0);
+
+		program.program = std::make_unique<ms::synth::Program>(patch);
 	}
 
 	// Create an liveplayback
-	ms::synth::playback::LivePlayback<10> playback(patch);
+	ms::synth::playback::LivePlayback<10> playback(std::move(program));
 
 	// Add it to the event pool
 	ms::evt::add(&playback);
+	RecordButton record_button;
+	ms::evt::add(&record_button);
+	ms::evt::add(&sequencer);
+	SequencerButtons sequencer_buttons;
+	ms::evt::add(&sequencer_buttons);
 	// Set it as the source
 	ms::audio::add_source(&playback);
+	// Effects
+	ms::audio::master_bus().add_stage(&reverb, 120'000);
 	// Start audio subsystem
 	ms::audio::set_volume(32767);
 	ms::audio::start();
@@ -120,9 +212,29 @@ int main() {
 	struct mallinfo g = mallinfo();
 	printf("arena %d; uord %d; ford %d\n", g.arena, g.uordblks, g.fordblks);
 	
+#ifdef MSYNTH_DEBUG_PROGRAM
+	uint8_t peak_voices = 0;
+#endif
 	while (1) {
 		util::delay(1);
 		ms::in::poll();
+		playback.update();
+#ifdef MSYNTH_DEBUG_PROGRAM
+		if (playback.peak_voices() != peak_voices) {
+			peak_voices = playback.peak_voices();
+			printf("peak voices %d\n", peak_voices);
+		}
+#endif
+		ms::synth::stream::service();
+		// Saving compiled programs stalls flash, so only do it while nothing is playing
+		ms::synth::bank::service(!playback.active_voices() && !sequencer.playing() && !ms::record::recording());
+		if (sequencer.playing()) {
+			sequencer.update();
+			if (!sequencer.playing()) periph::ui::set(periph::ui::led::PLAY, false);
+		}
+		ms::record::service();
+		sd::service();
+		if (ms::record::recording() && ms::record::stats().tracks[0].full) record_button.stop();
 		ms::ui::mgr::draw();
 	}
 
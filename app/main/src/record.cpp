@@ -0,0 +1,368 @@
+#include "record.h"
+#include <msynth/sd.h>
+#include <msynth/sdcache.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace ms::record {
+	namespace {
+		constexpr uint32_t sector_size = 512;
+		constexpr uint32_t sector_samples = sector_size / sizeof(int16_t);
+		// Same as synth::sample_rate
+		constexpr uint32_t sample_rate = 44100;
+		// The WAV header is padded out to a whole sector (with a JUNK chunk) so the samples start on a sector boundary
+		constexpr uint32_t header_size = sector_size;
+		// The most pieces a file's reservation can be in; anything past that is left unused
+		constexpr uint32_t max_extents = 16;
+
+		struct Track final : synth::fx::Effect {
+			Track(uint8_t index) : index(index) {}
+
+			void process(int16_t *block, size_t count) override;
+
+			const uint8_t index;
+			int16_t *ring = nullptr;
+			// Samples put into the ring by the tap, and samples whose space in the ring has been freed again by a finished
+			// write. Each side only writes its own, so the ring needs no lock.
+			volatile uint32_t written = 0, drained = 0;
+			uint32_t capacity = 0; // samples that fit in the file
+			fat::File file;
+			// Every run of sectors the file has reserved, all looked up before starting so capturing never reads the FAT
+			fat::Extent extents[max_extents];
+			uint8_t extent_count = 0, next_extent = 0;
+			fat::Extent extent{}; // where the next sectors go
+			uint32_t bytes = 0; // written to the card
+			bool open = false;
+		};
+
+		Track tracks[max_tracks]{0, 1, 2, 3};
+
+		// Tracks whose taps are capturing
+		volatile uint32_t armed = 0;
+		bool active = false, stopping = false, failed = false;
+		status failure = status::Ok;
+
+		// The write in flight (or just finished, until service() catches up with it)
+		volatile bool writing = false, write_failed = false;
+		Track *written_track = nullptr;
+		uint32_t written_sectors = 0, written_samples = 0;
+
+		uint32_t current_take = 0;
+		fat::status last_fat_error = fat::status::Ok;
+		Stats statistics{};
+
+		alignas(4) uint8_t header[header_size];
+
+		void make_header(uint32_t data_bytes) {
+			auto put16 = [](size_t at, uint16_t value) {memcpy(header + at, &value, 2);};
+			auto put32 = [](size_t at, uint32_t value) {memcpy(header + at, &value, 4);};
+
+			memset(header, 0, header_size);
+			memcpy(header, "RIFF", 4);
+			put32(4, header_size - 8 + data_bytes);
+			memcpy(header + 8, "WAVE", 4);
+
+			// Mono 16 bit PCM
+			memcpy(header + 12, "fmt ", 4);
+			put32(16, 16);
+			put16(20, 1);
+			put16(22, 1);
+			put32(24, sample_rate);
+			put32(28, sample_rate * 2);
+			put16(32, 2);
+			put16(34, 16);
+
+			memcpy(header + 36, "JUNK", 4);
+			put32(40, header_size - 44 - 8);
+
+			memcpy(header + header_size - 8, "data", 4);
+			put32(header_size - 4, data_bytes);
+		}
+
+		void make_path(char *path, uint32_t take, uint8_t track) {
+			snprintf(path, 16, "R%03u_%u.WAV", static_cast<unsigned>(take), static_cast<unsigned>(track));
+		}
+
+		status file_error(fat::status error) {
+			last_fat_error = error;
+			return status::FileError;
+		}
+
+		void fail(status why) {
+			armed = 0;
+			failed = true;
+			failure = why;
+		}
+
+		void on_write(void *, sd::access_status result) {
+			if (result == sd::access_status::Ok) {
+				written_track->drained = written_track->drained + written_samples;
+			}
+			else {
+				++statistics.write_errors;
+				write_failed = true;
+			}
+			writing = false;
+		}
+
+		// Send the next part of track's ring to the card
+		void write(Track& track, uint32_t waiting) {
+			if (!track.extent.length) {
+				// Can't happen, since the capacity only covers the extents
+				if (track.next_extent == track.extent_count) {
+					last_fat_error = fat::status::Full;
+					fail(status::FileError);
+					return;
+				}
+				track.extent = track.extents[track.next_extent++];
+			}
+
+			// Whole sectors only, except for the very end once the taps have stopped
+			uint32_t offset = track.drained % ring_samples;
+			uint32_t sectors = stopping ? (waiting + sector_samples - 1) / sector_samples : waiting / sector_samples;
+			if (sectors > max_write_sectors) sectors = max_write_sectors;
+			if (sectors > (ring_samples - offset) / sector_samples) sectors = (ring_samples - offset) / sector_samples;
+			if (sectors > track.extent.length) sectors = track.extent.length;
+
+			uint32_t samples = sectors * sector_samples < waiting ? sectors * sector_samples : waiting;
+			memset(track.ring + offset + samples, 0, (sectors * sector_samples - samples) * sizeof(int16_t));
+
+			written_track = &track;
+			written_sectors = sectors;
+			written_samples = samples;
+			write_failed = false;
+			writing = true;
+
+			// Nothing should have these cached, but the cache mustn't hold on to stale copies either way
+			sd::cache::invalidate(track.extent.sector, sectors);
+			auto result = sd::write(track.extent.sector, track.ring + offset, sectors, on_write, nullptr);
+			if (result != sd::access_status::InProgress) {
+				writing = false;
+				written_track = nullptr;
+				// A full queue clears up by itself; anything else won't
+				if (result != sd::access_status::Busy) {
+					++statistics.write_errors;
+					fail(status::DiskError);
+				}
+				return;
+			}
+
+			++statistics.writes;
+			statistics.sectors_written += sectors;
+		}
+
+		fat::status prepare(Track& track, uint32_t seconds) {
+			char path[16];
+			make_path(path, current_take, track.index);
+			if (auto result = track.file.create(path); result != fat::status::Ok) return result;
+			track.open = true;
+
+			make_header(0);
+			if (auto result = track.file.write(header, header_size); result != fat::status::Ok) return result;
+			if (auto result = track.file.reserve(seconds * sample_rate * sizeof(int16_t)); result != fat::status::Ok) return result;
+
+			// Map out the reservation
+			uint32_t wanted = seconds * sample_rate * sizeof(int16_t), mapped = 0;
+			track.extent_count = track.next_extent = 0;
+			while (mapped < wanted && track.extent_count < max_extents) {
+				fat::Extent& extent = track.extents[track.extent_count++];
+				if (auto result = track.file.extent(header_size + mapped, extent); result != fat::status::Ok) return result;
+				mapped += extent.length * sector_size;
+			}
+
+			track.capacity = (mapped < wanted ? mapped : wanted) / sizeof(int16_t);
+			track.extent = {};
+			track.bytes = 0;
+			track.written = 0;
+			track.drained = 0;
+			return fat::status::Ok;
+		}
+
+		fat::status finish(Track& track) {
+			// Take in everything that was written behind the filesystem's back
+			if (auto result = track.file.advance(track.bytes); result != fat::status::Ok) return result;
+
+			make_header(track.bytes);
+			if (auto result = track.file.seek(0); result != fat::status::Ok) return result;
+			if (auto result = track.file.write(header, header_size); result != fat::status::Ok) return result;
+			return track.file.close();
+		}
+
+		// Close every file (freeing whatever was reserved for it) and the rings
+		fat::status close_all(bool finish_files) {
+			fat::status first_error = fat::status::Ok;
+			for (auto& track : tracks) {
+				if (track.open) {
+					auto result = finish_files ? finish(track) : track.file.close();
+					if (result != fat::status::Ok && first_error == fat::status::Ok) first_error = result;
+					track.open = false;
+				}
+				free(track.ring);
+				track.ring = nullptr;
+			}
+			return first_error;
+		}
+	}
+
+	void Track::process(int16_t *block, size_t count) {
+		if (!(armed & (1u << index))) return;
+
+		auto& stats = statistics.tracks[index];
+		uint32_t at = written;
+		if (at + count > capacity) {
+			stats.full = true;
+			return;
+		}
+
+		uint32_t room = ring_samples - (at - drained);
+		if (room < stats.lowest_free) stats.lowest_free = room;
+		if (count > room) {
+			++stats.overruns;
+			stats.dropped_samples += count;
+			return;
+		}
+
+		uint32_t offset = at % ring_samples;
+		uint32_t first = count < ring_samples - offset ? count : ring_samples - offset;
+		memcpy(ring + offset, block, first * sizeof(int16_t));
+		memcpy(ring, block + first, (count - first) * sizeof(int16_t));
+
+		written = at + count;
+		stats.samples = at + count;
+	}
+
+	synth::fx::Effect& tap(size_t track) {
+		return tracks[track];
+	}
+
+	status start(uint32_t track_mask, uint32_t seconds) {
+		if (active) return status::AlreadyRecording;
+		track_mask &= (1u << max_tracks) - 1;
+		if (!track_mask) return status::NoTracks;
+		if (sd::card.status != sd::init_status::Ok) return status::NoCard;
+		if (!fat::volume.mounted) {
+			if (auto result = fat::mount(); result != fat::status::Ok) return file_error(result);
+		}
+
+		// Find the next take that has no files yet
+		for (uint32_t tries = 0;; ++tries) {
+			if (tries == 999) return file_error(fat::status::AlreadyExists);
+			current_take = current_take % 999 + 1;
+
+			bool exists = false;
+			for (uint8_t track = 0; track < max_tracks && !exists; ++track) {
+				char path[16];
+				make_path(path, current_take, track);
+				fat::File existing;
+				auto result = existing.open(path);
+				if (result == fat::status::Ok) exists = true;
+				else if (result != fat::status::NotFound) return file_error(result);
+			}
+			if (!exists) break;
+		}
+
+		statistics = {};
+		for (auto& track : tracks) {
+			if (!(track_mask & (1u << track.index))) continue;
+
+			track.ring = static_cast<int16_t *>(malloc(ring_samples * sizeof(int16_t)));
+			if (!track.ring) {
+				close_all(false);
+				return status::NoMemory;
+			}
+			if (auto result = prepare(track, seconds); result != fat::status::Ok) {
+				close_all(false);
+				return file_error(result);
+			}
+			statistics.tracks[track.index].lowest_free = ring_samples;
+		}
+
+		// Get the directory entries and allocations onto the card now, so nothing else has to be written until stop()
+		if (auto result = fat::sync(); result != fat::status::Ok) {
+			close_all(false);
+			return file_error(result);
+		}
+
+		active = true;
+		stopping = failed = false;
+		failure = status::Ok;
+		// All at once, so the tracks line up
+		armed = track_mask;
+		return status::Ok;
+	}
+
+	status stop() {
+		if (!active) return status::NotRecording;
+
+		armed = 0;
+		stopping = true;
+		while (true) {
+			sd::service();
+			service();
+			if (failed) break;
+			if (writing || written_track) continue;
+
+			bool waiting = false;
+			for (const auto& track : tracks) {
+				if (track.open && track.written != track.drained) waiting = true;
+			}
+			if (!waiting) break;
+		}
+
+		status result = failed ? failure : status::Ok;
+		if (auto closed = close_all(true); closed != fat::status::Ok && result == status::Ok) result = file_error(closed);
+
+		active = stopping = false;
+		return result;
+	}
+
+	bool recording() {
+		return active;
+	}
+
+	void service() {
+		if (!active || writing) return;
+
+		if (written_track) {
+			// Account for the write that just finished
+			Track& track = *written_track;
+			written_track = nullptr;
+			if (write_failed) {
+				fail(status::DiskError);
+				return;
+			}
+
+			track.extent.sector += written_sectors;
+			track.extent.length -= written_sectors;
+			track.bytes += written_samples * sizeof(int16_t);
+		}
+		if (failed) return;
+
+		// Write out whichever track has the most waiting
+		Track *neediest = nullptr;
+		uint32_t most = 0;
+		for (auto& track : tracks) {
+			if (!track.open) continue;
+
+			uint32_t waiting = track.written - track.drained;
+			if (waiting > most && (stopping || waiting >= min_write_sectors * sector_samples)) {
+				most = waiting;
+				neediest = &track;
+			}
+		}
+		if (neediest) write(*neediest, most);
+	}
+
+	uint32_t take() {
+		return current_take;
+	}
+
+	fat::status fat_error() {
+		return last_fat_error;
+	}
+
+	const Stats& stats() {
+		return statistics;
+	}
+}
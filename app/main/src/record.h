@@ -0,0 +1,82 @@
+#pragma once
+// Recording to the SD card
+//
+// Up to max_tracks tracks can be captured at the same time. Track 0 is the master mix (tapped in audio.cpp before the volume is
+// applied); the others are stems, which can be taken from any effect bus by adding the track's tap as that bus's last stage:
+//
+// 	drum_bus.add_stage(&ms::record::tap(1));
+//
+// Taps run in the audio interrupt and only copy each block into their track's ring. The main loop drains the rings to the card
+// from service() with large asynchronous writes, so the interrupt never waits for the card. If the card stalls for longer than
+// a ring lasts, whole blocks are dropped and counted as overruns.
+//
+// Every take is written to one mono WAV file per track in the root of the card, named Rnnn_t.WAV (take nnn, track t). The files
+// are allocated in full before recording starts, so while capturing only sample data is written, straight into sectors that
+// were looked up ahead of time; the FAT and directory are updated once, by stop(), which also frees whatever wasn't used.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <msynth/fat.h>
+#include "synth/fx/bus.h"
+
+namespace ms::record {
+	constexpr inline size_t max_tracks = 4;
+
+	// Each track's ring: 32KiB, or ~370ms
+	constexpr inline size_t ring_sectors = 64;
+	constexpr inline size_t ring_samples = ring_sectors * 256;
+
+	// Writes are at least this long (except for the last one) so the card isn't kept busy with small writes, and at most this
+	// long so ring space keeps getting freed up
+	constexpr inline size_t min_write_sectors = 8;
+	constexpr inline size_t max_write_sectors = 32;
+
+	enum struct status {
+		Ok,
+		NoCard, // The SD card isn't initialized
+		AlreadyRecording,
+		NotRecording,
+		NoTracks, // No tracks were selected
+		NoMemory, // The rings couldn't be allocated
+		FileError, // Creating or finishing the files failed; see fat_error()
+		DiskError // A write failed, which stopped the recording
+	};
+
+	struct TrackStats {
+		uint32_t samples; // captured into the ring
+		uint32_t overruns; // blocks dropped because the ring was full
+		uint32_t dropped_samples;
+		uint32_t lowest_free; // the least free space the interrupt saw in the ring, in samples
+		bool full; // ran out of preallocated space
+	};
+
+	struct Stats {
+		uint32_t writes; // write commands sent
+		uint32_t sectors_written;
+		uint32_t write_errors;
+		TrackStats tracks[max_tracks];
+	};
+
+	// The tap that feeds track (an effect that leaves the block alone)
+	synth::fx::Effect& tap(size_t track);
+
+	// Start a new take recording the tracks in track_mask (bit 0 is the master mix), with room for up to `seconds` of audio. The
+	// card must be initialized; the filesystem is mounted if it isn't yet.
+	status start(uint32_t track_mask, uint32_t seconds);
+
+	// Stop recording, write out everything that's left and finish the files. Blocks until that's done.
+	status stop();
+
+	bool recording();
+
+	// Write buffered audio to the card. Call regularly from the main loop (along with sd::service()).
+	void service();
+
+	// The number of the current (or last) take
+	uint32_t take();
+
+	// What went wrong in the filesystem for the last FileError
+	fat::status fat_error();
+
+	const Stats& stats();
+}
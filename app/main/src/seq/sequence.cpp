@@ -0,0 +1,275 @@
+#include "sequence.h"
+#include "../audio.h"
+#include "../synth/fx/bus.h"
+#include <msynth/sd.h>
+#include <string.h>
+
+namespace ms::seq {
+	namespace {
+		constexpr uint32_t sector_size = 512;
+
+		// Data bytes after the type byte
+		size_t data_length(uint8_t type) {
+			return type == evt::MidiEvent::TypeProgramChange ? 1 : 2;
+		}
+	}
+
+	size_t encode(uint32_t delta, const evt::MidiEvent &event, uint8_t *out) {
+		uint8_t data[2];
+		switch (event.type) {
+			case evt::MidiEvent::TypeNoteOn:
+			case evt::MidiEvent::TypeNoteOff:
+				data[0] = event.note.note;
+				data[1] = event.note.velocity;
+				break;
+			case evt::MidiEvent::TypePitchBend:
+				data[0] = static_cast<uint16_t>(event.pitchbend.amount);
+				data[1] = static_cast<uint16_t>(event.pitchbend.amount) >> 8;
+				break;
+			case evt::MidiEvent::TypeAftertouch:
+				data[0] = event.aftertouch.note;
+				data[1] = event.aftertouch.amount;
+				break;
+			case evt::MidiEvent::TypeControl:
+				data[0] = event.controller.control;
+				data[1] = event.controller.value;
+				break;
+			case evt::MidiEvent::TypeProgramChange:
+				data[0] = event.programchange.pc;
+				break;
+			default:
+				return 0;
+		}
+
+		// Variable length delta, most significant group first
+		uint8_t groups[5];
+		size_t count = 0, size = 0;
+		do {
+			groups[count++] = delta & 0x7f;
+			delta >>= 7;
+		} while (delta);
+		while (count--) out[size++] = groups[count] | (count ? 0x80 : 0);
+
+		out[size++] = event.type;
+		for (size_t i = 0; i < data_length(event.type); ++i) out[size++] = data[i];
+		return size;
+	}
+
+	void Take::clear() {
+		window_start = window_length = 0;
+		length = event_count = 0;
+		last_time = 0;
+		rewind();
+	}
+
+	status Take::append(uint32_t time, const evt::MidiEvent &event) {
+		uint8_t encoded[max_encoded_size];
+		size_t size = encode(time - last_time, event, encoded);
+		if (!size) return status::NotStorable;
+
+		if (window_length + size > ram_bytes) {
+			if (auto result = spill(); result != status::Ok) return result;
+		}
+
+		memcpy(ram + window_length, encoded, size);
+		window_length += size;
+		length += size;
+		last_time = time;
+		++event_count;
+		return status::Ok;
+	}
+
+	status Take::spill() {
+		if (!spill_open) {
+			if (!fat::volume.mounted) {
+				if (sd::card.status != sd::init_status::Ok) return status::NoCard;
+				if (auto result = fat::mount(); result != fat::status::Ok) {
+					last_fat_error = result;
+					return status::FileError;
+				}
+			}
+
+			// The file is just scratch space (the length is kept here), so an old one is simply written over
+			auto result = spill_file.open(spill_path);
+			if (result == fat::status::NotFound) result = spill_file.create(spill_path);
+			if (result != fat::status::Ok) {
+				last_fat_error = result;
+				return status::FileError;
+			}
+			spill_open = true;
+		}
+
+		// Move the first half of the buffer out to the card
+		constexpr uint32_t half = ram_bytes / 2;
+		fat::status result = spill_file.seek(window_start);
+		if (result == fat::status::Ok) result = spill_file.write(ram, half);
+		if (result != fat::status::Ok) {
+			last_fat_error = result;
+			return status::FileError;
+		}
+
+		memmove(ram, ram + half, window_length - half);
+		window_start += half;
+		window_length -= half;
+		return status::Ok;
+	}
+
+	status Take::finish() {
+		if (!spill_open) return status::Ok;
+
+		// Put the rest of it after what's already there, so the whole take is in the file
+		fat::status result = spill_file.seek(window_start);
+		if (result == fat::status::Ok) result = spill_file.write(ram, window_length);
+		if (result == fat::status::Ok) result = spill_file.flush();
+		if (result != fat::status::Ok) {
+			last_fat_error = result;
+			return status::FileError;
+		}
+		return status::Ok;
+	}
+
+	bool Take::byte(uint32_t position, uint8_t &out) {
+		if (position - window_start >= window_length) {
+			if (!spill_open || position >= length) return false;
+
+			// Load the next buffer's worth from the spill file
+			uint32_t start = position & ~(sector_size - 1);
+			uint32_t wanted = length - start < ram_bytes ? length - start : ram_bytes, done;
+			window_length = 0;
+			if (spill_file.seek(start) != fat::status::Ok || spill_file.read(ram, wanted, done) != fat::status::Ok) return false;
+			window_start = start;
+			window_length = done;
+			if (position - window_start >= window_length) return false;
+		}
+
+		out = ram[position - window_start];
+		return true;
+	}
+
+	void Take::rewind() {
+		read_position = 0;
+		read_time = 0;
+	}
+
+	bool Take::next(uint32_t &time, evt::MidiEvent &event) {
+		if (read_position >= length) return false;
+
+		uint32_t delta = 0;
+		uint8_t value;
+		do {
+			if (!byte(read_position++, value)) return false;
+			delta = (delta << 7) | (value & 0x7f);
+		} while (value & 0x80);
+
+		uint8_t type, data[2];
+		if (!byte(read_position++, type) || type > evt::MidiEvent::TypeProgramChange) return false;
+		for (size_t i = 0; i < data_length(type); ++i) {
+			if (!byte(read_position++, data[i])) return false;
+		}
+
+		event.type = static_cast<decltype(event.type)>(type);
+		switch (event.type) {
+			case evt::MidiEvent::TypeNoteOn:
+			case evt::MidiEvent::TypeNoteOff:
+				event.note = {data[0], data[1]};
+				break;
+			case evt::MidiEvent::TypePitchBend:
+				event.pitchbend.amount = static_cast<int16_t>(data[0] | (data[1] << 8));
+				break;
+			case evt::MidiEvent::TypeAftertouch:
+				event.aftertouch = {data[0], data[1]};
+				break;
+			case evt::MidiEvent::TypeControl:
+				event.controller = {data[0], data[1]};
+				break;
+			default:
+				event.programchange.pc = data[0];
+				break;
+		}
+
+		read_time += delta;
+		time = read_time;
+		return true;
+	}
+
+	void Sequencer::record() {
+		stop();
+		take.clear();
+		statistics.recorded = statistics.dropped = 0;
+		origin = audio::sample_clock();
+		is_recording = true;
+	}
+
+	void Sequencer::play(Source &from) {
+		stop();
+		statistics.played = statistics.late = statistics.most_late = 0;
+
+		from.rewind();
+		if (!from.next(pending_time, pending)) return;
+		source = &from;
+		origin = audio::rendered_until();
+	}
+
+	status Sequencer::stop() {
+		status result = status::Ok;
+		if (is_recording) {
+			is_recording = false;
+			result = take.finish();
+		}
+
+		if (source) {
+			source = nullptr;
+
+			// Don't leave notes hanging
+			for (uint8_t note = 0; note < 128; ++note) {
+				if (!(held[note / 32] & (1u << (note % 32)))) continue;
+				evt::MidiEvent off;
+				off.type = evt::MidiEvent::TypeNoteOff;
+				off.note = {note, 0};
+				evt::dispatch(off);
+			}
+			memset(held, 0, sizeof held);
+		}
+		return result;
+	}
+
+	void Sequencer::update() {
+		if (!source) return;
+
+		// Play everything up to the end of the next block the audio interrupt will render
+		uint32_t rendered = audio::rendered_until() - origin;
+		uint32_t horizon = rendered + synth::fx::block_size;
+
+		while (static_cast<int32_t>(pending_time - horizon) < 0) {
+			if (static_cast<int32_t>(pending_time - rendered) < 0) {
+				++statistics.late;
+				if (rendered - pending_time > statistics.most_late) statistics.most_late = rendered - pending_time;
+			}
+
+			dispatch(pending);
+			if (!source->next(pending_time, pending)) {
+				stop();
+				return;
+			}
+		}
+	}
+
+	void Sequencer::dispatch(const evt::MidiEvent &event) {
+		if (event.type == evt::MidiEvent::TypeNoteOn || event.type == evt::MidiEvent::TypeNoteOff) {
+			uint8_t note = event.note.note & 0x7f;
+			if (event.type == evt::MidiEvent::TypeNoteOn && event.note.velocity) held[note / 32] |= 1u << (note % 32);
+			else held[note / 32] &= ~(1u << (note % 32));
+		}
+
+		++statistics.played;
+		evt::dispatch(event);
+	}
+
+	bool Sequencer::handle(const evt::MidiEvent &event) {
+		if (!is_recording) return false;
+
+		if (take.append(audio::sample_clock() - origin, event) == status::Ok) ++statistics.recorded;
+		else ++statistics.dropped;
+		return false;
+	}
+}
@@ -0,0 +1,146 @@
+#pragma once
+// MIDI sequencing
+//
+// A Sequencer records the MIDI events coming through the event system into a Take, and plays back any Source (a Take, or a
+// Standard MIDI File, see smf.h) by dispatching its events the same way live input is, so whatever handles live MIDI plays
+// sequences too.
+//
+// Times are in samples on the audio clock (see audio::sample_clock()), so recordings keep the exact timing of the input
+// rather than that of the main loop. Playback keeps the next event decoded and waiting; update() just compares its time with
+// the end of the next block to be rendered and dispatches everything that falls before it, so each event costs the same no
+// matter how long the sequence is, and lands in the block it belongs to.
+//
+// Takes are stored in a compact format. Each event is:
+//
+// 	delta    time since the previous event in samples, as a MIDI style variable length quantity (7 bits per byte, MSB first,
+// 	         high bit set on all but the last byte)
+// 	type     evt::MidiEvent type: 0 note on, 1 note off, 2 pitch bend, 3 aftertouch, 4 control, 5 program change
+// 	data     two bytes (note and velocity, pitch bend amount as a little endian int16, note and amount, control and value),
+// 	         or one for program changes
+//
+// so a typical note event takes 4 or 5 bytes. SysEx isn't stored.
+//
+// A take lives in a RAM buffer as long as it fits. Once it doesn't, the start of it is moved out to a scratch file on the SD card
+// (with blocking writes, from the main loop) and it's played back from there, a buffer at a time.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <msynth/fat.h>
+#include "../evt/dispatch.h"
+#include "../evt/events.h"
+
+namespace ms::seq {
+	enum struct status {
+		Ok,
+		NoCard, // The take needed to spill to the card, but there's no filesystem on it
+		FileError, // Reading or writing the spill file failed; see Take::fat_error()
+		NotStorable // SysEx, which takes don't store
+	};
+
+	// Something to play: gives its events in order, each with its time in samples from the start
+	struct Source {
+		virtual bool next(uint32_t &time, evt::MidiEvent &event) = 0;
+		// Go back to the start
+		virtual void rewind() = 0;
+	};
+
+	// Encode event (delta samples after the previous one) into out, which needs max_encoded_size bytes. Returns the length, or 0
+	// if the event can't be stored.
+	constexpr inline size_t max_encoded_size = 5 + 1 + 2;
+	size_t encode(uint32_t delta, const evt::MidiEvent &event, uint8_t *out);
+
+	struct Take final : Source {
+		// Must be a multiple of the sector size
+		constexpr static inline size_t ram_bytes = 8192;
+
+		// spill_path is the (8.3) scratch file used once the take outgrows RAM
+		Take(const char *spill_path) : spill_path(spill_path) {}
+
+		// Forget everything recorded
+		void clear();
+
+		// Add an event at time (which can't be before the last one)
+		status append(uint32_t time, const evt::MidiEvent &event);
+
+		// Done recording: writes out the rest if the take has spilled
+		status finish();
+
+		bool next(uint32_t &time, evt::MidiEvent &event) override;
+		void rewind() override;
+
+		uint32_t bytes() const {return length;}
+		uint32_t events() const {return event_count;}
+		bool spilled() const {return spill_open;}
+		fat::status fat_error() const {return last_fat_error;}
+
+	private:
+		status spill();
+		// The byte at position, loading it from the spill file if need be
+		bool byte(uint32_t position, uint8_t &out);
+
+		const char *spill_path;
+		fat::File spill_file;
+		bool spill_open = false;
+		fat::status last_fat_error = fat::status::Ok;
+
+		// ram holds [window_start, window_start + window_length) of the take
+		alignas(4) uint8_t ram[ram_bytes];
+		uint32_t window_start = 0, window_length = 0;
+
+		uint32_t length = 0, event_count = 0;
+		uint32_t last_time = 0; // of the last event appended
+
+		uint32_t read_position = 0, read_time = 0;
+	};
+
+	struct Stats {
+		uint32_t recorded; // events added to the take
+		uint32_t dropped; // events that couldn't be recorded
+		uint32_t played; // events dispatched
+		uint32_t late; // events dispatched after their block had already been rendered
+		uint32_t most_late; // by how many samples, at worst
+	};
+
+	struct Sequencer : evt::EventHandler<evt::MidiEvent> {
+		Sequencer(Take &take) : take(take) {}
+
+		// Start recording into the take (clearing it), with time starting now. Stops playback.
+		void record();
+
+		// Start playing source from its start, at the start of the next block to be rendered. The source has to stay around
+		// until playback is done. Stops recording.
+		void play(Source &source);
+
+		// Stop recording (finishing the take) or playing (releasing any notes still held)
+		status stop();
+
+		// Dispatch the events that are due. Call regularly from the main loop.
+		void update();
+
+		bool recording() const {return is_recording;}
+		bool playing() const {return source != nullptr;}
+		const Stats& stats() const {return statistics;}
+
+		// Adds events to the take while recording
+		bool handle(const evt::MidiEvent &event) override;
+
+	private:
+		void dispatch(const evt::MidiEvent &event);
+
+		Take &take;
+		Source *source = nullptr;
+		bool is_recording = false;
+
+		// Where time 0 is on the audio clock
+		uint32_t origin = 0;
+
+		// The next event to play
+		evt::MidiEvent pending;
+		uint32_t pending_time = 0;
+
+		// Notes turned on by playback, to turn off when stopping
+		uint32_t held[4]{};
+
+		Stats statistics{};
+	};
+}
@@ -0,0 +1,230 @@
+#include "smf.h"
+#include <string.h>
+
+namespace ms::seq::smf {
+	namespace {
+		uint32_t get32(const uint8_t *in) {
+			return (in[0] << 24) | (in[1] << 16) | (in[2] << 8) | in[3];
+		}
+
+		uint16_t get16(const uint8_t *in) {
+			return (in[0] << 8) | in[1];
+		}
+
+		// Turn a channel message into an event; false for ones nothing handles
+		bool convert(const uint8_t *message, evt::MidiEvent &event) {
+			switch (message[0] & 0xf0) {
+				case 0x80:
+					event.type = evt::MidiEvent::TypeNoteOff;
+					event.note = {message[1], message[2]};
+					return true;
+				case 0x90:
+					event.type = evt::MidiEvent::TypeNoteOn;
+					event.note = {message[1], message[2]};
+					return true;
+				case 0xa0:
+					event.type = evt::MidiEvent::TypeAftertouch;
+					event.aftertouch = {message[1], message[2]};
+					return true;
+				case 0xb0:
+					event.type = evt::MidiEvent::TypeControl;
+					event.controller = {message[1], message[2]};
+					return true;
+				case 0xc0:
+					event.type = evt::MidiEvent::TypeProgramChange;
+					event.programchange.pc = message[1];
+					return true;
+				case 0xd0:
+					event.type = evt::MidiEvent::TypeAftertouch;
+					event.aftertouch = {evt::MidiEvent::AftertouchEvt::All, message[1]};
+					return true;
+				case 0xe0:
+					// Packed the same way the live MIDI input does it
+					event.type = evt::MidiEvent::TypePitchBend;
+					event.pitchbend.amount = static_cast<int16_t>(message[2] | (message[1] << 7));
+					return true;
+				default:
+					return false;
+			}
+		}
+	}
+
+	bool Reader::Track::byte(uint8_t &out) {
+		if (used == buffered) {
+			uint32_t left = end - file.tell(), done;
+			if (!left) return false;
+			if (file.read(buffer, left < buffer_size ? left : buffer_size, done) != fat::status::Ok || !done) return false;
+			buffered = done;
+			used = 0;
+		}
+		out = buffer[used++];
+		return true;
+	}
+
+	bool Reader::Track::quantity(uint32_t &out) {
+		out = 0;
+		for (int i = 0; i < 4; ++i) {
+			uint8_t value;
+			if (!byte(value)) return false;
+			out = (out << 7) | (value & 0x7f);
+			if (!(value & 0x80)) return true;
+		}
+		return false;
+	}
+
+	bool Reader::Track::skip(uint32_t count) {
+		uint32_t in_buffer = buffered - used;
+		if (count <= in_buffer) {
+			used += count;
+			return true;
+		}
+
+		count -= in_buffer;
+		used = buffered = 0;
+		if (count > end - file.tell()) return false;
+		return file.seek(file.tell() + count) == fat::status::Ok;
+	}
+
+	void Reader::Track::advance() {
+		while (true) {
+			uint32_t delta, length;
+			uint8_t status;
+			if (!quantity(delta) || !byte(status)) break;
+			tick += delta;
+
+			if (status == 0xff) {
+				// Meta event
+				uint8_t type;
+				if (!byte(type) || !quantity(length) || type == 0x2f) break;
+				if (type == 0x51 && length == 3) {
+					uint8_t value[3];
+					if (!byte(value[0]) || !byte(value[1]) || !byte(value[2])) break;
+					tempo = (value[0] << 16) | (value[1] << 8) | value[2];
+					kind = Tempo;
+					return;
+				}
+				if (!skip(length)) break;
+				continue;
+			}
+			if (status == 0xf0 || status == 0xf7) {
+				if (!quantity(length) || !skip(length)) break;
+				continue;
+			}
+
+			uint8_t first;
+			if (status & 0x80) {
+				if (status >= 0xf0) break;
+				running_status = status;
+				if (!byte(first)) break;
+			}
+			else {
+				if (!running_status) break;
+				first = status;
+				status = running_status;
+			}
+
+			message[0] = status;
+			message[1] = first;
+			// Program change and channel pressure only have one data byte
+			if ((status & 0xe0) != 0xc0 && !byte(message[2])) break;
+			kind = Message;
+			return;
+		}
+
+		// End of the track (or garbage, which is treated the same)
+		kind = Done;
+	}
+
+	status Reader::open(const char *path) {
+		tracks = 0;
+
+		fat::File file;
+		if (auto result = file.open(path); result != fat::status::Ok) {
+			last_fat_error = result;
+			return status::FileError;
+		}
+
+		uint8_t header[14];
+		uint32_t done;
+		if (auto result = file.read(header, sizeof header, done); result != fat::status::Ok) {
+			last_fat_error = result;
+			return status::FileError;
+		}
+		if (done != sizeof header || memcmp(header, "MThd", 4)) return status::NotMidi;
+
+		uint16_t format = get16(header + 8), count = get16(header + 10);
+		division = get16(header + 12);
+		if (format > 1 || (division & 0x8000) || !division) return status::Unsupported;
+		if (count > max_tracks) return status::TooManyTracks;
+
+		// Find where each track is
+		uint32_t position = 8 + get32(header + 4);
+		while (tracks < count && position + 8 <= file.size()) {
+			uint8_t chunk[8];
+			fat::status result = file.seek(position);
+			if (result == fat::status::Ok) result = file.read(chunk, sizeof chunk, done);
+			if (result != fat::status::Ok) {
+				last_fat_error = result;
+				return status::FileError;
+			}
+
+			uint32_t length = get32(chunk + 4);
+			if (!memcmp(chunk, "MTrk", 4)) {
+				Track &track = track_states[tracks++];
+				track.file = file;
+				track.start = position + 8;
+				track.end = length > file.size() - track.start ? file.size() : track.start + length;
+			}
+			position += 8 + length;
+		}
+
+		rewind();
+		return status::Ok;
+	}
+
+	void Reader::rewind() {
+		for (size_t i = 0; i < tracks; ++i) {
+			Track &track = track_states[i];
+			track.buffered = track.used = 0;
+			track.tick = 0;
+			track.running_status = 0;
+			if (track.file.seek(track.start) == fat::status::Ok) track.advance();
+			else track.kind = Track::Done;
+		}
+
+		current_tick = current_time = 0;
+		fraction = 0;
+		tempo = 500000;
+	}
+
+	bool Reader::next(uint32_t &time, evt::MidiEvent &event) {
+		while (true) {
+			Track *earliest = nullptr;
+			for (size_t i = 0; i < tracks; ++i) {
+				Track &track = track_states[i];
+				if (track.kind != Track::Done && (!earliest || track.tick < earliest->tick)) earliest = &track;
+			}
+			if (!earliest) return false;
+
+			// Samples per tick are tempo / division * 44100 / 1000000
+			uint64_t elapsed = static_cast<uint64_t>(earliest->tick - current_tick) * tempo * 441 + fraction;
+			uint64_t per_sample = static_cast<uint64_t>(division) * 10000;
+			current_time += elapsed / per_sample;
+			fraction = elapsed % per_sample;
+			current_tick = earliest->tick;
+
+			if (earliest->kind == Track::Tempo) {
+				tempo = earliest->tempo;
+				earliest->advance();
+				continue;
+			}
+
+			bool converted = convert(earliest->message, event);
+			earliest->advance();
+			if (!converted) continue;
+
+			time = current_time;
+			return true;
+		}
+	}
+}
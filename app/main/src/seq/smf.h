@@ -0,0 +1,72 @@
+#pragma once
+// Standard MIDI File playback
+//
+// Files are parsed as they play instead of being loaded: every track keeps its own place in the file and a small read buffer,
+// and the tracks are merged by always taking whichever has the earliest event next. Tempo changes are applied as they come up,
+// turning ticks into samples, so RAM use only depends on the number of tracks.
+//
+// Format 0 and 1 files with metrical timing (ticks per quarter note) are supported; SMPTE timing and format 2 aren't. Channels
+// are ignored (everything goes to the same place, just like live input), as are SysEx and meta events other than tempo.
+
+#include "sequence.h"
+
+namespace ms::seq::smf {
+	enum struct status {
+		Ok,
+		FileError, // The file couldn't be read; see Reader::fat_error()
+		NotMidi, // No MThd header
+		Unsupported, // SMPTE timing, or format 2
+		TooManyTracks
+	};
+
+	struct Reader final : Source {
+		constexpr static inline size_t max_tracks = 16;
+		constexpr static inline size_t buffer_size = 64;
+
+		// Open the file and find its tracks. The filesystem must be mounted.
+		status open(const char *path);
+
+		bool next(uint32_t &time, evt::MidiEvent &event) override;
+		void rewind() override;
+
+		size_t track_count() const {return tracks;}
+		fat::status fat_error() const {return last_fat_error;}
+
+	private:
+		struct Track {
+			fat::File file;
+			uint32_t start, end; // of the events in the file
+
+			uint8_t buffer[buffer_size];
+			uint8_t buffered, used;
+
+			// The next thing that happens on this track and its absolute tick
+			enum : uint8_t {
+				Message,
+				Tempo,
+				Done
+			} kind;
+			uint32_t tick;
+			uint8_t message[3];
+			uint32_t tempo;
+
+			uint8_t running_status;
+
+			bool byte(uint8_t &out);
+			bool quantity(uint32_t &out);
+			bool skip(uint32_t count);
+			// Read up to the next channel message or tempo change
+			void advance();
+		};
+
+		Track track_states[max_tracks];
+		size_t tracks = 0;
+		uint16_t division = 96; // ticks per quarter note
+		fat::status last_fat_error = fat::status::Ok;
+
+		// Where playback has got to, with the leftover fraction of a sample (over division * 10000)
+		uint32_t current_tick = 0, current_time = 0;
+		uint64_t fraction = 0;
+		uint32_t tempo = 500000; // microseconds per quarter note
+	};
+}
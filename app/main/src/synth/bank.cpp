@@ -0,0 +1,79 @@
+#include "bank.h"
+#include "serialize.h"
+#include "cache.h"
+
+#include <msynth/fs.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+namespace ms::synth::bank {
+	namespace {
+		// A compiled program waiting for service() to save it
+		struct PendingSave {
+			char path[48];
+			void * buffer;
+			size_t length;
+		} pending_save{};
+	}
+
+	Entry load(const char *name) {
+		char path[48];
+
+		snprintf(path, sizeof path, "%s.pch", name);
+		if (!fs::exists(path)) return {};
+		const fs::File * file = fs::get(path);
+
+		Entry entry;
+		entry.patch = std::make_unique<Patch>();
+
+		const void * blob = fs::open(*file);
+		if (auto result = serialize::load(*entry.patch, blob, (*file)->length); result != serialize::load_status::Ok) {
+			printf("failed to load %s (%d)\n", path, static_cast<int>(result));
+			return {};
+		}
+
+		// Use the precompiled program if one was saved for this patch & firmware, otherwise compile it now
+		uint32_t patch_hash = cache::hash(blob, (*file)->length);
+		snprintf(path, sizeof path, "%s.pcc", name);
+		if (fs::exists(path)) {
+			const fs::File * cache_file = fs::get(path);
+			entry.program = Program::from_cache(*entry.patch, patch_hash, fs::open(*cache_file), (*cache_file)->length);
+			if (!entry.program) printf("%s is stale, recompiling\n", path);
+		}
+		if (!entry.program) {
+			entry.program = std::make_unique<Program>(*entry.patch);
+
+			// and save it for next time (this only ever programs free flash, nothing gets erased). Programming flash still stalls
+			// everything running from it, the audio interrupt included, for the whole write (~16us a word, so a big program takes
+			// a good fraction of a second), so the write itself waits for service() to see audio go idle.
+			size_t length = entry.program->cache_size();
+			if (void * buffer = length <= 0xffff ? malloc(length) : nullptr; buffer) {
+				if (entry.program->save_cache(patch_hash, buffer, length)) {
+					// Only the latest one is kept; an older one just gets compiled (and queued) again next time it's loaded
+					free(pending_save.buffer);
+					snprintf(pending_save.path, sizeof pending_save.path, "%s", path);
+					pending_save.buffer = buffer;
+					pending_save.length = length;
+				}
+				else free(buffer);
+			}
+		}
+
+		return entry;
+	}
+
+	Entry load(uint8_t program_number) {
+		char name[16];
+		snprintf(name, sizeof name, "patches/prg%03d", program_number);
+		return load(name);
+	}
+
+	void service(bool audio_idle) {
+		if (!pending_save.buffer || !audio_idle) return;
+
+		if (auto result = fs::write(pending_save.path, pending_save.buffer, pending_save.length); result != fs::write_status::Ok)
+			printf("couldn't save %s (%d)\n", pending_save.path, static_cast<int>(result));
+		free(pending_save.buffer);
+		pending_save.buffer = nullptr;
+	}
+}
@@ -0,0 +1,32 @@
+#pragma once
+// Loading programs out of the filesystem
+//
+// Patches live in patches/ as NAME.pch (see serialize.h), optionally with a precompiled NAME.pcc next to them (see cache.h).
+// MIDI program changes map to patches/prgNNN, with NNN the zero-padded program number.
+//
+// Loading compiles the program if there's no up to date NAME.pcc, which is slow, so this should only ever be called from the main
+// loop. The compiled program is saved as a new NAME.pcc later by service(). Loaded patches use their blobs in place, so
+// fs::compact() mustn't run while any are loaded.
+
+#include "patch.h"
+#include "program.h"
+#include <memory>
+
+namespace ms::synth::bank {
+	// A program along with the patch it was compiled from (which has to outlive it)
+	struct Entry {
+		std::unique_ptr<Patch> patch;
+		std::unique_ptr<Program> program;
+
+		explicit operator bool() const {return static_cast<bool>(program);}
+	};
+
+	// Load patches/NAME.pch (name is without the extension). Returns an empty entry if it doesn't exist or is invalid.
+	Entry load(const char *name);
+
+	// Load the patch for a MIDI program number
+	Entry load(uint8_t program_number);
+
+	// Save the last program load() compiled, once audio_idle is set. Called from the main loop.
+	void service(bool audio_idle);
+}
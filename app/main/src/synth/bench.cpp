@@ -0,0 +1,336 @@
+#include "bench.h"
+
+#ifdef MSYNTH_BENCH
+#include "util.h"
+#include "modules/env.h"
+#include "modules/waves.h"
+#include "modules/filter.h"
+#include "modules/fm.h"
+#include "modules/noise.h"
+#include "modules/math.h"
+#include "fx/reverb.h"
+
+#include <msynth/util.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+namespace ms::synth::bench {
+	namespace {
+		// Results get written here so the optimizer can't drop the loops
+		volatile float sink;
+
+		const int iterations = 1024;
+
+		// Average cycles per call of func(i) over iterations calls
+		template<typename Func>
+		uint32_t measure(Func&& func) {
+			uint32_t start = util::cycles();
+			for (int i = 0; i < iterations; ++i) {
+				sink = func(i);
+			}
+			return (util::cycles() - start) / iterations;
+		}
+
+		void report(const char *name, uint32_t fast, uint32_t reference, float max_error) {
+			printf("bench %-20s %5lu cyc (ref %5lu cyc) max err %e\n", name, fast, reference, max_error);
+		}
+
+		void bench_exp() {
+			// Sweep inputs in a range that's representative of pitch/gain work
+			auto input = [](int i){return static_cast<float>(i - iterations/2) * (1.f / 64.f);};
+
+			float max_error = 0;
+			for (int i = 0; i < iterations; ++i) {
+				float ref = exp2f(input(i));
+				max_error = fmaxf(max_error, fabsf(fast_exp2(input(i)) - ref) / ref);
+			}
+			report("fast_exp2", measure([&](int i){return fast_exp2(input(i));}), measure([&](int i){return powf(2.f, input(i));}), max_error);
+
+			max_error = 0;
+			for (int i = 0; i < 128; ++i) {
+				float ref = powf(2.f, (i - 69.f) / 12.f) * 440.f;
+				max_error = fmaxf(max_error, fabsf(midi_to_freq(i) - ref) / ref);
+			}
+			report("midi_to_freq", measure([](int i){return midi_to_freq(i & 0x7f);}), measure([](int i){return powf(2.f, ((i & 0x7f) - 69.f) / 12.f) * 440.f;}), max_error);
+
+			auto bend = [](int i){return static_cast<float>((i & 0x7f) - 64) / 32.f;};
+			max_error = 0;
+			for (int i = 0; i < 128; ++i) {
+				float ref = powf(2.f, bend(i) / 24.f);
+				max_error = fmaxf(max_error, fabsf(offset_scale_from_semitones(bend(i)) - ref) / ref);
+			}
+			report("semitone_offset", measure([&](int i){return offset_scale_from_semitones(bend(i));}), measure([&](int i){return powf(2.f, bend(i) / 24.f);}), max_error);
+
+			max_error = 0;
+			for (int i = 1; i < iterations; ++i) {
+				float base = i * (1.f / 128.f);
+				float ref = powf(base, 1.5f);
+				max_error = fmaxf(max_error, fabsf(fast_pow(base, 1.5f) - ref) / ref);
+			}
+			report("fast_pow", measure([](int i){return fast_pow((i + 1) * (1.f / 128.f), 1.5f);}), measure([](int i){return powf((i + 1) * (1.f / 128.f), 1.5f);}), max_error);
+		}
+
+		void bench_sin() {
+			// Sweep the whole period with a step that isn't a multiple of the table spacing
+			const uint32_t step = 0x0040'1f3b;
+
+			float max_error = 0, error_power = 0;
+			uint32_t phase = 0;
+			for (int i = 0; i < iterations * 4; ++i, phase += step) {
+				float ref = sinf(static_cast<float>(phase) * (2.f * static_cast<float>(M_PI) / 4294967296.f));
+				float error = fabsf(wavesin_phase(phase) - ref);
+				max_error = fmaxf(max_error, error);
+				error_power += error * error;
+			}
+			report("wavesin_phase", measure([&](int i){return wavesin_phase(i * step);}), measure([&](int i){
+				return sinf(static_cast<float>(i * step) * (2.f * static_cast<float>(M_PI) / 4294967296.f));
+			}), max_error);
+			// Full scale sine has power 1/2
+			printf("bench sin table: %d entries, snr %.1f dB\n", tables::sin_table_size, 10.f * log10f(0.5f / (error_power / (iterations * 4))));
+
+			report("wavesin", measure([](int i){return wavesin(i * (1.f / 337.f));}), 0, 0.f);
+
+			mod::SinWave osc{};
+			mod::SinWave::Cfg cfg{false, false};
+			osc.frequency = 440.f;
+			osc.amplitude = 1.f;
+			osc.curr_time = 1.f;
+
+			report("sin_wave", measure([&](int){
+				osc.generate(cfg);
+				return osc.output;
+			}), 0, 0.f);
+		}
+
+		void bench_env() {
+			mod::ExpADSR env{};
+			mod::ExpADSR::Cfg cfg{0.1f, 0.2f, 0.3f, 1.f, 0.5f};
+			env.scale = 1.f;
+			env.off_time = -1.f;
+
+			report("exp_adsr", measure([&](int i){
+				env.curr_time = i * (0.5f / iterations);
+				env.generate(cfg);
+				return env.output;
+			}), 0, 0.f);
+		}
+
+		void bench_filters() {
+			auto input = [](int i){return wavesin_phase(i * 0x0123'4567u);};
+
+			mod::SVFilter svf{};
+			mod::SVFilter::Cfg svf_cfg{0.002f};
+			svf.cutoff = 1000.f;
+			svf.resonance = 0.5f;
+
+			report("svf_fixed", measure([&](int i){
+				svf.input = input(i);
+				svf.generate(svf_cfg);
+				return svf.low;
+			}), measure([&](int i){
+				// Reference: recompute the coefficients on every sample
+				svf.input = input(i);
+				svf.cutoff = 1000.f + (i & 1);
+				svf.generate(mod::SVFilter::Cfg{0.f});
+				return svf.low;
+			}), 0.f);
+			// A slow sweep only crosses the threshold every so often
+			report("svf_sweep", measure([&](int i){
+				svf.input = input(i);
+				svf.cutoff = 1000.f + i * 0.5f;
+				svf.generate(svf_cfg);
+				return svf.low;
+			}), 0, 0.f);
+
+			mod::LadderFilter ladder{};
+			mod::LadderFilter::Cfg ladder_cfg{0.002f};
+			ladder.cutoff = 1000.f;
+			ladder.resonance = 0.5f;
+
+			report("ladder_fixed", measure([&](int i){
+				ladder.input = input(i);
+				ladder.generate(ladder_cfg);
+				return ladder.output;
+			}), measure([&](int i){
+				ladder.input = input(i);
+				ladder.cutoff = 1000.f + (i & 1);
+				ladder.generate(mod::LadderFilter::Cfg{0.f});
+				return ladder.output;
+			}), 0.f);
+			report("ladder_sweep", measure([&](int i){
+				ladder.input = input(i);
+				ladder.cutoff = 1000.f + i * 0.5f;
+				ladder.generate(ladder_cfg);
+				return ladder.output;
+			}), 0, 0.f);
+		}
+
+		void bench_fm() {
+			mod::FmOperator op{};
+			mod::FmOperator::Cfg op_cfg{2.f};
+			op.frequency = 220.f;
+			op.amplitude = 1.f;
+			op.index = 2.f;
+			op.feedback = 0.5f;
+
+			report("fm_operator", measure([&](int i){
+				op.modulation = op.output;
+				op.generate(op_cfg);
+				return op.output;
+			}), 0, 0.f);
+
+			// 6 operators as 3 modulator -> carrier pairs
+			mod::FmStack stack{};
+			mod::FmStack::Cfg stack_cfg{};
+			stack_cfg.operator_count = 6;
+			for (int i = 0; i < 6; ++i) {
+				stack_cfg.operators[i].ratio = 1.f + i;
+				stack_cfg.operators[i].level = (i & 1) ? 2.f : 0.3f;
+				stack_cfg.operators[i].carrier = !(i & 1);
+				stack_cfg.operators[i].modulators = (i & 1) ? 0 : 1 << (i + 1);
+			}
+			stack_cfg.operators[5].feedback = 0.3f;
+			stack.frequency = 220.f;
+			stack.amplitude = 1.f;
+			stack.index_scale = 1.f;
+
+			// Reference: the same thing as 6 separate operator modules
+			mod::FmOperator ops[6]{};
+			mod::FmOperator::Cfg ops_cfg[6];
+			for (int i = 0; i < 6; ++i) {
+				ops_cfg[i].ratio = 1.f + i;
+				ops[i].frequency = 220.f;
+				ops[i].amplitude = 1.f;
+				ops[i].index = 2.f;
+			}
+
+			report("fm_stack_6op", measure([&](int){
+				stack.generate(stack_cfg);
+				return stack.output;
+			}), measure([&](int){
+				float total = 0.f;
+				for (int j = 5; j >= 0; --j) {
+					if (j & 1) ops[j].generate(ops_cfg[j]);
+					else {
+						ops[j].modulation = ops[j + 1].output;
+						ops[j].generate(ops_cfg[j]);
+						total += ops[j].output;
+					}
+				}
+				return total;
+			}), 0.f);
+		}
+
+		void bench_noise() {
+			mod::Noise noise{};
+			noise.amplitude = 1.f;
+
+			mod::Noise::Cfg white{mod::Noise::Cfg::ColorWhite};
+			report("noise_white", measure([&](int){
+				noise.generate(white);
+				return noise.output;
+			}), measure([](int){return static_cast<float>(rand()) * (2.f / RAND_MAX) - 1.f;}), 0.f);
+
+			mod::Noise::Cfg pink{mod::Noise::Cfg::ColorPink};
+			report("noise_pink", measure([&](int){
+				noise.generate(pink);
+				return noise.output;
+			}), 0, 0.f);
+
+			mod::SampleHold sh{};
+			mod::SampleHold::Cfg sh_cfg{true};
+			sh.rate = 10.f;
+			report("sample_and_hold", measure([&](int){
+				sh.generate(sh_cfg);
+				return sh.output;
+			}), 0, 0.f);
+		}
+
+		void bench_math() {
+			// mixer -> vca -> scale/offset, once through each module's proc (as the JIT calls them) and once fused
+			struct {
+				mod::Mixer mixer;
+				mod::Vca vca;
+				mod::ScaleOffset scale;
+			} chain{};
+			const mod::Mixer::Cfg mixer_cfg{0.5f, 0.25f, 0.25f, 0.f};
+			const mod::Vca::Cfg vca_cfg{1.f};
+			const mod::ScaleOffset::Cfg scale_cfg{0.5f, 0.1f};
+			chain.vca.gain = 0.8f;
+
+			auto separate = measure([&](int i){
+				chain.mixer.a = chain.mixer.b = chain.mixer.c = static_cast<float>(i & 0xff) * (1.f / 256.f);
+				mod::MixerModule.proc(&chain.mixer, &mixer_cfg);
+				chain.vca.input = chain.mixer.output;
+				mod::VcaModule.proc(&chain.vca, &vca_cfg);
+				chain.scale.input = chain.vca.output;
+				mod::ScaleOffsetModule.proc(&chain.scale, &scale_cfg);
+				return chain.scale.output;
+			});
+
+			std::vector<uint32_t> ops{3};
+			uint16_t vca_at = offsetof(decltype(chain), vca), scale_at = offsetof(decltype(chain), scale);
+			mod::fused::append(ops, mod::MixerModule, &mixer_cfg, 0, {offsetof(mod::Mixer, output) | (uint32_t)(vca_at + offsetof(mod::Vca, input)) << 16});
+			mod::fused::append(ops, mod::VcaModule, &vca_cfg, vca_at, {(vca_at + offsetof(mod::Vca, output)) | (uint32_t)(scale_at + offsetof(mod::ScaleOffset, input)) << 16});
+			mod::fused::append(ops, mod::ScaleOffsetModule, &scale_cfg, scale_at, {});
+
+			report("math_chain_fused", measure([&](int i){
+				chain.mixer.a = chain.mixer.b = chain.mixer.c = static_cast<float>(i & 0xff) * (1.f / 256.f);
+				mod::fused::run(&chain, ops.data());
+				return chain.scale.output;
+			}), separate, 0.f);
+		}
+
+		void bench_reverb() {
+			int16_t block[fx::block_size];
+			int16_t *memory = static_cast<int16_t *>(malloc(fx::Reverb::LargeSamples * sizeof(int16_t)));
+			if (!memory) {
+				puts("bench reverb: out of memory");
+				return;
+			}
+
+			const struct {const char *name; size_t samples;} presets[] = {
+				{"reverb_small", fx::Reverb::SmallSamples},
+				{"reverb_medium", fx::Reverb::MediumSamples},
+				{"reverb_large", fx::Reverb::LargeSamples}
+			};
+
+			for (const auto& preset : presets) {
+				fx::Reverb reverb(memory, preset.samples);
+
+				const int blocks = 64;
+				uint32_t total = 0;
+				for (int i = 0; i < blocks; ++i) {
+					for (size_t j = 0; j < fx::block_size; ++j) block[j] = static_cast<int16_t>(wavesin_phase((i * fx::block_size + j) * 0x0100'0000u) * 8192.f);
+
+					uint32_t start = util::cycles();
+					reverb.process(block, fx::block_size);
+					total += util::cycles() - start;
+				}
+
+				printf("bench %-20s %5lu cyc/block, %u bytes of lines + %u bytes state\n", preset.name, total / blocks,
+					preset.samples * sizeof(int16_t), sizeof(fx::Reverb));
+			}
+
+			free(memory);
+		}
+	}
+
+	void run() {
+		util::enable_cycle_counter();
+		puts("--- synth bench ---");
+		bench_exp();
+		bench_sin();
+		bench_env();
+		bench_filters();
+		bench_fm();
+		bench_noise();
+		bench_math();
+		bench_reverb();
+		puts("--- end bench ---");
+	}
+}
+#else
+void ms::synth::bench::run() {}
+#endif
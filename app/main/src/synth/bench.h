@@ -0,0 +1,9 @@
+#pragma once
+// Synth microbenchmarks
+//
+// These time the DSP kernels with the DWT cycle counter and print the results (plus error against the libm/reference
+// versions) over the debug UART. They're only compiled in when MSYNTH_BENCH is set in cmake, and are run once at startup.
+
+namespace ms::synth::bench {
+	void run();
+}
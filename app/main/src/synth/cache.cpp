@@ -0,0 +1,56 @@
+#include "cache.h"
+#include "serialize.h"
+#include "modules/registry.h"
+
+#include <stdlib.h>
+
+namespace ms::synth::cache {
+	namespace {
+		// Bump whenever the JIT output or the cache layout changes
+		const uint32_t format_version = 3;
+	}
+
+	uint32_t hash(const void * data, size_t length, uint32_t seed) {
+		const uint8_t *bytes = static_cast<const uint8_t *>(data);
+		for (size_t i = 0; i < length; ++i) {
+			seed ^= bytes[i];
+			seed *= 0x01000193;
+		}
+		return seed;
+	}
+
+	uint32_t build_id() {
+		static uint32_t id = 0;
+		if (id) return id;
+
+		uint32_t result = hash(&format_version, sizeof(format_version));
+		for (uint16_t i = 0; i < mod::IdCount; ++i) {
+			const ModuleBase *mod = mod::lookup(i);
+
+			uint32_t sizes[4] = {mod->cfg_size, mod->dyncfg_size, mod->input_count, mod->output_count};
+			result = hash(sizes, sizeof(sizes), result);
+			for (size_t j = 0; j < mod->input_count; ++j) result = hash(&mod->inputs[j].offset, sizeof(uintptr_t), result);
+			for (size_t j = 0; j < mod->output_count; ++j) {
+				const auto& output = mod->outputs[j];
+				uintptr_t offsets[4] = {output.offset, output.offset_enabled, output.offset_min, output.offset_max};
+				result = hash(offsets, sizeof(offsets), result);
+			}
+			// Inlined modules are part of the procedure itself
+			if (mod->inline_body) result = hash(mod->inline_body->ops, mod->inline_body->count * sizeof(InlineOp), result);
+		}
+
+		return (id = result);
+	}
+
+	uint32_t patch_hash(const Patch& patch) {
+		size_t length = serialize::serialized_size(patch);
+		void * buffer = malloc(length);
+		if (!buffer) return 0;
+
+		uint32_t result = 0;
+		if (serialize::serialize(patch, buffer, length)) result = hash(buffer, length);
+
+		free(buffer);
+		return result;
+	}
+}
@@ -0,0 +1,72 @@
+#pragma once
+// Precompiled program cache
+//
+// Compiling a Program (sorting, linking and running the JIT) is by far the slowest part of switching patches, but its output only
+// depends on the patch and on the firmware. It can therefore be saved alongside the patch with Program::save_cache and loaded back
+// with Program::from_cache, which only has to copy a few blobs and patch the literal pools.
+//
+// The assembled procedure is position independent apart from its literal pool entries, which hold absolute pointers to module
+// procedures and configuration blobs. These are stored as relocations against the patch's module list and fixed up on load.
+//
+// Layout (everything is 4-byte aligned):
+//
+// 	CacheHeader
+// 	uint16_t procedure[procedure_length] (padded to 4 bytes)
+// 	Relocation[relocation_count]
+// 	uint32_t offset_pool[offset_pool_length]
+// 	uint32_t fused_ops[fused_length]
+// 	dyncfg template (dyncfg_length bytes)
+//
+// Caches are keyed by the hash of the serialized patch and by build_id(); anything that doesn't match both is ignored.
+
+#include "patch.h"
+#include <stddef.h>
+#include <stdint.h>
+
+namespace ms::synth::cache {
+	struct CacheHeader {
+		char magic[4];
+		uint32_t build_id;
+		uint32_t patch_hash;
+		uint32_t length; // of the entire blob, including this header
+		uint16_t procedure_length; // in halfwords
+		uint16_t relocation_count;
+		uint16_t offset_pool_length;
+		uint16_t dyncfg_length; // in bytes
+		uint8_t  pitch_end, velocity_end, time_end;
+		uint8_t  reserved;
+		uint16_t fused_length; // in words
+		uint16_t reserved2;
+
+		bool ok() const {
+			return magic[0] == 'M' && magic[1] == 'S' && magic[2] == 'p' && magic[3] == 'c';
+		}
+	};
+
+	struct Relocation {
+		enum : uint8_t {
+			KindConfigPointer, // address of the module's configuration blob
+			KindModuleProc,    // address of the module's procedure (with the thumb bit set)
+			KindFusedOps,      // address of a fused op list, module_index is its word offset into the fused ops
+			KindFusedProc      // address of mod::fused::run (with the thumb bit set)
+		} kind;
+		uint8_t  reserved;
+		uint16_t position;     // index of the literal pool entry's low halfword in the procedure
+		uint16_t module_index; // index into Patch::all_modules() (or the fused ops, see above)
+		uint16_t reserved2;
+	};
+
+	static_assert(sizeof(CacheHeader) % 4 == 0 && sizeof(Relocation) % 4 == 0, "records must keep 4-byte alignment");
+
+	// Identifies everything about this firmware that compiled programs depend on (the JIT/cache format and the layout of every
+	// registered module). Addresses aren't included since those are relocated.
+	uint32_t build_id();
+
+	// 32-bit FNV-1a
+	uint32_t hash(const void * data, size_t length, uint32_t seed = 0x811c9dc5);
+
+	// Hash of a patch's serialized form. For patches loaded with serialize::load this is the same as hashing the blob directly.
+	//
+	// Returns 0 if the patch can't be serialized.
+	uint32_t patch_hash(const Patch& patch);
+}
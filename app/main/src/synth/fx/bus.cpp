@@ -0,0 +1,97 @@
+#include "bus.h"
+#include <msynth/util.h>
+#include <cmsis_gcc.h>
+#include <string.h>
+
+namespace ms::synth::fx {
+	namespace {
+		inline int16_t apply_gain(int32_t sample, int16_t gain) {
+			return static_cast<int16_t>((sample * gain) >> 15);
+		}
+
+		void mix_generator(int16_t *out, size_t count, playback::AudioGenerator *generator, int16_t gain) {
+			generator->begin_block();
+
+			// Skip the vtable lookup for every sample
+			const static auto generate = &playback::AudioGenerator::generate;
+			typedef int16_t (*hoisted_loop_type)(playback::AudioGenerator *);
+			hoisted_loop_type hoisted_loop = (hoisted_loop_type)(generator->*generate);
+
+			if (gain == INT16_MAX) {
+				for (size_t i = 0; i < count; ++i) out[i] = __QADD16(out[i], hoisted_loop(generator));
+			}
+			else {
+				for (size_t i = 0; i < count; ++i) out[i] = __QADD16(out[i], apply_gain(hoisted_loop(generator), gain));
+			}
+		}
+	}
+
+	bool Bus::add_source(playback::AudioGenerator *generator, int16_t gain) {
+		if (num_sources == max_sources) return false;
+		sources[num_sources++] = {generator, nullptr, gain};
+		return true;
+	}
+
+	bool Bus::add_source(Bus *bus, int16_t gain) {
+		if (num_sources == max_sources || bus == this) return false;
+		sources[num_sources++] = {nullptr, bus, gain};
+		return true;
+	}
+
+	void Bus::clear_sources() {
+		num_sources = 0;
+	}
+
+	bool Bus::add_stage(Effect *effect, uint32_t budget_cycles) {
+		if (num_stages == max_stages) return false;
+		stages[num_stages] = {effect, budget_cycles, 0, {}};
+		++num_stages;
+		return true;
+	}
+
+	void Bus::clear_stages() {
+		num_stages = 0;
+	}
+
+	void Bus::reset_stats() {
+		for (size_t i = 0; i < num_stages; ++i) {
+			stages[i].stats = {};
+			stages[i].consecutive_overruns = 0;
+		}
+	}
+
+	void Bus::render(int16_t *out, size_t count) {
+		memset(out, 0, count * sizeof(int16_t));
+
+		// Mix
+		for (size_t i = 0; i < num_sources; ++i) {
+			const Source& source = sources[i];
+			if (source.generator) {
+				mix_generator(out, count, source.generator, source.gain);
+			}
+			else {
+				source.bus->render(scratch, count);
+				for (size_t j = 0; j < count; ++j) out[j] = __QADD16(out[j], apply_gain(scratch[j], source.gain));
+			}
+		}
+
+		// Effects
+		for (size_t i = 0; i < num_stages; ++i) {
+			Stage& stage = stages[i];
+			if (stage.stats.bypassed) continue;
+
+			uint32_t start = util::cycles();
+			stage.effect->process(out, count);
+			uint32_t taken = util::cycles() - start;
+
+			stage.stats.last_cycles = taken;
+			if (taken > stage.stats.max_cycles) stage.stats.max_cycles = taken;
+
+			if (stage.budget && taken > stage.budget) {
+				++stage.stats.overruns;
+				if (++stage.consecutive_overruns >= overrun_limit) stage.stats.bypassed = true;
+			}
+			else stage.consecutive_overruns = 0;
+		}
+	}
+}
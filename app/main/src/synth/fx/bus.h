@@ -0,0 +1,81 @@
+#pragma once
+// The effect bus
+//
+// Effects run once per block on an already mixed signal instead of per voice. A Bus mixes together any number of sources
+// (AudioGenerators, or other buses which lets you build a tree of sends) and then runs that mix through its chain of effect
+// stages. The root of the tree is the master bus in audio.cpp, which is the eventual sink: it writes into the DMA buffer.
+//
+// Everything here runs in the audio interrupt, so nothing allocates; buses and effects are owned by whoever set them up and
+// have fixed capacities.
+//
+// Every stage can be given a cycle budget. The bus times each stage with the DWT cycle counter, and a stage that keeps running over
+// its budget gets bypassed rather than letting the whole block miss its deadline.
+
+#include "../playback.h"
+#include <stddef.h>
+#include <stdint.h>
+
+namespace ms::synth::fx {
+	// Samples per block; this is the same as the DMA half-buffer size.
+	constexpr inline size_t block_size = 300;
+
+	// An effect processes a mono block in place.
+	struct Effect {
+		virtual void process(int16_t *block, size_t count) = 0;
+		// Clear any internal state (delay lines, filter history)
+		virtual void reset() {}
+	};
+
+	struct StageStats {
+		uint32_t last_cycles = 0, max_cycles = 0;
+		uint32_t overruns = 0;
+		bool bypassed = false;
+	};
+
+	struct Bus {
+		constexpr static inline size_t max_sources = 4;
+		constexpr static inline size_t max_stages = 4;
+
+		// Number of blocks in a row a stage may go over its budget before being bypassed
+		constexpr static inline uint8_t overrun_limit = 8;
+
+		// These return false if the bus is full. Buses must not be added to themselves (directly or otherwise).
+		bool add_source(playback::AudioGenerator *generator, int16_t gain = INT16_MAX);
+		bool add_source(Bus *bus, int16_t gain = INT16_MAX);
+		void clear_sources();
+
+		// A budget of 0 means unlimited
+		bool add_stage(Effect *effect, uint32_t budget_cycles = 0);
+		void clear_stages();
+
+		// Re-enable a bypassed stage
+		void reset_stats();
+
+		// Mix all sources and run the effect chain, writing count samples to out (count <= block_size)
+		void render(int16_t *out, size_t count);
+
+		const StageStats& stats(size_t stage) const {return stages[stage].stats;}
+		size_t stage_count() const {return num_stages;}
+
+	private:
+		struct Source {
+			playback::AudioGenerator *generator;
+			Bus *bus;
+			int16_t gain;
+		};
+
+		struct Stage {
+			Effect *effect;
+			uint32_t budget;
+			uint8_t consecutive_overruns;
+			StageStats stats;
+		};
+
+		Source sources[max_sources]{};
+		Stage stages[max_stages]{};
+		size_t num_sources = 0, num_stages = 0;
+
+		// Where sub-buses render to before being mixed in
+		int16_t scratch[block_size];
+	};
+}
@@ -0,0 +1,30 @@
+#include "delay.h"
+#include <cmsis_gcc.h>
+#include <string.h>
+
+namespace ms::synth::fx {
+	void Delay::process(int16_t *block, size_t count) {
+		for (size_t i = 0; i < count; ++i) {
+			int32_t delayed = line[position];
+			int32_t in = block[i];
+
+			line[position] = __SSAT(in + ((delayed * feedback) >> 15), 16);
+			block[i] = __SSAT(in + ((delayed * mix) >> 15), 16);
+
+			if (++position == delay) position = 0;
+		}
+	}
+
+	void Delay::reset() {
+		memset(line, 0, length * sizeof(int16_t));
+		position = 0;
+		if (!delay) delay = length;
+	}
+
+	void Delay::set_delay(size_t samples) {
+		if (samples > length) samples = length;
+		if (samples == 0) samples = 1;
+		delay = samples;
+		if (position >= delay) position = 0;
+	}
+}
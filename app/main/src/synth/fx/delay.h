@@ -0,0 +1,28 @@
+#pragma once
+// Feedback delay
+//
+// The delay line is provided by the owner (int16 samples, so ~88KiB per second), which lets it be placed wherever there's room.
+
+#include "bus.h"
+
+namespace ms::synth::fx {
+	struct Delay : Effect {
+		Delay(int16_t *line, size_t length) : line(line), length(length) {
+			reset();
+		}
+
+		void process(int16_t *block, size_t count) override;
+		void reset() override;
+
+		// Delay time in samples, clamped to the line length
+		void set_delay(size_t samples);
+
+		// Both are Q15
+		int16_t feedback = 0x2000;
+		int16_t mix = 0x4000;
+
+	private:
+		int16_t *line;
+		size_t length, delay = 0, position = 0;
+	};
+}
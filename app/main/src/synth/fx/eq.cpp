@@ -0,0 +1,72 @@
+#include "eq.h"
+#include "../util.h"
+#include <cmsis_gcc.h>
+#include <math.h>
+
+namespace ms::synth::fx {
+	void Eq::process(int16_t *block, size_t count) {
+		// Transposed direct form II
+		float s1 = z1, s2 = z2;
+		for (size_t i = 0; i < count; ++i) {
+			float in = block[i];
+			float out = b0 * in + s1;
+			s1 = b1 * in - a1 * out + s2;
+			s2 = b2 * in - a2 * out;
+			block[i] = __SSAT(static_cast<int32_t>(out), 16);
+		}
+		z1 = s1;
+		z2 = s2;
+	}
+
+	void Eq::reset() {
+		z1 = z2 = 0.f;
+	}
+
+	void Eq::set(Shape shape, float frequency, float gain_db, float q) {
+		// 10^(db/40)
+		const float a = fast_exp2(gain_db * (3.321928f / 40.f));
+		const float w0 = 2.f * static_cast<float>(M_PI) * frequency / sample_rate;
+		const float cosw = cosf(w0), alpha = sinf(w0) / (2.f * q);
+
+		float nb0, nb1, nb2, na0, na1, na2;
+		switch (shape) {
+			case LowShelf:
+				{
+					const float sq = 2.f * sqrtf(a) * alpha;
+					nb0 =    a*((a+1) - (a-1)*cosw + sq);
+					nb1 =  2*a*((a-1) - (a+1)*cosw);
+					nb2 =    a*((a+1) - (a-1)*cosw - sq);
+					na0 =       (a+1) + (a-1)*cosw + sq;
+					na1 =   -2*((a-1) + (a+1)*cosw);
+					na2 =       (a+1) + (a-1)*cosw - sq;
+				}
+				break;
+			case HighShelf:
+				{
+					const float sq = 2.f * sqrtf(a) * alpha;
+					nb0 =    a*((a+1) + (a-1)*cosw + sq);
+					nb1 = -2*a*((a-1) + (a+1)*cosw);
+					nb2 =    a*((a+1) + (a-1)*cosw - sq);
+					na0 =       (a+1) - (a-1)*cosw + sq;
+					na1 =    2*((a-1) - (a+1)*cosw);
+					na2 =       (a+1) - (a-1)*cosw - sq;
+				}
+				break;
+			case Peak:
+			default:
+				nb0 = 1 + alpha*a;
+				nb1 = -2*cosw;
+				nb2 = 1 - alpha*a;
+				na0 = 1 + alpha/a;
+				na1 = -2*cosw;
+				na2 = 1 - alpha/a;
+				break;
+		}
+
+		b0 = nb0 / na0;
+		b1 = nb1 / na0;
+		b2 = nb2 / na0;
+		a1 = na1 / na0;
+		a2 = na2 / na0;
+	}
+}
@@ -0,0 +1,29 @@
+#pragma once
+// Single band biquad EQ (shelves and peaking), using the usual RBJ cookbook formulas.
+//
+// The coefficients are only recomputed by the setters, which should be called from the main loop.
+
+#include "bus.h"
+
+namespace ms::synth::fx {
+	struct Eq : Effect {
+		enum Shape : uint8_t {
+			LowShelf,
+			HighShelf,
+			Peak
+		};
+
+		Eq(Shape shape, float frequency, float gain_db, float q = 0.707f) {
+			set(shape, frequency, gain_db, q);
+		}
+
+		void process(int16_t *block, size_t count) override;
+		void reset() override;
+
+		void set(Shape shape, float frequency, float gain_db, float q = 0.707f);
+
+	private:
+		float b0, b1, b2, a1, a2;
+		float z1 = 0.f, z2 = 0.f;
+	};
+}
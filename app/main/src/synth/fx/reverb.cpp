@@ -0,0 +1,99 @@
+#include "reverb.h"
+#include <cmsis_gcc.h>
+#include <string.h>
+
+namespace ms::synth::fx {
+	namespace {
+		const uint16_t comb_tunings[Reverb::comb_count] = {1116, 1188, 1277, 1356, 1422, 1491, 1557, 1617};
+		const uint16_t allpass_tunings[Reverb::allpass_count] = {556, 441, 341, 225};
+
+		// Rounding towards zero keeps quiet signals from getting stuck cycling around the feedback loops
+		inline int32_t q15_toward_zero(int32_t x) {
+			return (x + ((x >> 31) & 0x7fff)) >> 15;
+		}
+
+		// Freeverb's room size maps [0, 1] to feedback [0.7, 0.98]
+		inline int16_t feedback_for(int16_t room_size) {
+			return static_cast<int16_t>(0x599a + ((room_size * 0x23d7) >> 15));
+		}
+	}
+
+	Reverb::Reverb(int16_t *memory, size_t samples) : memory(memory), samples(samples) {
+		// Scale all the lines by the same amount (in 1/256ths) so they keep their ratios
+		uint32_t scale = samples >= FullSamples ? 256 : (samples * 256) / FullSamples;
+
+		int16_t *cursor = memory;
+		auto setup = [&](Line& line, uint16_t tuning){
+			line.length = (tuning * scale) >> 8;
+			if (line.length == 0) line.length = 1;
+			line.data = cursor;
+			line.position = 0;
+			cursor += line.length;
+		};
+		for (size_t i = 0; i < comb_count; ++i) setup(combs[i], comb_tunings[i]);
+		for (size_t i = 0; i < allpass_count; ++i) setup(allpasses[i], allpass_tunings[i]);
+
+		set_room_size(0x5000);
+		set_damping(0x4000);
+		reset();
+	}
+
+	void Reverb::set_room_size(int16_t size) {
+		feedback = feedback_for(size);
+	}
+
+	void Reverb::set_damping(int16_t damping) {
+		this->damping = damping;
+	}
+
+	void Reverb::reset() {
+		memset(memory, 0, samples * sizeof(int16_t));
+		memset(comb_filter, 0, sizeof comb_filter);
+	}
+
+	void Reverb::process(int16_t *block, size_t count) {
+		memset(accumulator, 0, count * sizeof(int32_t));
+
+		const int32_t damp1 = damping, damp2 = 0x8000 - damping;
+
+		// Combs in parallel, fed with input / 8 so the sum stays in range
+		for (size_t c = 0; c < comb_count; ++c) {
+			Line line = combs[c];
+			int32_t filter = comb_filter[c];
+
+			for (size_t i = 0; i < count; ++i) {
+				int32_t out = line.data[line.position];
+				accumulator[i] += out;
+
+				filter = q15_toward_zero(out * damp2 + filter * damp1);
+				line.data[line.position] = __SSAT((block[i] >> 3) + q15_toward_zero(filter * feedback), 16);
+
+				if (++line.position == line.length) line.position = 0;
+			}
+
+			combs[c].position = line.position;
+			comb_filter[c] = filter;
+		}
+
+		// Allpasses in series
+		for (size_t a = 0; a < allpass_count; ++a) {
+			Line line = allpasses[a];
+
+			for (size_t i = 0; i < count; ++i) {
+				int32_t in = __SSAT(accumulator[i], 16);
+				int32_t buffered = line.data[line.position];
+
+				accumulator[i] = buffered - in;
+				line.data[line.position] = __SSAT(in + buffered / 2, 16);
+
+				if (++line.position == line.length) line.position = 0;
+			}
+
+			allpasses[a].position = line.position;
+		}
+
+		for (size_t i = 0; i < count; ++i) {
+			block[i] = __SSAT(((block[i] * dry) >> 15) + ((accumulator[i] * wet) >> 15), 16);
+		}
+	}
+}
@@ -0,0 +1,55 @@
+#pragma once
+// Schroeder/Freeverb style reverb: 8 damped feedback combs in parallel followed by 4 allpasses in series.
+//
+// All delay lines are int16 and live in one owner-provided block of memory, whose size sets how big the room can get: the
+// line lengths are the usual Freeverb tunings scaled down to fit. The presets are the sizes that are worth using; even Large
+// fits comfortably in CCMRAM, e.g.
+//
+// 	CCMBSS int16_t reverb_memory[fx::Reverb::MediumSamples];
+//
+// Processing is done a line at a time over the whole block so each line's state can stay in registers.
+
+#include "bus.h"
+
+namespace ms::synth::fx {
+	struct Reverb : Effect {
+		constexpr static inline size_t comb_count = 8;
+		constexpr static inline size_t allpass_count = 4;
+
+		// Delay line memory (in samples) needed for the full-size tunings
+		constexpr static inline size_t FullSamples = 1116 + 1188 + 1277 + 1356 + 1422 + 1491 + 1557 + 1617 + 556 + 441 + 341 + 225;
+
+		// Memory presets
+		constexpr static inline size_t SmallSamples  = FullSamples / 2;     // ~12KiB
+		constexpr static inline size_t MediumSamples = FullSamples * 3 / 4; // ~19KiB
+		constexpr static inline size_t LargeSamples  = FullSamples;         // ~25KiB
+
+		Reverb(int16_t *memory, size_t samples);
+
+		void process(int16_t *block, size_t count) override;
+		void reset() override;
+
+		// All of these are Q15
+		void set_room_size(int16_t size);
+		void set_damping(int16_t damping);
+		int16_t wet = 0x2000;
+		int16_t dry = 0x7fff;
+
+	private:
+		struct Line {
+			int16_t *data;
+			uint16_t length, position;
+		};
+
+		Line combs[comb_count];
+		Line allpasses[allpass_count];
+		int32_t comb_filter[comb_count]{};
+
+		int16_t *memory;
+		size_t samples;
+
+		int16_t feedback, damping;
+
+		int32_t accumulator[block_size];
+	};
+}
@@ -7,6 +7,7 @@
 #include <stdint.h>
 #include <vector>
 #include <ranges>
+#include <algorithm>
 
 #include "module.h"
 
@@ -39,6 +40,10 @@ namespace ms::synth::jit {
 	// 		Copy the value at DynCfgOffset+src to DynCfgOffset+target 
 	// 	LoadResult <offset>
 	// 		Copy the value at DynCfgOffset+offset into the result pointer
+	// 	InlineModule <body>
+	// 		Same as RunModule, but emit the module's inline template instead of calling it
+	// 		:::NOTE:::
+	// 		This must also _immediately_ follow a LoadConfig instruction
 	//
 	// All offsets are in bytes.
 	struct PsuedoInstruction {
@@ -47,17 +52,19 @@ namespace ms::synth::jit {
 			OpcodeLoadConfig,
 			OpcodeAdvanceDynConfig,
 			OpcodeCopyFloat,
-			OpcodeLoadResult
+			OpcodeLoadResult,
+			OpcodeInlineModule
 		} opcode;
 
 		union {
 			ModuleProc  proc; // For RunModule
+			const InlineTemplate *body; // For InlineModule
 			int16_t     advance_or_result_offset; // For Advance or LoadResult
 			struct {
 				int16_t source_offset; // For CopyFloat
 				int16_t target_offset;
 			};
-			void *      config_location; // For LoadConfig
+			const void *config_location; // For LoadConfig
 		};
 	};
 
@@ -195,6 +202,59 @@ namespace ms::synth::jit {
 			return (0b0100000000 << 6) | ((operand & 0b111) << 3) | (target & 0b111);
 		}
 
+		// MOVS-IMMEDIATE: load an 8 bit immediate into a low register
+		inline uint16_t movs_immediate(int target, uint8_t immediate) {
+			return (0b00100 << 11) | ((target & 0b111) << 8) | immediate;
+		}
+
+		// VFP single precision registers are numbered 0-31, split into a 4 bit field and a separate low bit (D/N/M).
+		//
+		// The JIT only uses s0-s15, which also guarantees none of these can look like a literal pool placeholder.
+
+		// VLDR: load a single from a register with a word offset (offset <= 1020)
+		inline uint32_t vldr(int target, int base, uint16_t offset) {
+			return ((0b1110110110010000 | ((target & 1) << 6) | (base & 0b1111)) << 16) |
+				(((target >> 1) & 0b1111) << 12) | (0b1010 << 8) | ((offset >> 2) & 0xff);
+		}
+
+		// VSTR: store a single to a register with a word offset (offset <= 1020)
+		inline uint32_t vstr(int source, int base, uint16_t offset) {
+			return ((0b1110110110000000 | ((source & 1) << 6) | (base & 0b1111)) << 16) |
+				(((source >> 1) & 0b1111) << 12) | (0b1010 << 8) | ((offset >> 2) & 0xff);
+		}
+
+		// Three register VFP data processing
+		inline uint32_t vfp_three_register(uint16_t opcode_high, uint16_t opcode_low, int target, int op1, int op2) {
+			return ((opcode_high | ((target & 1) << 6) | ((op1 >> 1) & 0b1111)) << 16) |
+				(((target >> 1) & 0b1111) << 12) | (0b1010 << 8) | opcode_low | ((op1 & 1) << 7) | ((op2 & 1) << 5) | ((op2 >> 1) & 0b1111);
+		}
+
+		// VMUL.F32 target = op1 * op2
+		inline uint32_t vmul(int target, int op1, int op2) {
+			return vfp_three_register(0b1110111000100000, 0, target, op1, op2);
+		}
+
+		// VADD.F32 target = op1 + op2
+		inline uint32_t vadd(int target, int op1, int op2) {
+			return vfp_three_register(0b1110111000110000, 0, target, op1, op2);
+		}
+
+		// VSUB.F32 target = op1 - op2
+		inline uint32_t vsub(int target, int op1, int op2) {
+			return vfp_three_register(0b1110111000110000, 0b1000000, target, op1, op2);
+		}
+
+		// VMLA.F32 target += op1 * op2
+		inline uint32_t vmla(int target, int op1, int op2) {
+			return vfp_three_register(0b1110111000000000, 0, target, op1, op2);
+		}
+
+		// VMOV.F32: move single registers
+		inline uint32_t vmov(int target, int source) {
+			return ((0b1110111010110000 | ((target & 1) << 6)) << 16) |
+				(((target >> 1) & 0b1111) << 12) | (0b101001 << 6) | ((source & 1) << 5) | ((source >> 1) & 0b1111);
+		}
+
 		// BRANCH by pc offset.
 		// offset is shifted right once
 		inline uint16_t branch_offset(int16_t offset) {
@@ -202,13 +262,30 @@ namespace ms::synth::jit {
 		}
 	}
 
+	// Where a literal pool entry ended up in an assembled procedure.
+	//
+	// Literal pool entries are the only position-dependent part of the output (everything else is PC-relative), so these are
+	// what needs fixing up to reuse a procedure with different config/procedure addresses (see cache.h)
+	struct LiteralRelocation {
+		uint16_t position;    // index of the entry's low halfword in the result
+		uint16_t instruction; // index of the pseudo instruction which loads it
+	};
+
+	// Assemble instructions into result. If relocations is given, every literal pool entry is recorded into it.
+	//
+	// The literal pools are word aligned based on the address of result's storage, so the output may only be moved to
+	// storage with the same alignment mod 4 (which anything from malloc is).
 	template<typename ResultAllocator>
-	void assemble(std::vector<uint16_t, ResultAllocator> &result, const std::ranges::range auto& instructions) {
+	void assemble(std::vector<uint16_t, ResultAllocator> &result, const std::ranges::range auto& instructions, std::vector<LiteralRelocation> *relocations = nullptr) {
 		// Ensure the result is clear
 		result.clear();
 
-		// Setup literal pool
-		std::vector<uint32_t> literalpool;
+		// Setup literal pool; entries are the value and the index of the instruction that wants it
+		struct PendingLiteral {
+			uint32_t value;
+			uint16_t instruction;
+		};
+		std::vector<PendingLiteral> literalpool;
 		literalpool.reserve(32);
 		int distance_since_last_pool = 0;
 		bool inited_r4 = false;
@@ -230,25 +307,28 @@ namespace ms::synth::jit {
 			}
 
 			while (!literalpool.empty()) {
-				uint32_t value = literalpool.back();
+				auto [value, instruction] = literalpool.back();
 				literalpool.pop_back();
-				uint16_t* value_addr = nullptr;
+				// Index rather than pointer, since pushing to the pool can reallocate result
+				int value_index = -1;
 				
 				// Is this value already in this pool?
 				for (int i = literalpool_start; i < result.size(); i+=2) {
 					if ((static_cast<uint32_t>(result[i]) | (static_cast<uint32_t>(result[i + 1]) << 16)) == value) {
-						value_addr = &result[i];
+						value_index = i;
 						break;
 					}
 				}
 
 				// No:
-				if (value_addr == nullptr) {
+				if (value_index == -1) {
 					// Add it to the pool
+					value_index = result.size();
 					result.push_back(value & 0xffff);
-					value_addr = &result.back();
 					result.push_back(value >> 16);
 
+					if (relocations) relocations->push_back({static_cast<uint16_t>(value_index), instruction});
+
 					// Increment jump count
 					jumpcount += 2;
 				}
@@ -260,7 +340,7 @@ namespace ms::synth::jit {
 				}
 				
 				// Update the instruction with the new offset
-				result[it] = insns::load_literal_pool(target, reinterpret_cast<uintptr_t>(&result[it]), reinterpret_cast<uintptr_t>(value_addr));
+				result[it] = insns::load_literal_pool(target, reinterpret_cast<uintptr_t>(&result[it]), reinterpret_cast<uintptr_t>(&result[value_index]));
 
 				// Go to the next (previous) instruction
 				--it;
@@ -291,6 +371,115 @@ namespace ms::synth::jit {
 			return ret;
 		};
 
+		// Inlined modules keep floats in s0-s15 (all caller saved, so they're free to use but don't survive a RunModule). The
+		// JIT remembers which dyncfg words are still in a register, by offset from the start of the dyncfg, so a value produced by
+		// one inlined module and consumed by the next is never loaded back; the stores are still done since anything else may
+		// read them.
+		struct CachedWord {
+			int32_t offset;
+			uint8_t reg;
+		};
+		std::vector<CachedWord> cached;
+		int32_t dyncfg_position = 0;
+
+		auto find_cached = [&](int32_t offset) -> int {
+			for (const auto& word : cached) if (word.offset == offset) return word.reg;
+			return -1;
+		};
+		auto forget_offset = [&](int32_t offset) {
+			std::erase_if(cached, [&](const CachedWord& word){return word.offset == offset;});
+		};
+		auto forget_register = [&](int reg) {
+			std::erase_if(cached, [&](const CachedWord& word){return word.reg == reg;});
+		};
+		auto remember = [&](int32_t offset, int reg) {
+			forget_offset(offset);
+			cached.push_back({offset, static_cast<uint8_t>(reg)});
+		};
+
+		// Load/store a single relative to a core register, going through r7 if the offset is too large
+		auto vfp_transfer = [&](bool load, int reg, int base, uint16_t offset) {
+			if (offset > 1020) {
+				push_instr(insns::movw(7, offset));
+				push_instr(insns::add_register(7, base));
+				base = 7;
+				offset = 0;
+			}
+			push_instr(load ? insns::vldr(reg, base, offset) : insns::vstr(reg, base, offset));
+		};
+
+		auto emit_inline = [&](const InlineTemplate& body) {
+			int8_t temporaries[InlineTemplate::max_temporaries];
+			for (auto& t : temporaries) t = -1;
+
+			auto in_use = [&](int reg) {
+				for (auto t : temporaries) if (t == reg) return true;
+				return false;
+			};
+
+			// Pick a register for a new value: a free one if possible, otherwise the one cached longest ago.
+			auto allocate = [&]() -> int {
+				for (int reg = 0; reg < 16; ++reg) {
+					if (!in_use(reg) && std::none_of(cached.begin(), cached.end(), [&](const CachedWord& word){return word.reg == reg;}))
+						return reg;
+				}
+				for (const auto& word : cached) {
+					if (!in_use(word.reg)) {
+						int reg = word.reg;
+						forget_register(reg);
+						return reg;
+					}
+				}
+				return -1; // can't happen with 8 temporaries
+			};
+
+			for (size_t i = 0; i < body.count; ++i) {
+				const InlineOp& op = body.ops[i];
+				int reg;
+
+				switch (op.op) {
+					case InlineOp::OpLoadInput:
+						reg = find_cached(dyncfg_position + op.offset);
+						if (reg == -1) {
+							reg = allocate();
+							vfp_transfer(true, reg, 5, op.offset);
+							remember(dyncfg_position + op.offset, reg);
+						}
+						temporaries[op.dest] = reg;
+						break;
+					case InlineOp::OpLoadConfig:
+						reg = allocate();
+						vfp_transfer(true, reg, 1, op.offset);
+						temporaries[op.dest] = reg;
+						break;
+					case InlineOp::OpMul:
+					case InlineOp::OpAdd:
+					case InlineOp::OpSub:
+						reg = allocate();
+						if (op.op == InlineOp::OpMul) push_instr(insns::vmul(reg, temporaries[op.a], temporaries[op.b]));
+						else if (op.op == InlineOp::OpAdd) push_instr(insns::vadd(reg, temporaries[op.a], temporaries[op.b]));
+						else push_instr(insns::vsub(reg, temporaries[op.a], temporaries[op.b]));
+						temporaries[op.dest] = reg;
+						break;
+					case InlineOp::OpMulAdd:
+						reg = temporaries[op.dest];
+						// Accumulating in place would clobber a cached word or another temporary, so copy it first
+						if (std::any_of(cached.begin(), cached.end(), [&](const CachedWord& word){return word.reg == reg;}) ||
+								std::count(std::begin(temporaries), std::end(temporaries), reg) > 1) {
+							int copy = allocate();
+							push_instr(insns::vmov(copy, reg));
+							reg = temporaries[op.dest] = copy;
+						}
+						push_instr(insns::vmla(reg, temporaries[op.a], temporaries[op.b]));
+						break;
+					case InlineOp::OpStoreOutput:
+						vfp_transfer(false, temporaries[op.a], 5, op.offset);
+						remember(dyncfg_position + op.offset, temporaries[op.a]);
+						break;
+				}
+			}
+		};
+
 		// r4 - return state
 		// r5 - dyncfg pointer
 		// r6,r7 - scratch
@@ -299,6 +488,7 @@ namespace ms::synth::jit {
 		//     - trampoline for RunModule
 		//  r7 - offset larger than 12 bit
 		//
+		// s0-s15 - inlined modules
 		// r8 - output pointer
 
 		// Create prologue
@@ -306,13 +496,18 @@ namespace ms::synth::jit {
 		push_instr(insns::mov(8, 0));
 		push_instr(insns::mov(5, 1));
 
+		uint16_t pins_index = 0;
 		for (const PsuedoInstruction& pins : instructions) {
 			switch (pins.opcode) {
 				case PsuedoInstruction::OpcodeLoadConfig:
-					literalpool.push_back(reinterpret_cast<uint32_t>(pins.config_location));
+					literalpool.push_back({reinterpret_cast<uint32_t>(pins.config_location), pins_index});
 					push_instr(insns::load_literal_pool_placeholder(1));
 					break;
 				case PsuedoInstruction::OpcodeLoadResult:
+					if (int reg = find_cached(dyncfg_position + pins.advance_or_result_offset); reg != -1) {
+						push_instr(insns::vstr(reg, 8, 0));
+						break;
+					}
 					// LOAD TO REG 6
 					if (!(pins.advance_or_result_offset & 0b11) && (pins.advance_or_result_offset < (256 << 2))) {
 						// We can use 5-bit form
@@ -331,6 +526,7 @@ namespace ms::synth::jit {
 					push_instr(insns::store_12bit_reg_offset(6, 8, 0));
 					break;
 				case PsuedoInstruction::OpcodeAdvanceDynConfig:
+					dyncfg_position += pins.advance_or_result_offset;
 					if (pins.advance_or_result_offset < 256) push_instr(insns::add_immediate_8bit(5, pins.advance_or_result_offset));
 					else if (pins.advance_or_result_offset <= 0b1111'1111'1111) push_instr(insns::add_immediate_12bit(5, 5, pins.advance_or_result_offset));
 					else {
@@ -339,6 +535,13 @@ namespace ms::synth::jit {
 					}
 					break;
 				case PsuedoInstruction::OpcodeCopyFloat:
+					// If an inlined module left the value in a register store it from there
+					if (int reg = find_cached(dyncfg_position + pins.source_offset); reg != -1 && pins.target_offset <= 1020) {
+						push_instr(insns::vstr(reg, 5, pins.target_offset));
+						remember(dyncfg_position + pins.target_offset, reg);
+						break;
+					}
+					forget_offset(dyncfg_position + pins.target_offset);
 					// LOAD TO REG 6
 					if (!(pins.source_offset & 0b11) && (pins.source_offset < (256 << 2))) {
 						// We can use 5-bit form
@@ -369,7 +572,7 @@ namespace ms::synth::jit {
 					}
 					break;
 				case PsuedoInstruction::OpcodeRunModule:
-					literalpool.push_back(reinterpret_cast<uint32_t>(pins.proc) | 1); // make sure the thumb bit is set
+					literalpool.push_back({reinterpret_cast<uint32_t>(pins.proc) | 1, pins_index}); // make sure the thumb bit is set
 					push_instr(insns::load_literal_pool_placeholder(6));
 					push_instr(insns::mov(0, 5));
 					push_instr(insns::blx(6));
@@ -380,8 +583,20 @@ namespace ms::synth::jit {
 						inited_r4 = true;
 						push_instr(insns::mov(4, 0));
 					}
+					// The call clobbers s0-s15
+					cached.clear();
+					break;
+				case PsuedoInstruction::OpcodeInlineModule:
+					emit_inline(*pins.body);
+					// Inlined modules never end the note
+					if (!inited_r4) {
+						inited_r4 = true;
+						push_instr(insns::movs_immediate(4, 1));
+					}
 					break;
 			}
+
+			++pins_index;
 		}
 
 		do_literalpool();
@@ -7,9 +7,19 @@
 // the various voices. Unlike a proper channel based setup, there's no per-channel panning or effects, rather the entire object
 // handles stereo stuff and effect buffers.
 //
+// Program changes are double buffered: the new program is compiled in the main loop (update()) while the old one keeps playing,
+// and then swapped in by the audio interrupt at the start of a block. Held notes crossfade over to the new program, and released
+// notes finish on the old one, which is only freed once nothing is playing on it anymore.
+//
+// Released voices stop being generated as soon as they're done: either a module ended the note or the output has stayed below
+// silence_threshold for silence_samples. This is decided at the start of each block by the audio interrupt, which only flags the
+// slot; the Voice itself stays allocated and is reused by the next note in that slot (or deleted by update() if it belongs to an
+// old program), so nothing on the audio side touches the heap.
+//
 // TODO: well i mean effects, layering, literally everything :)
 
 #include "program.h"
+#include "bank.h"
 #include "playback.h"
 #include "../evt/dispatch.h"
 #include "../evt/events.h"
@@ -21,8 +31,13 @@ namespace ms::synth::playback {
 
 	template<size_t Channels> // this could be heap'd, but at that point i'm going to be fragmenting everything
 	struct LivePlayback : evt::EventHandler<evt::MidiEvent>, AudioGenerator {
-		LivePlayback(const Patch &patch) :
-			patch(patch)
+		LivePlayback(const Patch &patch) {
+			current.program = std::make_unique<Program>(patch);
+		}
+
+		// Use an already compiled program (e.g. one loaded from the program cache)
+		LivePlayback(bank::Entry &&entry) :
+			current(std::move(entry))
 		{}
 
 		bool handle(const evt::MidiEvent& evt) override {
@@ -45,73 +60,223 @@ namespace ms::synth::playback {
 						if (evt.pitchbend.amount < 128)
 							semitones = static_cast<float>(evt.pitchbend.amount - 64) / 32.f;
 						pitch_bend_offset = offset_scale_from_semitones(semitones);
+						finish_swap();
 						for (int i = 0; i < Channels; ++i) {
 							if (voices[i])
 								voices[i]->set_pitch(voices[i]->pitch() * pitch_bend_offset);
 						}
 					}
+					break;
+				case evt::MidiEvent::TypeProgramChange:
+					// Loaded in update()
+					requested_program = evt.programchange.pc;
+					break;
 				default:
 					break;
 			}
 
 			return true;
 		}
+
+		void begin_block() override {
+			// Retire voices that finished during the last block
+			uint8_t active = 0;
+			for (size_t i = 0; i < Channels; ++i) {
+				if (!voices[i] || finished[i]) continue;
+				if (voices[i]->released_time() != -1.f && (cut_voices[i] || quiet_samples[i] >= silence_samples)) {
+					finished[i] = true;
+					continue;
+				}
+				++active;
+			}
+			active_count = active;
+			if (active > peak_count) peak_count = active;
+
+			if (!swap_ready) return;
+
+			// Everything here is just pointer moves; the old program is freed later in update().
+			retiring = std::move(current);
+			current = std::move(pending);
+
+			for (size_t i = 0; i < Channels; ++i) {
+				if (!replacements[i]) continue;
+				fading[i] = voices[i];
+				voices[i] = replacements[i];
+				replacements[i] = nullptr;
+			}
+
+			fade_remaining = crossfade_samples;
+			swap_ready = false;
+		}
+
 		int16_t generate() override {
 			int16_t total = 0;
 			for (size_t i = 0; i < Channels; ++i) {
-				if (voices[i]) {
-					if (cut_voices[i] && voices[i]->released_time() != -1.f) continue;
-					total = __QADD16(total, voices[i]->generate(cut_voices[i]) / (int16_t)Channels);
+				if (voices[i] && !finished[i]) {
+					int32_t sample = voices[i]->generate(cut_voices[i]);
+					if (voices[i]->released_time() == -1.f) quiet_samples[i] = 0;
+					else if (sample > -silence_threshold && sample < silence_threshold) {
+						if (quiet_samples[i] < silence_samples) ++quiet_samples[i];
+					}
+					else quiet_samples[i] = 0;
+					if (fading[i] && fade_remaining) {
+						// Crossfade from the same note on the previous program
+						bool fading_cut = false;
+						int32_t old_sample = fading[i]->generate(fading_cut);
+						sample = (old_sample * fade_remaining + sample * (crossfade_samples - fade_remaining)) / crossfade_samples;
+					}
+					total = __QADD16(total, sample / (int16_t)Channels);
 					if (cut_voices[i] && (voices[i]->released_time() == -1.f)) cut_voices[i] = false;
 				}
 			}
+			if (fade_remaining) --fade_remaining;
 			return total;
 		}
 
+		// Number of voices generated in the current block, and the most there have ever been
+		uint8_t active_voices() const {return active_count;}
+		uint8_t peak_voices() const {return peak_count;}
+
+		// Called from the main loop: frees voices left on old programs and handles program changes
 		void update() {
 			for (int i = 0; i < Channels; ++i) {
-				if (cut_voices[i] && voices[i]) {
-					delete voices[i];
+				// Finished voices are kept for reuse by claim(), unless they can't be reused
+				if (finished[i] && voices[i] && &voices[i]->source() != current.program.get()) {
+					Voice *voice = voices[i];
 					voices[i] = nullptr;
+					delete voice;
 				}
+				if (fading[i] && !fade_remaining && !swap_ready) {
+					Voice *voice = fading[i];
+					fading[i] = nullptr;
+					delete voice;
+				}
+			}
+
+			// The old program stays around until the last note played on it has finished
+			if (retiring && !in_use(*retiring.program)) retiring = {};
+
+			// Compile the requested program while the current one keeps playing
+			if (requested_program != NoProgramRequested && !staged) {
+				staged = bank::load(static_cast<uint8_t>(requested_program));
+				if (!staged) printf("no patch for program %d\n", requested_program);
+				requested_program = NoProgramRequested;
+			}
+
+			// ...and hand it over to the audio interrupt once the last swap is fully done
+			if (staged && !swap_ready && !retiring) {
+				prepare_swap(std::move(staged));
 			}
 		}
 		
 	private:
+		// ~5ms
+		constexpr static inline uint16_t crossfade_samples = 256;
+		// A released voice quieter than this (about -72dBFS) for ~50ms is done
+		constexpr static inline int32_t silence_threshold = 8;
+		constexpr static inline uint16_t silence_samples = 2205;
+		constexpr static inline int NoProgramRequested = -1;
+
+		void prepare_swap(bank::Entry &&next) {
+			// Held notes move to the new program (crossfading over); released ones finish their tails on the old one.
+			for (size_t i = 0; i < Channels; ++i) {
+				if (!voices[i] || finished[i] || voices[i]->released_time() != -1.f) continue;
+				Voice *voice = next.program->new_voice();
+				voice->reset_time();
+				voice->set_pitch(voices[i]->pitch());
+				voice->set_velocity(velocities[i]);
+				replacements[i] = voice;
+			}
+
+			pending = std::move(next);
+			swap_ready = true;
+		}
+
+		bool in_use(const Program& program) const {
+			for (size_t i = 0; i < Channels; ++i) {
+				if (voices[i] && !finished[i] && &voices[i]->source() == &program) return true;
+				if (fading[i] && &fading[i]->source() == &program) return true;
+			}
+			return false;
+		}
+
+		// Get a voice on the current program for slot i. Never called while a swap is pending.
+		Voice * claim(size_t i) {
+			Voice *voice = voices[i];
+			voices[i] = nullptr;
+			if (voice && &voice->source() != current.program.get()) {
+				delete voice;
+				voice = nullptr;
+			}
+			if (!voice) voice = current.program->new_voice();
+			return voice;
+		}
+
+		// The swap only knows about the notes held when it was prepared (replacements are set up from them), so anything that
+		// changes a held note has to finish it first.
+		void finish_swap() {
+			if (!swap_ready) return;
+			__disable_irq();
+			begin_block();
+			__enable_irq();
+		}
+
 		void start_note(float pitch, float velocity) {
+			finish_swap();
+
 			// Find an open slot
 			size_t i;
 			for (i = 0; i < Channels; ++i) {
-				if (cut_voices[i] || !voices[i]) {
-					if (!voices[i]) voices[i] = patch.new_voice();
-					// Re-init
-init:
-					voices[i]->reset_time();
-					voices[i]->set_pitch(pitch);
-					voices[i]->set_pitch(pitch*pitch_bend_offset);
-					voices[i]->set_velocity(velocity);
-					cut_voices[i] = false;
-					return;
-				}
+				if (finished[i] || !voices[i]) goto init;
 			}
 			i = 0;
 			// Otherwise, replace the earliest one
 			for (size_t j = 0; j < Channels; ++j) {
 				if (voices[j]->held_time() > voices[i]->held_time()) i = j;
 			}
-			goto init;
+init:
+			{
+				Voice *voice = claim(i);
+				voice->reset_time();
+				voice->set_pitch(pitch*pitch_bend_offset);
+				voice->set_velocity(velocity);
+				velocities[i] = velocity;
+				cut_voices[i] = false;
+				quiet_samples[i] = 0;
+				voices[i] = voice;
+				// Only hand the slot back to the audio interrupt once it's fully set up
+				__DMB();
+				finished[i] = false;
+			}
 		}
 		void end_note(float pitch) {
+			finish_swap();
 			for (size_t i = 0; i < Channels; ++i) {
-				if (voices[i]->pitch() == pitch) {
+				if (voices[i] && voices[i]->pitch() == pitch) {
 					voices[i]->mark_off();
 				}
 			}
 		}
 
-		Program patch;
+		// current is what new notes play on, retiring is the previous program which is kept alive until its
+		// last voice finishes, and pending is the next program waiting for the audio interrupt to swap it in.
+		bank::Entry current, retiring, pending;
+		// Compiled but not yet handed over
+		bank::Entry staged;
+		Voice* replacements[Channels]{};
+		volatile bool swap_ready = false;
+		int requested_program = NoProgramRequested;
+
 		Voice*  voices[Channels]{};
+		Voice*  fading[Channels]{};
 		bool    cut_voices[Channels]{};
+		// Set by the audio interrupt when a released voice is done, cleared when the slot is reused
+		volatile bool finished[Channels]{};
+		uint16_t quiet_samples[Channels]{};
+		float   velocities[Channels]{};
+		volatile uint8_t active_count = 0;
+		uint8_t peak_count = 0;
+		uint16_t fade_remaining = 0;
 		float pitch_bend_offset=1.f;
 	};
 }
@@ -54,6 +54,33 @@ namespace ms::synth {
 
 	typedef bool (*ModuleProc)(void *block, const void *staticblock);
 
+	// An inline template: a module body simple enough for the JIT to emit directly into the procedure as VFP instructions
+	// instead of calling its proc (see jit::assemble). Templates work on up to 8 float temporaries which the JIT maps onto
+	// registers, so values passed between inlined modules usually never get reloaded from the dyncfg.
+	//
+	// Inlined modules can't end the note (they're treated as always returning true) and their outputs can't have
+	// enabled/min/max metadata.
+	struct InlineOp {
+		enum : uint8_t {
+			OpLoadInput,   // t[dest] = dyncfg[offset]
+			OpLoadConfig,  // t[dest] = cfg[offset]
+			OpMul,         // t[dest] = t[a] * t[b]
+			OpAdd,         // t[dest] = t[a] + t[b]
+			OpSub,         // t[dest] = t[a] - t[b]
+			OpMulAdd,      // t[dest] += t[a] * t[b]
+			OpStoreOutput  // dyncfg[offset] = t[a]
+		} op;
+		uint8_t dest, a, b;
+		uint16_t offset; // in bytes, at most 1020
+	};
+
+	struct InlineTemplate {
+		const InlineOp *ops;
+		size_t count;
+
+		static constexpr uint8_t max_temporaries = 8;
+	};
+
 	struct ModuleBase {
 		// The name as seen in the UI
 		const char * name;
@@ -68,6 +95,8 @@ namespace ms::synth {
 		// Pointer to descriptors for inputs and outputs
 		const ModuleInput * const inputs; 
 		const ModuleOutput * const outputs;
+		// Optional inline template, used by the JIT instead of proc
+		const InlineTemplate * inline_body = nullptr;
 	};
 
 	namespace detail {
@@ -194,6 +223,26 @@ namespace ms::synth {
 		return obj;
 	}
 
+	// Inline template ops (see InlineOp)
+	template<typename Module>
+	constexpr InlineOp inline_input(uint8_t dest, float Module::* ptr) {
+		return InlineOp{InlineOp::OpLoadInput, dest, 0, 0, static_cast<uint16_t>(detail::offset_from_memberptr(ptr))};
+	}
+
+	template<typename Cfg>
+	constexpr InlineOp inline_config(uint8_t dest, float Cfg::* ptr) {
+		return InlineOp{InlineOp::OpLoadConfig, dest, 0, 0, static_cast<uint16_t>(detail::offset_from_memberptr(ptr))};
+	}
+
+	constexpr InlineOp inline_op(decltype(InlineOp::op) op, uint8_t dest, uint8_t a, uint8_t b) {
+		return InlineOp{op, dest, a, b, 0};
+	}
+
+	template<typename Module>
+	constexpr InlineOp inline_output(float Module::* ptr, uint8_t source) {
+		return InlineOp{InlineOp::OpStoreOutput, 0, source, 0, static_cast<uint16_t>(detail::offset_from_memberptr(ptr))};
+	}
+
 	// Create a module.
 	//
 	// The only template argument you should specify is a ModuleType.
@@ -226,6 +275,28 @@ namespace ms::synth {
 		};
 	}
 
+	// Create a module which the JIT may inline using body instead of calling generate (which must do the same thing, it's
+	// still used wherever the module isn't inlined).
+	template<typename Module, template<typename, size_t> typename InHolder, template<typename, size_t> typename OutHolder, size_t InCount, size_t OutCount>
+	constexpr ModuleBase make_module(
+		const char *name,
+		const InHolder<ModuleInput, InCount> &inputs,
+		const OutHolder<ModuleOutput, OutCount> &outputs,
+		const InlineTemplate &body
+	) {
+		return ModuleBase{
+			name,
+			detail::ModuleHelper<Module>::proc,
+			sizeof(typename Module::Cfg),
+			sizeof(Module),
+			InCount,
+			OutCount,
+			inputs.data,
+			outputs.data,
+			&body
+		};
+	}
+
 	/* Sample module: 
 		namespace square {
 			struct SqwWave {
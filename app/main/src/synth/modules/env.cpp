@@ -1,6 +1,13 @@
 #include "env.h"
 #include <cmath>
 
+namespace {
+	// The exponential curves are all quadratic, so there's no reason to go through powf for them
+	inline float square(float x) {
+		return x * x;
+	}
+}
+
 bool ms::synth::mod::ADSR::generate(const Cfg& cfg) {
 	output = 0.f;
 
@@ -27,16 +34,16 @@ bool ms::synth::mod::ExpADSR::generate(const Cfg& cfg) {
 	output = 0.f;
 
 	if (curr_time < cfg.attack_time) {
-		output = (1.f - powf(1.f - curr_time / cfg.attack_time, 2.f)) * cfg.attack_level;
+		output = (1.f - square(1.f - curr_time / cfg.attack_time)) * cfg.attack_level;
 	}
 	else if (curr_time < (cfg.attack_time + cfg.decay_time)) {
-		output = cfg.sustain_level + powf(1.f - (curr_time - cfg.attack_time) / cfg.decay_time, 2.f) * (cfg.attack_level - cfg.sustain_level);
+		output = cfg.sustain_level + square(1.f - (curr_time - cfg.attack_time) / cfg.decay_time) * (cfg.attack_level - cfg.sustain_level);
 	}
 	else {
 		output = cfg.sustain_level;
 	}
 	if (off_time >= 0.f) {
-		output *= powf(1.f - (curr_time - off_time) / cfg.release_time, 2.f);
+		output *= square(1.f - (curr_time - off_time) / cfg.release_time);
 	}
 
 	output *= scale;
@@ -0,0 +1,74 @@
+#include "filter.h"
+#include "../util.h"
+#include <cmath>
+
+namespace {
+	// Keep the cutoff where the coefficient maths stays stable
+	inline float clamp_cutoff(float cutoff) {
+		return fminf(fmaxf(cutoff, 10.f), ms::synth::sample_rate * 0.45f);
+	}
+
+	inline float clamp_resonance(float resonance) {
+		return fminf(fmaxf(resonance, 0.f), 1.f);
+	}
+
+	inline bool moved(float value, float cached, float threshold) {
+		return fabsf(value - cached) > fabsf(cached) * threshold;
+	}
+
+	// Pade approximation of tanh, good enough to keep the ladder feedback bounded
+	inline float saturate(float x) {
+		x = fminf(fmaxf(x, -3.f), 3.f);
+		float x2 = x * x;
+		return x * (27.f + x2) / (27.f + 9.f * x2);
+	}
+}
+
+bool ms::synth::mod::SVFilter::generate(const Cfg& cfg) {
+	if (!valid || moved(cutoff, cached_cutoff, cfg.threshold) || moved(resonance, cached_resonance, cfg.threshold)) {
+		cached_cutoff = cutoff;
+		cached_resonance = resonance;
+		valid = true;
+
+		float g = tanf(static_cast<float>(M_PI) * clamp_cutoff(cutoff) / sample_rate);
+		k = 2.f - 1.98f * clamp_resonance(resonance);
+		a1 = 1.f / (1.f + g * (g + k));
+		a2 = g * a1;
+		a3 = g * a2;
+	}
+
+	float v3 = input - ic2eq;
+	float v1 = a1 * ic1eq + a2 * v3;
+	float v2 = ic2eq + a2 * ic1eq + a3 * v3;
+	ic1eq = 2.f * v1 - ic1eq;
+	ic2eq = 2.f * v2 - ic2eq;
+
+	low = v2;
+	band = v1;
+	high = input - k * v1 - v2;
+
+	return true;
+}
+
+bool ms::synth::mod::LadderFilter::generate(const Cfg& cfg) {
+	if (!valid || moved(cutoff, cached_cutoff, cfg.threshold) || moved(resonance, cached_resonance, cfg.threshold)) {
+		cached_cutoff = cutoff;
+		cached_resonance = resonance;
+		valid = true;
+
+		// 1 - e^(-2pi fc / fs)
+		g = 1.f - fast_exp2(clamp_cutoff(cutoff) * (-2.f * static_cast<float>(M_PI) * static_cast<float>(M_LOG2E) / sample_rate));
+		k = 4.f * clamp_resonance(resonance);
+	}
+
+	// Partly make up for the passband dropping as resonance goes up
+	float x = saturate(input * (1.f + 0.5f * k) - k * stage[3]);
+	stage[0] += g * (x - stage[0]);
+	stage[1] += g * (stage[0] - stage[1]);
+	stage[2] += g * (stage[1] - stage[2]);
+	stage[3] += g * (stage[2] - stage[3]);
+
+	output = stage[3];
+
+	return true;
+}
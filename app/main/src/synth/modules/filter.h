@@ -0,0 +1,85 @@
+#pragma once
+
+#include "../module.h"
+
+// Resonant filter modules.
+//
+// Working out the coefficients needs tan/exp, so they're cached in the dyncfg and only recomputed when cutoff or resonance
+// move by more than cfg.threshold (relative). A steady or slowly swept cutoff then only costs the filter itself per sample.
+// A threshold of 0 recomputes on every change.
+
+namespace ms::synth::mod {
+	// Trapezoidal (zero-delay feedback) state variable filter, with lowpass/bandpass/highpass outputs
+	struct SVFilter {
+		struct Cfg {
+			float threshold;
+		};
+
+		float input, cutoff, resonance;
+		float low, band, high;
+
+		bool generate(const Cfg& cfg);
+
+	private:
+		// Cached coefficients
+		float cached_cutoff = 0.f, cached_resonance = 0.f;
+		float a1 = 0.f, a2 = 0.f, a3 = 0.f, k = 0.f;
+		bool valid = false;
+
+		// Integrator state
+		float ic1eq = 0.f, ic2eq = 0.f;
+	};
+
+	// 4-pole (24dB/oct) ladder lowpass
+	struct LadderFilter {
+		struct Cfg {
+			float threshold;
+		};
+
+		float input, cutoff, resonance;
+		float output;
+
+		bool generate(const Cfg& cfg);
+
+	private:
+		float cached_cutoff = 0.f, cached_resonance = 0.f;
+		float g = 0.f, k = 0.f;
+		bool valid = false;
+
+		float stage[4]{};
+	};
+
+	constexpr auto SVFilterInputs = make_inputs(
+		make_input("input", &SVFilter::input),
+		make_input("cutoff", &SVFilter::cutoff, 10.f, 20000.f),
+		make_input("resonance", &SVFilter::resonance, 0.f, 1.f)
+	);
+
+	constexpr auto SVFilterOutputs = make_outputs(
+		make_output("low", &SVFilter::low),
+		make_output("band", &SVFilter::band),
+		make_output("high", &SVFilter::high)
+	);
+
+	constexpr auto SVFilterModule = make_module<SVFilter>(
+		"state_variable_filter",
+		SVFilterInputs,
+		SVFilterOutputs
+	);
+
+	constexpr auto LadderFilterInputs = make_inputs(
+		make_input("input", &LadderFilter::input),
+		make_input("cutoff", &LadderFilter::cutoff, 10.f, 20000.f),
+		make_input("resonance", &LadderFilter::resonance, 0.f, 1.f)
+	);
+
+	constexpr auto LadderFilterOutputs = make_outputs(
+		make_output("", &LadderFilter::output)
+	);
+
+	constexpr auto LadderFilterModule = make_module<LadderFilter>(
+		"ladder_filter",
+		LadderFilterInputs,
+		LadderFilterOutputs
+	);
+}
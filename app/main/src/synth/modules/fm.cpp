@@ -0,0 +1,50 @@
+#include "fm.h"
+#include "../util.h"
+
+namespace {
+	constexpr float inv_two_pi = 0.15915494f;
+}
+
+bool ms::synth::mod::FmOperator::generate(const Cfg& cfg) {
+	// Average the last two outputs for the feedback path, like the DX7 does, to keep it from oscillating
+	float offset = index * modulation + feedback * 0.5f * (previous[0] + previous[1]);
+
+	float value = wavesin_phase(phase + phase_offset(offset * inv_two_pi));
+	previous[1] = previous[0];
+	previous[0] = value;
+
+	output = value * amplitude;
+	phase += phase_increment(frequency * cfg.ratio);
+
+	return true;
+}
+
+bool ms::synth::mod::FmStack::generate(const Cfg& cfg) {
+	const size_t count = cfg.operator_count < max_operators ? cfg.operator_count : max_operators;
+	float sum = 0.f;
+
+	// Modulators always have higher numbers, so going top down means everything an operator needs is already done
+	for (size_t i = count; i-- > 0;) {
+		const auto& op = cfg.operators[i];
+
+		float offset = op.feedback * 0.5f * (last[i] + previous[i]);
+		for (uint8_t mods = op.modulators >> (i + 1), j = i + 1; mods; mods >>= 1, ++j) {
+			if (mods & 1) offset += out[j];
+		}
+
+		float value = wavesin_phase(phase[i] + phase_offset(offset * inv_two_pi));
+		previous[i] = last[i];
+		last[i] = value;
+
+		if (op.carrier) {
+			out[i] = value * op.level;
+			sum += out[i];
+		}
+		else out[i] = value * op.level * index_scale;
+
+		phase[i] += phase_increment(frequency * op.ratio);
+	}
+
+	output = sum * amplitude;
+	return true;
+}
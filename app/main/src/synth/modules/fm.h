@@ -0,0 +1,103 @@
+#pragma once
+
+#include "../module.h"
+
+// FM (well, phase modulation, like every other "FM" synth) operators.
+//
+// Both use an integer phase accumulator and the shared sine table. Modulation indices and feedback are in radians.
+//
+// FmOperator is a single operator for building algorithms out of separate modules. FmStack runs a whole set of operators
+// in one module call, which avoids going through the program for every operator and copying every intermediate output around.
+
+namespace ms::synth::mod {
+	struct FmOperator {
+		struct Cfg {
+			// Frequency multiplier applied to the frequency input
+			float ratio;
+		};
+
+		float frequency, amplitude;
+		// The modulating signal, scaled by index
+		float modulation, index;
+		float feedback;
+
+		float output;
+
+		bool generate(const Cfg& cfg);
+
+	private:
+		uint32_t phase = 0;
+		float previous[2]{};
+	};
+
+	struct FmStack {
+		constexpr static inline size_t max_operators = 6;
+
+		struct Cfg {
+			struct Operator {
+				float ratio;
+				// Output level: the modulation index for operators modulating others, the amplitude for carriers
+				float level;
+				float feedback;
+				// Bit i set means operator i modulates this one. Only operators with a higher number can modulate lower ones,
+				// which keeps every algorithm evaluable in one pass from the top down.
+				uint8_t modulators;
+				bool carrier;
+				uint16_t reserved;
+			};
+
+			uint8_t operator_count; // up to max_operators
+			uint8_t reserved[3];
+			Operator operators[max_operators];
+		};
+
+		float frequency, amplitude;
+		// Scales the level of every modulator (i.e. brightness)
+		float index_scale;
+
+		float output;
+
+		bool generate(const Cfg& cfg);
+
+	private:
+		uint32_t phase[max_operators]{};
+		// Level-scaled output (what modulates other operators)
+		float out[max_operators]{};
+		// Last two raw outputs, for feedback
+		float last[max_operators]{}, previous[max_operators]{};
+	};
+
+	constexpr auto FmOperatorInputs = make_inputs(
+		make_input(predef::AutoFrequency, &FmOperator::frequency),
+		make_input("amplitude", &FmOperator::amplitude, 0.f, 1.f),
+		make_input("modulation", &FmOperator::modulation, -1.f, 1.f),
+		make_input("index", &FmOperator::index),
+		make_input("feedback", &FmOperator::feedback)
+	);
+
+	constexpr auto FmOperatorOutputs = make_outputs(
+		make_output("", &FmOperator::output)
+	);
+
+	constexpr auto FmOperatorModule = make_module<FmOperator>(
+		"fm_operator",
+		FmOperatorInputs,
+		FmOperatorOutputs
+	);
+
+	constexpr auto FmStackInputs = make_inputs(
+		make_input(predef::AutoFrequency, &FmStack::frequency),
+		make_input("amplitude", &FmStack::amplitude, 0.f, 1.f),
+		make_input("index_scale", &FmStack::index_scale, 0.f, 1.f)
+	);
+
+	constexpr auto FmStackOutputs = make_outputs(
+		make_output("", &FmStack::output)
+	);
+
+	constexpr auto FmStackModule = make_module<FmStack>(
+		"fm_stack",
+		FmStackInputs,
+		FmStackOutputs
+	);
+}
@@ -0,0 +1,79 @@
+#include "math.h"
+#include "registry.h"
+#include "../util.h"
+
+bool ms::synth::mod::Crossfade::generate(const Cfg& cfg) {
+	if (cfg.equal_power) {
+		// a * cos + b * sin over a quarter period
+		uint32_t phase = static_cast<uint32_t>(mix * 1073741824.f);
+		output = a * wavesin_phase(phase + 0x4000'0000) + b * wavesin_phase(phase);
+	}
+	else output = a + (b - a) * mix;
+
+	return true;
+}
+
+namespace ms::synth::mod::fused {
+	namespace {
+		template<typename Module>
+		inline const uint32_t * step(uint8_t *dyncfg, const uint32_t *cfg) {
+			reinterpret_cast<Module *>(dyncfg)->generate(*reinterpret_cast<const typename Module::Cfg *>(cfg));
+			return cfg + (sizeof(typename Module::Cfg) + 3) / 4;
+		}
+	}
+
+	bool fusable(const ModuleBase& mod) {
+		switch (id_of(mod)) {
+			case IdMixer:
+			case IdVca:
+			case IdCrossfade:
+			case IdScaleOffset:
+				return true;
+			default:
+				return false;
+		}
+	}
+
+	void append(std::vector<uint32_t> &ops, const ModuleBase& mod, const void * cfg, uint16_t dyncfg_offset,
+			const std::vector<uint32_t> &copies) {
+		ops.push_back(id_of(mod) | (copies.size() << 8) | (static_cast<uint32_t>(dyncfg_offset) << 16));
+
+		size_t start = ops.size();
+		ops.resize(start + (mod.cfg_size + 3) / 4);
+		memcpy(ops.data() + start, cfg, mod.cfg_size);
+
+		ops.insert(ops.end(), copies.begin(), copies.end());
+	}
+
+	bool run(void *dyncfg, const void *ops) {
+		uint8_t *base = static_cast<uint8_t *>(dyncfg);
+		const uint32_t *op = static_cast<const uint32_t *>(ops);
+
+		for (uint32_t count = *op++; count; --count) {
+			uint32_t header = *op++;
+			uint8_t *module = base + (header >> 16);
+
+			switch (header & 0xff) {
+				case IdMixer:
+					op = step<Mixer>(module, op);
+					break;
+				case IdVca:
+					op = step<Vca>(module, op);
+					break;
+				case IdCrossfade:
+					op = step<Crossfade>(module, op);
+					break;
+				case IdScaleOffset:
+					op = step<ScaleOffset>(module, op);
+					break;
+			}
+
+			for (uint32_t copies = (header >> 8) & 0xff; copies; --copies, ++op) {
+				*reinterpret_cast<float *>(base + (*op >> 16)) = *reinterpret_cast<const float *>(base + (*op & 0xffff));
+			}
+		}
+
+		// None of these care about when the note ends
+		return true;
+	}
+}
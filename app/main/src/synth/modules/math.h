@@ -0,0 +1,192 @@
+#pragma once
+
+#include "../module.h"
+#include <vector>
+
+// Mixing and math modules: a 4 input mixer, VCA, crossfade and scale/offset.
+//
+// These are all only a few flops each, so the mixer, VCA and scale/offset provide inline templates which the JIT emits straight
+// into the procedure. What can't be inlined (the crossfade) gets fused: when several math modules end up next to each other in
+// a program the linker turns them into a single call to fused::run (see below) instead of dispatching to each one separately.
+
+namespace ms::synth::mod {
+	struct Mixer {
+		struct Cfg {
+			float gain_a, gain_b, gain_c, gain_d;
+		};
+
+		float a, b, c, d;
+		float output;
+
+		bool generate(const Cfg& cfg) {
+			output = a * cfg.gain_a + b * cfg.gain_b + c * cfg.gain_c + d * cfg.gain_d;
+			return true;
+		}
+	};
+
+	struct Vca {
+		struct Cfg {
+			float scale;
+		};
+
+		float input, gain;
+		float output;
+
+		bool generate(const Cfg& cfg) {
+			output = input * gain * cfg.scale;
+			return true;
+		}
+	};
+
+	struct Crossfade {
+		struct Cfg {
+			// Use an equal power (sin/cos) curve instead of a linear one
+			bool equal_power;
+		};
+
+		float a, b, mix;
+		float output;
+
+		bool generate(const Cfg& cfg);
+	};
+
+	struct ScaleOffset {
+		struct Cfg {
+			float scale, offset;
+		};
+
+		float input;
+		float output;
+
+		bool generate(const Cfg& cfg) {
+			output = input * cfg.scale + cfg.offset;
+			return true;
+		}
+	};
+
+	constexpr auto MixerInputs = make_inputs(
+		make_input("a", &Mixer::a),
+		make_input("b", &Mixer::b),
+		make_input("c", &Mixer::c),
+		make_input("d", &Mixer::d)
+	);
+
+	constexpr auto MixerOutputs = make_outputs(
+		make_output("", &Mixer::output)
+	);
+
+	constexpr InlineOp MixerInline[] = {
+		inline_input(0, &Mixer::a),
+		inline_config(1, &Mixer::Cfg::gain_a),
+		inline_op(InlineOp::OpMul, 2, 0, 1),
+		inline_input(0, &Mixer::b),
+		inline_config(1, &Mixer::Cfg::gain_b),
+		inline_op(InlineOp::OpMulAdd, 2, 0, 1),
+		inline_input(0, &Mixer::c),
+		inline_config(1, &Mixer::Cfg::gain_c),
+		inline_op(InlineOp::OpMulAdd, 2, 0, 1),
+		inline_input(0, &Mixer::d),
+		inline_config(1, &Mixer::Cfg::gain_d),
+		inline_op(InlineOp::OpMulAdd, 2, 0, 1),
+		inline_output(&Mixer::output, 2)
+	};
+
+	constexpr InlineTemplate MixerTemplate{MixerInline, sizeof(MixerInline) / sizeof(InlineOp)};
+
+	constexpr auto MixerModule = make_module<Mixer>(
+		"mixer",
+		MixerInputs,
+		MixerOutputs,
+		MixerTemplate
+	);
+
+	constexpr auto VcaInputs = make_inputs(
+		make_input("input", &Vca::input),
+		make_input("gain", &Vca::gain, 0.f, 1.f)
+	);
+
+	constexpr auto VcaOutputs = make_outputs(
+		make_output("", &Vca::output)
+	);
+
+	constexpr InlineOp VcaInline[] = {
+		inline_input(0, &Vca::input),
+		inline_input(1, &Vca::gain),
+		inline_op(InlineOp::OpMul, 2, 0, 1),
+		inline_config(3, &Vca::Cfg::scale),
+		inline_op(InlineOp::OpMul, 2, 2, 3),
+		inline_output(&Vca::output, 2)
+	};
+
+	constexpr InlineTemplate VcaTemplate{VcaInline, sizeof(VcaInline) / sizeof(InlineOp)};
+
+	constexpr auto VcaModule = make_module<Vca>(
+		"vca",
+		VcaInputs,
+		VcaOutputs,
+		VcaTemplate
+	);
+
+	constexpr auto CrossfadeInputs = make_inputs(
+		make_input("a", &Crossfade::a),
+		make_input("b", &Crossfade::b),
+		make_input("mix", &Crossfade::mix, 0.f, 1.f)
+	);
+
+	constexpr auto CrossfadeOutputs = make_outputs(
+		make_output("", &Crossfade::output)
+	);
+
+	constexpr auto CrossfadeModule = make_module<Crossfade>(
+		"crossfade",
+		CrossfadeInputs,
+		CrossfadeOutputs
+	);
+
+	constexpr auto ScaleOffsetInputs = make_inputs(
+		make_input("input", &ScaleOffset::input)
+	);
+
+	constexpr auto ScaleOffsetOutputs = make_outputs(
+		make_output("", &ScaleOffset::output)
+	);
+
+	constexpr InlineOp ScaleOffsetInline[] = {
+		inline_input(0, &ScaleOffset::input),
+		inline_config(1, &ScaleOffset::Cfg::scale),
+		inline_config(2, &ScaleOffset::Cfg::offset),
+		inline_op(InlineOp::OpMulAdd, 2, 0, 1),
+		inline_output(&ScaleOffset::output, 2)
+	};
+
+	constexpr InlineTemplate ScaleOffsetTemplate{ScaleOffsetInline, sizeof(ScaleOffsetInline) / sizeof(InlineOp)};
+
+	constexpr auto ScaleOffsetModule = make_module<ScaleOffset>(
+		"scale_offset",
+		ScaleOffsetInputs,
+		ScaleOffsetOutputs,
+		ScaleOffsetTemplate
+	);
+
+	// Fused math chains
+	//
+	// A run of math modules is compiled into an op list, which fused::run (a regular ModuleProc) interprets using the dyncfg of
+	// the first module in the run as its base. Each op is:
+	//
+	// 	uint32_t header: module id (8 bits) | copy count (8 bits) | dyncfg offset (16 bits)
+	// 	the module's cfg, copied in (padded to words)
+	// 	uint32_t copies[copy count]: source offset (low 16 bits) | target offset (high 16 bits)
+	//
+	// preceded by a word with the number of ops. Copies are the links between modules in the run, done straight after the module
+	// runs. All offsets are in bytes from the base. Since cfgs are copied in, an op list doesn't contain any pointers.
+	namespace fused {
+		// Can this module be part of a fused run? (the linker still prefers inlining modules that have an inline template)
+		bool fusable(const ModuleBase& mod);
+
+		// Append an op to an op list (the count word is managed by the caller)
+		void append(std::vector<uint32_t> &ops, const ModuleBase& mod, const void * cfg, uint16_t dyncfg_offset,
+				const std::vector<uint32_t> &copies);
+
+		bool run(void *dyncfg, const void *ops);
+	}
+}
@@ -0,0 +1,55 @@
+#include "noise.h"
+#include "../util.h"
+
+namespace {
+	inline uint32_t seed_for(const void *dyncfg) {
+		return (reinterpret_cast<uintptr_t>(dyncfg) * 2654435761u) | 1;
+	}
+
+	inline uint32_t xorshift32(uint32_t &state) {
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		return state;
+	}
+
+	// Uniform in [-1, 1)
+	inline float uniform(uint32_t &state) {
+		return static_cast<float>(static_cast<int32_t>(xorshift32(state))) * (1.f / 2147483648.f);
+	}
+}
+
+bool ms::synth::mod::Noise::generate(const Cfg& cfg) {
+	if (!state) state = seed_for(this);
+
+	float white = uniform(state);
+
+	if (cfg.color == Cfg::ColorPink) {
+		// Paul Kellet's economy pink filter (-3dB/oct within about +/-0.5dB above 10hz at 44.1khz)
+		b0 = 0.99765f * b0 + white * 0.0990460f;
+		b1 = 0.96300f * b1 + white * 0.2965164f;
+		b2 = 0.57000f * b2 + white * 1.0526913f;
+		// Scaled so peaks stay within about +/-1 like white
+		output = (b0 + b1 + b2 + white * 0.1848f) * 0.13f * amplitude;
+	}
+	else output = white * amplitude;
+
+	return true;
+}
+
+bool ms::synth::mod::SampleHold::generate(const Cfg& cfg) {
+	if (!state) state = seed_for(this);
+
+	bool sample = trigger >= 0.5f && last_trigger < 0.5f;
+	last_trigger = trigger;
+
+	if (rate > 0.f) {
+		uint32_t previous = phase;
+		phase += phase_increment(rate);
+		if (phase < previous) sample = true;
+	}
+
+	if (sample) output = cfg.random ? uniform(state) : input;
+
+	return true;
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include "../module.h"
+
+// Noise sources and sample & hold.
+//
+// Each voice gets its own xorshift32 generator in its dyncfg, seeded from the dyncfg's address the first time it runs so that
+// voices don't all produce the same noise.
+
+namespace ms::synth::mod {
+	struct Noise {
+		struct Cfg {
+			enum Color : uint8_t {
+				ColorWhite,
+				ColorPink
+			} color;
+		};
+
+		float amplitude;
+		float output;
+
+		bool generate(const Cfg& cfg);
+
+	private:
+		// 0 until seeded
+		uint32_t state = 0;
+		// Pink noise filter state
+		float b0 = 0.f, b1 = 0.f, b2 = 0.f;
+	};
+
+	struct SampleHold {
+		struct Cfg {
+			// Hold random values instead of the input (for random LFOs)
+			bool random;
+		};
+
+		float input;
+		// Internal clock in hz (0 to disable)
+		float rate;
+		// Also samples on every rising edge through 0.5
+		float trigger;
+
+		float output;
+
+		bool generate(const Cfg& cfg);
+
+	private:
+		uint32_t state = 0;
+		uint32_t phase = 0;
+		float last_trigger = 0.f;
+	};
+
+	constexpr auto NoiseInputs = make_inputs(
+		make_input("amplitude", &Noise::amplitude, 0.f, 1.f)
+	);
+
+	constexpr auto NoiseOutputs = make_outputs(
+		make_output("", &Noise::output)
+	);
+
+	constexpr auto NoiseModule = make_module<Noise>(
+		"noise",
+		NoiseInputs,
+		NoiseOutputs
+	);
+
+	constexpr auto SampleHoldInputs = make_inputs(
+		make_input("input", &SampleHold::input),
+		make_input("rate", &SampleHold::rate),
+		make_input("trigger", &SampleHold::trigger)
+	);
+
+	constexpr auto SampleHoldOutputs = make_outputs(
+		make_output("", &SampleHold::output)
+	);
+
+	constexpr auto SampleHoldModule = make_module<SampleHold>(
+		"sample_and_hold",
+		SampleHoldInputs,
+		SampleHoldOutputs
+	);
+}
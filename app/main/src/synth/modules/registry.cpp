@@ -0,0 +1,47 @@
+#include "registry.h"
+#include "waves.h"
+#include "env.h"
+#include "filter.h"
+#include "sampler.h"
+#include "wavetable.h"
+#include "fm.h"
+#include "noise.h"
+#include "math.h"
+
+namespace ms::synth::mod {
+	namespace {
+		// Indexed by ModuleId
+		const ModuleBase * const registry[IdCount] = {
+			&SqwModule,
+			&TriModule,
+			&SawModule,
+			&SinModule,
+			&ADSRModule,
+			&ExpADSRModule,
+			&SVFilterModule,
+			&LadderFilterModule,
+			&SamplerModule,
+			&WavetableModule,
+			&FmOperatorModule,
+			&FmStackModule,
+			&NoiseModule,
+			&SampleHoldModule,
+			&MixerModule,
+			&VcaModule,
+			&CrossfadeModule,
+			&ScaleOffsetModule
+		};
+	}
+
+	const ModuleBase * lookup(uint16_t id) {
+		if (id >= IdCount) return nullptr;
+		return registry[id];
+	}
+
+	uint16_t id_of(const ModuleBase& mod) {
+		for (uint16_t id = 0; id < IdCount; ++id) {
+			if (registry[id]->proc == mod.proc) return id;
+		}
+		return IdInvalid;
+	}
+}
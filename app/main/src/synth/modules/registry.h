@@ -0,0 +1,42 @@
+#pragma once
+// Module registry
+//
+// Gives every module type a stable numeric ID, which is what serialized patches use to refer to them.
+//
+// IDs are part of the patch format: never renumber or reuse them, only append new ones before IdCount.
+
+#include "../module.h"
+
+namespace ms::synth::mod {
+	enum ModuleId : uint16_t {
+		IdSquareWave = 0,
+		IdTriangleWave = 1,
+		IdSawWave = 2,
+		IdSinWave = 3,
+		IdADSR = 4,
+		IdExpADSR = 5,
+		IdSVFilter = 6,
+		IdLadderFilter = 7,
+		IdSampler = 8,
+		IdWavetable = 9,
+		IdFmOperator = 10,
+		IdFmStack = 11,
+		IdNoise = 12,
+		IdSampleHold = 13,
+		IdMixer = 14,
+		IdVca = 15,
+		IdCrossfade = 16,
+		IdScaleOffset = 17,
+
+		IdCount,
+		IdInvalid = 0xffff
+	};
+
+	// Find the module with the given ID, returns nullptr if it doesn't exist
+	const ModuleBase * lookup(uint16_t id);
+
+	// Find the ID of a module, returns IdInvalid if it isn't registered.
+	//
+	// Modules are matched by their procedure, since the constexpr ModuleBases get duplicated into every translation unit.
+	uint16_t id_of(const ModuleBase& mod);
+}
@@ -0,0 +1,60 @@
+#include "sampler.h"
+#include "../util.h"
+#include <msynth/fs.h>
+
+void ms::synth::mod::Sampler::start(const Cfg& cfg) {
+	started = true;
+	index = fraction = 0;
+	data = nullptr;
+	length = 0;
+
+	if (stream) {
+		stream::release(stream);
+		stream = {};
+	}
+
+	switch (cfg.source) {
+		case Cfg::SourceFs:
+			if (const fs::File * file = fs::get(cfg.path); file) {
+				data = static_cast<const int16_t *>(fs::open(*file));
+				length = (*file)->length / 2;
+			}
+			break;
+		case Cfg::SourceSd:
+			stream = stream::acquire(cfg.sd_sector, cfg.sd_length);
+			if (stream) length = cfg.sd_length;
+			break;
+	}
+}
+
+bool ms::synth::mod::Sampler::generate(const Cfg& cfg) {
+	if (!started || on_time < last_on_time) start(cfg);
+	last_on_time = on_time;
+
+	output = 0.f;
+	if (index >= length) return true;
+
+	const int16_t *samples = data ? data + index : stream.at(index);
+	// Only streams miss; wait for the data instead of skipping past it
+	if (!samples) return true;
+
+	// Interpolate with the next sample, except at the very end
+	float a = samples[0], b = index + 1 < length ? samples[1] : 0.f;
+	float t = static_cast<float>(fraction >> 16) * (1.f / 65536.f);
+	output = (a + (b - a) * t) * (amplitude / 32768.f);
+
+	// Advance by frequency / root_frequency, adjusted for the sample's rate
+	float step = frequency / cfg.root_frequency * (cfg.sample_rate / sample_rate);
+	uint32_t step_int = static_cast<uint32_t>(step);
+	uint32_t step_fraction = static_cast<uint32_t>((step - step_int) * 2147483648.f) << 1;
+
+	uint32_t previous = fraction;
+	fraction += step_fraction;
+	index += step_int + (fraction < previous);
+
+	if (index >= length && cfg.loop && data && cfg.loop_start < length) {
+		index = cfg.loop_start + (index - length) % (length - cfg.loop_start);
+	}
+
+	return true;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "../module.h"
+#include "../stream.h"
+
+// Sample playback
+//
+// Plays mono int16 PCM, pitched relative to the sample's root frequency by the note frequency and linearly interpolated.
+// Samples come from either:
+// 	- a file in the flash fs, which is played in place (nothing is copied into RAM), or
+// 	- raw sectors on the SD card, streamed through the pool in stream.h. These can't loop.
+//
+// The sample restarts whenever the note on time goes backwards, i.e. when the voice is (re)triggered. Streamed samples hold their
+// position (outputting silence) until the data is there, both while the stream is first filling and if it falls behind, so
+// notes start from the top and the read position never gets ahead of what the ring can hold.
+
+namespace ms::synth::mod {
+	struct Sampler {
+		struct Cfg {
+			enum Source : uint8_t {
+				SourceFs,
+				SourceSd
+			} source;
+			bool loop;
+			uint16_t reserved;
+
+			// Frequency the sample plays at unpitched, and its sample rate
+			float root_frequency, sample_rate;
+
+			// SourceSd: location and length (in samples)
+			uint32_t sd_sector, sd_length;
+			// Loop back to here when looping (in samples)
+			uint32_t loop_start;
+
+			// SourceFs: path of the sample
+			char path[32];
+		};
+
+		float frequency, amplitude, on_time;
+		float output;
+
+		bool generate(const Cfg& cfg);
+
+	private:
+		void start(const Cfg& cfg);
+
+		float last_on_time = 0.f;
+		bool started = false;
+
+		const int16_t * data = nullptr;
+		stream::Handle stream{};
+		uint32_t length = 0;
+
+		// Position as 32.32 fixed point
+		uint32_t index = 0, fraction = 0;
+	};
+
+	constexpr auto SamplerInputs = make_inputs(
+		make_input(predef::AutoFrequency, &Sampler::frequency),
+		make_input("amplitude", &Sampler::amplitude, 0.f, 1.f),
+		make_input(predef::AutoOnTime, &Sampler::on_time)
+	);
+
+	constexpr auto SamplerOutputs = make_outputs(
+		make_output("", &Sampler::output)
+	);
+
+	constexpr auto SamplerModule = make_module<Sampler>(
+		"sampler",
+		SamplerInputs,
+		SamplerOutputs
+	);
+}
@@ -56,12 +56,9 @@ bool ms::synth::mod::SawWave::generate(const Cfg& config) {
 }
 
 bool ms::synth::mod::SinWave::generate(const Cfg& config) {
-	if (curr_time == 0.f) incstate = 0.f;
-	incstate += (frequency/44100.f);
-	if (incstate > 1.f) {
-		incstate -= 1.f;
-	}
-	output = wavesin(incstate);
+	if (curr_time == 0.f) phase = 0;
+	phase += phase_increment(frequency); // wraps naturally
+	output = wavesin_phase(phase);
 
 	if (config.rectified) {
 		output = fabsf(output);
@@ -69,7 +69,7 @@ namespace ms::synth::mod {
 
 		bool generate(const Cfg& config);
 	private:
-		float incstate;
+		uint32_t phase;
 	};
 
 	static constexpr auto SqwInputs = make_inputs(
@@ -0,0 +1,66 @@
+#include "wavetable.h"
+#include "../util.h"
+#include <msynth/fs.h>
+#include <bit>
+
+const int16_t * ms::synth::mod::wavetable::Header::level_data(uint8_t level) const {
+	const int16_t *data = reinterpret_cast<const int16_t *>(this + 1);
+	for (uint8_t i = 0; i < level; ++i) data += frame_count << level_bits(i);
+	return data;
+}
+
+bool ms::synth::mod::Wavetable::generate(const Cfg& cfg) {
+	output = dc_offset;
+
+	// Don't look a missing table up again every sample, only when the note is played again
+	if (on_time < last_on_time) missing = false;
+	last_on_time = on_time;
+
+	if (!table) {
+		if (missing) return true;
+		table = static_cast<const wavetable::Header *>(fs::open(cfg.path));
+		if (!table || !table->ok() || !table->frame_count || !table->level_count) {
+			table = nullptr;
+			missing = true;
+			return true;
+		}
+		level = nullptr;
+	}
+
+	const uint32_t increment = phase_increment(frequency);
+
+	// Pick the first level whose frames are small enough that we step through them at most one sample at a time
+	uint32_t step = (static_cast<int32_t>(increment) < 0 ? -increment : increment) >> (32 - table->frame_bits);
+	uint8_t wanted = std::bit_width(step);
+	if (wanted >= table->level_count) wanted = table->level_count - 1;
+	if (!level || wanted != level_index) {
+		level_index = wanted;
+		level = table->level_data(wanted);
+	}
+
+	const uint8_t bits = table->level_bits(level_index);
+	const uint32_t mask = (1u << bits) - 1;
+	const uint32_t index = phase >> (32 - bits);
+	const uint32_t next = (index + 1) & mask;
+	const float t = static_cast<float>((phase << bits) >> 16) * (1.f / 65536.f);
+
+	// Morph between two neighbouring frames
+	float position = morph * (table->frame_count - 1);
+	if (position < 0.f) position = 0.f;
+	uint32_t frame = static_cast<uint32_t>(position);
+	if (frame >= table->frame_count - 1u) frame = table->frame_count - 1u;
+	const float blend = position - frame;
+
+	const int16_t *a = level + (frame << bits);
+	float sample = a[index] + (a[next] - a[index]) * t;
+	if (blend > 0.f && frame + 1u < table->frame_count) {
+		const int16_t *b = a + (1u << bits);
+		float sample_b = b[index] + (b[next] - b[index]) * t;
+		sample += (sample_b - sample) * blend;
+	}
+
+	output += sample * (amplitude / 32768.f);
+	phase += increment;
+
+	return true;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "../module.h"
+
+// Wavetable oscillator
+//
+// Plays tables straight out of the flash fs (in the MSwt format, made with bmap/wavtbl.py). A table has one or more frames
+// (single cycles), which the morph input crossfades between, and a set of band-limited mip levels: level n only has the harmonics
+// that stay under nyquist for notes up to sample_rate / (frame_size >> n), and the right one is picked from the frequency every sample.
+
+namespace ms::synth::mod {
+	namespace wavetable {
+		struct Header {
+			char magic[4];
+			uint8_t frame_bits;    // log2 of the level 0 frame size
+			uint8_t frame_count;
+			uint8_t level_count;
+			uint8_t min_bits;      // levels never get smaller than 2^min_bits samples
+
+			bool ok() const {
+				return magic[0] == 'M' && magic[1] == 'S' && magic[2] == 'w' && magic[3] == 't';
+			}
+
+			// log2 of the size of each frame in level
+			uint8_t level_bits(uint8_t level) const {
+				return frame_bits - level > min_bits ? frame_bits - level : min_bits;
+			}
+
+			// Start of the frames for level (they follow the header one after the other, level 0 first)
+			const int16_t * level_data(uint8_t level) const;
+		};
+	}
+
+	struct Wavetable {
+		struct Cfg {
+			char path[32];
+		};
+
+		float frequency, amplitude, morph, dc_offset, on_time;
+		float output;
+
+		bool generate(const Cfg& cfg);
+
+	private:
+		uint32_t phase = 0;
+
+		const wavetable::Header * table = nullptr;
+		// The table couldn't be opened; not looked for again until the voice is retriggered
+		bool missing = false;
+		float last_on_time = 0.f;
+		// The level the last sample played from
+		const int16_t * level = nullptr;
+		uint8_t level_index = 0;
+	};
+
+	constexpr auto WavetableInputs = make_inputs(
+		make_input(predef::AutoFrequency, &Wavetable::frequency),
+		make_input("amplitude", &Wavetable::amplitude, 0.f, 1.f),
+		make_input("morph", &Wavetable::morph, 0.f, 1.f),
+		make_input("dc_offset", &Wavetable::dc_offset),
+		make_input(predef::AutoOnTime, &Wavetable::on_time)
+	);
+
+	constexpr auto WavetableOutputs = make_outputs(
+		make_output("", &Wavetable::output)
+	);
+
+	constexpr auto WavetableModule = make_module<Wavetable>(
+		"wavetable",
+		WavetableInputs,
+		WavetableOutputs
+	);
+}
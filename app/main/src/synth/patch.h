@@ -17,8 +17,8 @@ namespace ms::synth {
 		struct ModuleHolder;
 	
 		// TODO: this should probably be scaled for potential multi-channel synths
-		const ModuleHolder *output_source;
-		uint16_t            output_idx;
+		const ModuleHolder *output_source = nullptr;
+		uint16_t            output_idx = 0;
 	private:
 		std::vector<std::unique_ptr<ModuleHolder>> modules;
 
@@ -42,15 +42,27 @@ namespace ms::synth {
 			ModuleHolder(const ModuleBase& mod) :
 				mod(&mod) {
 
-				configuration.reset(new uint32_t[(mod.cfg_size + 3) / 4]);
-				dynamic_configuration.reset(new uint32_t[(mod.dyncfg_size + 3) / 4]);
+				owned_configuration.reset(new uint32_t[(mod.cfg_size + 3) / 4]);
+				owned_dynamic_configuration.reset(new uint32_t[(mod.dyncfg_size + 3) / 4]);
+				configuration = owned_configuration.get();
+				dynamic_configuration = owned_dynamic_configuration.get();
 			}
 
 			ModuleHolder(const ModuleBase& mod, const void * config, const void * dynamic_config) :
 				ModuleHolder(mod) {
 
-				memcpy(configuration.get(), config, mod.cfg_size);
-				memcpy(dynamic_configuration.get(), dynamic_config, mod.dyncfg_size);
+				memcpy(owned_configuration.get(), config, mod.cfg_size);
+				memcpy(owned_dynamic_configuration.get(), dynamic_config, mod.dyncfg_size);
+			}
+
+			// Create a holder which refers to configuration blobs stored elsewhere (usually a serialized patch mapped straight
+			// out of flash) instead of copying them. Both blobs must stay valid for as long as this holder and any Program made from it.
+			static std::unique_ptr<ModuleHolder> borrowed(const ModuleBase& mod, const void * config, const void * dynamic_config) {
+				std::unique_ptr<ModuleHolder> holder{new ModuleHolder};
+				holder->mod = &mod;
+				holder->configuration = config;
+				holder->dynamic_configuration = dynamic_config;
+				return holder;
 			}
 
 			// no constructor provided for initializing links since usually you need to init every single module before
@@ -58,9 +70,17 @@ namespace ms::synth {
 
 			inline const auto&  get_links() const {return links;}
 
-			std::unique_ptr<uint32_t[]> configuration;
-			std::unique_ptr<uint32_t[]> dynamic_configuration;
+			// Is the configuration stored in this holder (as opposed to borrowed from somewhere else)
+			inline bool owns_configuration() const {return owned_configuration != nullptr;}
+
+			// Either point into the owned storage below or at borrowed memory
+			const void * configuration = nullptr;
+			const void * dynamic_configuration = nullptr;
 		private:
+			ModuleHolder() = default;
+
+			std::unique_ptr<uint32_t[]> owned_configuration;
+			std::unique_ptr<uint32_t[]> owned_dynamic_configuration;
 			std::vector<ModuleLink>     links;
 		};
 
@@ -6,5 +6,8 @@
 namespace ms::synth::playback {
 	struct AudioGenerator {
 		virtual int16_t generate();
+		// Called from the audio interrupt before each block of generate() calls; anything that has to change atomically
+		// with respect to the output (e.g. swapping programs) should happen here.
+		virtual void begin_block() {}
 	};
 }
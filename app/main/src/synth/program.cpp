@@ -1,5 +1,6 @@
 #include "program.h"
 #include "jit.h"
+#include "modules/math.h"
 #include <algorithm>
 
 #include <stdio.h>
@@ -56,6 +57,10 @@ namespace {
 		return false;
 	}
 
+	bool fusable(const ms::synth::ModuleBase& mod) {
+		return !mod.inline_body && ms::synth::mod::fused::fusable(mod);
+	}
+
 	template<typename Func>
 	void add_offset_pool_entries(std::vector<uintptr_t>& into, const std::vector<const ms::synth::Patch::ModuleHolder *>& from, Func&& predicate) {
 		size_t offset = 0;
@@ -131,7 +136,7 @@ void dump_patch(const ms::synth::Patch &patch) {
 		puts("---");
 		printf("module at %p\n", mod.get());
 		dump_mod(mod->mod);
-		printf("cfg %p; dyncfg_base %p\n", mod->configuration.get(), mod->dynamic_configuration.get());
+		printf("cfg %p; dyncfg_base %p\n", mod->configuration, mod->dynamic_configuration);
 		for (const auto& link : mod->get_links()) {
 			printf("links %p output %d to input %d\n", link.source, link.source_idx, link.target_idx);
 		}
@@ -146,8 +151,10 @@ ms::synth::Program::Program(const ms::synth::Patch& patch) {
 	std::vector<jit::PsuedoInstruction>      pinsns;
 	ordered_copy.reserve(patch.all_modules().size());
 
+#ifdef MSYNTH_DEBUG_PROGRAM
 	puts("creating program of");
 	dump_patch(patch);
+#endif
 
 	size_t dyncfg_total_size = 0;
 	for (const auto& x : patch.all_modules()) {
@@ -159,7 +166,9 @@ ms::synth::Program::Program(const ms::synth::Patch& patch) {
 	}
 
 	dyncfg_original_len = dyncfg_total_size;
+#ifdef MSYNTH_DEBUG_PROGRAM
 	printf("got total dyncfg blob len %d\n", dyncfg_total_size);
+#endif
 
 	// Sort them:
 	// 	Predicate is operator<, returns true if A is before B. A is strictly before B if A is anywhere in the input chain of B.
@@ -167,8 +176,10 @@ ms::synth::Program::Program(const ms::synth::Patch& patch) {
 		return is_in_input_list(b, a);
 	});
 
+#ifdef MSYNTH_DEBUG_PROGRAM
 	puts("order:");
 	for (const auto& x : ordered_copy) printf("-- %p\n", x);
+#endif
 
 	// Alright, we now have a workable order of the modules.
 	//
@@ -178,13 +189,73 @@ ms::synth::Program::Program(const ms::synth::Patch& patch) {
 	
 	// Now, we initialize the dyncfg with the values from the Patch. Linking the outputs is performed during psuedoinstruction generation
 	for (uint8_t *i = reinterpret_cast<uint8_t *>(this->dyncfg_original.get()); const auto& x : ordered_copy) {
-		printf("copying to %p from %p\n", i, x->dynamic_configuration.get());
-		memcpy(i, x->dynamic_configuration.get(), x->mod->dyncfg_size);
+#ifdef MSYNTH_DEBUG_PROGRAM
+		printf("copying to %p from %p\n", i, x->dynamic_configuration);
+#endif
+		memcpy(i, x->dynamic_configuration, x->mod->dyncfg_size);
 		i += x->mod->dyncfg_size;
 		if (x->mod->dyncfg_size % 4)
 			i += 4 - (x->mod->dyncfg_size % 4);
 	}
 
+	// Work out where each module's dyncfg ends up and find runs of math modules to fuse. Modules with an inline template are
+	// left out, since the JIT inlines those which is better still.
+	//
+	// A fused run is replaced by a single call to mod::fused::run with the dyncfg of its first module, so the links between
+	// modules inside the run become part of the op list instead of CopyFloat instructions. Everything else (the result pointer,
+	// copies out of the run and the dyncfg advances) is emitted exactly as if the modules were separate.
+	std::vector<uint16_t> dyncfg_offset_of(ordered_copy.size());
+	std::vector<int16_t>  group_of(ordered_copy.size(), -1);
+	std::vector<size_t>   group_start, group_ops;
+	for (size_t i = 0, offset = 0; i < ordered_copy.size(); ++i) {
+		dyncfg_offset_of[i] = offset;
+		offset += ordered_copy[i]->mod->dyncfg_size;
+		if (offset % 4)
+			offset += 4 - (offset % 4);
+
+		if (!fusable(*ordered_copy[i]->mod)) continue;
+		if (i && group_of[i - 1] != -1) group_of[i] = group_of[i - 1];
+		else if (i + 1 < ordered_copy.size() && fusable(*ordered_copy[i + 1]->mod)) {
+			group_of[i] = group_start.size();
+			group_start.push_back(i);
+		}
+	}
+
+	// Build all the op lists up front, since the program refers to them by address.
+	for (size_t group = 0; group < group_start.size(); ++group) {
+		size_t first = group_start[group], count_at = fused_ops.size();
+		group_ops.push_back(count_at);
+		fused_ops.push_back(0);
+
+		for (size_t i = first; i < ordered_copy.size() && group_of[i] == (int16_t)group; ++i) {
+			const auto *x = ordered_copy[i];
+			std::vector<uint32_t> copies;
+			for (size_t j = i + 1; j < ordered_copy.size() && group_of[j] == (int16_t)group; ++j) {
+				for (const auto& link : ordered_copy[j]->get_links()) {
+					if (link.source != x) continue;
+					uint32_t source = dyncfg_offset_of[i] - dyncfg_offset_of[first] + x->mod->outputs[link.source_idx].offset;
+					uint32_t target = dyncfg_offset_of[j] - dyncfg_offset_of[first] + ordered_copy[j]->mod->inputs[link.target_idx].offset;
+					copies.push_back(source | (target << 16));
+				}
+			}
+
+			mod::fused::append(fused_ops, *x->mod, x->configuration, dyncfg_offset_of[i] - dyncfg_offset_of[first], copies);
+			++fused_ops[count_at];
+		}
+	}
+
+#ifdef MSYNTH_DEBUG_PROGRAM
+	for (size_t group = 0; group < group_start.size(); ++group)
+		printf("fused %d modules starting at %d\n", fused_ops[group_ops[group]], group_start[group]);
+#endif
+
+	// What each LoadConfig/RunModule refers to, for the relocations: a module index or an offset into fused_ops
+	struct Owner {
+		bool fused;
+		uint16_t index;
+	};
+	std::vector<Owner> owner_of_pinsn;
+
 	// Keep track of the state of the MJIT
 	uint8_t *dyncfg_for_x = (uint8_t *)this->dyncfg_original.get();
 	size_t   mod_index = 0;
@@ -199,14 +270,30 @@ ms::synth::Program::Program(const ms::synth::Patch& patch) {
 	// 	- Copy (optional/multiple)
 	// 	- AdvanceDynConfig (if not end)
 	for (const auto& x : ordered_copy) {
-		// Load the config
-		insn.opcode = jit::PsuedoInstruction::OpcodeLoadConfig;
-		insn.config_location = x->configuration.get();
-		pinsns.push_back(insn);
-		// Run the module
-		insn.opcode = jit::PsuedoInstruction::OpcodeRunModule;
-		insn.proc   = x->mod->proc;
-		pinsns.push_back(insn);
+		int16_t group = group_of[mod_index];
+		if (group == -1 || group_start[group] == mod_index) {
+			const auto& all = patch.all_modules();
+			Owner owner = group == -1 ?
+				Owner{false, (uint16_t)(std::find_if(all.begin(), all.end(), [&](const auto& holder){return holder.get() == x;}) - all.begin())} :
+				Owner{true, (uint16_t)group_ops[group]};
+
+			// Load the config
+			insn.opcode = jit::PsuedoInstruction::OpcodeLoadConfig;
+			insn.config_location = group == -1 ? x->configuration : fused_ops.data() + group_ops[group];
+			pinsns.push_back(insn);
+			owner_of_pinsn.resize(pinsns.size(), owner);
+			// Run the module
+			if (group == -1 && x->mod->inline_body) {
+				insn.opcode = jit::PsuedoInstruction::OpcodeInlineModule;
+				insn.body   = x->mod->inline_body;
+			}
+			else {
+				insn.opcode = jit::PsuedoInstruction::OpcodeRunModule;
+				insn.proc   = group == -1 ? x->mod->proc : mod::fused::run;
+			}
+			pinsns.push_back(insn);
+			owner_of_pinsn.resize(pinsns.size(), owner);
+		}
 		// Clear output enables
 		for (size_t i = 0; i < x->mod->output_count; ++i) {
 			const auto& output = x->mod->outputs[i];
@@ -236,6 +323,9 @@ ms::synth::Program::Program(const ms::synth::Patch& patch) {
 			// Check if this module points to here
 			for (const auto& link : ordered_copy[i]->get_links()) {
 				if (link.source == x) {
+					// Copies inside a fused run are done by the op list
+					bool internal = group != -1 && group_of[i] == group;
+
 					const auto& output = x->mod->outputs[link.source_idx];
 					const auto& input  = ordered_copy[i]->mod->inputs[link.target_idx];
 
@@ -247,6 +337,8 @@ ms::synth::Program::Program(const ms::synth::Patch& patch) {
 					if (output.offset_max != -1)
 						*(float *)(dyncfg_for_x + output.offset_max) = input.max;
 
+					if (internal) continue;
+
 					// Emit a copy instruction
 					insn.opcode = jit::PsuedoInstruction::OpcodeCopyFloat;
 					insn.source_offset = output.offset;
@@ -294,17 +386,152 @@ ms::synth::Program::Program(const ms::synth::Patch& patch) {
 	});
 
 	// Run JIT
-	jit::assemble(compiled_procedure, pinsns);
+	std::vector<jit::LiteralRelocation> literals;
+	jit::assemble(compiled_procedure, pinsns, &literals);
+
+	// Convert the literal locations into relocations against the patch (or the fused op lists)
+	relocations.reserve(literals.size());
+	for (const auto& literal : literals) {
+		const auto& owner = owner_of_pinsn[literal.instruction];
+		bool config = pinsns[literal.instruction].opcode == jit::PsuedoInstruction::OpcodeLoadConfig;
+
+		cache::Relocation reloc{};
+		if (owner.fused)
+			reloc.kind = config ? cache::Relocation::KindFusedOps : cache::Relocation::KindFusedProc;
+		else
+			reloc.kind = config ? cache::Relocation::KindConfigPointer : cache::Relocation::KindModuleProc;
+		reloc.position = literal.position;
+		reloc.module_index = owner.index;
+		relocations.push_back(reloc);
+	}
 
-	// Report memory stats
+	// Compact procedure
+#ifdef MSYNTH_DEBUG_PROGRAM
 	puts("--- memusage --");
 	printf("procedure: %d insns = %d bytes in a %d capactity.\n", compiled_procedure.size(), compiled_procedure.size() * 2, compiled_procedure.capacity() * 2);
-	// Compact procedure
+#endif
 	compiled_procedure.shrink_to_fit();
+#ifdef MSYNTH_DEBUG_PROGRAM
 	printf("after shrink, now using %d bytes\n", compiled_procedure.capacity() * 2);
 	puts(" --");
 	printf("offset pool is using %d bytes\n", offset_pool.capacity() * 4);
 	puts("--- end ---");
+#endif
+}
+
+namespace {
+	inline size_t pad4(size_t size) {
+		return (size + 3) & ~size_t(3);
+	}
+}
+
+size_t ms::synth::Program::cache_size() const {
+	return sizeof(cache::CacheHeader) + pad4(compiled_procedure.size() * 2) + relocations.size() * sizeof(cache::Relocation) +
+		offset_pool.size() * 4 + fused_ops.size() * 4 + dyncfg_original_len;
+}
+
+size_t ms::synth::Program::save_cache(uint32_t patch_hash, void * buffer, size_t length) const {
+	size_t total = cache_size();
+	if (total > length) return 0;
+
+	uint8_t *cursor = static_cast<uint8_t *>(buffer);
+	memset(cursor, 0, total);
+
+	auto *header = reinterpret_cast<cache::CacheHeader *>(cursor);
+	memcpy(header->magic, "MSpc", 4);
+	header->build_id = cache::build_id();
+	header->patch_hash = patch_hash;
+	header->length = total;
+	header->procedure_length = compiled_procedure.size();
+	header->relocation_count = relocations.size();
+	header->offset_pool_length = offset_pool.size();
+	header->fused_length = fused_ops.size();
+	header->dyncfg_length = dyncfg_original_len;
+	header->pitch_end = pitch_end;
+	header->velocity_end = velocity_end;
+	header->time_end = time_end;
+	cursor += sizeof(cache::CacheHeader);
+
+	memcpy(cursor, compiled_procedure.data(), compiled_procedure.size() * 2);
+	cursor += pad4(compiled_procedure.size() * 2);
+	memcpy(cursor, relocations.data(), relocations.size() * sizeof(cache::Relocation));
+	cursor += relocations.size() * sizeof(cache::Relocation);
+	for (uintptr_t offset : offset_pool) {
+		uint32_t word = offset;
+		memcpy(cursor, &word, 4);
+		cursor += 4;
+	}
+	memcpy(cursor, fused_ops.data(), fused_ops.size() * 4);
+	cursor += fused_ops.size() * 4;
+	memcpy(cursor, dyncfg_original.get(), dyncfg_original_len);
+
+	return total;
+}
+
+std::unique_ptr<ms::synth::Program> ms::synth::Program::from_cache(const Patch& patch, uint32_t patch_hash, const void * blob, size_t length) {
+	const auto *header = static_cast<const cache::CacheHeader *>(blob);
+	if (length < sizeof(cache::CacheHeader) || !header->ok() || header->length > length) return nullptr;
+	if (header->build_id != cache::build_id() || header->patch_hash != patch_hash) return nullptr;
+
+	const uint8_t *cursor = static_cast<const uint8_t *>(blob) + sizeof(cache::CacheHeader);
+	const auto *procedure = reinterpret_cast<const uint16_t *>(cursor);
+	cursor += pad4(header->procedure_length * 2);
+	const auto *relocs = reinterpret_cast<const cache::Relocation *>(cursor);
+	cursor += header->relocation_count * sizeof(cache::Relocation);
+	const auto *offsets = reinterpret_cast<const uint32_t *>(cursor);
+	cursor += header->offset_pool_length * 4;
+	const auto *fused = reinterpret_cast<const uint32_t *>(cursor);
+	cursor += header->fused_length * 4;
+	const uint8_t *dyncfg = cursor;
+	if (cursor + header->dyncfg_length > static_cast<const uint8_t *>(blob) + header->length) return nullptr;
+
+	std::unique_ptr<Program> program{new Program};
+
+	// The procedure only has to keep its alignment mod 4 (see jit::assemble), which a fresh vector always has.
+	program->compiled_procedure.assign(procedure, procedure + header->procedure_length);
+	// The op lists are referenced by address, so they have to be in place before relocating
+	program->fused_ops.assign(fused, fused + header->fused_length);
+	for (uint16_t i = 0; i < header->relocation_count; ++i) {
+		const auto& reloc = relocs[i];
+		if (reloc.position + 1u >= header->procedure_length) return nullptr;
+
+		uint32_t value;
+		switch (reloc.kind) {
+			case cache::Relocation::KindConfigPointer:
+			case cache::Relocation::KindModuleProc:
+				{
+					if (reloc.module_index >= patch.all_modules().size()) return nullptr;
+					const auto& holder = patch.all_modules()[reloc.module_index];
+					value = reloc.kind == cache::Relocation::KindConfigPointer ?
+						reinterpret_cast<uint32_t>(holder->configuration) : (reinterpret_cast<uint32_t>(holder->mod->proc) | 1);
+				}
+				break;
+			case cache::Relocation::KindFusedOps:
+				if (reloc.module_index >= header->fused_length) return nullptr;
+				value = reinterpret_cast<uint32_t>(program->fused_ops.data() + reloc.module_index);
+				break;
+			case cache::Relocation::KindFusedProc:
+				value = reinterpret_cast<uint32_t>(mod::fused::run) | 1;
+				break;
+			default:
+				return nullptr;
+		}
+
+		program->compiled_procedure[reloc.position] = value & 0xffff;
+		program->compiled_procedure[reloc.position + 1] = value >> 16;
+	}
+	program->relocations.assign(relocs, relocs + header->relocation_count);
+
+	program->offset_pool.assign(offsets, offsets + header->offset_pool_length);
+	program->pitch_end = header->pitch_end;
+	program->velocity_end = header->velocity_end;
+	program->time_end = header->time_end;
+
+	program->dyncfg_original_len = header->dyncfg_length;
+	program->dyncfg_original.reset(new uint32_t[(header->dyncfg_length + 3) / 4]);
+	memcpy(program->dyncfg_original.get(), dyncfg, header->dyncfg_length);
+
+	return program;
 }
 
 ms::synth::Voice * ms::synth::Program::new_voice() {
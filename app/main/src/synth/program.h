@@ -18,6 +18,7 @@
 #include <stdint.h>
 #include <vector>
 #include "patch.h"
+#include "cache.h"
 
 namespace ms::synth {
 	struct Program;
@@ -53,6 +54,7 @@ namespace ms::synth {
 		const float& pitch() {return original_pitch;}
 		const float& held_time() {return on_time;}
 		const float& released_time() {return off_time;}
+		const Program& source() const {return program;}
 
 	private:
 		const Program& program;
@@ -79,7 +81,21 @@ namespace ms::synth {
 		// 
 		// This constructor does allocate quite a lot of temporary stuff in addition to the 
 		Program(const Patch& patch);
+
+		// Load a program compiled earlier from the same patch (see cache.h), skipping the linker and JIT.
+		//
+		// patch_hash is the hash of the patch's serialized form. Returns nullptr if the cache is for a different patch or firmware,
+		// in which case the program should just be compiled normally.
+		static std::unique_ptr<Program> from_cache(const Patch& patch, uint32_t patch_hash, const void * blob, size_t length);
+
+		// Number of bytes save_cache() needs
+		size_t cache_size() const;
+
+		// Save this program's compiled form into buffer, returning the number of bytes written (or 0 if the buffer is too small)
+		size_t save_cache(uint32_t patch_hash, void * buffer, size_t length) const;
 	private:
+		Program() = default;
+
 		// TODO: check if there's a better datatype to use here? in terms of size/speed/etc.
 
 		// Offsets that set_pitch and friends need
@@ -98,6 +114,13 @@ namespace ms::synth {
 
 		// size of assembled dyncfg
 		size_t dyncfg_original_len;
+
+		// Where the position-dependent literals in compiled_procedure are, for saving to the cache
+		std::vector<cache::Relocation> relocations;
+
+		// Op lists for runs of math modules fused into one call (see modules/math.h). The procedure points into this, so it
+		// must not be resized after linking.
+		std::vector<uint32_t> fused_ops;
 		
 		bool generate(float *out, void *dyncfg_blob) const;
 		void set_pitch(float pitch, void *dyncfg_blob) const;
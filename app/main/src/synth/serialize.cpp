@@ -0,0 +1,140 @@
+#include "serialize.h"
+#include "modules/registry.h"
+
+#include <string.h>
+
+namespace ms::synth::serialize {
+	namespace {
+		inline size_t pad4(size_t size) {
+			return (size + 3) & ~size_t(3);
+		}
+
+		size_t record_size(const Patch::ModuleHolder& holder) {
+			return sizeof(ModuleRecord) + pad4(holder.mod->cfg_size) + pad4(holder.mod->dyncfg_size) + holder.get_links().size() * sizeof(LinkRecord);
+		}
+
+		uint16_t index_of(const Patch& patch, const Patch::ModuleHolder *holder) {
+			if (holder == predef::ModuleRefGlobalIn) return ModuleIndexGlobalIn;
+			for (uint16_t i = 0; i < patch.all_modules().size(); ++i) {
+				if (patch.all_modules()[i].get() == holder) return i;
+			}
+			return ModuleIndexNone;
+		}
+	}
+
+	load_status load(Patch& into, const void * blob, size_t length) {
+		const auto *header = static_cast<const PatchHeader *>(blob);
+		if (length < sizeof(PatchHeader) || !header->ok() || header->version != Version || header->length > length)
+			return load_status::BadHeader;
+
+		const uint8_t *begin = static_cast<const uint8_t *>(blob);
+		const uint8_t *end   = begin + header->length;
+
+		// Modules have to exist before anything can link to them, so this walks the records twice: once to create all
+		// the holders and once to link them up.
+		const uint8_t *cursor = begin + sizeof(PatchHeader);
+		for (uint16_t i = 0; i < header->module_count; ++i) {
+			if (cursor + sizeof(ModuleRecord) > end) return load_status::Truncated;
+			const auto *record = reinterpret_cast<const ModuleRecord *>(cursor);
+
+			const ModuleBase *mod = mod::lookup(record->module_id);
+			if (mod == nullptr) return load_status::UnknownModule;
+			if (mod->cfg_size != record->cfg_size || mod->dyncfg_size != record->dyncfg_size) return load_status::SizeMismatch;
+
+			cursor += sizeof(ModuleRecord);
+			const uint8_t *cfg = cursor;
+			cursor += pad4(record->cfg_size);
+			const uint8_t *dyncfg = cursor;
+			cursor += pad4(record->dyncfg_size) + record->link_count * sizeof(LinkRecord);
+			if (cursor > end) return load_status::Truncated;
+
+			into.add_module(Patch::ModuleHolder::borrowed(*mod, cfg, dyncfg));
+		}
+
+		const auto& holders = into.all_modules();
+		cursor = begin + sizeof(PatchHeader);
+		for (uint16_t i = 0; i < header->module_count; ++i) {
+			const auto *record = reinterpret_cast<const ModuleRecord *>(cursor);
+			const auto *links  = reinterpret_cast<const LinkRecord *>(cursor + sizeof(ModuleRecord) + pad4(record->cfg_size) + pad4(record->dyncfg_size));
+			const auto *target = holders[i].get();
+
+			for (uint16_t j = 0; j < record->link_count; ++j) {
+				const auto& link = links[j];
+				if (link.target_idx >= target->mod->input_count) return load_status::BadLink;
+
+				const Patch::ModuleHolder *source;
+				if (link.source_module == ModuleIndexGlobalIn) {
+					if (link.source_idx > predef::GlobalInOffTimeIdx) return load_status::BadLink;
+					source = predef::ModuleRefGlobalIn;
+				}
+				else if (link.source_module < header->module_count) {
+					source = holders[link.source_module].get();
+					if (link.source_idx >= source->mod->output_count) return load_status::BadLink;
+				}
+				else return load_status::BadLink;
+
+				into.link_modules(source, target, link.source_idx, link.target_idx);
+			}
+
+			cursor = reinterpret_cast<const uint8_t *>(links + record->link_count);
+		}
+
+		if (header->output_module != ModuleIndexNone) {
+			if (header->output_module >= header->module_count) return load_status::BadLink;
+			const auto *source = holders[header->output_module].get();
+			if (header->output_idx >= source->mod->output_count) return load_status::BadLink;
+
+			into.link_modules(source, predef::ModuleRefGlobalOut, header->output_idx, 0);
+		}
+
+		return load_status::Ok;
+	}
+
+	size_t serialized_size(const Patch& patch) {
+		size_t total = sizeof(PatchHeader);
+		for (const auto& holder : patch.all_modules()) total += record_size(*holder);
+		return total;
+	}
+
+	size_t serialize(const Patch& patch, void * buffer, size_t length) {
+		size_t total = serialized_size(patch);
+		if (total > length) return 0;
+
+		uint8_t *cursor = static_cast<uint8_t *>(buffer);
+		memset(cursor, 0, total);
+
+		auto *header = reinterpret_cast<PatchHeader *>(cursor);
+		memcpy(header->magic, "MSpt", 4);
+		header->version = Version;
+		header->module_count = patch.all_modules().size();
+		header->output_module = patch.output_source ? index_of(patch, patch.output_source) : ModuleIndexNone;
+		header->output_idx = patch.output_idx;
+		header->length = total;
+		cursor += sizeof(PatchHeader);
+
+		for (const auto& holder : patch.all_modules()) {
+			auto *record = reinterpret_cast<ModuleRecord *>(cursor);
+			record->module_id = mod::id_of(*holder->mod);
+			if (record->module_id == mod::IdInvalid) return 0;
+			record->link_count = holder->get_links().size();
+			record->cfg_size = holder->mod->cfg_size;
+			record->dyncfg_size = holder->mod->dyncfg_size;
+			cursor += sizeof(ModuleRecord);
+
+			memcpy(cursor, holder->configuration, holder->mod->cfg_size);
+			cursor += pad4(holder->mod->cfg_size);
+			memcpy(cursor, holder->dynamic_configuration, holder->mod->dyncfg_size);
+			cursor += pad4(holder->mod->dyncfg_size);
+
+			for (const auto& link : holder->get_links()) {
+				auto *link_record = reinterpret_cast<LinkRecord *>(cursor);
+				link_record->target_idx = link.target_idx;
+				link_record->source_idx = link.source_idx;
+				link_record->source_module = index_of(patch, link.source);
+				cursor += sizeof(LinkRecord);
+			}
+		}
+
+		return total;
+	}
+}
@@ -0,0 +1,80 @@
+#pragma once
+// Binary patch format
+//
+// Patches are stored as a single little-endian blob which is designed to be used in place: when loaded, the cfg/dyncfg blobs of
+// every module are referenced directly by the Patch (see ModuleHolder::borrowed) instead of being copied, so a patch stored in the
+// flash filesystem costs no SRAM for its static configuration. Patches read off the SD card work the same way, they just have to
+// be kept around in a RAM buffer.
+//
+// Layout (everything is 4-byte aligned):
+//
+// 	PatchHeader
+// 	for each module:
+// 		ModuleRecord
+// 		cfg blob    (cfg_size bytes, padded to 4)
+// 		dyncfg blob (dyncfg_size bytes, padded to 4)
+// 		LinkRecord[link_count]
+//
+// Modules are referred to by their index in the file; the module types themselves by their ID in the module registry.
+
+#include "patch.h"
+#include <stddef.h>
+#include <stdint.h>
+
+namespace ms::synth::serialize {
+	inline const uint16_t Version = 1;
+
+	// Special module indices
+	inline const uint16_t ModuleIndexGlobalIn = 0xfffe;
+	inline const uint16_t ModuleIndexNone = 0xffff;
+
+	struct PatchHeader {
+		char magic[4];
+		uint16_t version;
+		uint16_t module_count;
+		uint16_t output_module; // module index or ModuleIndexNone
+		uint16_t output_idx;
+		uint32_t length; // of the entire blob, including this header
+
+		bool ok() const {
+			return magic[0] == 'M' && magic[1] == 'S' && magic[2] == 'p' && magic[3] == 't';
+		}
+	};
+
+	struct ModuleRecord {
+		uint16_t module_id;
+		uint16_t link_count;
+		// These are checked against the registered module, to catch patches saved by incompatible firmware
+		uint16_t cfg_size;
+		uint16_t dyncfg_size;
+	};
+
+	struct LinkRecord {
+		uint16_t target_idx, source_idx;
+		uint16_t source_module; // module index or ModuleIndexGlobalIn
+		uint16_t reserved;
+	};
+
+	static_assert(sizeof(PatchHeader) % 4 == 0 && sizeof(ModuleRecord) % 4 == 0 && sizeof(LinkRecord) % 4 == 0, "records must keep 4-byte alignment");
+
+	enum struct load_status {
+		Ok,
+		BadHeader, // Magic, version or length is wrong
+		Truncated, // A record runs past the end of the blob
+		UnknownModule, // The module ID isn't in the registry
+		SizeMismatch, // The cfg/dyncfg sizes don't match this firmware's idea of the module
+		BadLink, // A link refers to a module/input/output that doesn't exist
+	};
+
+	// Load a patch from a blob into an empty patch, without copying any configuration.
+	//
+	// The blob must be 4-byte aligned and outlive the patch (and any Program created from it).
+	load_status load(Patch& into, const void * blob, size_t length);
+
+	// Number of bytes serialize() will need for this patch
+	size_t serialized_size(const Patch& patch);
+
+	// Serialize a patch into buffer, returning the number of bytes written or 0 if the buffer is too small
+	// or the patch contains unregistered modules.
+	size_t serialize(const Patch& patch, void * buffer, size_t length);
+}
@@ -0,0 +1,132 @@
+#include "stream.h"
+#include <string.h>
+
+namespace ms::synth::stream {
+	namespace {
+		// Must be in main SRAM, since it's filled with DMA
+		Stream streams[max_streams];
+
+		volatile bool sd_busy = false;
+		uint32_t reads = 0, read_errors = 0;
+
+		// About 50ms of main loop iterations
+		const uint8_t idle_limit = 50;
+
+		uint32_t last_generation = 0;
+	}
+
+	void Stream::on_read(void *arg, sd::access_status status) {
+		Stream& stream = *static_cast<Stream *>(arg);
+
+		if (status == sd::access_status::Ok) {
+			uint32_t chunk_start = stream.loaded_end;
+			if (chunk_start % ring_samples == 0) stream.ring[ring_samples] = stream.ring[0];
+
+			uint32_t end = chunk_start + chunk_samples;
+			stream.loaded_end = end > stream.length ? stream.length : end;
+		}
+		else ++read_errors;
+
+		stream.reading = false;
+		sd_busy = false;
+	}
+
+	const int16_t * Stream::at(uint32_t index) {
+		touched = true;
+
+		uint32_t end = loaded_end;
+		if (!end) return nullptr;
+		uint32_t needed = index + 1 < length ? index + 2 : index + 1;
+		if (index >= length || needed > end || index + ring_samples < end) {
+			++underruns;
+			return nullptr;
+		}
+
+		consumed = index;
+		return &ring[index % ring_samples];
+	}
+
+	const int16_t * Handle::at(uint32_t index) const {
+		if (!stream || !stream->active || stream->generation != generation) return nullptr;
+		return stream->at(index);
+	}
+
+	Handle acquire(uint32_t sector, uint32_t length) {
+		for (auto& stream : streams) {
+			if (stream.active || stream.reading) continue;
+
+			stream.start_sector = sector;
+			stream.length = length;
+			stream.loaded_end = 0;
+			stream.consumed = 0;
+			stream.underruns = 0;
+			stream.touched = true;
+			stream.idle_passes = 0;
+			// (0 is never used, so a zeroed handle can't match)
+			if (++last_generation == 0) ++last_generation;
+			stream.generation = last_generation;
+			stream.active = true;
+			return {&stream, stream.generation};
+		}
+		return {};
+	}
+
+	void release(const Handle& handle) {
+		if (handle.stream && handle.stream->generation == handle.generation) handle.stream->active = false;
+	}
+
+	void service() {
+		// Reclaim streams nobody reads from anymore
+		for (auto& stream : streams) {
+			if (!stream.active) continue;
+			if (stream.touched) {
+				stream.touched = false;
+				stream.idle_passes = 0;
+			}
+			else if (++stream.idle_passes >= idle_limit) stream.active = false;
+		}
+
+		if (sd_busy || sd::card.status != sd::init_status::Ok) return;
+
+		// Top up whichever stream has the least buffered ahead of its read position
+		Stream *neediest = nullptr;
+		uint32_t least_ahead = UINT32_MAX;
+		for (auto& stream : streams) {
+			if (!stream.active || stream.loaded_end >= stream.length) continue;
+
+			// The chunk about to be loaded can't overwrite the one being played
+			uint32_t next_chunk = stream.loaded_end / chunk_samples;
+			if (next_chunk >= ring_chunks && next_chunk - ring_chunks >= stream.consumed / chunk_samples) continue;
+
+			uint32_t ahead = stream.loaded_end - stream.consumed;
+			if (ahead < least_ahead) {
+				least_ahead = ahead;
+				neediest = &stream;
+			}
+		}
+		if (!neediest) return;
+
+		uint32_t chunk = neediest->loaded_end / chunk_samples;
+		int16_t *target = neediest->ring + (chunk % ring_chunks) * chunk_samples;
+
+		sd_busy = true;
+		neediest->reading = true;
+		if (sd::read(neediest->start_sector + chunk * chunk_sectors, target, chunk_sectors, Stream::on_read, neediest) != sd::access_status::InProgress) {
+			++read_errors;
+			neediest->reading = false;
+			sd_busy = false;
+			return;
+		}
+		++reads;
+	}
+
+	Stats stats() {
+		Stats result{reads, read_errors, 0, 0};
+		for (const auto& stream : streams) {
+			if (!stream.active) continue;
+			++result.active;
+			result.underruns += stream.underruns;
+		}
+		return result;
+	}
+}
@@ -0,0 +1,88 @@
+#pragma once
+// SD sample streaming
+//
+// Samples too long to keep in RAM are streamed off the SD card through a small pool of ring buffers. Consumers (the sampler module,
+// running in the audio interrupt) grab a stream, then read samples out of its ring by absolute index; the main loop keeps every
+// active stream topped up with read-ahead by calling service().
+//
+// Streams are raw little-endian int16 PCM starting at a sector on the card.
+//
+// Modules have no destructor hook (voices just free their dyncfg), so instead of being released explicitly, a stream that hasn't been
+// read from for a while is reclaimed by service(). Calling release() just does that early. Since a reclaimed stream can then be
+// handed to someone else, acquire() gives out a Handle tagged with a generation, and a stale handle does nothing.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <msynth/sd.h>
+
+namespace ms::synth::stream {
+	constexpr inline size_t chunk_sectors = 2;
+	constexpr inline size_t chunk_samples = chunk_sectors * 256;
+	constexpr inline size_t ring_chunks = 4;
+	constexpr inline size_t ring_samples = chunk_samples * ring_chunks;
+	constexpr inline size_t max_streams = 4;
+
+	// Totals since boot (underruns only for the currently active streams)
+	struct Stats {
+		uint32_t reads, read_errors, underruns;
+		uint8_t active;
+	};
+
+	struct Stream;
+
+	// Zero (as in a fresh dyncfg) is no stream
+	struct Handle {
+		Stream *stream;
+		uint32_t generation;
+
+		explicit operator bool() const {return stream != nullptr;}
+
+		// Get a pointer to sample index and the one after it, or nullptr if they aren't loaded (yet, or anymore), or the
+		// stream has been reclaimed. A new stream is empty until service() has read its first chunk; misses before then
+		// aren't counted as underruns.
+		//
+		// Also marks everything before index as free to be overwritten.
+		const int16_t * at(uint32_t index) const;
+	};
+
+	struct Stream {
+		uint32_t underruns;
+
+	private:
+		friend struct Handle;
+		friend Handle acquire(uint32_t sector, uint32_t length);
+		friend void release(const Handle&);
+		friend void service();
+		friend Stats stats();
+
+		static void on_read(void *stream, sd::access_status status);
+
+		const int16_t * at(uint32_t index);
+
+		// Bumped every time the stream is handed out
+		uint32_t generation;
+
+		uint32_t start_sector, length;
+		// Everything in [loaded_end - ring_samples, loaded_end) is in the ring
+		volatile uint32_t loaded_end;
+		volatile uint32_t consumed;
+		volatile bool touched;
+		uint8_t idle_passes;
+		bool active;
+		volatile bool reading;
+
+		// The extra sample mirrors ring[0] so at() never has to wrap between the two samples it returns
+		int16_t ring[ring_samples + 1];
+	};
+
+	// Start streaming length samples from sector. Returns an empty handle if all streams are in use. Safe to call from the audio
+	// interrupt.
+	Handle acquire(uint32_t sector, uint32_t length);
+	// Give the stream back, unless it's already been reclaimed (and maybe reused)
+	void release(const Handle& handle);
+
+	// Issue read-ahead for the active streams. Call regularly from the main loop.
+	void service();
+
+	Stats stats();
+}
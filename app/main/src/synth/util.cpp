@@ -1,30 +1,92 @@
 #include "util.h"
+#include <msynth/util.h>
 #include <gcem.hpp>
+#include <bit>
 
 namespace ms::synth {
 	namespace tables {
-		struct SinTable {
-			float data[4096];
-
-			constexpr SinTable() {
-				float pos = 0;
-				for (int i = 0; i < 4096; ++i) {
-					data[i] = gcem::sin(pos);
-					pos += (M_PI/2.f)/4095.f;
+		constexpr SinTable::SinTable() : data{} {
+			for (int i = 0; i < sin_table_size; ++i) {
+				data[i] = gcem::sin(2.0 * M_PI * i / sin_table_size);
+			}
+			data[sin_table_size] = data[0];
+		}
+
+		// 2^(i/256) for i in [0, 256]; the extra entry lets interpolation run off the end without a bounds check
+		struct Exp2Table {
+			float data[257];
+
+			constexpr Exp2Table() : data{} {
+				for (int i = 0; i < 257; ++i) {
+					data[i] = gcem::pow(2.0, i / 256.0);
+				}
+			}
+		};
+
+		// log2(1 + i/256) for i in [0, 256]
+		struct Log2Table {
+			float data[257];
+
+			constexpr Log2Table() : data{} {
+				for (int i = 0; i < 257; ++i) {
+					data[i] = gcem::log(1.0 + i / 256.0) / gcem::log(2.0);
 				}
 			}
 		};
 
-		constexpr auto sin_table = SinTable{};
+		constexpr NoteFreqTable::NoteFreqTable() : data{} {
+			for (int i = 0; i < 128; ++i) {
+				data[i] = gcem::pow(2.0, (i - 69) / 12.0) * 440.0;
+			}
+		}
+
+		// Copied into CCMRAM by the startup code
+		CCMDATA constinit SinTable sin_table{};
+		constexpr auto exp2_table = Exp2Table{};
+		constexpr auto log2_table = Log2Table{};
+		constexpr NoteFreqTable note_freq{};
+	}
+
+	float fast_exp2(float x) {
+		if (x < -126.f) return 0.f;
+		if (x > 127.f) x = 127.f;
+
+		// floor without going through libm
+		int32_t whole = static_cast<int32_t>(x);
+		if (x < static_cast<float>(whole)) --whole;
+
+		float index = (x - static_cast<float>(whole)) * 256.f;
+		int   i     = static_cast<int>(index);
+		float frac  = index - static_cast<float>(i);
+		// x - whole rounds up to 1 for tiny negative x, which would read past the table
+		if (i > 255) {
+			i = 255;
+			frac = 1.f;
+		}
+
+		float mantissa = tables::exp2_table.data[i] + (tables::exp2_table.data[i+1] - tables::exp2_table.data[i]) * frac;
+		// Build 2^whole directly
+		return mantissa * std::bit_cast<float>(static_cast<uint32_t>(whole + 127) << 23);
+	}
+
+	float fast_log2(float x) {
+		uint32_t bits = std::bit_cast<uint32_t>(x);
+
+		int   exponent = static_cast<int>((bits >> 23) & 0xff) - 127;
+		int   i        = (bits >> 15) & 0xff;                       // top 8 bits of the mantissa
+		float frac     = static_cast<float>(bits & 0x7fff) * (1.f / 32768.f); // remaining 15 bits
+
+		return static_cast<float>(exponent) + tables::log2_table.data[i] + (tables::log2_table.data[i+1] - tables::log2_table.data[i]) * frac;
 	}
 
 	float wavesin(float in) {
-		if (in < 0.f) in += 1.f;
-		if (in > 1.f) in -= 1.f;
-		
-		if (in > 0.5f) return -wavesin(in-0.5f);
-		if (in > 0.25f) return wavesin(0.5f-in);
-		int offset = in * (4095.f/0.25f);
-		return tables::sin_table.data[offset];
+		// Take the fractional part (without libm) and scale it to a full 32-bit phase
+		int32_t whole = static_cast<int32_t>(in);
+		if (in < static_cast<float>(whole)) --whole;
+
+		// The fraction can round up to a whole period for tiny negative inputs, which doesn't fit the phase (and is phase 0)
+		float phase = (in - static_cast<float>(whole)) * 4294967296.f;
+		if (phase >= 4294967296.f) phase = 0.f;
+		return wavesin_phase(static_cast<uint32_t>(phase));
 	}
 }
@@ -4,17 +4,98 @@
 #include <math.h>
 #include <stdint.h>
 
+// log2 of the number of entries in the sine table. Each entry is a float, and the table lives in CCMRAM so the oscillators
+// don't stall on flash wait states; 9 (512 entries, 2KiB) keeps the interpolation error around -97dB.
+#ifndef MSYNTH_SIN_TABLE_BITS
+#define MSYNTH_SIN_TABLE_BITS 9
+#endif
+
+static_assert(MSYNTH_SIN_TABLE_BITS >= 6 && MSYNTH_SIN_TABLE_BITS <= 12, "unreasonable sine table size");
+
 namespace ms::synth {
+	// Sample rate everything in the synth runs at
+	inline const float sample_rate = 44100.f;
+
+	namespace tables {
+		// A full period of sin, with one extra (wrapped) entry at the end so interpolation never has to wrap
+		inline const int sin_table_bits = MSYNTH_SIN_TABLE_BITS;
+		inline const int sin_table_size = 1 << sin_table_bits;
+
+		struct SinTable {
+			float data[sin_table_size + 1];
+
+			constexpr SinTable();
+		};
+
+		extern SinTable sin_table;
+
+		// Equal-tempered frequencies (A4 = 440hz) for every midi note
+		struct NoteFreqTable {
+			float data[128];
+
+			constexpr NoteFreqTable();
+		};
+
+		extern const NoteFreqTable note_freq;
+	}
+
+	// Fast 2^x.
+	//
+	// The integer part of x is placed directly into the float exponent, and the fractional part is linearly interpolated
+	// from a 257-entry table. Max relative error is < 3e-6 over the full float range (results below 2^-126 flush to 0).
+	float fast_exp2(float x);
+
+	// Fast log2(x), x must be positive and normal.
+	//
+	// Uses the float exponent plus a 257-entry table indexed by the top 8 mantissa bits. Max absolute error is < 5e-6.
+	float fast_log2(float x);
+
+	// Fast base^exponent for positive bases, built from fast_exp2/fast_log2. Max relative error is < 1e-5 for results within
+	// a few octaves of 1 (i.e. anything used for pitch / gain scaling); it grows proportionally with |exponent * log2(base)|.
+	inline float fast_pow(float base, float exponent) {
+		return fast_exp2(exponent * fast_log2(base));
+	}
+
 	inline float midi_to_freq(uint8_t midi_note) {
-		return powf(2.f, static_cast<float>(midi_note - 69.f) / 12.f) * 440.f;
+		return tables::note_freq.data[midi_note & 0x7f];
 	}
 
 	inline float offset_scale_from_semitones(float semitones) {
-		return powf(2.f, (semitones / 24.f));
+		return fast_exp2(semitones / 24.f);
+	}
+
+	// Convert a frequency in hz to a per-sample increment for a 32-bit phase accumulator (where 2^32 is one full period)
+	inline uint32_t phase_increment(float frequency) {
+		// Going through int32_t lets negative frequencies wrap backwards. Anything past Nyquist would overflow it, so it's held
+		// just below (2147483520 is the largest float under 2^31).
+		float increment = frequency * (4294967296.f / sample_rate);
+		if (increment > 2147483520.f) increment = 2147483520.f;
+		else if (increment < -2147483648.f) increment = -2147483648.f;
+		return static_cast<uint32_t>(static_cast<int32_t>(increment));
+	}
+
+	// Convert an offset in periods (any magnitude) to a 32-bit phase offset, wrapping like the accumulator does
+	inline uint32_t phase_offset(float periods) {
+		// Drop the whole periods first so the scaled value always fits in an int32
+		periods -= static_cast<float>(static_cast<int32_t>(periods));
+		return static_cast<uint32_t>(static_cast<int32_t>(periods * 2147483648.f)) << 1;
+	}
+
+	// sin of a 32-bit phase (2^32 is one full period)
+	//
+	// The top bits index the table and the rest linearly interpolate between entries; no float compares or range folding.
+	inline float wavesin_phase(uint32_t phase) {
+		const int frac_bits = 32 - tables::sin_table_bits;
+
+		uint32_t index = phase >> frac_bits;
+		float    frac  = static_cast<float>(phase & ((1u << frac_bits) - 1)) * (1.f / static_cast<float>(1u << frac_bits));
+
+		const float *entry = tables::sin_table.data + index;
+		return entry[0] + (entry[1] - entry[0]) * frac;
 	}
 
 	// sin, but it's scaled to 0-1 as a repeating wave.
 	//
-	// and also uses a lookup table for high speed
+	// and also uses a lookup table for high speed. Prefer wavesin_phase with an integer accumulator where possible.
 	float wavesin(float x);
 }
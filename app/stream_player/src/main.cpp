@@ -8,8 +8,12 @@
 #include <msynth/sound.h>
 #include <msynth/sd.h>
 #include <msynth/fs.h>
+#include <msynth/audiostream.h>
 
-#define BUFSIZE 8192
+// Output buffers: 512 stereo frames (~12ms) each
+#define OUTPUT_FRAMES 512
+// Prefetch ring: 32KiB (~190ms)
+#define RING_SECTORS 64
 
 ISR(SDIO) {
 	sd::sdio_interrupt();
@@ -17,14 +21,10 @@ ISR(SDIO) {
 
 const void * uiFnt;
 
-int16_t buffers[2][BUFSIZE];
-bool sd_is_transferring = false;
-bool not_up_to_date_flag = false;
+int16_t output_buffers[2][OUTPUT_FRAMES * 2];
+alignas(4) uint8_t ring[RING_SECTORS * 512];
 
-uint32_t pos = 0;
-uint32_t size = 0;
-
-int16_t voltagediv = 1;
+audiostream::Player player(ring, RING_SECTORS);
 
 void output(const char * txt) {
 	static uint16_t y = 50;
@@ -44,77 +44,22 @@ inline void output(const char *fmt, Args& ...args) {
 	output(buf);
 }
 
-void sd_read_callback(void *arg, sd::access_status status) {
-	if (pos * 512 >= size) {
-		output("pos = %d; size = %d", pos, size);
-		output("Done!");
-		sound::stop_output();
-		return;
-	}
-	if (status != sd::access_status::Ok) {
-		output("read failed");
-		LL_DMA_DisableStream(DMA1, LL_DMA_STREAM_4);
-		return;
-	}
-	if (not_up_to_date_flag && sd_is_transferring) {
-		LL_DMA_DisableStream(DMA1, LL_DMA_STREAM_4);
-		// Handle behind
-		output("behind");
-
-		if (/*the active buffer is b1*/ arg == buffers[1]) {
-			memcpy(buffers[0], buffers[1], BUFSIZE);
-		}
-
-		sd_is_transferring = false;
-		sd::read(pos, buffers[1], BUFSIZE/256, sd_read_callback, nullptr);
-		pos += BUFSIZE/256;
-	}
-	else if (not_up_to_date_flag) {
-		output("restart");
-		sd_is_transferring = false;
-		not_up_to_date_flag = false;
-
-		sound::setup_double_buffer(buffers[0], buffers[1], BUFSIZE / 2);
-	}
-	else {
-		for (int i = 0; i < BUFSIZE; ++i) {
-			((int16_t *)(arg))[i] /= voltagediv;
-		}
-		if (!(pos % 0x800)) output("pos = %d", pos);
-		sd_is_transferring = false;
-	}
-}
-
-// STREAM SYSTEM
+// OUTPUT
 //
-// Initially both buffers are setup, once a buffer is sent, we try to load the next one.
-// If this completes before the next TCIF of the sound buffer, we keep going.
-// Otherwise, the sound output is paused. If this occurs, the SD handler will start another transfer, which when complete will restart the process.
+// The player keeps its ring topped up by itself; every time the I2S DMA finishes a buffer it just gets refilled from the ring. If
+// the card falls behind the player outputs silence until it catches up, so the output never has to be restarted.
 
 ISR(DMA1_Stream4) {
 	if (LL_DMA_IsActiveFlag_TE4(DMA1)) {
 		LL_DMA_ClearFlag_TE4(DMA1);
-		output("DMA TE!");
 		LL_DMA_DisableStream(DMA1, LL_DMA_STREAM_4);
 		return;
 	}
 	else if (!LL_DMA_IsActiveFlag_TC4(DMA1)) return;
 	LL_DMA_ClearFlag_TC4(DMA1);
 
-	// TC is set, we check if sd_is_transferring
-	if (!sd_is_transferring && sd::card.active_state != sd::Card::ActiveStateReading) {
-		// Good, we can continue and start the SD to fill up this current buffer
-		int16_t * buf = LL_DMA_GetCurrentTargetMem(DMA1, LL_DMA_STREAM_4) == LL_DMA_CURRENTTARGETMEM1 ? buffers[0] : buffers[1];
-		sd_is_transferring = true;
-		if (sd::read(pos, buf, BUFSIZE/256, sd_read_callback, buf) != sd::access_status::InProgress) {
-			output("Read failed");
-			LL_DMA_DisableStream(DMA1, LL_DMA_STREAM_4);
-		}
-		pos += BUFSIZE/256;
-	}
-	else {
-		not_up_to_date_flag = true;
-	}
+	int16_t * buf = LL_DMA_GetCurrentTargetMem(DMA1, LL_DMA_STREAM_4) == LL_DMA_CURRENTTARGETMEM1 ? output_buffers[0] : output_buffers[1];
+	player.render(buf, OUTPUT_FRAMES);
 }
 
 int main() {
@@ -137,7 +82,7 @@ int main() {
 	output("Starting SD");
 	sd::init();
 	output("Waiting for SD card");
-	output("It should have a 4byte size with audio data");
+	output("It should have audio from fmtforsd.py written to it");
 retry:
 	while (!sd::inserted()) {
 		;
@@ -180,52 +125,71 @@ retry:
 	}
 	output("Ok");
 
-	output("Checking size of data");
-	uint8_t data[512];
+	output("Checking format of data");
+	alignas(4) uint8_t data[512];
 	if (sd::read(0, data, 1) != sd::access_status::Ok) {
 		output("failed");
 	};
 
-	size = *(uint32_t *)(data);
-	output("Data size = %d", size);
+	// Either a header sector followed by the data, or the old format with a 4 byte size in front of raw audio
+	audiocodec::Header header;
+	uint32_t first_sector = 1, offset = 0, size;
+	if (audiocodec::parse_header(data, header)) {
+		const char * codecs[] = {"pcm", "adpcm", "rice"};
+		size = header.data_length;
+		output("%s, %d frames, %d bytes", codecs[(int)header.codec], header.frames, size);
+	}
+	else {
+		header.codec = audiocodec::Codec::Pcm;
+		first_sector = 0;
+		offset = 4;
+		size = *(uint32_t *)(data);
+		output("Raw data size = %d", size);
+	}
 	util::delay(100);
 	output("Enabling NVIC");
 	NVIC_EnableIRQ(DMA1_Stream4_IRQn);
 	NVIC_SetPriority(DMA1_Stream4_IRQn, NVIC_EncodePriority(NVIC_GetPriorityGrouping(), 5, 0));
 
-	memset(buffers[0], 0, sizeof(buffers[0]));
-	memset(buffers[1], 0, sizeof(buffers[1]));
-
-restart:
 	output("Starting");
-	if (sd::read(pos, buffers[0], BUFSIZE/256) != sd::access_status::Ok) {
-		output("R1 fail");
-		util::delay(50);
-		goto retry;
-	}
-	if (sd::read(pos+BUFSIZE/256, buffers[1], BUFSIZE/256) != sd::access_status::Ok) {
-		output("R2 fail");
+	if (player.start(first_sector, offset, size, header.codec) != sd::access_status::Ok) {
+		output("Prefetch failed");
 		util::delay(50);
 		goto retry;
 	}
-	pos += (BUFSIZE/256);
-	output("Read 16k samples");
 	output("Starting audio player!");
 	sound::init();
 	util::delay(10);
 
-	sound::setup_double_buffer(buffers[0], buffers[1], BUFSIZE / 2);
+	player.render(output_buffers[0], OUTPUT_FRAMES);
+	player.render(output_buffers[1], OUTPUT_FRAMES);
+	sound::setup_double_buffer(output_buffers[0], output_buffers[1], OUTPUT_FRAMES);
+
 	// Main MSynth start
+	uint32_t last_report = 0, last_underruns = 0;
 	while (1) {
 		util::delay(1);
+		player.service();
+
+		// Volume is applied by the player as it fills the output buffers
 		auto current = (float)periph::ui::get(periph::ui::knob::VOLUME);
-		auto target_max = (std::pow((4096 - current) / 4096.0f, 2.5f) * 32768.f);
-		current = std::max(1.f, std::min(32767.0f, 32768.f / target_max));
+		auto target_max = std::pow((4096 - current) / 4096.0f, 2.5f) * 32768.f;
+		player.set_volume(std::round(target_max));
 
-		auto old = voltagediv;
-		voltagediv = std::round(current);
+		if (player.finished()) {
+			sound::stop_output();
+			output("Done!");
+			while (1) {;}
+		}
 
-		if (!LL_DMA_IsEnabledStream(DMA1, LL_DMA_STREAM_4)) goto restart;
+		// Report roughly every second, or straight away when something went wrong
+		const auto& stats = player.stats();
+		if (++last_report >= 1000 || stats.underruns != last_underruns) {
+			uint32_t position = player.position() / 512, underruns = stats.underruns, silent = stats.silent_frames, lowest = stats.lowest_fill;
+			output("pos = %d; underruns = %d (%d frames); lowest fill = %d", position, underruns, silent, lowest);
+			last_report = 0;
+			last_underruns = stats.underruns;
+		}
 	}
 
 	return 0;
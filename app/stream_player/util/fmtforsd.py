@@ -13,33 +13,295 @@ $ sudo dd if=test.img of=/dev/sdX bs=4m
 
 where X is the disk ID for the SD card (or if the SD controller is directly integrated to your motherboard, like on a laptop, something
 like /dev/mmcblk0)
+
+The audio can be compressed with --codec (see framework/lib/include/msynth/audiocodec.h for the format):
+
+    pcm    raw s16le (the default)
+    adpcm  IMA ADPCM, 4:1
+    rice   lossless, usually around 1.5-2:1
+
+--verify decodes the result again and reports how close it is to the original. --legacy writes the old headerless format (just the
+length and raw PCM) that older players expect.
 """
 
-import subprocess
-import sys
-import struct
+import argparse
+import math
 import os
 import shutil
+import struct
+import subprocess
+
+SECTOR = 512
+MAGIC = 0x5541534D  # "MSAU"
+CODECS = {"pcm": 0, "adpcm": 1, "rice": 2}
+
+# IMA ADPCM
+
+ADPCM_STEPS = [
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45, 50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130,
+    143, 157, 173, 190, 209, 230, 253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963, 1060, 1166, 1282,
+    1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630,
+    9493, 10442, 11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+]
+ADPCM_INDEX_STEPS = [-1, -1, -1, -1, 2, 4, 6, 8]
+ADPCM_BLOCK_FRAMES = 505
+
+
+def clamp16(x):
+    return max(-32768, min(32767, x))
+
+
+class AdpcmChannel:
+    def __init__(self):
+        self.predictor = 0
+        self.index = 0
+
+    def decode(self, nibble):
+        step = ADPCM_STEPS[self.index]
+        diff = step >> 3
+        if nibble & 1:
+            diff += step >> 2
+        if nibble & 2:
+            diff += step >> 1
+        if nibble & 4:
+            diff += step
+        self.predictor = clamp16(self.predictor - diff if nibble & 8 else self.predictor + diff)
+        self.index = max(0, min(88, self.index + ADPCM_INDEX_STEPS[nibble & 7]))
+        return self.predictor
+
+    def encode(self, sample):
+        step = ADPCM_STEPS[self.index]
+        diff = sample - self.predictor
+        nibble = 0
+        if diff < 0:
+            nibble = 8
+            diff = -diff
+        if diff >= step:
+            nibble |= 4
+            diff -= step
+        if diff >= step >> 1:
+            nibble |= 2
+            diff -= step >> 1
+        if diff >= step >> 2:
+            nibble |= 1
+        # Track exactly what the decoder will see
+        self.decode(nibble)
+        return nibble
+
+
+def encode_adpcm(left, right):
+    channels = [AdpcmChannel(), AdpcmChannel()]
+    out = bytearray()
+    for start in range(0, len(left), ADPCM_BLOCK_FRAMES):
+        block = [left[start:start + ADPCM_BLOCK_FRAMES], right[start:start + ADPCM_BLOCK_FRAMES]]
+        for samples in block:
+            samples.extend([0] * (ADPCM_BLOCK_FRAMES - len(samples)))
+
+        for channel, samples in zip(channels, block):
+            channel.predictor = samples[0]
+            out += struct.pack("<hBx", samples[0], channel.index)
+
+        for group in range(63):
+            for channel, samples in zip(channels, block):
+                frames = samples[1 + group * 8:9 + group * 8]
+                for i in range(0, 8, 2):
+                    low = channel.encode(frames[i])
+                    out.append(low | (channel.encode(frames[i + 1]) << 4))
+    return bytes(out)
+
+
+def decode_adpcm(data):
+    left, right = [], []
+    for start in range(0, len(data), SECTOR):
+        block = data[start:start + SECTOR]
+        channels = [AdpcmChannel(), AdpcmChannel()]
+        frames = [[0] * ADPCM_BLOCK_FRAMES, [0] * ADPCM_BLOCK_FRAMES]
+        for c in range(2):
+            channels[c].predictor, index = struct.unpack_from("<hB", block, c * 4)
+            channels[c].index = min(index, 88)
+            frames[c][0] = channels[c].predictor
+        pos = 8
+        for group in range(63):
+            for c in range(2):
+                for i in range(4):
+                    byte = block[pos]
+                    pos += 1
+                    frames[c][1 + group * 8 + i * 2] = channels[c].decode(byte & 0xF)
+                    frames[c][2 + group * 8 + i * 2] = channels[c].decode(byte >> 4)
+        left += frames[0]
+        right += frames[1]
+    return left, right
+
+# RICE
+
+RICE_BLOCK_FRAMES = 1024
+RICE_ESCAPE = 15
+RICE_ESCAPE_BITS = 19
+
+
+class BitWriter:
+    def __init__(self):
+        self.out = bytearray()
+        self.bits = 0
+        self.count = 0
+
+    def write(self, value, length):
+        self.bits = (self.bits << length) | value
+        self.count += length
+        while self.count >= 8:
+            self.count -= 8
+            self.out.append((self.bits >> self.count) & 0xFF)
+        self.bits &= (1 << self.count) - 1
+
+    def flush(self):
+        if self.count:
+            self.write(0, 8 - self.count)
+        return bytes(self.out)
+
+
+class BitReader:
+    def __init__(self, data):
+        self.data = data
+        self.position = 0
+
+    def read(self, length):
+        value = 0
+        for _ in range(length):
+            byte = self.data[self.position >> 3] if self.position >> 3 < len(self.data) else 0
+            value = (value << 1) | ((byte >> (7 - (self.position & 7))) & 1)
+            self.position += 1
+        return value
+
+
+def residuals(samples):
+    return [samples[n] - (2 * samples[n - 1] - samples[n - 2]) for n in range(2, len(samples))]
+
+
+def zigzag(value):
+    return (value << 1) ^ (value >> 31) if value >= 0 else ((-value) << 1) - 1
+
+
+def rice_parameter(values):
+    if not values:
+        return 0
+    mean = sum(values) / len(values)
+    return max(0, min(16, int(math.log2(mean + 1)))) if mean >= 1 else 0
+
+
+def encode_rice(left, right):
+    out = bytearray()
+    for start in range(0, len(left), RICE_BLOCK_FRAMES):
+        block = [left[start:start + RICE_BLOCK_FRAMES], right[start:start + RICE_BLOCK_FRAMES]]
+        frames = len(block[0])
+        coded = [[zigzag(r) for r in residuals(samples)] for samples in block]
+        ks = [rice_parameter(values) for values in coded]
+
+        header = bytearray()
+        for samples, k in zip(block, ks):
+            header += struct.pack("<hhB", samples[0], samples[1] if frames > 1 else 0, k)
+
+        bits = BitWriter()
+        for n in range(frames - 2):
+            for c in range(2):
+                value, k = coded[c][n], ks[c]
+                quotient = value >> k
+                if quotient < RICE_ESCAPE:
+                    bits.write((1 << (quotient + 1)) - 2, quotient + 1)
+                    bits.write(value & ((1 << k) - 1), k)
+                else:
+                    bits.write((1 << RICE_ESCAPE) - 1, RICE_ESCAPE)
+                    bits.write(value, RICE_ESCAPE_BITS)
+        body = bits.flush()
+
+        out += struct.pack("<HH", 4 + len(header) + len(body), frames) + header + body
+    return bytes(out)
+
+
+def decode_rice(data):
+    left, right = [], []
+    pos = 0
+    while pos + 4 <= len(data):
+        length, frames = struct.unpack_from("<HH", data, pos)
+        channels = []
+        for c in range(2):
+            first, second, k = struct.unpack_from("<hhB", data, pos + 4 + c * 5)
+            channels.append(([first, second][:frames], k))
+        bits = BitReader(data[pos + 14:pos + length])
+        for n in range(frames - 2):
+            for samples, k in channels:
+                quotient = 0
+                while quotient < RICE_ESCAPE and bits.read(1):
+                    quotient += 1
+                if quotient < RICE_ESCAPE:
+                    value = (quotient << k) | bits.read(k)
+                else:
+                    value = bits.read(RICE_ESCAPE_BITS)
+                residual = (value >> 1) ^ -(value & 1)
+                samples.append(clamp16(2 * samples[-1] - samples[-2] + residual))
+        left += channels[0][0]
+        right += channels[1][0]
+        pos += length
+    return left, right
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Convert audio into an image for the SD player")
+    parser.add_argument("input")
+    parser.add_argument("output")
+    parser.add_argument("--codec", choices=CODECS.keys(), default="pcm")
+    parser.add_argument("--legacy", action="store_true", help="write the old headerless raw format")
+    parser.add_argument("--verify", action="store_true", help="decode the output again and compare")
+    args = parser.parse_args()
+
+    ffmpeg = "/usr/bin/ffmpeg"
+    if not os.path.exists(ffmpeg):
+        ffmpeg = shutil.which("ffmpeg")
+    if not ffmpeg or not os.path.exists(ffmpeg):
+        print("fmtforsd: unable to find ffmpeg")
+        exit(1)
+
+    out = os.path.expanduser(args.output)
+
+    raw = subprocess.run([ffmpeg, "-i", os.path.expanduser(args.input), "-f", "s16le", "-c:a", "pcm_s16le", "-ac", "2", "-ar", "44100", "-"],
+            check=True, stdout=subprocess.PIPE).stdout
+    raw = raw[:len(raw) & ~3]
 
-if len(sys.argv) != 3:
-    print("usage: {} <in> <out>".format(sys.argv[0]))
-    exit(2)
+    if args.legacy:
+        with open(out, "wb") as f:
+            f.write(struct.pack("<I", len(raw)))
+            f.write(raw)
+        return
 
-FFMPEG = "/usr/bin/ffmpeg"
+    samples = struct.unpack("<{}h".format(len(raw) // 2), raw)
+    left, right = list(samples[0::2]), list(samples[1::2])
 
-if not os.path.exists(FFMPEG):
-    FFMPEG = shutil.which("ffmpeg")
+    if args.codec == "pcm":
+        data = raw
+    elif args.codec == "adpcm":
+        data = encode_adpcm(left, right)
+    else:
+        data = encode_rice(left, right)
 
-if not os.path.exists(FFMPEG):
-    print("fmtforsd: unable to find ffmpeg")
+    header = struct.pack("<IBBBBIII", MAGIC, 1, CODECS[args.codec], 2, 0, 44100, len(left), len(data))
+    with open(out, "wb") as f:
+        f.write(header.ljust(SECTOR, b"\0"))
+        f.write(data)
 
-out = os.path.expanduser(sys.argv[2])
+    print("fmtforsd: {} frames, {} bytes of {} ({:.2f}:1)".format(len(left), len(data), args.codec, len(raw) / max(1, len(data))))
 
-subprocess.run([FFMPEG, "-i", os.path.expanduser(sys.argv[1]), "-f", "s16le", "-c:a", "pcm_s16le", "-ar", "44100", out], check=True)
+    if args.verify and args.codec != "pcm":
+        decoded = (decode_adpcm if args.codec == "adpcm" else decode_rice)(data)
+        decoded = [d[:len(left)] for d in decoded]
+        if args.codec == "rice":
+            ok = decoded == [left, right]
+            print("fmtforsd: verify {}".format("ok, lossless" if ok else "FAILED"))
+            if not ok:
+                exit(1)
+        else:
+            signal = sum(x * x for x in left + right) or 1
+            noise = sum((a - b) ** 2 for a, b in zip(left + right, decoded[0] + decoded[1])) or 1
+            print("fmtforsd: verify SNR {:.1f} dB".format(10 * math.log10(signal / noise)))
 
-with open(out, "rb") as f:
-    old = f.read()
 
-with open(out, "wb") as f:
-    f.write(struct.pack("<I", len(old)))
-    f.write(old)
+if __name__ == "__main__":
+    main()
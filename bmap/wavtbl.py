@@ -0,0 +1,81 @@
+#!/usr/bin/env python3
+"""
+wavtbl - WAVeTaBLe generator
+
+Creates an MSwt wavetable (for the wavetable oscillator module) from either a built-in shape or a mono 16-bit wav file made of
+back-to-back single cycles.
+
+Usage: wavtbl.py <saw|square|triangle|sine|input.wav> <output path> [frame size (default 2048)]
+"""
+import sys
+import struct
+import wave
+import math
+import numpy as np
+
+MIN_BITS = 6
+
+if len(sys.argv) not in [3, 4]:
+    print("Usage: {} <saw|square|triangle|sine|input.wav> <output path> [frame size]".format(sys.argv[0]))
+    exit(1)
+
+source = sys.argv[1]
+output_path = sys.argv[2]
+frame_size = int(sys.argv[3]) if len(sys.argv) == 4 else 2048
+
+frame_bits = frame_size.bit_length() - 1
+if 1 << frame_bits != frame_size or frame_bits < MIN_BITS or frame_bits > 14:
+    print("wavtbl: frame size must be a power of two between {} and {}".format(1 << MIN_BITS, 1 << 14))
+    exit(1)
+
+t = np.arange(frame_size) / frame_size
+shapes = {
+    "saw": lambda: 2 * t - 1,
+    "square": lambda: np.where(t < 0.5, 1.0, -1.0),
+    "triangle": lambda: 1 - 4 * np.abs(t - 0.5),
+    "sine": lambda: np.sin(2 * np.pi * t),
+}
+
+if source in shapes:
+    frames = [shapes[source]()]
+else:
+    with wave.open(source, "rb") as w:
+        if w.getnchannels() != 1 or w.getsampwidth() != 2:
+            print("wavtbl: input must be mono 16-bit")
+            exit(1)
+        samples = np.frombuffer(w.readframes(w.getnframes()), dtype="<i2").astype(np.float64) / 32768
+    if len(samples) % frame_size:
+        print("wavtbl: input length isn't a multiple of the frame size, ignoring the last {} samples".format(len(samples) % frame_size))
+    frames = [samples[i:i + frame_size] for i in range(0, len(samples) - frame_size + 1, frame_size)]
+
+if not frames or len(frames) > 255:
+    print("wavtbl: need between 1 and 255 frames")
+    exit(1)
+
+# Level n keeps the harmonics below (frame_size / 2) >> n, down to just the fundamental
+level_count = frame_bits
+spectra = [np.fft.rfft(frame) for frame in frames]
+
+levels = []
+for level in range(level_count):
+    size = 1 << max(frame_bits - level, MIN_BITS)
+    harmonics = (frame_size // 2) >> level
+    level_frames = []
+    for spectrum in spectra:
+        limited = np.zeros(size // 2 + 1, dtype=complex)
+        keep = min(harmonics, size // 2 - 1)
+        limited[1:keep + 1] = spectrum[1:keep + 1] # drop DC and nyquist too
+        level_frames.append(np.fft.irfft(limited, n=size) * (size / frame_size))
+    levels.append(level_frames)
+
+peak = max(np.max(np.abs(f)) for frames_ in levels for f in frames_)
+scale = 32767 / peak if peak > 0 else 0
+
+with open(output_path, "wb") as f:
+    f.write(b"MSwt")
+    f.write(struct.pack("<BBBB", frame_bits, len(frames), level_count, MIN_BITS))
+    for level_frames in levels:
+        for frame in level_frames:
+            f.write(np.round(frame * scale).astype("<i2").tobytes())
+
+print("wavtbl: wrote {} frames x {} levels".format(len(frames), level_count))
@@ -8,6 +8,9 @@
 
 alignas(4) uint8_t sector_dump[1024];
 
+// Big enough for the largest benchmark transfer. Static so it's in SRAM, where the DMA can reach it.
+alignas(4) uint8_t benchmark_buffer[64 * 512];
+
 void SdTest::start() {
 	state = (sd::inserted() ? WaitingForStartInserted : WaitingForStartEjected);
 	uiFnt  = fs::open("fonts/djv_16.fnt");
@@ -51,16 +54,36 @@ TestState SdTest::loop() {
 				memset(sector_dump, 0, sizeof(sector_dump));
 				sd::read(8192, sector_dump, 2, &SdTest::dma_read_finished_callback, *this);
 				break;
+			case BenchmarkingCard:
+				draw::fill(0b11'01'01'11);
+				draw::text(20, 120, "BenchmarkingCard", bigFnt, 0b11'11'11'11);
+				run_benchmark();
+				break;
 			case WaitingForActionSelection:
 				draw::fill(0);
 				{
 					char buf[64] = {0}; snprintf(buf, 64, "size: %u KiB; est %d GB", (uint32_t)(sd::card.length / 1024), (int)(sd::card.length / (1000*1000*1000)));
 					draw::text(draw::text(30, 60, "SD Init OK!", bigFnt, 0xff), 60, buf, uiFnt, 0b11'10'10'10);
+					snprintf(buf, 64, "%s speed, %s", sd::card.high_speed ? "high" : "default", sd::card.set_block_count ? "CMD23" : "no CMD23");
+					draw::text(30, 80, buf, uiFnt, 0b11'10'10'10);
 				}
 				draw::text(120, 120, "1 - erase/read/write", uiFnt, 0xff);
 				draw::text(120, 152, "2 - read sector 8192", uiFnt, 0xff);
 				draw::text(120, 184, "3 - read sector 8192 async", uiFnt, 0xff);
 				draw::text(120, 184 + 32, "4 - exit", uiFnt, 0xff);
+				draw::text(120, 184 + 64, "5 - read benchmark", uiFnt, 0xff);
+				break;
+			case ShowingBenchmark:
+				draw::fill(0);
+				draw::text(2, 14, "Read throughput ([ENTER] to return to menu)", uiFnt, 0xff);
+				for (int i = 0; i < benchmark_count; ++i) {
+					const auto& result = benchmark_results[i];
+					char buf[64] = {0};
+					if (result.kib_per_second) snprintf(buf, 64, "%s %2u sectors: %u.%02u MB/s", result.dma ? "DMA     " : "blocking", result.sectors,
+							(unsigned)(result.kib_per_second / 1024), (unsigned)(result.kib_per_second % 1024 * 100 / 1024));
+					else snprintf(buf, 64, "%s %2u sectors: failed", result.dma ? "DMA     " : "blocking", result.sectors);
+					draw::text(20, 50 + i * 24, buf, uiFnt, result.kib_per_second ? 0xff : 0b11'11'01'01);
+				}
 				break;
 			case ShowingDumpOnScreen:
 				draw::fill(0);
@@ -173,12 +196,17 @@ TestState SdTest::loop() {
 				if (periph::ui::pressed(periph::ui::button::N4)) state = ResettingCardAndExiting;
 				if (periph::ui::pressed(periph::ui::button::N3)) state = AsyncReadingCard;
 				if (periph::ui::pressed(periph::ui::button::N2)) state = ReadingDataFromCardForDump;
+				if (periph::ui::pressed(periph::ui::button::N5)) state = BenchmarkingCard;
 			}
 			return InProgress;
+		case BenchmarkingCard:
+			state = ShowingBenchmark;
+			return InProgress;
 		case ReadingDataFromCardForDump:
 			if (sd_access_error != sd::access_status::Ok) state = ShowingAccessError;
 			else state = ShowingDumpOnScreen;
 		case ShowingDumpOnScreen:
+		case ShowingBenchmark:
 			if (periph::ui::pressed(periph::ui::button::ENTER)) state = WaitingForActionSelection;
 			return InProgress;
 		case ShowingAccessError:
@@ -196,3 +224,47 @@ void SdTest::dma_read_finished_callback(sd::access_status result) {
 	if (result != sd::access_status::Ok) state = ShowingAccessError;
 	else state = ShowingDumpOnScreen;
 }
+
+void SdTest::run_benchmark() {
+	// Read 512KiB (128KiB for the slow blocking reads) starting at sector 8192 with each transfer size
+	static constexpr BenchmarkResult configs[benchmark_count] = {
+		{1, false, 0}, {8, false, 0},
+		{1, true, 0}, {8, true, 0}, {32, true, 0}, {64, true, 0}
+	};
+
+	util::enable_cycle_counter();
+
+	for (int i = 0; i < benchmark_count; ++i) {
+		auto& result = benchmark_results[i] = configs[i];
+		uint32_t total = result.dma ? 1024 : 256;
+		uint32_t start = util::cycles();
+		bool ok = true;
+
+		for (uint32_t sector = 0; ok && sector < total; sector += result.sectors) {
+			if (!result.dma) {
+				ok = sd::read(8192 + sector, benchmark_buffer, result.sectors) == sd::access_status::Ok;
+				continue;
+			}
+
+			struct Transfer {
+				volatile bool done = false;
+				volatile sd::access_status status = sd::access_status::Ok;
+			} transfer;
+			auto finished = [](void * argument, sd::access_status status) {
+				auto& transfer = *static_cast<Transfer *>(argument);
+				transfer.status = status;
+				transfer.done = true;
+			};
+
+			if (sd::read(8192 + sector, benchmark_buffer, result.sectors, finished, &transfer) != sd::access_status::InProgress) ok = false;
+			else {
+				while (!transfer.done) sd::service();
+				ok = transfer.status == sd::access_status::Ok;
+			}
+		}
+
+		// Cycles are at 168MHz; total is in sectors
+		uint64_t elapsed = util::cycles() - start;
+		result.kib_per_second = ok && elapsed ? (uint64_t)total * 512 * F_CPU / 1024 / elapsed : 0;
+	}
+}
@@ -18,6 +18,7 @@ private:
 	// 	 1 - erase card and do read/write test
 	// 	 2 - just read card and do hexdump
 	// 	 3 - exit and reset (de-init sd)
+	// 	 5 - measure read throughput for a few transfer sizes
 	
 	enum {
 		WaitingForStartEjected,
@@ -33,6 +34,8 @@ private:
 		ShowingInitError,
 		ShowingAccessError,
 		AsyncReadingCard,
+		BenchmarkingCard,
+		ShowingBenchmark,
 		UndefinedState
 	} state = WaitingForStartInserted, last_state = UndefinedState;
 
@@ -43,4 +46,16 @@ private:
 	sd::access_status sd_access_error;
 
 	void dma_read_finished_callback(sd::access_status result);
+
+	// Throughput benchmark
+	struct BenchmarkResult {
+		uint16_t sectors; // per transfer
+		bool dma;
+		uint32_t kib_per_second; // 0 if it failed
+	};
+
+	static constexpr int benchmark_count = 6;
+	BenchmarkResult benchmark_results[benchmark_count];
+
+	void run_benchmark();
 };
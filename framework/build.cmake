@@ -59,6 +59,10 @@ add_library(mslib STATIC ${mslib_srcs})
 
 target_include_directories(mslib PRIVATE ${FRAMEWORK_DIR}/lib/include/msynth)
 
+set(MSYNTH_SD_CACHE_SECTORS 8 CACHE STRING "Number of sectors kept in the SD sector cache")
+set(MSYNTH_SD_READ_AHEAD 8 CACHE STRING "Sectors read at once by each of the two SD read-ahead buffers")
+target_compile_definitions(mslib PRIVATE MSYNTH_SD_CACHE_SECTORS=${MSYNTH_SD_CACHE_SECTORS} MSYNTH_SD_READ_AHEAD=${MSYNTH_SD_READ_AHEAD})
+
 include_directories(
 	${PFRAMEWORK_DIR}/f4/Drivers/STM32F4xx_HAL_Driver/Inc
 	${PFRAMEWORK_DIR}/f4/Drivers/CMSIS/Device/ST/STM32F4xx/Include
@@ -0,0 +1,75 @@
+#pragma once
+// audiocodec.h -- compressed audio for streaming off the SD card
+//
+// Audio written by fmtforsd.py starts with a one sector header, followed by the (possibly compressed) interleaved stereo data
+// from the next sector on. Compressed data is split into blocks that can each be decoded on their own:
+//
+// - IMA ADPCM (4:1): every block is exactly one sector, laid out like in WAV files. For each channel there's a 4 byte header
+//   (first sample as int16, step index, padding), then 4 bytes of nibbles for the left channel, 4 for the right and so on, low
+//   nibble first. That makes 505 frames per block.
+//
+// - Rice (lossless): blocks are up to rice_block_frames frames and variable length. Each starts with its length in bytes and
+//   frame count (both uint16), then for each channel two warmup samples (int16) and a Rice parameter (uint8). The rest of the
+//   frames are the residuals of the predictor 2*x[n-1] - x[n-2] for each channel in turn, zigzag encoded and Rice coded MSB
+//   first. Values with a quotient of 15 or more are escaped as 15 one bits and the 19 bit value, so no sample takes more
+//   than 34 bits to decode. Blocks are padded to a whole byte.
+//
+// Files without the header are raw PCM with just the length in front of them (what older versions of fmtforsd.py made).
+
+#include <stdint.h>
+
+namespace audiocodec {
+	enum struct Codec : uint8_t {
+		Pcm,
+		ImaAdpcm,
+		Rice
+	};
+
+	constexpr inline uint32_t magic = 0x5541'534D; // "MSAU"
+
+	struct Header {
+		uint32_t magic;
+		uint8_t version; // 1
+		Codec codec;
+		uint8_t channels; // always 2
+		uint8_t reserved;
+		uint32_t sample_rate;
+		uint32_t frames; // total, after decoding
+		uint32_t data_length; // in bytes, starting at the next sector
+	};
+
+	constexpr inline uint32_t adpcm_block_bytes = 512;
+	constexpr inline uint32_t adpcm_block_frames = 505;
+
+	constexpr inline uint32_t rice_block_frames = 1024;
+	// Length and frames, then the warmup samples and parameter for both channels
+	constexpr inline uint32_t rice_block_header_bytes = 14;
+
+	// The most frames any block decodes to
+	constexpr inline uint32_t max_block_frames = rice_block_frames;
+
+	// Read the header from the first sector; false if it's an old style raw file
+	bool parse_header(const uint8_t * sector, Header& header);
+
+	// Decode one ADPCM block into adpcm_block_frames stereo frames
+	void decode_adpcm(const uint8_t * block, int16_t * out);
+
+	// Compressed data sitting in a ring buffer, which it may wrap around the end of
+	struct RingReader {
+		const uint8_t * data;
+		uint32_t size;
+		uint32_t position;
+
+		uint8_t next() {
+			uint8_t value = data[position];
+			if (++position == size) position = 0;
+			return value;
+		}
+	};
+
+	// The length in bytes of the Rice block at in
+	uint32_t rice_block_length(RingReader in);
+
+	// Decode the Rice block at in, which must all be there, into out. Returns how many stereo frames it had.
+	uint32_t decode_rice(RingReader in, int16_t * out);
+}
@@ -0,0 +1,110 @@
+#pragma once
+// audiostream.h -- continuous audio playback from the SD card
+//
+// A Player streams 16 bit interleaved stereo PCM off the card through a ring of sectors. Reading and playing are decoupled: the SD
+// side keeps the ring topped up with multi-sector DMA reads (each read's callback starts the next one, so nothing waits on the
+// main loop), and the output side copies whatever's in the ring into the I2S buffer, applying the volume as it goes. If the
+// ring runs dry the output is filled with silence and counted as an underrun; playback picks up where it left off as soon as
+// data arrives, without restarting the I2S DMA.
+//
+// The audio can either be a run of sectors on the card or a file, in which case the file's extents are looked up from service()
+// (since that needs blocking reads of the FAT).
+//
+// The audio can also be compressed (see audiocodec.h). Compressed blocks go through the ring just the same and are decoded one
+// at a time from render() into a block sized buffer in the player, which is then drained into the output. Decoding costs a
+// fixed amount per frame (no block needs more than 34 bits per sample), so it's fine to do from the I2S interrupt. The ring
+// has to be able to hold at least one whole block plus min_read_sectors; the default of 64 sectors is plenty.
+//
+// The ring is supplied by the caller and must be in regular SRAM (not CCM), since it's filled with DMA.
+
+#include <stdint.h>
+#include "sd.h"
+#include "fat.h"
+#include "audiocodec.h"
+
+namespace audiostream {
+	struct Stats {
+		uint32_t reads; // read commands sent
+		uint32_t read_errors;
+		uint32_t underruns; // render() calls that didn't have enough data
+		uint32_t silent_frames; // frames filled with silence because of underruns
+		uint32_t lowest_fill; // the least data seen in the ring by render(), in sectors (once started)
+	};
+
+	struct Player {
+		// Reads are at most this long, so fresh data keeps arriving steadily
+		static constexpr uint32_t max_read_sectors = 16;
+		// And at least this long (unless the audio ends first), so the card isn't busy with lots of tiny reads
+		static constexpr uint32_t min_read_sectors = 4;
+
+		// ring_sectors sectors of ring starting at ring, which must be word aligned and in SRAM
+		Player(void * ring, uint32_t ring_sectors);
+
+		// Start streaming length bytes, beginning offset bytes into the sector at sector. Waits until the ring is full (or an error).
+		// ADPCM data has to start on a sector boundary.
+		sd::access_status start(uint32_t sector, uint32_t offset, uint32_t length, audiocodec::Codec codec = audiocodec::Codec::Pcm);
+
+		// Start streaming a file from its current position (which must be sector aligned). The file has to stay open (and
+		// unmodified) while playing.
+		sd::access_status start(fat::File& file, audiocodec::Codec codec = audiocodec::Codec::Pcm);
+
+		// Stop reading; render() outputs silence from now on
+		void stop();
+
+		// Fill `frames` stereo frames (2 * frames samples) with the next bit of audio. Call from the I2S DMA interrupt.
+		void render(int16_t * out, uint32_t frames);
+
+		// Find the next extent of a file and restart reading if it's been waiting for that. Call regularly from the main loop.
+		void service();
+
+		// 0 to 32768 (unity)
+		void set_volume(uint32_t volume);
+
+		// Has everything been played?
+		bool finished() const;
+
+		// How far into the audio playback is, in bytes of (possibly compressed) data
+		uint32_t position() const;
+
+		const Stats& stats() const {return statistics;}
+
+	private:
+		static void on_read(void * player, sd::access_status status);
+
+		// Start the next read if there's room and nothing is in flight. Safe to call from any context.
+		void kick();
+		// Wait for the read in flight
+		void wait();
+
+		// How many bytes are ready to be played from the ring
+		uint32_t available();
+		void render_pcm(int16_t * out, uint32_t frames);
+		// Decode the next compressed block if it's all there
+		bool decode_next();
+
+		uint8_t * ring;
+		uint32_t ring_sectors;
+
+		// Where the data comes from: the rest of the current extent, and the file to get more from
+		uint32_t extent_sector = 0, extent_left = 0;
+		fat::File * file = nullptr;
+
+		// Both count from the start of the first sector. The SD side only ever writes sectors_read and the output side only
+		// played, so neither needs a lock.
+		volatile uint32_t sectors_read = 0, played = 0;
+		uint32_t start_offset = 0, end = 0; // in bytes
+		uint32_t read_length = 0; // of the read in flight
+
+		volatile sd::access_status last_error = sd::access_status::Ok;
+
+		volatile bool reading = false, running = false, need_extent = false;
+		volatile int32_t volume = 32768;
+
+		// The block being played, for compressed audio. Only used by the output side.
+		audiocodec::Codec codec = audiocodec::Codec::Pcm;
+		uint32_t decoded_frames = 0, decoded_position = 0;
+		int16_t decoded[audiocodec::max_block_frames * 2];
+
+		Stats statistics{};
+	};
+}
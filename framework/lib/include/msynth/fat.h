@@ -0,0 +1,175 @@
+#pragma once
+// fat.h -- FAT32 filesystem on the SD card
+//
+// Everything here is built from small state wrappers (File, Dir) that only hold enough to carry on where they left off. The only
+// global state is the mounted Volume and two sector buffers (one for the FAT and one for everything else), so RAM use doesn't
+// depend on the size of the card or on how many files are open.
+//
+// Files remember the contiguous run of clusters (the extent) they're currently in, so following the cluster chain is usually
+// just arithmetic. File::extent() hands out the rest of that run, which lets long files be streamed straight off the card with
+// multi-block DMA reads (see sd::read) instead of going through File::read.
+//
+// Long names are matched when opening, but only 8.3 names can be created.
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace fat {
+	enum struct status {
+		Ok,
+		NoCard, // The SD card isn't initialized
+		NoFilesystem, // There's no FAT32 partition on the card
+		NotMounted, // mount() hasn't succeeded yet
+		DiskError, // The card returned an error
+		NotFound, // The path doesn't exist
+		NotAFile, // The path is a directory
+		NotADirectory, // Part of the path isn't a directory
+		AlreadyExists, // Tried to create something that's already there
+		InvalidName, // Not a valid 8.3 name
+		Full, // No free clusters
+		EndOfFile, // Nothing left to read
+		EndOfDirectory, // No more entries
+	};
+
+	struct Volume {
+		uint32_t fat_start; // first sector of the first FAT
+		uint32_t fat_sectors; // length of one FAT
+		uint32_t data_start; // first sector of cluster 2
+		uint32_t cluster_count;
+		uint32_t root_cluster;
+		uint32_t fsinfo_sector;
+		uint32_t free_hint; // where to start looking for free clusters
+		uint8_t  fat_count;
+		uint8_t  cluster_shift; // log2(sectors per cluster)
+		bool     mounted = false;
+		bool     fsinfo_stale = false; // the free cluster count in the FSInfo sector has been invalidated
+
+		uint32_t cluster_sector(uint32_t cluster) const {
+			return data_start + ((cluster - 2) << cluster_shift);
+		}
+	};
+
+	extern Volume volume;
+
+	// Mount the first FAT32 partition on the card (or the card itself if it isn't partitioned). The card must be initialized.
+	status mount();
+
+	// Write back anything still buffered, here and in the sector cache (see sdcache.h). Files also do this when flushed or
+	// closed.
+	status sync();
+
+	// A contiguous run of sectors on the card
+	struct Extent {
+		uint32_t sector;
+		uint32_t length; // in sectors
+	};
+
+	// An entry in a directory
+	struct Entry {
+		enum : uint8_t {
+			AttributeReadOnly = 0x01,
+			AttributeHidden = 0x02,
+			AttributeSystem = 0x04,
+			AttributeVolume = 0x08,
+			AttributeDirectory = 0x10,
+			AttributeArchive = 0x20,
+			AttributeLongName = 0x0f
+		};
+
+		char short_name[13]; // as NAME.EXT
+		char name[64]; // the long name if there is one (and it fits), otherwise the short name
+		uint8_t attributes;
+		uint32_t first_cluster;
+		uint32_t size;
+
+		// Where the entry itself is
+		uint32_t sector;
+		uint16_t index;
+
+		bool is_directory() const {return attributes & AttributeDirectory;}
+	};
+
+	struct Dir {
+		// Open a directory; "" and "/" are the root.
+		status open(const char * path);
+
+		// Get the next entry (this includes . and ..)
+		status next(Entry &entry);
+
+		// Open the directory starting at cluster
+		status open(uint32_t cluster);
+
+		status rewind();
+
+	private:
+		friend struct File;
+
+		// Find the next raw entry (including deleted ones and the end marker)
+		status next_raw(uint8_t *&raw, uint32_t &sector, uint16_t &index);
+
+		uint32_t first_cluster = 0, cluster = 0;
+		uint16_t index = 0;
+	};
+
+	struct File {
+		// Open an existing file
+		status open(const char * path);
+
+		// Create a new, empty file. The name must be 8.3 and the directory it's in must exist.
+		status create(const char * path);
+
+		// Read up to length bytes, setting done to how many were read. Whole sectors are read straight into buffer if it's word
+		// aligned.
+		status read(void * buffer, uint32_t length, uint32_t &done);
+
+		// Write length bytes at the current position, growing the file as needed
+		status write(const void * buffer, uint32_t length);
+
+		// Move to position, which can't be past the end of the file
+		status seek(uint32_t position);
+
+		// Allocate clusters for another `length` bytes past the end of the file up front, as contiguously as possible, so
+		// writing doesn't have to search the FAT. Anything still unused is freed by close().
+		status reserve(uint32_t length);
+
+		// The contiguous sectors from the current position (which must be sector aligned) to the end of the current extent,
+		// clamped to the end of the file (or to the allocated clusters, if the file is being written). Doesn't move the position.
+		status extent(Extent &out) {return extent(position, out);}
+
+		// The same, but from offset (which must be sector aligned) instead of the current position. While the file is reserved
+		// that can be past the end, which lets the whole reservation be mapped out up front.
+		status extent(uint32_t offset, Extent &out);
+
+		// Move past length bytes that were written straight to the card through the sectors from extent(), growing the file if
+		// that's past the end. The clusters have to be allocated already (see reserve()).
+		status advance(uint32_t length);
+
+		// Write the size and first cluster back to the directory entry
+		status flush();
+
+		// Free any reserved clusters that weren't used, then flush
+		status close();
+
+		uint32_t size() const {return length;}
+		uint32_t tell() const {return position;}
+
+	private:
+		// Find the cluster holding cluster_index of the file, updating the cached extent
+		status locate(uint32_t cluster_index, uint32_t &cluster);
+		// Append a cluster to the end of the chain
+		status grow();
+		// Allocated clusters in the chain
+		status chain_length(uint32_t &clusters);
+		status open(const Entry &entry);
+
+		uint32_t first_cluster = 0, length = 0, position = 0;
+
+		// The directory entry
+		uint32_t entry_sector = 0;
+		uint16_t entry_index = 0;
+		bool dirty = false, reserved = false;
+
+		// Cached extent: clusters [extent_index, extent_index + extent_clusters) of the file start at extent_start
+		uint32_t extent_index = 0, extent_start = 0, extent_clusters = 0;
+	};
+}
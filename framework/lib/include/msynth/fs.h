@@ -15,6 +15,24 @@ namespace fs {
 	inline const uint16_t FileDeleted = (1 << 0);
 	inline const uint16_t FileMarkedForDeletion = (1 << 1);
 
+	// Pointers stored in the filesystem are 32 bit flash addresses. Host builds (the tests, which map images at their flash
+	// addresses) need a pointer type that's still 32 bits wide.
+#ifdef MSYNTH_HOST
+	template<typename T>
+	struct FlashPointer {
+		uint32_t address;
+
+		FlashPointer() = default;
+		FlashPointer(T * pointer) : address(static_cast<uint32_t>(reinterpret_cast<uintptr_t>(pointer))) {}
+
+		operator T *() const {return reinterpret_cast<T *>(static_cast<uintptr_t>(address));}
+		T& operator*() const {return *static_cast<T *>(*this);}
+	};
+#else
+	template<typename T>
+	using FlashPointer = T *;
+#endif
+
 	// DATATYPES
 	struct File {
 		char magic[4];
@@ -22,8 +40,8 @@ namespace fs {
 		uint32_t used_by;
 		uint16_t length;
 		uint16_t flags;
-		File * list_next;
-		File * revision_next;
+		FlashPointer<File> list_next;
+		FlashPointer<File> revision_next;
 
 		bool ok() const {
 			return magic[0] == 'f' && magic[1] == 'L' && magic[2] == 'e' && magic[3] == 'T';
@@ -101,7 +119,7 @@ namespace fs {
 		char magic[4];
 		char name[12];
 
-		File * list_top;
+		FlashPointer<File> list_top;
 		uint16_t flags;
 		uint16_t reserved;
 
@@ -134,6 +152,73 @@ namespace fs {
 		}
 	};
 
+	// PATH INDEX
+	//
+	// Version 3 images have an Index right after the Header: a minimal perfect hash of every file's path ("toplevel/name"),
+	// generated by fsgen.py (or by compaction), so a file can be found without walking its folder's chain. Version 2 indexes
+	// were missing generation and erases; they're skipped over but not used, so files in those images are searched for.
+	//
+	// The path's hash picks a bucket, and the bucket's displacement scatters it into a slot in the entries (index_slot).
+	// Displacements are chosen so no two paths share a slot, so the entry there is the only file the path can be. Entries
+	// point at the first revision of each file.
+	inline const uint8_t IndexVersion = 3;
+
+	struct IndexEntry {
+		uint32_t hash; // of the path, to skip comparing names for most paths that aren't this one
+		FlashPointer<File> file;
+		uint8_t toplevel; // index into Header::top_level
+		uint8_t reserved[3];
+	};
+
+	struct Index {
+		char magic[4];
+		uint16_t bucket_count; // power of two
+		uint16_t entry_count;
+		// All ones as long as every file is in the index. Cleared (which needs no erase) once files have been added
+		// without updating it, after which paths that aren't in it have to be searched for.
+		uint32_t complete;
+		uint32_t generation; // counts up with every compaction; breaks the tie if one was cut short before retiring the old copy
+		uint32_t erases; // of the sector this copy is in, as far as is known
+		uint16_t displacement[]; // [bucket_count], followed by padding to 4 bytes and IndexEntry[entry_count]
+
+		bool ok() const {
+			return magic[0] == 'f' && magic[1] == 'I' && magic[2] == 'd' && magic[3] == 'X';
+		}
+
+		const IndexEntry * entries() const {
+			return reinterpret_cast<const IndexEntry *>(displacement + ((bucket_count + 1) & ~1));
+		}
+
+		static constexpr uint32_t size(uint32_t bucket_count, uint32_t entry_count) {
+			return 20 + 2 * ((bucket_count + 1) & ~1) + sizeof(IndexEntry) * entry_count;
+		}
+	};
+
+	// FNV-1a of the first length bytes of path, finished with murmur3's mixer so the low bits depend on all of it.
+	// fsgen.py has to compute the same thing.
+	constexpr uint32_t path_hash(const char *path, uint32_t length) {
+		uint32_t hash = 0x811c9dc5;
+		for (uint32_t i = 0; i < length; ++i) {
+			hash ^= static_cast<uint8_t>(path[i]);
+			hash *= 0x01000193;
+		}
+		hash ^= hash >> 16;
+		hash *= 0x85ebca6b;
+		hash ^= hash >> 13;
+		hash *= 0xc2b2ae35;
+		hash ^= hash >> 16;
+		return hash;
+	}
+
+	// Where a path with this hash goes, given its bucket's displacement
+	constexpr uint32_t index_slot(uint32_t hash, uint16_t displacement, uint16_t entry_count) {
+		hash ^= displacement * 0x9e3779b9u;
+		hash ^= hash >> 15;
+		hash *= 0x2c1b3c6du;
+		hash ^= hash >> 12;
+		return hash % entry_count;
+	}
+
 	// BASIC ACCESS API
 	bool is_present(); // Tries to find the Filesystem
 	
@@ -150,6 +235,61 @@ namespace fs {
 	// Find a top-level folder.
 	const TopLevel* find(const char *path);
 
-	// Get a reference to a file
+	// Get a reference to a file (its latest revision). Uses the path index if the image has one, and remembers recent
+	// lookups, so loading the same resources again doesn't search for them again.
 	const File* get(const char *path);
+
+	// WRITING
+	//
+	// Nothing is ever changed in place. Writing a file that exists programs a new revision of it into the free space after
+	// everything else and links it from the old one's revision_next, a new file is linked onto the end of its folder's
+	// chain (creating the folder in a free slot if need be), and removing a file writes an empty revision flagged
+	// FileDeleted. All of that only programs erased words, so none of it needs an erase. Pointers to files (and their
+	// contents) stay valid until the next compaction.
+	//
+	// Once the filesystem fills up, compact() copies the latest revision of every live file into the spare sector (whichever
+	// of 0x080A0000 and 0x080E0000 isn't in use) along with a new index, and then retires the old copy, which becomes the
+	// next spare. Compaction happens a bit at a time, so it can be spread over the main loop, but it starts by erasing the
+	// spare, which stalls everything running from flash (interrupts included) for a second or so. A spare that holds an app
+	// is never touched.
+	enum struct write_status {
+		Ok,
+		InProgress, // compact() has more to do
+		NotPresent, // No filesystem
+		BadPath, // Not "folder/name", or the folder or name is too long
+		NotFound, // (remove) no such file
+		NoFolderSlot, // The folder doesn't exist and there's no free slot to create it in
+		Full, // No room left, compact() to get back what old revisions use
+		Busy, // Compacting, finish that first
+		SpareInUse, // The spare sector has something other than a filesystem in it
+		NoMemory,
+		FlashError
+	};
+
+	// Write a new revision of the file at path, creating it (and its folder) if it doesn't exist
+	write_status write(const char *path, const void *data, uint16_t length);
+
+	// Remove the file at path
+	write_status remove(const char *path);
+
+	// Compact into the spare sector, programming at most about budget bytes (so call it again while it returns InProgress).
+	// Reads keep going to the old copy until it's done.
+	write_status compact(uint32_t budget = 0xffff'ffff);
+	bool compacting();
+
+	// Space in the active copy, in bytes. Dead space is old revisions and deleted files, which compaction frees up.
+	struct Usage {
+		uint32_t live;
+		uint32_t dead;
+		uint32_t free;
+	};
+	Usage usage();
+
+	struct Wear {
+		uint32_t erases[2]; // of 0x080A0000 and 0x080E0000 over their lifetime, as recorded by the filesystem copies in them
+		uint32_t words_programmed; // since reset
+		uint32_t revisions_written; // since reset (including removals)
+		uint32_t compactions; // since reset
+	};
+	Wear wear();
 }
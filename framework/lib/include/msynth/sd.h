@@ -57,7 +57,7 @@ namespace sd {
 			CardTypeUndefined
 		} card_type = CardTypeUndefined;
 
-		// Card length (sectors)
+		// Card length (bytes)
 		uint64_t length = 0;
 
 		// Busy status
@@ -79,6 +79,8 @@ namespace sd {
 		uint8_t  NSAC; // data timeout * 100
 
 		// Various card info flags
+		bool high_speed = false; // Switched to high speed mode (CMD6) and clocked at 48MHz
+		bool set_block_count = false; // Supports CMD23, so multi-block transfers don't need a stop command
 	};
 
 	// Perform card initialization
@@ -93,6 +95,18 @@ namespace sd {
 	bool inserted();
 
 	// CARD ACCESS ROUTINES
+	//
+	// Asynchronous reads and writes are queued: if the card is busy with another transfer (or still programming the last
+	// write) the request waits behind it, up to queue_length requests. Requests are started from the SDIO interrupt when the
+	// previous one finishes, or from service(). Their callbacks are called from the interrupt.
+	//
+	// The blocking routines return Busy while anything asynchronous is running or queued.
+
+	constexpr inline int queue_length = 7;
+
+	// Start queued requests that had to wait for the card to finish programming a write. Call this regularly from the main loop
+	// when writing asynchronously.
+	void service();
 
 	// Read `length_in_sectors` sectors starting at address `address` into `result_buffer`, without DMA.
 	//
@@ -122,12 +136,15 @@ namespace sd {
 
 	// Write `length_in_sectors` sectors starting at address `address` from `source_buffer`, without DMA.
 	//
-	// This function will block until the data is transferred. There are no restrictions on the location of the result buffer
+	// This function will block until the data is programmed into the card. There are no restrictions on the location of the source buffer
 	access_status write(uint32_t address, const void * source_buffer, uint32_t length_in_sectors);
 
 	// Write `length_in_sectors` sectors starting at address `address` from `source_buffer` asynchronously with DMA,
 	// calling `callback` with argument `argument` and an access_status on completion/error.
 	//
+	// Multi-sector writes tell the card the length up front (ACMD23) so it can pre-erase. The callback happens once the data has
+	// been sent; the card finishes programming it in the background.
+	//
 	// The source buffer must be located in the RAM segment; note that the stack is usually placed into CCMRAM which will cause a 
 	// DMATransferError.
 	access_status write(uint32_t address, const void * source_buffer, uint32_t length_in_sectors, void (*callback)(void *, access_status), void * argument);
@@ -146,7 +163,7 @@ namespace sd {
 		return write(address, source_buffer, length_in_sectors, (void (*)(void *, access_status))callback, &instance);
 	}
 
-	// Erase `length_in_sectors` sectors starting at the address `address`
+	// Erase `length_in_sectors` sectors starting at the address `address`, blocking until the card is done.
 	access_status erase(uint32_t address, uint32_t length_in_sectors);
 
 	// Erase the entire card
@@ -0,0 +1,55 @@
+#pragma once
+// sdcache.h -- sector cache in front of the SD card
+//
+// A small LRU cache of single sectors (mostly for filesystem metadata, which gets looked at over and over) plus two read-ahead
+// buffers. When single sectors are read one after another the cache switches to reading a whole buffer's worth at once and
+// starts loading the next buffer with DMA in the background, so sequential reads mostly find their data already there.
+//
+// Writes are held in the cache until they're evicted or flush() is called, and adjacent dirty sectors are then written back
+// together as one multi-block write.
+//
+// Reads and writes of more than one sector skip the cache (keeping it coherent), since whoever asks for that many sectors has
+// already done the buffering.
+//
+// The sizes are set at build time with MSYNTH_SD_CACHE_SECTORS and MSYNTH_SD_READ_AHEAD. All the buffers are in regular SRAM
+// so the DMA can reach them.
+//
+// Nothing here knows about the asynchronous sd::read/sd::write; if those are used on sectors that might be cached, call
+// invalidate() afterwards.
+
+#include "sd.h"
+
+namespace sd::cache {
+	struct Stats {
+		uint32_t hits; // single sector reads found in the cache
+		uint32_t read_ahead_hits; // single sector reads found in a read-ahead buffer
+		uint32_t misses; // single sector reads that had to wait for the card
+		uint32_t read_ahead_sectors; // sectors read ahead in the background
+		uint32_t write_backs; // writes sent to the card
+		uint32_t sectors_written; // sectors in those writes
+
+		// Fraction of single sector reads that didn't have to wait for the card
+		float hit_rate() const {
+			uint32_t total = hits + read_ahead_hits + misses;
+			return total ? float(hits + read_ahead_hits) / total : 0.f;
+		}
+	};
+
+	// Read `length_in_sectors` sectors starting at `address`, blocking. There are no restrictions on the location of the buffer.
+	access_status read(uint32_t address, void * result_buffer, uint32_t length_in_sectors);
+
+	// Write `length_in_sectors` sectors starting at `address`. Single sectors only go to the cache; more go straight to the card.
+	access_status write(uint32_t address, const void * source_buffer, uint32_t length_in_sectors);
+
+	// Write back every dirty sector
+	access_status flush();
+
+	// Forget any cached copies of [address, address + length_in_sectors), including unwritten changes
+	void invalidate(uint32_t address, uint32_t length_in_sectors);
+
+	// Forget everything (e.g. when the card has been changed)
+	void invalidate();
+
+	const Stats& stats();
+	void reset_stats();
+}
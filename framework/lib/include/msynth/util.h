@@ -10,6 +10,8 @@
 #define MSYNTH_APPCODE_ERROR 0xc000
 
 #define CCMDATA __attribute__((section(".ccmdata")))
+// Zero-initialized CCMRAM; unlike CCMDATA this takes no space in flash, so use it for big buffers.
+#define CCMBSS __attribute__((section(".ccmbss")))
 
 namespace util {
 	template<int N, int D>
@@ -32,6 +34,12 @@ namespace util {
 
 	void delay(uint32_t ms);
 
+	// Turn on the DWT cycle counter used by cycles()
+	void enable_cycle_counter();
+
+	// Current CPU cycle count; wraps roughly every 25 seconds so only use it for differences
+	uint32_t cycles();
+
 	template<typename Return, typename ...Args>
 	struct FuncHolder {
 		typedef Return (*PtrType)(void * argument, Args...);
@@ -0,0 +1,147 @@
+#include <audiocodec.h>
+#include <string.h>
+
+// Audio decoders
+
+namespace {
+	const int16_t adpcm_steps[89] = {
+		7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45, 50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130,
+		143, 157, 173, 190, 209, 230, 253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963, 1060, 1166, 1282,
+		1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630,
+		9493, 10442, 11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+	};
+
+	const int8_t adpcm_index_steps[8] = {-1, -1, -1, -1, 2, 4, 6, 8};
+
+	inline int16_t clamp16(int32_t value) {
+		return value > INT16_MAX ? INT16_MAX : value < INT16_MIN ? INT16_MIN : value;
+	}
+
+	struct AdpcmChannel {
+		int32_t predictor;
+		int32_t index;
+
+		int16_t decode(uint8_t nibble) {
+			int32_t step = adpcm_steps[index];
+			int32_t diff = step >> 3;
+			if (nibble & 1) diff += step >> 2;
+			if (nibble & 2) diff += step >> 1;
+			if (nibble & 4) diff += step;
+			predictor = clamp16(nibble & 8 ? predictor - diff : predictor + diff);
+
+			index += adpcm_index_steps[nibble & 7];
+			index = index < 0 ? 0 : index > 88 ? 88 : index;
+			return predictor;
+		}
+	};
+
+	// MSB first bits out of a RingReader. Always has at least 25 bits buffered after refill().
+	struct BitReader {
+		audiocodec::RingReader& in;
+		uint32_t bits = 0;
+		int32_t count = 0;
+
+		void refill() {
+			while (count <= 24) {
+				bits |= static_cast<uint32_t>(in.next()) << (24 - count);
+				count += 8;
+			}
+		}
+
+		uint32_t read(uint32_t length) {
+			if (!length) return 0;
+			uint32_t value = bits >> (32 - length);
+			bits <<= length;
+			count -= length;
+			return value;
+		}
+
+		// Count (and skip) up to limit one bits, plus the zero after them if there are fewer than limit
+		uint32_t ones(uint32_t limit) {
+			uint32_t found = __builtin_clz(~bits | (1u << (31 - limit)));
+			read(found < limit ? found + 1 : limit);
+			return found;
+		}
+	};
+
+	constexpr uint32_t rice_escape = 15;
+	constexpr uint32_t rice_escape_bits = 19;
+}
+
+bool audiocodec::parse_header(const uint8_t * sector, Header& header) {
+	memcpy(&header, sector, sizeof header);
+	return header.magic == magic && header.version == 1 && header.channels == 2 && header.codec <= Codec::Rice;
+}
+
+void audiocodec::decode_adpcm(const uint8_t * block, int16_t * out) {
+	AdpcmChannel channels[2];
+	for (int channel = 0; channel < 2; ++channel) {
+		const uint8_t * header = block + channel * 4;
+		channels[channel].predictor = static_cast<int16_t>(header[0] | (header[1] << 8));
+		channels[channel].index = header[2] > 88 ? 88 : header[2];
+		out[channel] = channels[channel].predictor;
+	}
+
+	// 63 groups of 8 frames, 4 bytes per channel each
+	const uint8_t * in = block + 8;
+	out += 2;
+	for (int group = 0; group < 63; ++group, out += 16) {
+		for (int channel = 0; channel < 2; ++channel) {
+			for (int i = 0; i < 4; ++i) {
+				uint8_t byte = *in++;
+				out[i * 4 + channel] = channels[channel].decode(byte & 0xF);
+				out[i * 4 + 2 + channel] = channels[channel].decode(byte >> 4);
+			}
+		}
+	}
+}
+
+uint32_t audiocodec::rice_block_length(RingReader in) {
+	uint32_t low = in.next();
+	return low | (in.next() << 8);
+}
+
+uint32_t audiocodec::decode_rice(RingReader in, int16_t * out) {
+	auto read16 = [&]{
+		uint16_t low = in.next();
+		return static_cast<uint16_t>(low | (in.next() << 8));
+	};
+
+	read16(); // length
+	uint32_t frames = read16();
+	if (frames > rice_block_frames) frames = rice_block_frames;
+
+	// Previous two samples of each channel, and their Rice parameters
+	int32_t last[2], before[2];
+	uint32_t k[2];
+	for (int channel = 0; channel < 2; ++channel) {
+		before[channel] = static_cast<int16_t>(read16());
+		last[channel] = static_cast<int16_t>(read16());
+		k[channel] = in.next();
+		if (k[channel] > 16) k[channel] = 16;
+	}
+
+	for (uint32_t frame = 0; frame < 2 && frame < frames; ++frame) {
+		out[frame * 2] = frame ? last[0] : before[0];
+		out[frame * 2 + 1] = frame ? last[1] : before[1];
+	}
+
+	BitReader bits{in};
+	for (uint32_t frame = 2; frame < frames; ++frame) {
+		for (int channel = 0; channel < 2; ++channel) {
+			bits.refill();
+			uint32_t quotient = bits.ones(rice_escape);
+			bits.refill();
+
+			uint32_t value = quotient < rice_escape ? (quotient << k[channel]) | bits.read(k[channel]) : bits.read(rice_escape_bits);
+			int32_t residual = static_cast<int32_t>(value >> 1) ^ -static_cast<int32_t>(value & 1);
+
+			int32_t sample = clamp16(2 * last[channel] - before[channel] + residual);
+			before[channel] = last[channel];
+			last[channel] = sample;
+			out[frame * 2 + channel] = sample;
+		}
+	}
+
+	return frames;
+}
@@ -0,0 +1,262 @@
+#include <audiostream.h>
+#include <stm32f4xx.h>
+#include <string.h>
+
+// SD audio streaming
+
+namespace {
+	constexpr uint32_t sector_size = 512;
+
+	// Reads are started from both the SDIO and the I2S DMA interrupts, which can preempt each other
+	struct InterruptGuard {
+		InterruptGuard() : primask(__get_PRIMASK()) {
+			__disable_irq();
+		}
+		~InterruptGuard() {
+			__set_PRIMASK(primask);
+		}
+	private:
+		uint32_t primask;
+	};
+
+	template<typename T>
+	inline T min(T a, T b) {
+		return a < b ? a : b;
+	}
+}
+
+audiostream::Player::Player(void * ring, uint32_t ring_sectors) :
+	ring(static_cast<uint8_t *>(ring)), ring_sectors(ring_sectors) {}
+
+sd::access_status audiostream::Player::start(uint32_t sector, uint32_t offset, uint32_t length, audiocodec::Codec codec) {
+	stop();
+	if (codec == audiocodec::Codec::ImaAdpcm && offset % sector_size) return sd::access_status::InvalidAddress;
+
+	file = nullptr;
+	extent_sector = sector + offset / sector_size;
+	offset %= sector_size;
+	extent_left = (offset + length + sector_size - 1) / sector_size;
+	need_extent = false;
+
+	sectors_read = 0;
+	played = start_offset = offset;
+	end = offset + length;
+
+	this->codec = codec;
+	decoded_frames = decoded_position = 0;
+
+	statistics = {};
+	statistics.lowest_fill = ring_sectors;
+	last_error = sd::access_status::Ok;
+	running = true;
+
+	// Fill the ring before returning; every read starts the next one
+	kick();
+	wait();
+	return last_error;
+}
+
+sd::access_status audiostream::Player::start(fat::File& from, audiocodec::Codec codec) {
+	if (from.tell() % sector_size) return sd::access_status::InvalidAddress;
+
+	auto result = start(0, 0, 0, codec);
+	if (result != sd::access_status::Ok) return result;
+
+	file = &from;
+	end = from.size() - from.tell();
+	need_extent = true;
+	service();
+	wait();
+	return last_error;
+}
+
+void audiostream::Player::stop() {
+	running = false;
+	wait();
+}
+
+void audiostream::Player::wait() {
+	while (reading) sd::service();
+}
+
+void audiostream::Player::service() {
+	if (!need_extent || reading || !file) return;
+
+	// Look up where the rest of the file is, then skip past it
+	fat::Extent extent;
+	if (file->extent(extent) != fat::status::Ok) {
+		// Either the file is done or the FAT couldn't be read; nothing more to stream in both cases
+		need_extent = false;
+		end = min<uint32_t>(end, sectors_read * sector_size);
+		return;
+	}
+	uint32_t next = file->tell() + extent.length * sector_size;
+	file->seek(min(next, file->size()));
+
+	extent_sector = extent.sector;
+	extent_left = extent.length;
+	need_extent = false;
+	kick();
+}
+
+void audiostream::Player::kick() {
+	uint32_t at, count;
+	{
+		InterruptGuard guard;
+		if (reading || !running) return;
+		if (!extent_left) {
+			if (file && sectors_read * sector_size < end) need_extent = true;
+			return;
+		}
+
+		// The sector being played from can't be overwritten yet
+		uint32_t free = ring_sectors - (sectors_read - played / sector_size);
+		if (free < min_read_sectors && free < extent_left) return;
+
+		at = sectors_read % ring_sectors;
+		count = min(min(free, ring_sectors - at), min(extent_left, max_read_sectors));
+		if (!count) return;
+
+		reading = true;
+		read_length = count;
+	}
+
+	if (sd::read(extent_sector, ring + at * sector_size, count, on_read, this) != sd::access_status::InProgress) {
+		++statistics.read_errors;
+		last_error = sd::access_status::Busy;
+		reading = false;
+		return;
+	}
+	++statistics.reads;
+}
+
+void audiostream::Player::on_read(void * arg, sd::access_status status) {
+	auto& player = *static_cast<Player *>(arg);
+
+	if (status != sd::access_status::Ok) {
+		// Try again from the next render() rather than straight away from this interrupt
+		++player.statistics.read_errors;
+		player.last_error = status;
+		player.reading = false;
+		return;
+	}
+
+	player.extent_sector += player.read_length;
+	player.extent_left -= player.read_length;
+	player.sectors_read = player.sectors_read + player.read_length;
+	player.reading = false;
+	player.kick();
+}
+
+uint32_t audiostream::Player::available() {
+	if (!running) return 0;
+
+	uint32_t loaded = min(sectors_read * sector_size, end);
+	uint32_t result = loaded - played;
+	// Near the end the ring empties out anyway
+	if (loaded < end) statistics.lowest_fill = min(statistics.lowest_fill, result / sector_size);
+	return result;
+}
+
+void audiostream::Player::render(int16_t * out, uint32_t frames) {
+	if (codec == audiocodec::Codec::Pcm) {
+		render_pcm(out, frames);
+		kick();
+		return;
+	}
+
+	int32_t gain = volume;
+	uint32_t done = 0;
+	while (done < frames) {
+		if (decoded_position == decoded_frames && !decode_next()) break;
+
+		uint32_t chunk = min(frames - done, decoded_frames - decoded_position);
+		const int16_t * in = decoded + decoded_position * 2;
+		for (uint32_t i = 0; i < chunk * 2; ++i) {
+			*out++ = (*in++ * gain) >> 15;
+		}
+		decoded_position += chunk;
+		done += chunk;
+	}
+
+	if (done < frames) {
+		memset(out, 0, (frames - done) * 4);
+		if (running && played < end) {
+			++statistics.underruns;
+			statistics.silent_frames += frames - done;
+		}
+	}
+
+	kick();
+}
+
+void audiostream::Player::render_pcm(int16_t * out, uint32_t frames) {
+	uint32_t wanted = frames * 4;
+	uint32_t copied = min(wanted, available() & ~3u);
+	int32_t gain = volume;
+	uint32_t ring_bytes = ring_sectors * sector_size;
+	uint32_t position = played % ring_bytes;
+
+	for (uint32_t done = 0; done < copied;) {
+		// Up to the end of the ring
+		uint32_t chunk = min(copied - done, ring_bytes - position);
+		auto in = reinterpret_cast<const int16_t *>(ring + position);
+		for (uint32_t i = 0; i < chunk / 2; ++i) {
+			*out++ = (*in++ * gain) >> 15;
+		}
+		done += chunk;
+		position = 0;
+	}
+
+	if (copied < wanted) {
+		memset(out, 0, wanted - copied);
+		if (running && played + copied < end) {
+			++statistics.underruns;
+			statistics.silent_frames += (wanted - copied) / 4;
+		}
+	}
+
+	played = played + copied;
+}
+
+bool audiostream::Player::decode_next() {
+	uint32_t ready = available();
+	uint32_t ring_bytes = ring_sectors * sector_size;
+	audiocodec::RingReader in{ring, ring_bytes, played % ring_bytes};
+	uint32_t length;
+
+	if (codec == audiocodec::Codec::ImaAdpcm) {
+		// Blocks are sectors, so they never wrap around the ring
+		length = audiocodec::adpcm_block_bytes;
+		if (ready < length) return false;
+		audiocodec::decode_adpcm(ring + in.position, decoded);
+		decoded_frames = audiocodec::adpcm_block_frames;
+	}
+	else {
+		if (ready < 2) return false;
+		length = audiocodec::rice_block_length(in);
+		if (length < audiocodec::rice_block_header_bytes || length > ring_bytes - min_read_sectors * sector_size) {
+			// Garbage (or a block that could never fit); there's no way to find the next one, so that's the end
+			end = played;
+			return false;
+		}
+		if (ready < length) return false;
+		decoded_frames = audiocodec::decode_rice(in, decoded);
+	}
+
+	decoded_position = 0;
+	played = played + length;
+	return true;
+}
+
+void audiostream::Player::set_volume(uint32_t level) {
+	volume = min<uint32_t>(level, 32768);
+}
+
+bool audiostream::Player::finished() const {
+	return played >= end && decoded_position == decoded_frames;
+}
+
+uint32_t audiostream::Player::position() const {
+	return played - start_offset;
+}
@@ -0,0 +1,770 @@
+#include <fat.h>
+#include <sdcache.h>
+
+#include <string.h>
+#include <ctype.h>
+#include <strings.h>
+
+// FAT32 driver
+
+fat::Volume fat::volume;
+
+namespace {
+	constexpr uint32_t sector_size = 512;
+	constexpr uint32_t entries_per_sector = sector_size / 32;
+	constexpr uint32_t end_of_chain = 0x0FFF'FFFF;
+	constexpr uint32_t no_sector = 0xFFFF'FFFF;
+
+	// FAT entries have 28 bits; anything past the last cluster is an end of chain (or bad cluster) marker
+	inline bool is_end(uint32_t cluster) {
+		return cluster < 2 || cluster >= fat::volume.cluster_count + 2;
+	}
+
+	inline uint16_t get16(const uint8_t *at) {
+		return at[0] | (at[1] << 8);
+	}
+
+	inline uint32_t get32(const uint8_t *at) {
+		return at[0] | (at[1] << 8) | (at[2] << 16) | (static_cast<uint32_t>(at[3]) << 24);
+	}
+
+	inline void put16(uint8_t *at, uint16_t value) {
+		at[0] = value;
+		at[1] = value >> 8;
+	}
+
+	inline void put32(uint8_t *at, uint32_t value) {
+		put16(at, value);
+		put16(at + 2, value >> 16);
+	}
+
+	// SECTOR IO
+	//
+	// Both buffers are in regular SRAM and word aligned so they can be used for DMA too.
+
+	alignas(4) uint8_t sector_buffer[sector_size];
+	uint32_t buffered_sector = no_sector;
+	bool buffer_dirty = false;
+
+	alignas(4) uint8_t fat_buffer[sector_size];
+	uint32_t fat_buffered_sector = no_sector; // relative to the start of the FAT
+	bool fat_dirty = false;
+
+	// Everything goes through the sector cache, which keeps the FAT and directories that don't fit in the two buffers here
+	fat::status disk_read(uint32_t sector, void *buffer, uint32_t count) {
+		return sd::cache::read(sector, buffer, count) == sd::access_status::Ok ? fat::status::Ok : fat::status::DiskError;
+	}
+
+	fat::status disk_write(uint32_t sector, const void *buffer, uint32_t count) {
+		return sd::cache::write(sector, buffer, count) == sd::access_status::Ok ? fat::status::Ok : fat::status::DiskError;
+	}
+
+	fat::status disk_flush() {
+		return sd::cache::flush() == sd::access_status::Ok ? fat::status::Ok : fat::status::DiskError;
+	}
+
+	fat::status store() {
+		if (!buffer_dirty) return fat::status::Ok;
+		buffer_dirty = false;
+		return disk_write(buffered_sector, sector_buffer, 1);
+	}
+
+	fat::status load(uint32_t sector) {
+		if (sector == buffered_sector) return fat::status::Ok;
+		if (auto result = store(); result != fat::status::Ok) return result;
+
+		buffered_sector = no_sector;
+		if (auto result = disk_read(sector, sector_buffer, 1); result != fat::status::Ok) return result;
+		buffered_sector = sector;
+		return fat::status::Ok;
+	}
+
+	// Use the sector buffer for a sector that's about to be completely overwritten
+	fat::status load_blank(uint32_t sector) {
+		if (auto result = store(); result != fat::status::Ok) return result;
+		memset(sector_buffer, 0, sector_size);
+		buffered_sector = sector;
+		return fat::status::Ok;
+	}
+
+	// Forget the buffered sector if it's in [sector, sector + count), since it's been written directly
+	void invalidate(uint32_t sector, uint32_t count) {
+		if (buffered_sector >= sector && buffered_sector - sector < count) {
+			buffered_sector = no_sector;
+			buffer_dirty = false;
+		}
+	}
+
+	// FAT ACCESS
+
+	fat::status fat_flush() {
+		if (!fat_dirty) return fat::status::Ok;
+		fat_dirty = false;
+
+		// Keep every copy of the FAT in sync
+		for (uint8_t i = 0; i < fat::volume.fat_count; ++i) {
+			uint32_t sector = fat::volume.fat_start + i * fat::volume.fat_sectors + fat_buffered_sector;
+			if (auto result = disk_write(sector, fat_buffer, 1); result != fat::status::Ok) return result;
+		}
+		return fat::status::Ok;
+	}
+
+	fat::status fat_load(uint32_t cluster) {
+		uint32_t sector = cluster / (sector_size / 4);
+		if (sector == fat_buffered_sector) return fat::status::Ok;
+		if (auto result = fat_flush(); result != fat::status::Ok) return result;
+
+		fat_buffered_sector = no_sector;
+		if (auto result = disk_read(fat::volume.fat_start + sector, fat_buffer, 1); result != fat::status::Ok) return result;
+		fat_buffered_sector = sector;
+		return fat::status::Ok;
+	}
+
+	fat::status fat_get(uint32_t cluster, uint32_t &next) {
+		if (auto result = fat_load(cluster); result != fat::status::Ok) return result;
+		next = get32(fat_buffer + (cluster % (sector_size / 4)) * 4) & 0x0FFF'FFFF;
+		return fat::status::Ok;
+	}
+
+	fat::status fat_set(uint32_t cluster, uint32_t value) {
+		if (auto result = fat_load(cluster); result != fat::status::Ok) return result;
+		uint8_t *entry = fat_buffer + (cluster % (sector_size / 4)) * 4;
+		// The top 4 bits are reserved and must be preserved
+		put32(entry, (get32(entry) & 0xF000'0000) | (value & 0x0FFF'FFFF));
+		fat_dirty = true;
+		return fat::status::Ok;
+	}
+
+	// The free cluster count in FSInfo is only a hint, so rather than keeping it up to date mark it as unknown the first time
+	// anything is allocated or freed
+	fat::status invalidate_fsinfo() {
+		if (fat::volume.fsinfo_stale || !fat::volume.fsinfo_sector) return fat::status::Ok;
+		if (auto result = load(fat::volume.fsinfo_sector); result != fat::status::Ok) return result;
+		if (get32(sector_buffer) == 0x4161'5252 && get32(sector_buffer + 484) == 0x6141'7272) {
+			put32(sector_buffer + 488, 0xFFFF'FFFF);
+			buffer_dirty = true;
+		}
+		fat::volume.fsinfo_stale = true;
+		return fat::status::Ok;
+	}
+
+	// Allocate a cluster, preferring the one right after `after` to keep files contiguous, and link it onto after's chain
+	// (if after isn't 0).
+	fat::status allocate(uint32_t after, uint32_t &allocated) {
+		if (auto result = invalidate_fsinfo(); result != fat::status::Ok) return result;
+
+		uint32_t start = after ? after + 1 : fat::volume.free_hint;
+		for (uint32_t i = 0; i < fat::volume.cluster_count; ++i) {
+			uint32_t candidate = start + i;
+			if (candidate >= fat::volume.cluster_count + 2) candidate -= fat::volume.cluster_count;
+
+			uint32_t value;
+			if (auto result = fat_get(candidate, value); result != fat::status::Ok) return result;
+			if (value) continue;
+
+			if (auto result = fat_set(candidate, end_of_chain); result != fat::status::Ok) return result;
+			if (after) {
+				if (auto result = fat_set(after, candidate); result != fat::status::Ok) return result;
+			}
+
+			allocated = candidate;
+			fat::volume.free_hint = candidate + 1 < fat::volume.cluster_count + 2 ? candidate + 1 : 2;
+			return fat::status::Ok;
+		}
+		return fat::status::Full;
+	}
+
+	// Free a chain, starting at cluster
+	fat::status free_chain(uint32_t cluster) {
+		if (auto result = invalidate_fsinfo(); result != fat::status::Ok) return result;
+
+		while (!is_end(cluster)) {
+			uint32_t next;
+			if (auto result = fat_get(cluster, next); result != fat::status::Ok) return result;
+			if (auto result = fat_set(cluster, 0); result != fat::status::Ok) return result;
+			if (cluster < fat::volume.free_hint) fat::volume.free_hint = cluster;
+			cluster = next;
+		}
+		return fat::status::Ok;
+	}
+
+	fat::status zero_cluster(uint32_t cluster) {
+		uint32_t sector = fat::volume.cluster_sector(cluster);
+		for (uint32_t i = 0; i < (1u << fat::volume.cluster_shift); ++i) {
+			if (auto result = load_blank(sector + i); result != fat::status::Ok) return result;
+			buffer_dirty = true;
+		}
+		return store();
+	}
+
+	// NAMES
+
+	// Format a raw 11 byte name as NAME.EXT
+	void format_short_name(const uint8_t *raw, char *out) {
+		int length = 0;
+		for (int i = 0; i < 8 && raw[i] != ' '; ++i) out[length++] = raw[i];
+		if (raw[8] != ' ') {
+			out[length++] = '.';
+			for (int i = 8; i < 11 && raw[i] != ' '; ++i) out[length++] = raw[i];
+		}
+		out[length] = 0;
+		// 0xE5 as the first character is stored as 0x05
+		if (out[0] == 0x05) out[0] = static_cast<char>(0xE5);
+	}
+
+	// Convert name into a raw 11 byte 8.3 name. Only uppercases; no long name generation.
+	bool make_short_name(const char *name, size_t length, uint8_t *raw) {
+		memset(raw, ' ', 11);
+		if (!length || name[0] == '.') return false;
+
+		size_t i = 0, j = 0;
+		for (; i < length && name[i] != '.'; ++i, ++j) {
+			if (j == 8) return false;
+			raw[j] = toupper(name[i]);
+		}
+		if (i < length) {
+			++i;
+			for (j = 8; i < length; ++i, ++j) {
+				if (j == 11 || name[i] == '.') return false;
+				raw[j] = toupper(name[i]);
+			}
+		}
+
+		for (j = 0; j < 11; ++j) {
+			if (raw[j] < ' ' || strchr("\"*+,/:;<=>?[\\]|", raw[j])) return false;
+		}
+		return true;
+	}
+
+	bool name_matches(const fat::Entry &entry, const char *name, size_t length) {
+		auto equal = [&](const char *candidate){
+			return strlen(candidate) == length && strncasecmp(candidate, name, length) == 0;
+		};
+		return equal(entry.name) || equal(entry.short_name);
+	}
+
+	// Split off the next component of path, returning its length and advancing path past it
+	size_t next_component(const char *&path, const char *&component) {
+		while (*path == '/') ++path;
+		component = path;
+		while (*path && *path != '/') ++path;
+		return path - component;
+	}
+
+	// Find `name` in the directory dir
+	fat::status find(fat::Dir &dir, const char *name, size_t length, fat::Entry &entry) {
+		fat::status result;
+		while ((result = dir.next(entry)) == fat::status::Ok) {
+			if (name_matches(entry, name, length)) return fat::status::Ok;
+		}
+		return result == fat::status::EndOfDirectory ? fat::status::NotFound : result;
+	}
+
+	// Walk path to its last component, opening the directory it's in. The last component is returned in name/length.
+	fat::status walk(const char *path, fat::Dir &dir, const char *&name, size_t &length) {
+		if (!fat::volume.mounted) return fat::status::NotMounted;
+		if (auto result = dir.open("/"); result != fat::status::Ok) return result;
+
+		length = next_component(path, name);
+		while (true) {
+			const char *next;
+			size_t next_length = next_component(path, next);
+			if (!next_length) return fat::status::Ok;
+
+			fat::Entry entry;
+			if (auto result = find(dir, name, length, entry); result != fat::status::Ok) return result;
+			if (!entry.is_directory()) return fat::status::NotADirectory;
+			if (auto result = dir.open(entry.first_cluster ? entry.first_cluster : fat::volume.root_cluster); result != fat::status::Ok) return result;
+
+			name = next;
+			length = next_length;
+		}
+	}
+}
+
+// VOLUME
+
+fat::status fat::mount() {
+	volume.mounted = false;
+	buffered_sector = fat_buffered_sector = no_sector;
+	buffer_dirty = fat_dirty = false;
+
+	if (sd::card.status != sd::init_status::Ok) return status::NoCard;
+	sd::cache::invalidate();
+
+	// Either the MBR or an unpartitioned card's boot sector
+	if (auto result = load(0); result != status::Ok) return result;
+	if (get16(sector_buffer + 510) != 0xAA55) return status::NoFilesystem;
+
+	uint32_t start = 0;
+	if (memcmp(sector_buffer + 82, "FAT32", 5) != 0) {
+		for (int i = 0; i < 4; ++i) {
+			const uint8_t *partition = sector_buffer + 446 + i * 16;
+			if (partition[4] == 0x0B || partition[4] == 0x0C) {
+				start = get32(partition + 8);
+				break;
+			}
+		}
+		if (!start) return status::NoFilesystem;
+		if (auto result = load(start); result != status::Ok) return result;
+		if (get16(sector_buffer + 510) != 0xAA55) return status::NoFilesystem;
+	}
+
+	// Parse the BPB
+	uint8_t sectors_per_cluster = sector_buffer[13];
+	uint32_t reserved = get16(sector_buffer + 14);
+	uint32_t total = get16(sector_buffer + 19) ? get16(sector_buffer + 19) : get32(sector_buffer + 32);
+
+	if (get16(sector_buffer + 11) != sector_size || !sectors_per_cluster || (sectors_per_cluster & (sectors_per_cluster - 1))) return status::NoFilesystem;
+	if (get16(sector_buffer + 17) != 0 || get32(sector_buffer + 36) == 0) return status::NoFilesystem; // FAT12/16 have a fixed root
+
+	volume.cluster_shift = __builtin_ctz(sectors_per_cluster);
+	volume.fat_count = sector_buffer[16];
+	volume.fat_sectors = get32(sector_buffer + 36);
+	volume.fat_start = start + reserved;
+	volume.data_start = volume.fat_start + volume.fat_count * volume.fat_sectors;
+	volume.cluster_count = (total - (volume.data_start - start)) >> volume.cluster_shift;
+	volume.root_cluster = get32(sector_buffer + 44);
+	volume.fsinfo_sector = get16(sector_buffer + 48) ? start + get16(sector_buffer + 48) : 0;
+	volume.free_hint = 2;
+	volume.fsinfo_stale = false;
+
+	if (volume.cluster_count < 65525) return status::NoFilesystem;
+
+	volume.mounted = true;
+	return status::Ok;
+}
+
+fat::status fat::sync() {
+	if (auto result = fat_flush(); result != status::Ok) return result;
+	if (auto result = store(); result != status::Ok) return result;
+	return disk_flush();
+}
+
+// DIRECTORIES
+
+fat::status fat::Dir::open(uint32_t cluster) {
+	first_cluster = cluster;
+	return rewind();
+}
+
+fat::status fat::Dir::open(const char * path) {
+	if (!volume.mounted) return status::NotMounted;
+
+	const char *name;
+	size_t length = next_component(path, name);
+	if (!length) return open(volume.root_cluster);
+
+	// Open as a file path, then make sure it's a directory
+	Dir parent;
+	if (auto result = walk(name, parent, name, length); result != status::Ok) return result;
+
+	Entry entry;
+	if (auto result = find(parent, name, length, entry); result != status::Ok) return result;
+	if (!entry.is_directory()) return status::NotADirectory;
+	return open(entry.first_cluster ? entry.first_cluster : volume.root_cluster);
+}
+
+fat::status fat::Dir::rewind() {
+	cluster = first_cluster;
+	index = 0;
+	return status::Ok;
+}
+
+fat::status fat::Dir::next_raw(uint8_t *&raw, uint32_t &sector, uint16_t &entry_index) {
+	uint32_t entries_per_cluster = entries_per_sector << volume.cluster_shift;
+	if (index == entries_per_cluster) {
+		uint32_t next;
+		if (auto result = fat_get(cluster, next); result != status::Ok) return result;
+		if (is_end(next)) return status::EndOfDirectory;
+		cluster = next;
+		index = 0;
+	}
+
+	sector = volume.cluster_sector(cluster) + index / entries_per_sector;
+	entry_index = index % entries_per_sector;
+	if (auto result = load(sector); result != status::Ok) return result;
+
+	raw = sector_buffer + entry_index * 32;
+	++index;
+	return status::Ok;
+}
+
+fat::status fat::Dir::next(Entry &entry) {
+	bool have_long_name = false;
+	entry.name[0] = 0;
+
+	while (true) {
+		uint8_t *raw;
+		if (auto result = next_raw(raw, entry.sector, entry.index); result != status::Ok) return result;
+
+		if (raw[0] == 0) {
+			// End marker; stay on it
+			--index;
+			return status::EndOfDirectory;
+		}
+		if (raw[0] == 0xE5) {
+			have_long_name = false;
+			continue;
+		}
+
+		uint8_t attributes = raw[11];
+		if ((attributes & Entry::AttributeLongName) == Entry::AttributeLongName) {
+			// Long name entries come last part first, each with 13 UCS-2 characters. Only the low byte is kept.
+			static const uint8_t offsets[13] = {1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30};
+			size_t base = ((raw[0] & 0x1f) - 1) * 13;
+			if (raw[0] & 0x40) {
+				have_long_name = base + 13 < sizeof(entry.name);
+				if (have_long_name) entry.name[base + 13] = 0;
+			}
+			if (!have_long_name) continue;
+
+			for (int i = 0; i < 13; ++i) {
+				uint16_t c = get16(raw + offsets[i]);
+				entry.name[base + i] = c == 0xFFFF ? 0 : (c > 0x7F ? '?' : c);
+			}
+			continue;
+		}
+		if (attributes & Entry::AttributeVolume) {
+			have_long_name = false;
+			continue;
+		}
+
+		format_short_name(raw, entry.short_name);
+		if (!have_long_name) strcpy(entry.name, entry.short_name);
+		entry.attributes = attributes;
+		entry.first_cluster = (static_cast<uint32_t>(get16(raw + 20)) << 16) | get16(raw + 26);
+		entry.size = get32(raw + 28);
+		return status::Ok;
+	}
+}
+
+// FILES
+
+fat::status fat::File::open(const Entry &entry) {
+	if (entry.is_directory()) return status::NotAFile;
+
+	first_cluster = entry.first_cluster;
+	length = entry.size;
+	position = 0;
+	entry_sector = entry.sector;
+	entry_index = entry.index;
+	dirty = reserved = false;
+	extent_index = extent_start = extent_clusters = 0;
+	return status::Ok;
+}
+
+fat::status fat::File::open(const char * path) {
+	Dir dir;
+	const char *name;
+	size_t name_length;
+	if (auto result = walk(path, dir, name, name_length); result != status::Ok) return result;
+	if (!name_length) return status::NotAFile;
+
+	Entry entry;
+	if (auto result = find(dir, name, name_length, entry); result != status::Ok) return result;
+	return open(entry);
+}
+
+fat::status fat::File::create(const char * path) {
+	Dir dir;
+	const char *name;
+	size_t name_length;
+	if (auto result = walk(path, dir, name, name_length); result != status::Ok) return result;
+
+	uint8_t short_name[11];
+	if (!make_short_name(name, name_length, short_name)) return status::InvalidName;
+
+	Entry entry;
+	if (auto result = find(dir, name, name_length, entry); result != status::NotFound) {
+		return result == status::Ok ? status::AlreadyExists : result;
+	}
+
+	// Find a free slot
+	dir.rewind();
+	uint8_t *raw;
+	while (true) {
+		auto result = dir.next_raw(raw, entry.sector, entry.index);
+		if (result == status::Ok && (raw[0] == 0 || raw[0] == 0xE5)) break;
+		if (result == status::Ok) continue;
+		if (result != status::EndOfDirectory) return result;
+
+		// Directory is full, add a cluster to it
+		uint32_t added;
+		if (auto result = allocate(dir.cluster, added); result != status::Ok) return result;
+		if (auto result = zero_cluster(added); result != status::Ok) return result;
+	}
+
+	// The sector buffer might have moved while allocating
+	if (auto result = load(entry.sector); result != status::Ok) return result;
+	raw = sector_buffer + entry.index * 32;
+	memset(raw, 0, 32);
+	memcpy(raw, short_name, 11);
+	raw[11] = Entry::AttributeArchive;
+	// No RTC, so everything is made on 2020-01-01
+	put16(raw + 16, (40 << 9) | (1 << 5) | 1);
+	put16(raw + 18, (40 << 9) | (1 << 5) | 1);
+	put16(raw + 24, (40 << 9) | (1 << 5) | 1);
+	buffer_dirty = true;
+
+	entry.attributes = Entry::AttributeArchive;
+	entry.first_cluster = 0;
+	entry.size = 0;
+	return open(entry);
+}
+
+fat::status fat::File::locate(uint32_t cluster_index, uint32_t &cluster) {
+	if (!first_cluster) return status::EndOfFile;
+
+	// Start over from the beginning when going backwards
+	if (!extent_clusters || cluster_index < extent_index) {
+		extent_index = 0;
+		extent_start = first_cluster;
+		extent_clusters = 0;
+	}
+
+	while (true) {
+		if (extent_clusters == 0) {
+			// Measure the run starting at extent_start
+			uint32_t next;
+			extent_clusters = 1;
+			while (true) {
+				if (auto result = fat_get(extent_start + extent_clusters - 1, next); result != status::Ok) return result;
+				if (next != extent_start + extent_clusters) break;
+				++extent_clusters;
+			}
+		}
+
+		if (cluster_index < extent_index + extent_clusters) {
+			cluster = extent_start + (cluster_index - extent_index);
+			return status::Ok;
+		}
+
+		// Move on to the next extent
+		uint32_t next;
+		if (auto result = fat_get(extent_start + extent_clusters - 1, next); result != status::Ok) return result;
+		if (is_end(next)) return status::EndOfFile;
+
+		extent_index += extent_clusters;
+		extent_start = next;
+		extent_clusters = 0;
+	}
+}
+
+fat::status fat::File::chain_length(uint32_t &clusters) {
+	if (!first_cluster) {
+		clusters = 0;
+		return status::Ok;
+	}
+
+	// Find the last extent
+	uint32_t cluster;
+	if (auto result = locate(0xFFFF'FFFF, cluster); result != status::EndOfFile) return result == status::Ok ? status::DiskError : result;
+	clusters = extent_index + extent_clusters;
+	return status::Ok;
+}
+
+fat::status fat::File::grow() {
+	uint32_t clusters;
+	if (auto result = chain_length(clusters); result != status::Ok) return result;
+
+	uint32_t last = first_cluster ? extent_start + extent_clusters - 1 : 0;
+	uint32_t added;
+	if (auto result = allocate(last, added); result != status::Ok) return result;
+
+	if (!first_cluster) {
+		first_cluster = added;
+		dirty = true;
+	}
+
+	// Extend the cached extent if the new cluster is contiguous with it
+	if (last && added == last + 1) ++extent_clusters;
+	else {
+		extent_index = clusters;
+		extent_start = added;
+		extent_clusters = 1;
+	}
+	return status::Ok;
+}
+
+fat::status fat::File::read(void * buffer, uint32_t count, uint32_t &done) {
+	uint8_t *out = static_cast<uint8_t *>(buffer);
+	done = 0;
+
+	if (position >= length) return status::EndOfFile;
+	if (count > length - position) count = length - position;
+
+	uint32_t cluster_bytes_shift = 9 + volume.cluster_shift;
+	while (count) {
+		uint32_t cluster;
+		if (auto result = locate(position >> cluster_bytes_shift, cluster); result != status::Ok) return result;
+
+		uint32_t sector = volume.cluster_sector(cluster) + ((position >> 9) & ((1u << volume.cluster_shift) - 1));
+		uint32_t offset = position & (sector_size - 1);
+		uint32_t chunk;
+
+		if (offset == 0 && count >= sector_size && !(reinterpret_cast<uintptr_t>(out) & 3)) {
+			// Whole sectors, straight into the buffer and as many as are contiguous
+			uint32_t contiguous = volume.cluster_sector(extent_start + extent_clusters) - sector;
+			uint32_t sectors = count / sector_size < contiguous ? count / sector_size : contiguous;
+
+			if (auto result = store(); result != status::Ok) return result;
+			if (auto result = disk_read(sector, out, sectors); result != status::Ok) return result;
+			chunk = sectors * sector_size;
+		}
+		else {
+			if (auto result = load(sector); result != status::Ok) return result;
+			chunk = sector_size - offset < count ? sector_size - offset : count;
+			memcpy(out, sector_buffer + offset, chunk);
+		}
+
+		out += chunk;
+		position += chunk;
+		done += chunk;
+		count -= chunk;
+	}
+
+	return status::Ok;
+}
+
+fat::status fat::File::write(const void * buffer, uint32_t count) {
+	const uint8_t *in = static_cast<const uint8_t *>(buffer);
+	uint32_t cluster_bytes_shift = 9 + volume.cluster_shift;
+
+	while (count) {
+		uint32_t cluster;
+		auto located = locate(position >> cluster_bytes_shift, cluster);
+		if (located == status::EndOfFile) {
+			if (auto result = grow(); result != status::Ok) return result;
+			continue;
+		}
+		if (located != status::Ok) return located;
+
+		uint32_t sector = volume.cluster_sector(cluster) + ((position >> 9) & ((1u << volume.cluster_shift) - 1));
+		uint32_t offset = position & (sector_size - 1);
+		uint32_t chunk;
+
+		if (offset == 0 && count >= sector_size && !(reinterpret_cast<uintptr_t>(in) & 3)) {
+			uint32_t contiguous = volume.cluster_sector(extent_start + extent_clusters) - sector;
+			uint32_t sectors = count / sector_size < contiguous ? count / sector_size : contiguous;
+
+			invalidate(sector, sectors);
+			if (auto result = disk_write(sector, in, sectors); result != status::Ok) return result;
+			chunk = sectors * sector_size;
+		}
+		else {
+			// Don't bother reading sectors that only have garbage past the end of the file
+			auto result = offset == 0 && position >= length ? load_blank(sector) : load(sector);
+			if (result != status::Ok) return result;
+
+			chunk = sector_size - offset < count ? sector_size - offset : count;
+			memcpy(sector_buffer + offset, in, chunk);
+			buffer_dirty = true;
+		}
+
+		in += chunk;
+		position += chunk;
+		count -= chunk;
+		if (position > length) {
+			length = position;
+			dirty = true;
+		}
+	}
+
+	return status::Ok;
+}
+
+fat::status fat::File::seek(uint32_t to) {
+	if (to > length) return status::EndOfFile;
+	position = to;
+	return status::Ok;
+}
+
+fat::status fat::File::reserve(uint32_t extra) {
+	uint32_t cluster_bytes = sector_size << volume.cluster_shift;
+	uint32_t needed = (length + extra + cluster_bytes - 1) / cluster_bytes;
+
+	uint32_t clusters;
+	if (auto result = chain_length(clusters); result != status::Ok) return result;
+	for (; clusters < needed; ++clusters) {
+		if (auto result = grow(); result != status::Ok) return result;
+	}
+
+	reserved = true;
+	return status::Ok;
+}
+
+fat::status fat::File::extent(uint32_t offset, Extent &out) {
+	if (offset & (sector_size - 1)) return status::EndOfFile;
+	if (!reserved && offset >= length) return status::EndOfFile;
+
+	uint32_t cluster;
+	if (auto result = locate(offset >> (9 + volume.cluster_shift), cluster); result != status::Ok) return result;
+
+	out.sector = volume.cluster_sector(cluster) + ((offset >> 9) & ((1u << volume.cluster_shift) - 1));
+	out.length = volume.cluster_sector(extent_start + extent_clusters) - out.sector;
+
+	// Reading can't go past the end of the file, but writing can use everything that's allocated
+	if (!reserved) {
+		uint32_t left = (length - offset + sector_size - 1) / sector_size;
+		if (out.length > left) out.length = left;
+		if (!out.length) return status::EndOfFile;
+	}
+	return status::Ok;
+}
+
+fat::status fat::File::advance(uint32_t count) {
+	if (!count) return status::Ok;
+
+	// Make sure the clusters are really there (this also moves the cached extent along for the next extent())
+	uint32_t cluster;
+	if (auto result = locate((position + count - 1) >> (9 + volume.cluster_shift), cluster); result != status::Ok) return result;
+
+	position += count;
+	if (position > length) {
+		length = position;
+		dirty = true;
+	}
+	return status::Ok;
+}
+
+fat::status fat::File::flush() {
+	if (!dirty) return sync();
+
+	if (auto result = load(entry_sector); result != status::Ok) return result;
+	uint8_t *raw = sector_buffer + entry_index * 32;
+	put16(raw + 20, first_cluster >> 16);
+	put16(raw + 26, first_cluster);
+	put32(raw + 28, length);
+	buffer_dirty = true;
+	dirty = false;
+
+	return sync();
+}
+
+fat::status fat::File::close() {
+	if (reserved) {
+		reserved = false;
+
+		// Cut the chain after the last cluster that's actually used
+		uint32_t cluster_bytes = sector_size << volume.cluster_shift;
+		uint32_t used = (length + cluster_bytes - 1) / cluster_bytes;
+		if (!used && first_cluster) {
+			if (auto result = free_chain(first_cluster); result != status::Ok) return result;
+			first_cluster = 0;
+			dirty = true;
+		}
+		else if (used) {
+			uint32_t last, next;
+			if (auto result = locate(used - 1, last); result != status::Ok) return result;
+			if (auto result = fat_get(last, next); result != status::Ok) return result;
+			if (!is_end(next)) {
+				if (auto result = fat_set(last, end_of_chain); result != status::Ok) return result;
+				if (auto result = free_chain(next); result != status::Ok) return result;
+			}
+		}
+		extent_clusters = 0;
+	}
+
+	return flush();
+}
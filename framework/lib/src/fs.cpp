@@ -1,6 +1,9 @@
 #include "fs.h"
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stm32f4xx.h>
 
 struct PathInfo {
 	char toplevel_name[13] = {0};
@@ -16,6 +19,8 @@ struct PathInfo {
 		for (i = 0; i < length; ++i) {
 			if (from[i] != '/') continue;
 			else {
+				// (names that don't fit would otherwise be cut short into one that might exist)
+				if (i > 12 || length-i-1 > 16) return;
 				this->is_valid = true;
 				strncpy(this->toplevel_name, from, i);
 				if (i == length-1) return;
@@ -24,6 +29,7 @@ struct PathInfo {
 		}
 
 		if (i == length) {
+			if (length > 12) return;
 			strncpy(this->toplevel_name, from, length);
 			this->is_valid = true;
 			return;
@@ -34,16 +40,57 @@ struct PathInfo {
 	}
 };
 
+static_assert(sizeof(fs::Header) == 0x188, "fsgen.py puts the files (or the index) right after the header");
+
+namespace {
+	// The two places the filesystem can be, and their flash sectors
+	constexpr uint32_t copy_base[2] = {0x080A'0000, 0x080E'0000};
+	constexpr uint32_t copy_sector[2] = {9, 11};
+	constexpr uint32_t copy_size = 0x2'0000;
+
+	constexpr uint32_t erased = 0xffff'ffff;
+
+	const fs::Header& header_at(int copy) {
+		return *reinterpret_cast<const fs::Header *>(copy_base[copy]);
+	}
+
+	const fs::Index * path_index(const fs::Header& header) {
+		if (header.version < fs::IndexVersion) return nullptr;
+		const auto * index = reinterpret_cast<const fs::Index *>(&header + 1);
+		return index->ok() ? index : nullptr;
+	}
+
+	// How much space the index takes up, including a version 2 one that path_index won't use (its header was 8 bytes shorter)
+	uint32_t index_space(const fs::Header& header) {
+		const auto * index = reinterpret_cast<const fs::Index *>(&header + 1);
+		if (header.version < 2 || !index->ok()) return 0;
+		uint32_t size = fs::Index::size(index->bucket_count, index->entry_count);
+		return header.version < fs::IndexVersion ? size - 2 * sizeof(uint32_t) : size;
+	}
+
+	uint32_t generation(const fs::Header& header) {
+		const auto * index = path_index(header);
+		return index ? index->generation : 0;
+	}
+
+	// Which copy is in use. Both are only valid if a compaction was cut short right before retiring the old one, and then
+	// the new one has all the same files anyway.
+	int active_copy() {
+		bool low = header_at(0).ok(), high = header_at(1).ok();
+		if (low && high) return generation(header_at(0)) > generation(header_at(1)) ? 0 : 1;
+		return low ? 0 : 1;
+	}
+}
+
 const fs::Header& fs_header() {
-	return ((fs::Header *)0x080E'0000)->ok() ?
-		*((fs::Header *)0x080E'0000) : *((fs::Header *)0x080E'0000);
+	return header_at(active_copy());
 }
 
 bool fs::is_present() {
 	// The filesystem is ALWAYS at the end of flash, and is only ever a maximum of two sectors large. Search for it
 	// there
 	
-	return ((fs::Header *)0x080E'0000)->ok() || ((fs::Header *)0x080A'0000)->ok();
+	return header_at(1).ok() || header_at(0).ok();
 }
 
 const fs::TopLevel * fs::find(const char * path) {
@@ -60,7 +107,8 @@ const fs::TopLevel * fs::find(const char * path) {
 		if (!(mask & header.sector_use_mask) || !toplevel.ok()) {
 			mask <<= 1;
 		}
-		else if (strcmp(toplevel.name, pi.toplevel_name) == 0) {
+		// (names that fill the field aren't terminated)
+		else if (strncmp(toplevel.name, pi.toplevel_name, sizeof toplevel.name) == 0) {
 			// Make sure it's not deleted
 			return &toplevel;
 		}
@@ -69,21 +117,111 @@ const fs::TopLevel * fs::find(const char * path) {
 	return nullptr;
 }
 
-const fs::File * fs::get(const char * path) {
-	// split the path up
-	PathInfo pi(path);
-	if (!pi.is_valid || !pi.is_file) return nullptr;
+namespace {
+	// Lookups that were found recently, by path hash. Holds the latest revision, so hits don't walk revision chains either.
+	//
+	// fs::get is also called from the audio interrupt, so entries are only ever filled from the main loop with interrupts
+	// masked (an interrupt never sees half of one), and readers copy an entry out before checking it. Entries from before the
+	// last write or compaction are told apart by their generation rather than being cleared.
+	struct CachedLookup {
+		uint32_t hash;
+		uint32_t generation;
+		const fs::TopLevel * toplevel;
+		const fs::File * file;
+	};
+
+	constexpr size_t lookup_cache_size = 16;
+	CachedLookup lookup_cache[lookup_cache_size];
+	volatile uint32_t lookup_generation = 0;
 
-	const auto * toplevel = fs::find(pi.toplevel_name);
-	if (toplevel == nullptr) return nullptr;
+	// Whether a fixed size (not necessarily terminated) name field holds exactly the length characters at name
+	bool name_is(const char *field, size_t field_size, const char *name, uint32_t length) {
+		return length <= field_size && strncmp(field, name, length) == 0 && (length == field_size || field[length] == 0);
+	}
+
+	void forget_lookups() {
+		lookup_generation = lookup_generation + 1;
+	}
 
-	for (const auto& file : *toplevel) {
-		if (file.flags & FileDeleted) continue;
-		if (strcmp(file->name, pi.filename) == 0) {
-			return &file;
+	void remember_lookup(const CachedLookup& lookup) {
+		if (__get_IPSR()) return;
+		uint32_t primask = __get_PRIMASK();
+		__disable_irq();
+		lookup_cache[lookup.hash % lookup_cache_size] = lookup;
+		__set_PRIMASK(primask);
+	}
+
+	// Split path at its first / (the rest can have more, folders are just part of the name below the top level)
+	bool split(const char *path, uint32_t &length, uint32_t &slash) {
+		length = slash = 0;
+		for (; path[length]; ++length) {
+			if (path[length] == '/' && !slash) slash = length;
 		}
+		return slash && slash <= 12 && length - slash - 1 != 0 && length - slash - 1 <= 16;
+	}
+
+	// Look path up in the index, which must have the file if it's there at all
+	const fs::File * indexed(const fs::Header& header, const fs::Index& index, const char *path, uint32_t length, uint32_t slash,
+			uint32_t hash, const fs::TopLevel *& toplevel) {
+		if (!index.entry_count) return nullptr;
+
+		const auto& entry = index.entries()[fs::index_slot(hash, index.displacement[hash & (index.bucket_count - 1)], index.entry_count)];
+		if (entry.hash != hash || entry.toplevel >= 16) return nullptr;
+
+		toplevel = &header.top_level[entry.toplevel];
+		if (!toplevel->ok() || (toplevel->flags & fs::TopLevelDeleted) || !name_is(toplevel->name, sizeof toplevel->name, path, slash))
+			return nullptr;
+
+		const fs::File * file = (*entry.file).operator->();
+		if (!file->ok() || (file->flags & fs::FileDeleted) || !name_is(file->name, sizeof file->name, path + slash + 1, length - slash - 1))
+			return nullptr;
+		return file;
+	}
+
+	// Walk the folder's chain for the file
+	const fs::File * search(const char *path, const fs::TopLevel *& found_in) {
+		PathInfo pi(path);
+		if (!pi.is_valid || !pi.is_file) return nullptr;
+
+		const auto * toplevel = fs::find(pi.toplevel_name);
+		// (empty folders have no chain at all)
+		if (toplevel == nullptr || toplevel->list_top == (fs::File *)0xffff'ffff) return nullptr;
+
+		for (const auto& file : *toplevel) {
+			// (past the first file, the iterator gives the first revision)
+			const fs::File * latest = file.operator->();
+			if (latest->flags & fs::FileDeleted) continue;
+			if (strncmp(latest->name, pi.filename, sizeof latest->name) == 0) {
+				found_in = toplevel;
+				return latest;
+			}
+		}
+		return nullptr;
 	}
-	return nullptr;
+}
+
+const fs::File * fs::get(const char * path) {
+	if (!fs::is_present()) return nullptr;
+
+	uint32_t length, slash;
+	if (!split(path, length, slash)) return nullptr;
+
+	uint32_t hash = path_hash(path, length);
+	CachedLookup cached = lookup_cache[hash % lookup_cache_size];
+	if (cached.file && cached.generation == lookup_generation && cached.hash == hash && name_is(cached.toplevel->name, sizeof cached.toplevel->name, path, slash) &&
+			name_is(cached.file->name, sizeof cached.file->name, path + slash + 1, length - slash - 1))
+		return cached.file;
+
+	const auto& header = fs_header();
+	const auto * index = path_index(header);
+	const fs::TopLevel * toplevel = nullptr;
+	const fs::File * file = nullptr;
+	if (index) file = indexed(header, *index, path, length, slash, hash, toplevel);
+	// A complete index is the final word on what exists
+	if (!file && (!index || index->complete != erased)) file = search(path, toplevel);
+
+	if (file) remember_lookup({hash, lookup_generation, toplevel, file});
+	return file;
 }
 
 bool fs::exists(const char *path) {
@@ -111,6 +249,569 @@ const void * fs::open(const char *path) {
 const void * fs::open(const fs::File& f) {
 	if (!f->ok()) return nullptr;
 
-	// file data is after the header
-	return (const void *)(&f + 1); // Take advantage of pointer arithmetic (save a sizeof)
+	// file data is after the header (of the latest revision)
+	return (const void *)(f.operator->() + 1); // Take advantage of pointer arithmetic (save a sizeof)
+}
+
+// WRITING
+
+namespace {
+	fs::Wear wear_stats{};
+
+	uint32_t address(const void *at) {
+		return static_cast<uint32_t>(reinterpret_cast<uintptr_t>(at));
+	}
+
+	uint32_t record_size(const fs::File& file) {
+		return (sizeof(fs::File) + file.length + 3) & ~3u;
+	}
+
+	// Whether a record in the chains can be trusted to be one
+	bool is_record(const fs::File * file, uint32_t base) {
+		return address(file) >= base + sizeof(fs::Header) && address(file) < base + copy_size - sizeof(fs::File) && file->ok();
+	}
+
+	bool is_blank(uint32_t base) {
+		for (uint32_t at = base; at < base + copy_size; at += 4) {
+			if (*reinterpret_cast<const uint32_t *>(at) != erased) return false;
+		}
+		return true;
+	}
+
+	// FLASH
+
+	constexpr uint32_t flash_errors = FLASH_SR_PGSERR | FLASH_SR_PGPERR | FLASH_SR_PGAERR | FLASH_SR_WRPERR | FLASH_SR_SOP;
+
+	void flash_unlock() {
+		if (FLASH->CR & FLASH_CR_LOCK) {
+			FLASH->KEYR = 0x4567'0123;
+			FLASH->KEYR = 0xCDEF'89AB;
+		}
+	}
+
+	void flash_lock() {
+		FLASH->CR |= FLASH_CR_LOCK;
+
+		// The data cache doesn't see what was just programmed or erased
+		FLASH->ACR &= ~FLASH_ACR_DCEN;
+		FLASH->ACR |= FLASH_ACR_DCRST;
+		FLASH->ACR &= ~FLASH_ACR_DCRST;
+		FLASH->ACR |= FLASH_ACR_DCEN;
+	}
+
+	bool flash_wait() {
+		while (FLASH->SR & FLASH_SR_BSY) {;}
+		bool ok = !(FLASH->SR & flash_errors);
+		FLASH->SR = flash_errors;
+		return ok;
+	}
+
+	// Program a word, which can only clear bits
+	bool program_word(uint32_t at, uint32_t value) {
+		if (value == erased) return true;
+
+		flash_wait();
+		FLASH->CR = FLASH_CR_PSIZE_1 | FLASH_CR_PG;
+		*reinterpret_cast<volatile uint32_t *>(at) = value;
+		__DSB();
+		bool ok = flash_wait();
+		FLASH->CR &= ~FLASH_CR_PG;
+
+		++wear_stats.words_programmed;
+		return ok;
+	}
+
+	// Program length bytes (at must be word aligned; the last word is padded with zeroes, like fsgen.py does)
+	bool program(uint32_t at, const void *data, uint32_t length) {
+		const auto * bytes = static_cast<const uint8_t *>(data);
+		for (uint32_t done = 0; done < length; done += 4, at += 4) {
+			uint32_t word = 0;
+			memcpy(&word, bytes + done, length - done < 4 ? length - done : 4);
+			if (!program_word(at, word)) return false;
+		}
+		return true;
+	}
+
+	bool erase(int copy) {
+		flash_wait();
+		FLASH->CR = FLASH_CR_PSIZE_1 | FLASH_CR_SER | (copy_sector[copy] << FLASH_CR_SNB_Pos);
+		FLASH->CR |= FLASH_CR_STRT;
+		bool ok = flash_wait();
+		FLASH->CR &= ~FLASH_CR_SER;
+		return ok;
+	}
+
+	// LAYOUT
+
+	// The latest revision of folder's file called name (even if it's been deleted), and the last file in the folder
+	const fs::File * find_record(const fs::TopLevel& folder, const char *name, uint32_t length, const fs::File *& tail) {
+		tail = nullptr;
+		if (folder.list_top == reinterpret_cast<fs::File *>(erased)) return nullptr;
+
+		for (const auto& file : folder) {
+			tail = file.operator->();
+			if (name_is(tail->name, sizeof tail->name, name, length)) return tail;
+		}
+		return nullptr;
+	}
+
+	// Calls f with every record reachable from the header (every revision of every file), stopping at anything broken
+	template<typename F>
+	void each_record(const fs::Header& header, F&& f) {
+		uint32_t base = address(&header);
+		for (const auto& folder : header.top_level) {
+			if (!folder.ok()) continue;
+
+			const fs::File * file = folder.list_top;
+			while (is_record(file, base)) {
+				const fs::File * revision = file;
+				while (true) {
+					f(*revision, revision->revision_next == reinterpret_cast<fs::File *>(erased));
+					if (!is_record(revision->revision_next, base)) break;
+					revision = revision->revision_next;
+				}
+				file = revision->list_next;
+			}
+		}
+	}
+
+	// Where the free space of the active copy starts. Worked out once per copy.
+	uint32_t end_base = 0, end_at = 0;
+
+	uint32_t free_start() {
+		const auto& header = fs_header();
+		uint32_t base = address(&header);
+		if (end_base == base) return end_at;
+
+		uint32_t at = base + sizeof(fs::Header) + index_space(header);
+		each_record(header, [&](const fs::File& file, bool) {
+			if (address(&file) + record_size(file) > at) at = address(&file) + record_size(file);
+		});
+
+		// Step over anything a write that was cut short left behind
+		while (at < base + copy_size) {
+			const auto * orphan = reinterpret_cast<const fs::File *>(at);
+			if (at + sizeof(fs::File) <= base + copy_size && orphan->ok() && orphan->length != 0xffff) at += record_size(*orphan);
+			else if (*reinterpret_cast<const uint32_t *>(at) != erased) at += 4;
+			else break;
+		}
+
+		end_base = base;
+		end_at = at < base + copy_size ? at : base + copy_size;
+		return end_at;
+	}
+
+	// A folder slot that's never been written (fsgen.py leaves unused ones erased)
+	int free_folder(const fs::Header& header) {
+		for (int slot = 0; slot < 16; ++slot) {
+			if (!(header.sector_use_mask & (1 << slot))) continue;
+
+			const auto * words = reinterpret_cast<const uint32_t *>(&header.top_level[slot]);
+			bool blank = true;
+			for (size_t i = 0; i < sizeof(fs::TopLevel) / 4; ++i) {
+				if (words[i] != erased) blank = false;
+			}
+			if (blank) return slot;
+		}
+		return -1;
+	}
+
+	fs::write_status write_revision(const char *path, const void *data, uint16_t length, uint16_t flags);
+
+	// COMPACTION
+
+	struct Compaction {
+		bool active = false, prepared = false, erased_spare = false;
+		int from, to;
+
+		// Live files, and where the copies have got to
+		uint32_t count, copied;
+		uint32_t bucket_count;
+		uint32_t next; // where the next record goes
+		uint8_t folder;
+		const fs::File * file; // the first revision of the file being copied, or nullptr to start the folder
+		uint32_t offset; // how much of its contents have been copied
+		uint32_t first[16], last[16]; // each folder's new chain
+
+		// For the new index
+		uint32_t *hashes, *addresses;
+		uint8_t *folders;
+		uint32_t erases;
+	} compaction;
+
+	void end_compaction() {
+		free(compaction.hashes);
+		free(compaction.addresses);
+		free(compaction.folders);
+		compaction.hashes = compaction.addresses = nullptr;
+		compaction.folders = nullptr;
+		compaction.active = false;
+	}
+
+	fs::write_status start_compaction() {
+		auto& c = compaction;
+		c.from = active_copy();
+		c.to = 1 - c.from;
+
+		// The spare has to be blank, or an old (or half finished) copy of the filesystem; 0x080A0000 can also be an app
+		const auto& spare = header_at(c.to);
+		uint32_t first_word = *reinterpret_cast<const uint32_t *>(&spare);
+		if (first_word != erased && first_word != 0 && !spare.ok()) return fs::write_status::SpareInUse;
+		const auto * spare_index = first_word == erased ? nullptr : path_index(spare);
+		c.erases = spare_index ? spare_index->erases : 0;
+
+		// Count what has to be copied
+		const auto& header = header_at(c.from);
+		uint32_t count = 0, bytes = 0;
+		each_record(header, [&](const fs::File& file, bool latest) {
+			if (!latest || (file.flags & fs::FileDeleted)) return;
+			++count;
+			bytes += record_size(file);
+		});
+
+		uint32_t bucket_count = 1;
+		while (bucket_count * 2 < count) bucket_count *= 2;
+		uint32_t start = copy_base[c.to] + sizeof(fs::Header) + fs::Index::size(bucket_count, count);
+		if (start + bytes > copy_base[c.to] + copy_size) return fs::write_status::Full;
+
+		c.hashes = static_cast<uint32_t *>(malloc(count * sizeof(uint32_t) + 1));
+		c.addresses = static_cast<uint32_t *>(malloc(count * sizeof(uint32_t) + 1));
+		c.folders = static_cast<uint8_t *>(malloc(count + 1));
+		c.active = true;
+		if (!c.hashes || !c.addresses || !c.folders) {
+			end_compaction();
+			return fs::write_status::NoMemory;
+		}
+
+		c.prepared = c.erased_spare = false;
+		c.count = count;
+		c.copied = 0;
+		c.bucket_count = bucket_count;
+		c.next = start;
+		c.folder = 0;
+		c.file = nullptr;
+		c.offset = 0;
+		for (int i = 0; i < 16; ++i) c.first[i] = c.last[i] = erased;
+		return fs::write_status::InProgress;
+	}
+
+	// Copy live files into the spare until budget runs out. Returns whether they're all done.
+	bool copy_files(uint32_t& budget, bool& ok) {
+		auto& c = compaction;
+		const auto& header = header_at(c.from);
+		uint32_t base = copy_base[c.from];
+
+		while (budget) {
+			if (c.folder == 16) return true;
+			const auto& folder = header.top_level[c.folder];
+
+			if (!c.file) {
+				if (!folder.ok() || (folder.flags & fs::TopLevelDeleted) || !is_record(folder.list_top, base)) {
+					++c.folder;
+					continue;
+				}
+				c.file = folder.list_top;
+			}
+
+			const fs::File& latest = *c.file->operator->();
+			if (!(latest.flags & fs::FileDeleted)) {
+				if (!c.offset) {
+					// Start the copy with just the header; it's linked once the contents are there
+					fs::File record = latest;
+					record.list_next = record.revision_next = reinterpret_cast<fs::File *>(erased);
+					if (!(ok = program(c.next, &record, sizeof record))) return false;
+					budget = budget > sizeof record ? budget - sizeof record : 0;
+				}
+
+				// Whole words until the end
+				uint32_t chunk = latest.length - c.offset, allowed = budget < 4 ? 4 : budget & ~3u;
+				if (chunk > allowed) chunk = allowed;
+				if (!(ok = program(c.next + sizeof(fs::File) + c.offset, reinterpret_cast<const uint8_t *>(&latest + 1) + c.offset, chunk)))
+					return false;
+				c.offset += chunk;
+				budget = budget > chunk ? budget - chunk : 0;
+				if (c.offset < latest.length) continue;
+
+				// Done, hook it on the folder's new chain
+				if (c.last[c.folder] == erased) c.first[c.folder] = c.next;
+				else if (!(ok = program_word(c.last[c.folder] + offsetof(fs::File, list_next), c.next))) return false;
+				c.last[c.folder] = c.next;
+
+				char path[12 + 1 + 16];
+				uint32_t folder_length = strnlen(folder.name, sizeof folder.name), name_length = strnlen(latest.name, sizeof latest.name);
+				memcpy(path, folder.name, folder_length);
+				path[folder_length] = '/';
+				memcpy(path + folder_length + 1, latest.name, name_length);
+				c.hashes[c.copied] = fs::path_hash(path, folder_length + 1 + name_length);
+				c.addresses[c.copied] = c.next;
+				c.folders[c.copied] = c.folder;
+				++c.copied;
+
+				c.next += record_size(latest);
+				c.offset = 0;
+			}
+
+			c.file = latest.list_next;
+			if (!is_record(c.file, base)) {
+				c.file = nullptr;
+				++c.folder;
+			}
+		}
+		return c.folder == 16;
+	}
+
+	// Displace every bucket so the hashes all get their own slot, like fsgen.py does. Leaves slots empty (and the index to be
+	// searched past) if it can't.
+	bool build_index(uint16_t *displacements, uint32_t *slots) {
+		auto& c = compaction;
+		uint32_t *taken = static_cast<uint32_t *>(calloc((c.count + 31) / 32, sizeof(uint32_t)));
+		uint16_t *sizes = static_cast<uint16_t *>(calloc(c.bucket_count, sizeof(uint16_t)));
+		bool ok = taken && sizes;
+
+		uint32_t largest = 0;
+		for (uint32_t i = 0; ok && i < c.count; ++i) {
+			uint32_t size = ++sizes[c.hashes[i] & (c.bucket_count - 1)];
+			if (size > largest) largest = size;
+		}
+
+		// Fullest buckets first, while there's still lots of room
+		for (uint32_t size = largest; ok && size; --size) {
+			for (uint32_t bucket = 0; ok && bucket < c.bucket_count; ++bucket) {
+				if (sizes[bucket] != size) continue;
+
+				uint32_t displacement = 0;
+				for (; displacement < 0x10000; ++displacement) {
+					bool fits = true;
+					for (uint32_t i = 0; fits && i < c.count; ++i) {
+						if ((c.hashes[i] & (c.bucket_count - 1)) != bucket) continue;
+						uint32_t slot = fs::index_slot(c.hashes[i], displacement, c.count);
+						if (taken[slot / 32] & (1u << (slot % 32))) fits = false;
+						else {
+							taken[slot / 32] |= 1u << (slot % 32);
+							slots[i] = slot;
+						}
+					}
+					if (fits) break;
+
+					// Give back what this try took
+					for (uint32_t i = 0; i < c.count; ++i) {
+						if ((c.hashes[i] & (c.bucket_count - 1)) != bucket) continue;
+						uint32_t slot = fs::index_slot(c.hashes[i], displacement, c.count);
+						if (slots[i] == slot) taken[slot / 32] &= ~(1u << (slot % 32));
+						slots[i] = erased;
+					}
+				}
+				if (displacement == 0x10000) ok = false;
+				else displacements[bucket] = displacement;
+			}
+		}
+
+		free(taken);
+		free(sizes);
+		return ok;
+	}
+
+	// Write the index and the header (the magic last, so the copy only counts once it's all there), and retire the old copy
+	bool finish_compaction() {
+		auto& c = compaction;
+		const auto& old = header_at(c.from);
+		uint32_t base = copy_base[c.to];
+
+		uint16_t *displacements = static_cast<uint16_t *>(calloc(c.bucket_count + 1, sizeof(uint16_t)));
+		uint32_t *slots = static_cast<uint32_t *>(malloc(c.count * sizeof(uint32_t) + 1));
+		if (!displacements || !slots) {
+			free(displacements);
+			free(slots);
+			return false;
+		}
+		for (uint32_t i = 0; i < c.count; ++i) slots[i] = erased;
+		bool indexed = build_index(displacements, slots);
+
+		bool ok = true;
+		uint32_t at = base + sizeof(fs::Header);
+		struct {
+			char magic[4];
+			uint16_t bucket_count, entry_count;
+			uint32_t complete, generation, erases;
+		} index_header = {{'f', 'I', 'd', 'X'}, static_cast<uint16_t>(c.bucket_count), static_cast<uint16_t>(c.count),
+			indexed ? erased : 0, generation(old) + 1, c.erases + (c.erased_spare ? 1 : 0)};
+		ok = ok && program(at, &index_header, sizeof index_header);
+		ok = ok && program(at + sizeof index_header, displacements, c.bucket_count * sizeof(uint16_t));
+
+		auto * entries = reinterpret_cast<const fs::IndexEntry *>(at + fs::Index::size(c.bucket_count, 0));
+		for (uint32_t i = 0; ok && i < c.count; ++i) {
+			if (slots[i] == erased) continue;
+			fs::IndexEntry entry{c.hashes[i], reinterpret_cast<fs::File *>(c.addresses[i]), c.folders[i], {}};
+			ok = program(address(&entries[slots[i]]), &entry, sizeof entry);
+		}
+		free(displacements);
+		free(slots);
+
+		const auto& header = header_at(c.to);
+		for (int slot = 0; ok && slot < 16; ++slot) {
+			const auto& folder = old.top_level[slot];
+			if (!folder.ok() || (folder.flags & fs::TopLevelDeleted)) continue;
+
+			fs::TopLevel copy = folder;
+			copy.list_top = reinterpret_cast<fs::File *>(c.first[slot]);
+			ok = program(address(&header.top_level[slot]), &copy, sizeof copy);
+		}
+
+		// Version, sector count and every folder slot usable, then the magic
+		fs::Header top;
+		memcpy(top.magic, "MSFS", 4);
+		top.version = fs::IndexVersion;
+		top.sector_count = 1;
+		top.sector_use_mask = 0xffff;
+		ok = ok && program(base + 4, reinterpret_cast<const uint8_t *>(&top) + 4, 4);
+		ok = ok && program(base, &top, 4);
+
+		// From here on the new copy is the one in use
+		ok = ok && program_word(copy_base[c.from], 0);
+		return ok;
+	}
+}
+
+fs::write_status fs::write(const char *path, const void *data, uint16_t length) {
+	return write_revision(path, data, length, 0);
+}
+
+fs::write_status fs::remove(const char *path) {
+	if (!fs::get(path)) return write_status::NotFound;
+	return write_revision(path, nullptr, 0, FileDeleted);
+}
+
+namespace {
+	fs::write_status write_revision(const char *path, const void *data, uint16_t length, uint16_t flags) {
+		if (!fs::is_present()) return fs::write_status::NotPresent;
+		if (compaction.active) return fs::write_status::Busy;
+
+		uint32_t path_length, slash;
+		if (!split(path, path_length, slash)) return fs::write_status::BadPath;
+		const char *name = path + slash + 1;
+		uint32_t name_length = path_length - slash - 1;
+
+		const auto& header = fs_header();
+		uint32_t base = address(&header);
+		char folder_name[13] = {0};
+		memcpy(folder_name, path, slash);
+
+		const fs::TopLevel * folder = fs::find(folder_name);
+		int new_folder = -1;
+		if (!folder && (new_folder = free_folder(header)) < 0) return fs::write_status::NoFolderSlot;
+
+		const fs::File * tail = nullptr;
+		const fs::File * latest = folder ? find_record(*folder, name, name_length, tail) : nullptr;
+
+		uint32_t at = free_start();
+		uint32_t size = (sizeof(fs::File) + length + 3) & ~3u;
+		if (at + size > base + copy_size) return fs::write_status::Full;
+
+		// The record (and the folder, if it's new), then its contents, and only then link it in, so a write that gets cut
+		// short leaves nothing that can be found
+		flash_unlock();
+		bool ok = true;
+		if (new_folder >= 0) {
+			fs::TopLevel created;
+			memset(&created, 0xff, sizeof created);
+			memcpy(created.magic, "fStL", 4);
+			memset(created.name, 0, sizeof created.name);
+			memcpy(created.name, path, slash);
+			created.flags = 0;
+			folder = &header.top_level[new_folder];
+			ok = program(address(folder), &created, sizeof created);
+		}
+
+		fs::File record;
+		memset(&record, 0xff, sizeof record);
+		memcpy(record.magic, "fLeT", 4);
+		memset(record.name, 0, sizeof record.name);
+		memcpy(record.name, name, name_length);
+		record.used_by = 0;
+		record.length = length;
+		record.flags = flags;
+		// The latest revision carries the folder's chain on
+		if (latest) record.list_next = latest->list_next;
+		ok = ok && program(at, &record, sizeof record) && program(at + sizeof record, data, length);
+
+		if (ok) {
+			if (latest) ok = program_word(address(&latest->revision_next), at);
+			else if (tail) ok = program_word(address(&tail->list_next), at);
+			else ok = program_word(address(&folder->list_top), at);
+
+			// New paths aren't in the index, so it can't rule paths out any more
+			const auto * index = path_index(header);
+			if (ok && !latest && index && index->complete == erased) ok = program_word(address(&index->complete), 0);
+		}
+		flash_lock();
+
+		// Whatever happened, the space is used now
+		end_at = at + size;
+		forget_lookups();
+		++wear_stats.revisions_written;
+		return ok ? fs::write_status::Ok : fs::write_status::FlashError;
+	}
+}
+
+fs::write_status fs::compact(uint32_t budget) {
+	if (!compaction.active) {
+		if (!fs::is_present()) return write_status::NotPresent;
+		if (auto result = start_compaction(); result != write_status::InProgress) return result;
+	}
+
+	flash_unlock();
+	bool ok = true;
+	if (!compaction.prepared) {
+		if (!is_blank(copy_base[compaction.to])) {
+			ok = erase(compaction.to);
+			compaction.erased_spare = true;
+		}
+		compaction.prepared = true;
+	}
+
+	bool done = ok && copy_files(budget, ok);
+	if (done) ok = finish_compaction();
+	flash_lock();
+
+	if (!ok || done) {
+		end_compaction();
+		forget_lookups();
+		end_base = 0;
+		if (!ok) return write_status::FlashError;
+		++wear_stats.compactions;
+		return write_status::Ok;
+	}
+	return write_status::InProgress;
+}
+
+bool fs::compacting() {
+	return compaction.active;
+}
+
+fs::Usage fs::usage() {
+	Usage result{};
+	if (!fs::is_present()) return result;
+
+	const auto& header = fs_header();
+	uint32_t base = address(&header), start = base + sizeof(Header) + index_space(header);
+
+	each_record(header, [&](const File& file, bool latest) {
+		if (latest && !(file.flags & FileDeleted)) result.live += record_size(file);
+	});
+	uint32_t end = free_start();
+	result.dead = end - start - result.live;
+	result.free = base + copy_size - end;
+	return result;
+}
+
+fs::Wear fs::wear() {
+	Wear result = wear_stats;
+	for (int copy = 0; copy < 2; ++copy) {
+		// Retired copies keep their index
+		const auto& header = header_at(copy);
+		uint32_t first_word = *reinterpret_cast<const uint32_t *>(&header);
+		const auto * index = first_word == erased ? nullptr : path_index(header);
+		result.erases[copy] = index ? index->erases : 0;
+	}
+	return result;
 }
@@ -122,7 +122,7 @@ struct scr_register {
 		reg_bit<64, 48, 4> sd_bus_widths;
 		reg_bit<64, 52, 3> sd_security;
 		reg_bit<64, 55, 1> data_stat_after_erase;
-		reg_bit<64, 46, 4> sd_spec;
+		reg_bit<64, 56, 4> sd_spec;
 		reg_bit<64, 60, 4> scr_structure_ver;
 	};
 };
@@ -299,6 +299,67 @@ inline command_status send_command(uint32_t index) {
 
 sd::Card sd::card;
 
+namespace {
+	// CLKCR for transfers: 24MHz (48MHz / 2), or 48MHz with the divider bypassed once the card is in high speed mode
+	uint32_t transfer_clock = SDIO_CLKCR_WIDBUS_0 | SDIO_CLKCR_CLKEN;
+
+	// A data timeout in SDIO_CK periods at whichever of those is active
+	uint32_t data_timeout(uint32_t milliseconds) {
+		return milliseconds * ((transfer_clock & SDIO_CLKCR_BYPASS) ? 48'000 : 24'000);
+	}
+
+	// Read the few bytes of data some commands send back (the SCR, switch status). It all fits in the FIFO, so unlike
+	// read_polled this doesn't need a slower clock to keep up.
+	bool read_short_data(uint32_t argument, uint32_t index, uint32_t * buffer, uint32_t length) {
+		SDIO->DTIMER = 0xF'FFFF;
+		SDIO->DLEN = length;
+		SDIO->DCTRL = (__builtin_ctz(length) << SDIO_DCTRL_DBLOCKSIZE_Pos) | SDIO_DCTRL_DTDIR | SDIO_DCTRL_DTEN;
+
+		status_r1 status;
+		bool ok = send_command(argument, index, status) == command_status::Ok && !status.illegal_command;
+
+		for (uint32_t words = 0, timeout = 100; ok && words < length / 4;) {
+			if (SDIO->STA & SDIO_STA_RXDAVL) buffer[words++] = SDIO->FIFO;
+			else if ((SDIO->STA & (SDIO_STA_DCRCFAIL | SDIO_STA_DTIMEOUT | SDIO_STA_STBITERR)) || timeout-- == 0) ok = false;
+			else util::delay(1);
+		}
+
+		clear_sd_flags();
+		SDIO->DCTRL = 0;
+		return ok;
+	}
+
+	// Read the SD configuration register (ACMD51)
+	bool read_scr(scr_register& scr) {
+		if (send_command<uint32_t>((uint32_t)sd::card.RCA << 16, 55 /* APP_CMD */) != command_status::Ok) return false;
+
+		uint32_t raw[2];
+		if (!read_short_data(0, 51 /* SEND_SCR */, raw, 8)) return false;
+
+		// Sent MSB first
+		scr.raw_data = (uint64_t(__REV(raw[0])) << 32) | __REV(raw[1]);
+		return true;
+	}
+
+	// Try to switch the card to high speed (function 1 of function group 1) with CMD6
+	bool switch_high_speed() {
+		uint32_t switch_status[16];
+		const uint8_t * bytes = reinterpret_cast<const uint8_t *>(switch_status);
+
+		// Ask first (mode 0), so nothing changes if it isn't supported. Group 1's support bits are 415:400.
+		if (!read_short_data(0x00FF'FFF1, 6 /* SWITCH_FUNC */, switch_status, 64)) return false;
+		if (!(bytes[13] & 0b10)) return false;
+
+		// Then switch (mode 1). The function group 1 result (bits 379:376) is 0xF if it didn't work.
+		if (!read_short_data(0x80FF'FFF1, 6 /* SWITCH_FUNC */, switch_status, 64)) return false;
+		if ((bytes[16] & 0xF) != 1) return false;
+
+		// The card switches within 8 clocks of the status
+		util::delay(1);
+		return true;
+	}
+}
+
 void sd::init(bool enable_dma, bool enable_exti) {
 	LL_AHB1_GRP1_EnableClock(LL_AHB1_GRP1_PERIPH_GPIOG);
 	LL_AHB1_GRP1_EnableClock(LL_AHB1_GRP1_PERIPH_GPIOC);
@@ -585,7 +646,8 @@ sd::init_status sd::init_card() {
 
 		// Change bus speed settings
 		
-		SDIO->CLKCR = 0x00 | SDIO_CLKCR_CLKEN | SDIO_CLKCR_WIDBUS_0;
+		transfer_clock = SDIO_CLKCR_WIDBUS_0 | SDIO_CLKCR_CLKEN;
+		SDIO->CLKCR = transfer_clock;
 
 		util::delay(5);
 	}
@@ -596,8 +658,23 @@ sd::init_status sd::init_card() {
 		if (send_command(512, 16, status) != command_status::Ok) return init_status::CardNotResponding;
 		if (status.block_len_error) return init_status::NotSupported;
 	}
-	else {
-		// (OPTIONAL) STAGE 4: check support for cmd23
+
+	// (OPTIONAL) STAGE 5: check what else the card supports. If anything fails here the card still works as it is.
+	{
+		scr_register scr;
+		bool have_scr = read_scr(scr);
+
+		// CMD23 support is bit 1 of CMD_SUPPORT
+		card.set_block_count = have_scr && (scr.cmd_support & 0b10);
+
+		// CMD6 needs spec version 1.10 or later. Default speed allows 25MHz, high speed 50MHz, so bypass the divider and use
+		// SDIOCLK (48MHz) directly.
+		card.high_speed = have_scr && scr.sd_spec >= 1 && switch_high_speed();
+		if (card.high_speed) {
+			transfer_clock = SDIO_CLKCR_BYPASS | SDIO_CLKCR_WIDBUS_0 | SDIO_CLKCR_CLKEN;
+			SDIO->CLKCR = transfer_clock;
+			util::delay(1);
+		}
 	}
 
 	card.status = init_status::Ok;
@@ -630,19 +707,234 @@ void sd::reset() {
 	return;
 }
 
-// Blocking read
-sd::access_status sd::read(uint32_t address, void * result_buffer, uint32_t length_in_sectors) {
+namespace {
+	// Asynchronous requests waiting for the card
+	struct Request {
+		enum : uint8_t {
+			KindRead,
+			KindWrite
+		} kind;
+		uint32_t address;
+		void * buffer;
+		uint32_t length_in_sectors;
+		void (*callback)(void *, sd::access_status);
+		void * argument;
+	};
+
+	// One slot is always left empty to tell a full ring from an empty one
+	constexpr uint8_t queue_slots = sd::queue_length + 1;
+
+	Request queue[queue_slots];
+	volatile uint8_t queue_head = 0, queue_tail = 0;
+
+	// After a write's data has been sent the card keeps programming it, and won't accept another data command until it's
+	// back in the transfer state.
+	volatile bool card_programming = false;
+
+	// The longest the spec lets a card take to send a read block / program a written one, in milliseconds
+	constexpr uint32_t read_timeout_ms = 100;
+	constexpr uint32_t write_timeout_ms = 250;
+
+	// Simple critical section
+	struct InterruptGuard {
+		InterruptGuard() : primask(__get_PRIMASK()) {
+			__disable_irq();
+		}
+		~InterruptGuard() {
+			__set_PRIMASK(primask);
+		}
+	private:
+		uint32_t primask;
+	};
+
+	// Poll the card once to see if it's done programming
+	bool card_ready() {
+		status_r1 status;
+		if (send_command((uint32_t)sd::card.RCA << 16, 13 /* SEND_STATUS */, status) != command_status::Ok) return false;
+		if (status.ready_for_data && status.current_state == 4 /* tran */) {
+			card_programming = false;
+			return true;
+		}
+		return false;
+	}
+
+	// Wait up to timeout ms for the card to finish programming
+	sd::access_status wait_ready(uint32_t timeout=250) {
+		while (card_programming && !card_ready()) {
+			if (timeout-- == 0) return sd::access_status::CardNotResponding;
+			util::delay(1);
+		}
+		return sd::access_status::Ok;
+	}
+
+	// Claim the card for a blocking operation. Fails if an async transfer is running or queued, since those would be
+	// started from the interrupt underneath us.
+	bool claim_blocking(decltype(sd::card.active_state) state) {
+		InterruptGuard guard;
+		if (sd::card.active_state != sd::Card::ActiveStateInactive || queue_head != queue_tail) return false;
+		sd::card.active_state = state;
+		return true;
+	}
+
+	// Tell the card how many blocks the next multi block write is, so it can pre-erase them (ACMD23 SET_WR_BLK_ERASE_COUNT)
+	command_status pre_erase_hint(uint32_t length_in_sectors) {
+		if (auto result = send_command<uint32_t>((uint32_t)sd::card.RCA << 16, 55 /* APP_CMD */); result != command_status::Ok) return result;
+		return send_command<uint32_t>(length_in_sectors & 0x7F'FFFF, 23);
+	}
+
+	// Set up for a multi block transfer. Cards with CMD23 (SET_BLOCK_COUNT) are told the length up front and stop by themselves;
+	// otherwise the transfer needs a stop command afterwards, and writes get the pre-erase hint instead.
+	command_status announce_length(uint32_t length_in_sectors, bool writing, bool& needs_stop) {
+		needs_stop = false;
+		if (length_in_sectors == 1) return command_status::Ok;
+
+		if (sd::card.set_block_count) {
+			status_r1 status;
+			return send_command<uint32_t>(length_in_sectors & 0xFFFF, 23 /* SET_BLOCK_COUNT */, status);
+		}
+
+		needs_stop = true;
+		return writing ? pre_erase_hint(length_in_sectors) : command_status::Ok;
+	}
+
+	// Whether the running asynchronous transfer has to be ended with CMD12
+	volatile bool stop_after_transfer = false;
+
+	// Abort a DMA transfer that never started
+	void abort_dma_transfer() {
+		clear_sd_flags();
+
+		SDIO->DCTRL = 0;
+		SDIO->MASK = 0;
+
+		LL_DMA_DisableStream(DMA2, LL_DMA_STREAM_3);
+	}
+
+	// Start an asynchronous transfer. active_state must already be claimed for it.
+	sd::access_status start(const Request& request) {
+		using sd::card;
+		using sd::access_status;
+
+		bool writing = request.kind == Request::KindWrite;
+		uint32_t address = request.address;
+		if (card.card_type != sd::Card::CardTypeSDHC) address *= 512;
+
+		card.active_state = writing ? sd::Card::ActiveStateWriting : sd::Card::ActiveStateReading;
+		card.active_callback = request.callback;
+		card.argument = request.argument;
+
+		bool needs_stop;
+		if (announce_length(request.length_in_sectors, writing, needs_stop) != command_status::Ok) {
+			return access_status::CardNotResponding;
+		}
+		stop_after_transfer = needs_stop;
+
+		// Begin by setting up the DMA transfer
+		
+		LL_DMA_SetMemoryAddress(DMA2, LL_DMA_STREAM_3, (uint32_t)request.buffer);
+		LL_DMA_SetDataTransferDirection(DMA2, LL_DMA_STREAM_3, writing ? LL_DMA_DIRECTION_MEMORY_TO_PERIPH : LL_DMA_DIRECTION_PERIPH_TO_MEMORY);
+		LL_DMA_SetDataLength(DMA2, LL_DMA_STREAM_3, request.length_in_sectors * 128);
+		LL_DMA_EnableStream(DMA2, LL_DMA_STREAM_3);
+
+		clear_sd_flags();
+
+		SDIO->DLEN = request.length_in_sectors * 512;
+
+		status_r1 status;
+		if (!writing) {
+			// Reads: the DPSM has to be waiting before the command goes out
+			SDIO->DTIMER = data_timeout(read_timeout_ms);
+			SDIO->DCTRL = (0b1001u << SDIO_DCTRL_DBLOCKSIZE_Pos) | SDIO_DCTRL_DTDIR | SDIO_DCTRL_DMAEN | SDIO_DCTRL_DTEN;
+			SDIO->MASK = SDIO_MASK_RXOVERRIE | SDIO_MASK_DCRCFAILIE | SDIO_MASK_DTIMEOUTIE | SDIO_MASK_DATAENDIE | SDIO_MASK_STBITERRIE;
+
+			// No data will come in if this fails, so we can just disable the DPSM
+			if (send_command(address, request.length_in_sectors == 1 ? 17 : 18, status) != command_status::Ok) {
+				abort_dma_transfer();
+				return access_status::CardNotResponding;
+			}
+		}
+		else {
+			// Writes: the card only takes data after it has responded
+			if (send_command(address, request.length_in_sectors == 1 ? 24 : 25, status) != command_status::Ok) {
+				abort_dma_transfer();
+				return access_status::CardNotResponding;
+			}
+		}
+
+		// Check status flags
+		if (status.address_error || status.out_of_range) {abort_dma_transfer(); return access_status::InvalidAddress;}
+		if (status.card_is_locked) {abort_dma_transfer(); return access_status::CardLockedError;}
+
+		if (writing) {
+			SDIO->DTIMER = data_timeout(write_timeout_ms);
+			SDIO->MASK = SDIO_MASK_TXUNDERRIE | SDIO_MASK_DCRCFAILIE | SDIO_MASK_DTIMEOUTIE | SDIO_MASK_DATAENDIE | SDIO_MASK_STBITERRIE;
+			SDIO->DCTRL = (0b1001u << SDIO_DCTRL_DBLOCKSIZE_Pos) | SDIO_DCTRL_DMAEN | SDIO_DCTRL_DTEN;
+		}
+
+		// Operation in progress
+		return access_status::InProgress;
+	}
+
+	// Start queued requests until one is running (or the queue is empty)
+	void dispatch() {
+		while (true) {
+			{
+				InterruptGuard guard;
+				if (sd::card.active_state != sd::Card::ActiveStateInactive || queue_head == queue_tail) return;
+				sd::card.active_state = sd::Card::ActiveStateActiveUnknown;
+			}
+
+			// Still busy with the last write; sd::service() will try again
+			if (card_programming && !card_ready()) {
+				sd::card.active_state = sd::Card::ActiveStateInactive;
+				return;
+			}
+
+			Request request = queue[queue_tail];
+			queue_tail = (queue_tail + 1) % queue_slots;
+
+			auto result = start(request);
+			if (result == sd::access_status::InProgress) return;
+
+			sd::card.active_state = sd::Card::ActiveStateInactive;
+			if (request.callback) request.callback(request.argument, result);
+		}
+	}
+
+	// Queue an asynchronous request, starting it straight away if the card is free
+	sd::access_status submit(const Request& request) {
+		if (sd::card.status != sd::init_status::Ok) {
+			return sd::access_status::NotInitialized;
+		}
+
+		{
+			InterruptGuard guard;
+			if ((queue_head + 1) % queue_slots == queue_tail) return sd::access_status::Busy;
+			queue[queue_head] = request;
+			queue_head = (queue_head + 1) % queue_slots;
+		}
+
+		// Errors starting the request go to its callback
+		dispatch();
+		return sd::access_status::InProgress;
+	}
+}
+
+// Blocking read (the card must already be claimed)
+static sd::access_status read_polled(uint32_t address, void * result_buffer, uint32_t length_in_sectors) {
+	using namespace sd;
+
 	// POLLING gets stuck a lot, use a slower clock speed
 	
 	SDIO->CLKCR = 0x6E | SDIO_CLKCR_WIDBUS_0 | SDIO_CLKCR_CLKEN;
 
 	uint32_t * out_buffer = static_cast<uint32_t *>(result_buffer);
-	if (card.status != init_status::Ok) return access_status::NotInitialized;
-
-	if (length_in_sectors == 0) return access_status::Ok;
 
 	if (card.card_type != Card::CardTypeSDHC) address *= 512;
 
+	bool needs_stop;
+	if (announce_length(length_in_sectors, false, needs_stop) != command_status::Ok) return access_status::CardNotResponding;
+
 	// Program the DPSM for this transfer
 	SDIO->DLEN = length_in_sectors * 512;
 	SDIO->DTIMER = 0xFFF;
@@ -672,7 +964,7 @@ sd::access_status sd::read(uint32_t address, void * result_buffer, uint32_t leng
 	}
 
 	// Check status flags
-	if (status.address_error) {clear_sd_flags(); return access_status::InvalidAddress;}
+	if (status.address_error || status.out_of_range) {clear_sd_flags(); return access_status::InvalidAddress;}
 	if (status.card_is_locked) {clear_sd_flags(); return access_status::CardLockedError;}
 
 	// Begin transferring
@@ -689,7 +981,7 @@ sd::access_status sd::read(uint32_t address, void * result_buffer, uint32_t leng
 	uint32_t status_word = SDIO->STA;
 
 	// Send data end
-	if (SDIO->STA & SDIO_STA_DATAEND && length_in_sectors > 1) {
+	if (SDIO->STA & SDIO_STA_DATAEND && needs_stop) {
 		// Send data end
 		if (send_command(0xDEAD9009, 12, status) != command_status::Ok) {
 			clear_sd_flags();
@@ -732,84 +1024,142 @@ sd::access_status sd::read(uint32_t address, void * result_buffer, uint32_t leng
 
 	clear_sd_flags();
 
-	SDIO->CLKCR = 0x00 | SDIO_CLKCR_WIDBUS_0 | SDIO_CLKCR_CLKEN;
+	SDIO->CLKCR = transfer_clock;
 
 	return access_status::Ok;
 }
 
+sd::access_status sd::read(uint32_t address, void * result_buffer, uint32_t length_in_sectors) {
+	if (card.status != init_status::Ok) return access_status::NotInitialized;
+	if (length_in_sectors == 0) return access_status::Ok;
+	if (!claim_blocking(Card::ActiveStateReading)) return access_status::Busy;
+
+	access_status result = wait_ready();
+	if (result == access_status::Ok) result = read_polled(address, result_buffer, length_in_sectors);
+	// read_polled leaves the slow clock on if it fails
+	SDIO->CLKCR = transfer_clock;
+
+	card.active_state = Card::ActiveStateInactive;
+	dispatch();
+	return result;
+}
+
 sd::access_status sd::read(uint32_t address, void *result_buffer, uint32_t length_in_sectors, void (*callback)(void *, sd::access_status), void *argument) {
-	// DMA uses <electroboomvoice>FULL CLOCK SPEED</electroboomvoice>, start by instead checking if there is an ongoing
-	// transmission
-	
-	if (card.active_state != sd::Card::ActiveStateInactive) {
-		return access_status::Busy;
-	}
-	if (card.status != init_status::Ok) {
-		return access_status::NotInitialized;
-	}
+	// DMA uses <electroboomvoice>FULL CLOCK SPEED</electroboomvoice>. If something else is using the card this gets
+	// queued behind it.
+	return submit({Request::KindRead, address, result_buffer, length_in_sectors, callback, argument});
+}
 
-	card.active_state = Card::ActiveStateReading;
-	card.active_callback = callback;
-	card.argument = argument;
+sd::access_status sd::write(uint32_t address, const void *source_buffer, uint32_t length_in_sectors, void (*callback)(void *, sd::access_status), void *argument) {
+	return submit({Request::KindWrite, address, const_cast<void *>(source_buffer), length_in_sectors, callback, argument});
+}
 
-	// Begin by setting up the DMA transfer
-	
-	LL_DMA_SetMemoryAddress(DMA2, LL_DMA_STREAM_3, (uint32_t)result_buffer);
-	LL_DMA_SetDataTransferDirection(DMA2, LL_DMA_STREAM_3, LL_DMA_DIRECTION_PERIPH_TO_MEMORY);
-	LL_DMA_SetDataLength(DMA2, LL_DMA_STREAM_3, length_in_sectors * 128);
-	LL_DMA_EnableStream(DMA2, LL_DMA_STREAM_3);
+// Blocking write
+sd::access_status sd::write(uint32_t address, const void * source_buffer, uint32_t length_in_sectors) {
+	if (card.status != init_status::Ok) return access_status::NotInitialized;
+	if (length_in_sectors == 0) return access_status::Ok;
+	if (!claim_blocking(Card::ActiveStateWriting)) return access_status::Busy;
 
-	// Send the read command
-	if (card.card_type != Card::CardTypeSDHC) address *= 512;
+	access_status result = wait_ready();
+	if (result == access_status::Ok) {
+		// Same as reads, polling needs a slower clock to keep up
+		SDIO->CLKCR = 0x6E | SDIO_CLKCR_WIDBUS_0 | SDIO_CLKCR_CLKEN;
 
-	clear_sd_flags();
+		const uint32_t * in_buffer = static_cast<const uint32_t *>(source_buffer);
+		uint32_t remaining = length_in_sectors * 128;
 
-	SDIO->DTIMER = 0xFFFF;
-	SDIO->DLEN = length_in_sectors * 512;
-	SDIO->DCTRL = (0b1001u << SDIO_DCTRL_DBLOCKSIZE_Pos) | SDIO_DCTRL_DTDIR | SDIO_DCTRL_DMAEN | SDIO_DCTRL_DTEN;
-	SDIO->MASK = SDIO_MASK_RXOVERRIE | SDIO_MASK_DCRCFAILIE | SDIO_MASK_DTIMEOUTIE | SDIO_MASK_DATAENDIE | SDIO_MASK_STBITERRIE;
+		if (card.card_type != Card::CardTypeSDHC) address *= 512;
 
-	status_r1 status;
-	if (length_in_sectors == 1) {
-		if (send_command(address, 17, status) != command_status::Ok) {
-			clear_sd_flags();
+		status_r1 status;
+		bool needs_stop;
+		if (announce_length(length_in_sectors, true, needs_stop) != command_status::Ok) result = access_status::CardNotResponding;
+		else if (send_command(address, length_in_sectors == 1 ? 24 : 25, status) != command_status::Ok) result = access_status::CardNotResponding;
+		else if (status.address_error || status.out_of_range) result = access_status::InvalidAddress;
+		else if (status.card_is_locked) result = access_status::CardLockedError;
+		else {
+			SDIO->DTIMER = data_timeout(write_timeout_ms);
+			SDIO->DLEN = length_in_sectors * 512;
+			SDIO->DCTRL = (0b1001u /* 512 */ << SDIO_DCTRL_DBLOCKSIZE_Pos) | SDIO_DCTRL_DTEN; // host -> card
+
+			while (!(SDIO->STA & (SDIO_STA_TXUNDERR | SDIO_STA_DCRCFAIL | SDIO_STA_DTIMEOUT | SDIO_STA_DATAEND | SDIO_STA_STBITERR))) {
+				// Fill half the FIFO at a time
+				if (remaining && (SDIO->STA & SDIO_STA_TXFIFOHE)) {
+					for (int i = 0; i < 8 && remaining; ++i, --remaining) {
+						SDIO->FIFO = *in_buffer++;
+					}
+				}
+			}
 
-			// No data will come in if this fails, so we can just disable the DPSM
-			
-			SDIO->DCTRL = 0;
-			SDIO->MASK = 0;
+			uint32_t status_word = SDIO->STA;
 
-			LL_DMA_DisableStream(DMA2, LL_DMA_STREAM_3);
-			return access_status::CardNotResponding;
+			if (needs_stop && send_command(0, 12, status) != command_status::Ok) result = access_status::CardWillForeverMoreBeStuckInAnEndlessWaltzSendingData;
+			else if (status_word & SDIO_STA_TXUNDERR) result = access_status::DMATransferError;
+			else if (status_word & SDIO_STA_DCRCFAIL) result = access_status::CRCError;
+			else if (!(status_word & SDIO_STA_DATAEND)) result = access_status::CardNotResponding;
+
+			// Block until the data is actually on the card
+			card_programming = true;
+			if (result == access_status::Ok) result = wait_ready();
 		}
+
+		clear_sd_flags();
+		SDIO->DCTRL = 0;
+		SDIO->CLKCR = transfer_clock;
 	}
-	else {
-		if (send_command(address, 18, status) != command_status::Ok) {
-			clear_sd_flags();
 
-			// No data will come in if this fails, so we can just disable the DPSM
-			
-			SDIO->DCTRL = 0;
-			SDIO->MASK = 0;
-			
-			LL_DMA_DisableStream(DMA2, LL_DMA_STREAM_3);
-			return access_status::CardNotResponding;
+	card.active_state = Card::ActiveStateInactive;
+	dispatch();
+	return result;
+}
+
+sd::access_status sd::erase(uint32_t address, uint32_t length_in_sectors) {
+	if (card.status != init_status::Ok) return access_status::NotInitialized;
+	if (length_in_sectors == 0) return access_status::Ok;
+	if (!claim_blocking(Card::ActiveStateErasing)) return access_status::Busy;
+
+	access_status result = wait_ready();
+	if (result == access_status::Ok) {
+		uint32_t start = address, end = address + length_in_sectors - 1;
+		if (card.card_type != Card::CardTypeSDHC) {
+			start *= 512;
+			end *= 512;
+		}
+
+		status_r1 status;
+		if (send_command(start, 32 /* ERASE_WR_BLK_START */, status) != command_status::Ok ||
+				send_command(end, 33 /* ERASE_WR_BLK_END */, status) != command_status::Ok) {
+			result = access_status::CardNotResponding;
+		}
+		else if (status.address_error || status.out_of_range || status.erase_param_error || status.erase_seq_error) {
+			result = access_status::InvalidAddress;
+		}
+		else if (status.card_is_locked) result = access_status::CardLockedError;
+		else if (send_command(0, 38 /* ERASE */, status) != command_status::Ok) result = access_status::CardNotResponding;
+		else {
+			// Erases can take a very long time (the spec allows ~250ms per erase unit), just wait it out
+			card_programming = true;
+			result = wait_ready(60'000);
 		}
 	}
 
+	card.active_state = Card::ActiveStateInactive;
+	dispatch();
+	return result;
+}
 
-	// Check status flags
-	if (status.address_error) {clear_sd_flags(); LL_DMA_DisableStream(DMA2, LL_DMA_STREAM_3); return access_status::InvalidAddress;}
-	if (status.card_is_locked) {clear_sd_flags(); LL_DMA_DisableStream(DMA2, LL_DMA_STREAM_3); return access_status::CardLockedError;}
+sd::access_status sd::erase() {
+	return erase(0, card.length / 512);
+}
 
-	// Operation in progress
-	return access_status::InProgress;
+void sd::service() {
+	dispatch();
 }
 
 // Interrupt handler
 
 void sd::sdio_interrupt() {
-	if (card.active_state == Card::ActiveStateReading) {
+	if (card.active_state == Card::ActiveStateReading || card.active_state == Card::ActiveStateWriting) {
+		bool writing = card.active_state == Card::ActiveStateWriting;
 		access_status mode = access_status::Ok;
 		LL_DMA_DisableStream(DMA2, LL_DMA_STREAM_3);
 		LL_DMA_ClearFlag_TC3(DMA2);
@@ -817,7 +1167,7 @@ void sd::sdio_interrupt() {
 		SDIO->MASK = 0;
 		uint32_t status_word = SDIO->STA;
 		if (SDIO->STA & SDIO_STA_DATAEND) {
-			if (SDIO->DLEN > 512) {
+			if (stop_after_transfer) {
 				// Send a stop command
 				status_r1 status;
 				if (send_command(0, 12, status) != command_status::Ok) {
@@ -833,7 +1183,7 @@ void sd::sdio_interrupt() {
 		else if (status_word & SDIO_STA_DTIMEOUT) {
 			mode = access_status::CardNotResponding;
 		}
-		else if (SDIO->STA & SDIO_STA_RXOVERR) {
+		else if (SDIO->STA & (SDIO_STA_RXOVERR | SDIO_STA_TXUNDERR)) {
 			mode = access_status::DMATransferError;
 		}
 		if (LL_DMA_IsActiveFlag_TE3(DMA2)) {
@@ -842,11 +1192,18 @@ void sd::sdio_interrupt() {
 			LL_DMA_ClearFlag_TE3(DMA2);
 		}
 
-		// Call the function
-		card.active_callback(card.argument, mode);
-		card.active_state = Card::ActiveStateInactive;
+		// Even a failed write may have left the card programming
+		if (writing) card_programming = true;
 
 		SDIO->DCTRL = 0;
+		clear_sd_flags();
+
+		// Free the card before the callback so it can queue the next transfer
+		card.active_state = Card::ActiveStateInactive;
+		if (card.active_callback) card.active_callback(card.argument, mode);
+
+		dispatch();
+		return;
 	}
 
 	clear_sd_flags();
@@ -0,0 +1,338 @@
+#include <sdcache.h>
+
+#include <string.h>
+
+// SD sector cache
+
+#ifndef MSYNTH_SD_CACHE_SECTORS
+#define MSYNTH_SD_CACHE_SECTORS 8
+#endif
+
+#ifndef MSYNTH_SD_READ_AHEAD
+#define MSYNTH_SD_READ_AHEAD 8
+#endif
+
+namespace {
+	constexpr uint32_t sector_size = 512;
+	constexpr uint32_t slot_count = MSYNTH_SD_CACHE_SECTORS;
+	constexpr uint32_t read_ahead = MSYNTH_SD_READ_AHEAD;
+	constexpr uint32_t no_sector = 0xFFFF'FFFF;
+
+	static_assert(slot_count > 0 && read_ahead > 1);
+
+	sd::cache::Stats statistics{};
+
+	// LRU CACHE
+
+	struct Slot {
+		uint32_t sector = no_sector;
+		uint32_t last_used = 0;
+		bool dirty = false;
+	};
+
+	Slot slots[slot_count];
+	alignas(4) uint8_t slot_data[slot_count][sector_size];
+	uint32_t clock = 0;
+
+	// READ AHEAD
+	//
+	// Two buffers: while one is being read from the other is being filled.
+
+	struct Stream {
+		enum : uint8_t {
+			Empty,
+			Loading,
+			Ready
+		};
+
+		uint32_t start = 0, length = 0;
+		volatile uint8_t state = Empty;
+
+		bool covers(uint32_t sector) const {
+			return state != Empty && sector - start < length;
+		}
+
+		bool overlaps(uint32_t sector, uint32_t count) const {
+			return state != Empty && sector < start + length && start < sector + count;
+		}
+	};
+
+	Stream streams[2];
+	alignas(4) uint8_t stream_data[2][read_ahead * sector_size];
+
+	// The last single sector read, to spot sequential access
+	uint32_t last_read = no_sector;
+
+	// The blocking routines refuse to run while anything asynchronous is in flight (including our own read-ahead), so wait for
+	// that to finish.
+	sd::access_status card_read(uint32_t sector, void *buffer, uint32_t count) {
+		sd::access_status result;
+		while ((result = sd::read(sector, buffer, count)) == sd::access_status::Busy) sd::service();
+		return result;
+	}
+
+	sd::access_status card_write(uint32_t sector, const void *buffer, uint32_t count) {
+		sd::access_status result;
+		while ((result = sd::write(sector, buffer, count)) == sd::access_status::Busy) sd::service();
+		if (result == sd::access_status::Ok) {
+			++statistics.write_backs;
+			statistics.sectors_written += count;
+		}
+		return result;
+	}
+
+	uint32_t card_sectors() {
+		return sd::card.length / sector_size;
+	}
+
+	void wait(Stream &stream) {
+		while (stream.state == Stream::Loading) sd::service();
+	}
+
+	void prefetched(void *argument, sd::access_status status) {
+		auto &stream = *static_cast<Stream *>(argument);
+		stream.state = status == sd::access_status::Ok ? Stream::Ready : Stream::Empty;
+	}
+
+	// Start filling stream in the background with the sectors from start
+	void prefetch(Stream &stream, uint32_t start) {
+		wait(stream);
+		stream.state = Stream::Empty;
+
+		uint32_t end = card_sectors();
+		if (start >= end) return;
+		stream.start = start;
+		stream.length = end - start < read_ahead ? end - start : read_ahead;
+		stream.state = Stream::Loading;
+
+		// Queued reads report InProgress; anything that goes wrong from there on comes through prefetched()
+		if (sd::read(start, stream_data[&stream - streams], stream.length, prefetched, &stream) != sd::access_status::InProgress) {
+			stream.state = Stream::Empty;
+			return;
+		}
+		statistics.read_ahead_sectors += stream.length;
+	}
+
+	// Drop read-ahead data that's about to be out of date
+	void invalidate_streams(uint32_t sector, uint32_t count) {
+		for (auto &stream : streams) {
+			wait(stream);
+			if (stream.overlaps(sector, count)) stream.state = Stream::Empty;
+		}
+	}
+
+	Slot *find(uint32_t sector) {
+		for (auto &slot : slots) {
+			if (slot.sector == sector) return &slot;
+		}
+		return nullptr;
+	}
+
+	uint8_t *data_of(const Slot *slot) {
+		return slot_data[slot - slots];
+	}
+
+	void touch(Slot *slot) {
+		slot->last_used = ++clock;
+	}
+
+	// Read-ahead data might have been loaded while there were newer changes in the cache. That's fine while they're still
+	// cached, since the cache is checked first, but the read-ahead buffers need to be caught up before they're written back.
+	void patch_streams(uint32_t first, uint32_t count) {
+		for (auto &stream : streams) {
+			wait(stream);
+			if (!stream.overlaps(first, count)) continue;
+			for (uint32_t sector = first; sector < first + count; ++sector) {
+				if (stream.covers(sector)) memcpy(stream_data[&stream - streams] + (sector - stream.start) * sector_size, data_of(find(sector)), sector_size);
+			}
+		}
+	}
+
+	// Write back the dirty sector in slot along with any dirty sectors next to it, as one write
+	sd::access_status write_back(Slot *slot) {
+		// Find the run of dirty sectors around it, up to the size of a read-ahead buffer
+		uint32_t first = slot->sector, count = 1;
+		while (count < read_ahead) {
+			if (first == 0) break;
+			auto before = find(first - 1);
+			if (!before || !before->dirty) break;
+			--first;
+			++count;
+		}
+		while (count < read_ahead) {
+			auto after = find(first + count);
+			if (!after || !after->dirty) break;
+			++count;
+		}
+
+		if (count == 1) {
+			patch_streams(first, 1);
+			if (auto result = card_write(slot->sector, data_of(slot), 1); result != sd::access_status::Ok) return result;
+			slot->dirty = false;
+			return sd::access_status::Ok;
+		}
+
+		// Gather the run into a read-ahead buffer, preferring one that isn't holding anything
+		auto &stream = streams[streams[0].state == Stream::Empty ? 0 : 1];
+		wait(stream);
+		stream.state = Stream::Empty;
+		patch_streams(first, count);
+
+		uint8_t *staging = stream_data[&stream - streams];
+		for (uint32_t i = 0; i < count; ++i) {
+			memcpy(staging + i * sector_size, data_of(find(first + i)), sector_size);
+		}
+		if (auto result = card_write(first, staging, count); result != sd::access_status::Ok) return result;
+		for (uint32_t i = 0; i < count; ++i) find(first + i)->dirty = false;
+		return sd::access_status::Ok;
+	}
+
+	// Get a slot for sector, evicting the least recently used one
+	sd::access_status allocate(uint32_t sector, Slot *&allocated) {
+		Slot *oldest = slots;
+		for (auto &slot : slots) {
+			if (slot.sector == no_sector) {
+				oldest = &slot;
+				break;
+			}
+			if (slot.last_used < oldest->last_used) oldest = &slot;
+		}
+
+		if (oldest->sector != no_sector && oldest->dirty) {
+			if (auto result = write_back(oldest); result != sd::access_status::Ok) return result;
+		}
+
+		oldest->sector = sector;
+		oldest->dirty = false;
+		touch(oldest);
+		allocated = oldest;
+		return sd::access_status::Ok;
+	}
+
+	sd::access_status read_one(uint32_t sector, uint8_t *out) {
+		bool sequential = sector == last_read + 1;
+		last_read = sector;
+
+		if (auto slot = find(sector)) {
+			touch(slot);
+			memcpy(out, data_of(slot), sector_size);
+			++statistics.hits;
+			return sd::access_status::Ok;
+		}
+
+		for (auto &stream : streams) {
+			if (!stream.covers(sector)) continue;
+			wait(stream);
+			if (stream.state != Stream::Ready) break;
+
+			uint32_t index = &stream - streams;
+			memcpy(out, stream_data[index] + (sector - stream.start) * sector_size, sector_size);
+			++statistics.read_ahead_hits;
+
+			// Moved on to this buffer, so start filling the other one
+			auto &other = streams[index ^ 1];
+			uint32_t next = stream.start + stream.length;
+			if (sector == stream.start && !other.covers(next)) prefetch(other, next);
+			return sd::access_status::Ok;
+		}
+
+		++statistics.misses;
+
+		if (sequential) {
+			// Read a whole buffer now and start on the next one
+			auto &stream = streams[0];
+			invalidate_streams(0, no_sector);
+
+			uint32_t end = card_sectors();
+			stream.start = sector;
+			stream.length = end > sector && end - sector < read_ahead ? end - sector : read_ahead;
+			if (auto result = card_read(sector, stream_data[0], stream.length); result != sd::access_status::Ok) return result;
+			stream.state = Stream::Ready;
+
+			memcpy(out, stream_data[0], sector_size);
+			prefetch(streams[1], sector + stream.length);
+			return sd::access_status::Ok;
+		}
+
+		Slot *slot;
+		if (auto result = allocate(sector, slot); result != sd::access_status::Ok) return result;
+		if (auto result = card_read(sector, data_of(slot), 1); result != sd::access_status::Ok) {
+			slot->sector = no_sector;
+			return result;
+		}
+		memcpy(out, data_of(slot), sector_size);
+		return sd::access_status::Ok;
+	}
+}
+
+sd::access_status sd::cache::read(uint32_t address, void * result_buffer, uint32_t length_in_sectors) {
+	auto out = static_cast<uint8_t *>(result_buffer);
+	if (length_in_sectors == 1) return read_one(address, out);
+
+	// Long reads go straight to the card, then get patched with any newer cached data
+	for (auto &stream : streams) wait(stream);
+	if (auto result = card_read(address, out, length_in_sectors); result != access_status::Ok) return result;
+
+	for (auto &slot : slots) {
+		if (slot.dirty && slot.sector - address < length_in_sectors) memcpy(out + (slot.sector - address) * sector_size, data_of(&slot), sector_size);
+	}
+	last_read = address + length_in_sectors - 1;
+	return access_status::Ok;
+}
+
+sd::access_status sd::cache::write(uint32_t address, const void * source_buffer, uint32_t length_in_sectors) {
+	auto in = static_cast<const uint8_t *>(source_buffer);
+	invalidate_streams(address, length_in_sectors);
+
+	if (length_in_sectors == 1) {
+		Slot *slot = find(address);
+		if (slot) touch(slot);
+		else if (auto result = allocate(address, slot); result != access_status::Ok) return result;
+
+		memcpy(data_of(slot), in, sector_size);
+		slot->dirty = true;
+		return access_status::Ok;
+	}
+
+	if (auto result = card_write(address, in, length_in_sectors); result != access_status::Ok) return result;
+
+	// Keep cached copies up to date
+	for (auto &slot : slots) {
+		if (slot.sector - address < length_in_sectors) {
+			memcpy(data_of(&slot), in + (slot.sector - address) * sector_size, sector_size);
+			slot.dirty = false;
+		}
+	}
+	return access_status::Ok;
+}
+
+sd::access_status sd::cache::flush() {
+	for (auto &slot : slots) {
+		if (slot.sector == no_sector || !slot.dirty) continue;
+		if (auto result = write_back(&slot); result != access_status::Ok) return result;
+	}
+	return access_status::Ok;
+}
+
+void sd::cache::invalidate(uint32_t address, uint32_t length_in_sectors) {
+	invalidate_streams(address, length_in_sectors);
+	for (auto &slot : slots) {
+		if (slot.sector - address < length_in_sectors) {
+			slot.sector = no_sector;
+			slot.dirty = false;
+		}
+	}
+}
+
+void sd::cache::invalidate() {
+	invalidate(0, no_sector);
+	last_read = no_sector;
+}
+
+const sd::cache::Stats& sd::cache::stats() {
+	return statistics;
+}
+
+void sd::cache::reset_stats() {
+	statistics = {};
+}
@@ -14,3 +14,13 @@ void util::delay(uint32_t ms)
     }
   }
 }
+
+void util::enable_cycle_counter() {
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CYCCNT = 0;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+uint32_t util::cycles() {
+	return DWT->CYCCNT;
+}
@@ -0,0 +1,115 @@
+// audiocodec.cpp against the reference encoders and decoders in fmtforsd.py: every case in the vectors file (written by
+// audiocodec_vectors.py) has to decode to exactly what the Python decoder made of it, and Rice has to give back the original.
+// Rice blocks are fed through a ring buffer that they wrap around, like the stream player's.
+
+#include "test.h"
+#include <audiocodec.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+namespace {
+	struct Case {
+		uint8_t codec;
+		uint32_t frames;
+		std::vector<uint8_t> data;
+		std::vector<int16_t> decoded, original;
+	};
+
+	bool load(const char *path, std::vector<Case>& cases) {
+		FILE *file = fopen(path, "rb");
+		if (!file) return false;
+
+		auto get = [&](void *out, size_t length){
+			return fread(out, 1, length, file) == length;
+		};
+		auto get32 = [&](uint32_t &value){
+			uint8_t bytes[4];
+			if (!get(bytes, 4)) return false;
+			value = bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | (uint32_t(bytes[3]) << 24);
+			return true;
+		};
+		auto get_samples = [&](std::vector<int16_t>& out, uint32_t frames){
+			std::vector<uint8_t> bytes(frames * 4);
+			if (!get(bytes.data(), bytes.size())) return false;
+			out.resize(frames * 2);
+			for (size_t i = 0; i < out.size(); ++i) out[i] = static_cast<int16_t>(bytes[i * 2] | (bytes[i * 2 + 1] << 8));
+			return true;
+		};
+
+		uint32_t count;
+		bool ok = get32(count);
+		for (uint32_t i = 0; ok && i < count; ++i) {
+			Case c;
+			uint32_t length, decoded_frames;
+			ok = get(&c.codec, 1) && get32(c.frames) && get32(length);
+			if (!ok) break;
+			c.data.resize(length);
+			ok = get(c.data.data(), length) && get32(decoded_frames) && get_samples(c.decoded, decoded_frames) && get_samples(c.original, c.frames);
+			cases.push_back(std::move(c));
+		}
+		fclose(file);
+		return ok && !cases.empty();
+	}
+
+	bool test_adpcm(const Case& c) {
+		if (c.data.size() % audiocodec::adpcm_block_bytes) return false;
+		uint32_t blocks = c.data.size() / audiocodec::adpcm_block_bytes;
+		if (c.decoded.size() != blocks * audiocodec::adpcm_block_frames * 2) return false;
+
+		int16_t out[audiocodec::adpcm_block_frames * 2];
+		for (uint32_t block = 0; block < blocks; ++block) {
+			audiocodec::decode_adpcm(c.data.data() + block * audiocodec::adpcm_block_bytes, out);
+			if (memcmp(out, c.decoded.data() + block * audiocodec::adpcm_block_frames * 2, sizeof out)) return false;
+		}
+		return true;
+	}
+
+	bool test_rice(const Case& c) {
+		// Start near the end of the ring so the first block wraps
+		constexpr uint32_t ring_size = 16384;
+		std::vector<uint8_t> ring(ring_size);
+		uint32_t position = ring_size - 7;
+
+		std::vector<int16_t> decoded;
+		int16_t out[audiocodec::max_block_frames * 2];
+		for (uint32_t offset = 0; offset < c.data.size();) {
+			uint32_t length = c.data[offset] | (c.data[offset + 1] << 8);
+			if (length < audiocodec::rice_block_header_bytes || length > ring_size || offset + length > c.data.size()) return false;
+			for (uint32_t i = 0; i < length; ++i) ring[(position + i) % ring_size] = c.data[offset + i];
+
+			audiocodec::RingReader in{ring.data(), ring_size, position};
+			if (audiocodec::rice_block_length(in) != length) return false;
+			uint32_t frames = audiocodec::decode_rice(in, out);
+			if (!frames || frames > audiocodec::rice_block_frames) return false;
+			decoded.insert(decoded.end(), out, out + frames * 2);
+
+			offset += length;
+			position = (position + length) % ring_size;
+		}
+		return decoded == c.decoded && decoded == c.original;
+	}
+}
+
+int main(int argc, char **argv) {
+	// The build puts the vectors next to the test, which ctest runs from
+	const char *path = argc > 1 ? argv[1] : "audiocodec_vectors.bin";
+	std::vector<Case> cases;
+	if (!load(path, cases)) {
+		printf("couldn't load %s (written by audiocodec_vectors.py)\n", path);
+		return 2;
+	}
+
+	uint32_t adpcm = 0, rice = 0;
+	for (size_t i = 0; i < cases.size(); ++i) {
+		const Case& c = cases[i];
+		bool is_adpcm = c.codec == uint8_t(audiocodec::Codec::ImaAdpcm);
+		(is_adpcm ? adpcm : rice) += 1;
+
+		bool ok = is_adpcm ? test_adpcm(c) : test_rice(c);
+		if (!ok) printf("case %zu (%s, %u frames) doesn't match the reference\n", i, is_adpcm ? "ADPCM" : "Rice", c.frames);
+		CHECK(ok);
+	}
+	CHECK(adpcm && rice);
+	return test::report();
+}
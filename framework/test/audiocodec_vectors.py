@@ -0,0 +1,70 @@
+#!/usr/bin/env python3
+"""
+Write test vectors for audiocodec_test: a few test signals encoded by fmtforsd.py, along with what its reference decoders make
+of them.
+
+    audiocodec_vectors.py <fmtforsd.py> <output>
+
+The output is little endian: the number of cases, then for each one the codec (uint8), the number of frames in the original
+signal, the encoded length in bytes and the encoded data, the number of frames decoded and the decoded samples, and finally the
+original samples (samples are interleaved stereo int16).
+"""
+
+import importlib.util
+import math
+import random
+import struct
+import sys
+
+
+def load(path):
+    spec = importlib.util.spec_from_file_location("fmtforsd", path)
+    module = importlib.util.module_from_spec(spec)
+    spec.loader.exec_module(module)
+    return module
+
+
+def signals():
+    rng = random.Random(1234)
+
+    def sine(frames, frequency, amplitude):
+        return [int(amplitude * math.sin(2 * math.pi * frequency * n / 44100)) for n in range(frames)]
+
+    yield "sine", sine(3000, 440, 12000), sine(3000, 660, 9000)
+    yield "silence", [0] * 1500, [0] * 1500
+    # Full scale noise: ADPCM saturates its step index, Rice mostly escapes
+    yield "noise", [rng.randint(-32768, 32767) for _ in range(2100)], [rng.randint(-32768, 32767) for _ in range(2100)]
+    # Jumps between the rails, which the ADPCM predictor has to clamp
+    square = [32767 if (n // 37) % 2 else -32768 for n in range(1200)]
+    yield "square", square, [-x if x > -32768 else 32767 for x in square]
+    # Quiet noise on a slow sine, so the Rice parameter is somewhere in the middle
+    yield "mixed", [s + rng.randint(-40, 40) for s in sine(2600, 50, 20000)], [rng.randint(-3, 3) for _ in range(2600)]
+    # Blocks shorter than the predictor's warmup
+    for frames in (1, 2, 3):
+        yield "short", [1000 * (n + 1) for n in range(frames)], [-1000 * (n + 1) for n in range(frames)]
+
+
+def main():
+    fmtforsd = load(sys.argv[1])
+    cases = []
+    for name, left, right in signals():
+        for codec, encode, decode in ((1, fmtforsd.encode_adpcm, fmtforsd.decode_adpcm), (2, fmtforsd.encode_rice, fmtforsd.decode_rice)):
+            data = encode(list(left), list(right))
+            decoded = decode(data)
+            cases.append((codec, left, right, data, decoded))
+
+    def samples(left, right):
+        return struct.pack("<{}h".format(2 * len(left)), *[x for frame in zip(left, right) for x in frame])
+
+    with open(sys.argv[2], "wb") as out:
+        out.write(struct.pack("<I", len(cases)))
+        for codec, left, right, data, (decoded_left, decoded_right) in cases:
+            out.write(struct.pack("<BII", codec, len(left), len(data)))
+            out.write(data)
+            out.write(struct.pack("<I", len(decoded_left)))
+            out.write(samples(decoded_left, decoded_right))
+            out.write(samples(left, right))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,503 @@
+// fat.cpp on a FAT32 image built here: a partitioned card, 2 sectors per cluster and two FATs, with long names, a deleted
+// entry, a subdirectory and a fragmented file. Reads are checked against what was put in the image, and writes against the
+// raw image (both FATs, the directory entry, FSInfo) as well as by reading them back.
+
+#include "test.h"
+#include "mock/disk.h"
+#include <fat.h>
+#include <sd.h>
+#include <string.h>
+#include <vector>
+
+namespace {
+	constexpr uint32_t partition_start = 64;
+	constexpr uint32_t reserved_sectors = 32;
+	constexpr uint32_t sectors_per_cluster = 2;
+	constexpr uint32_t cluster_bytes = sectors_per_cluster * 512;
+	constexpr uint32_t cluster_count = 66000; // FAT32 needs at least 65525
+	constexpr uint32_t fat_sectors = ((cluster_count + 2) * 4 + 511) / 512;
+	constexpr uint32_t fat_start = partition_start + reserved_sectors;
+	constexpr uint32_t data_start = fat_start + 2 * fat_sectors;
+	constexpr uint32_t partition_sectors = reserved_sectors + 2 * fat_sectors + cluster_count * sectors_per_cluster;
+	constexpr uint32_t fsinfo_sector = partition_start + 1;
+	constexpr uint32_t end_of_chain = 0x0FFF'FFFF;
+
+	constexpr uint32_t root_cluster = 2;
+	constexpr uint32_t samples_cluster = 7;
+
+	uint32_t cluster_sector(uint32_t cluster) {
+		return data_start + (cluster - 2) * sectors_per_cluster;
+	}
+
+	void put16(uint8_t *at, uint16_t value) {
+		at[0] = value;
+		at[1] = value >> 8;
+	}
+
+	void put32(uint8_t *at, uint32_t value) {
+		put16(at, value);
+		put16(at + 2, value >> 16);
+	}
+
+	uint32_t get32(const uint8_t *at) {
+		return at[0] | (at[1] << 8) | (at[2] << 16) | (uint32_t(at[3]) << 24);
+	}
+
+	// The contents of the files in the image, so reads can be checked without keeping copies
+	uint8_t pattern(uint32_t seed, uint32_t offset) {
+		return static_cast<uint8_t>((offset * 131 + seed * 17) ^ (offset >> 8));
+	}
+
+	std::vector<uint8_t> contents(uint32_t seed, uint32_t size) {
+		std::vector<uint8_t> data(size);
+		for (uint32_t i = 0; i < size; ++i) data[i] = pattern(seed, i);
+		return data;
+	}
+
+	// RAW IMAGE ACCESS
+
+	uint32_t fat_entry(uint32_t cluster, int copy = 0) {
+		uint8_t sector[512];
+		mock::disk::read(fat_start + copy * fat_sectors + cluster / 128, sector, 1);
+		return get32(sector + (cluster % 128) * 4) & 0x0FFF'FFFF;
+	}
+
+	void set_fat_entry(uint32_t cluster, uint32_t value) {
+		uint8_t sector[512];
+		for (int copy = 0; copy < 2; ++copy) {
+			uint32_t at = fat_start + copy * fat_sectors + cluster / 128;
+			mock::disk::read(at, sector, 1);
+			put32(sector + (cluster % 128) * 4, value);
+			mock::disk::write(at, sector, 1);
+		}
+	}
+
+	// Follow a chain in the image, checking both FATs agree
+	std::vector<uint32_t> chain(uint32_t cluster) {
+		std::vector<uint32_t> clusters;
+		while (cluster >= 2 && cluster < cluster_count + 2 && clusters.size() <= cluster_count) {
+			clusters.push_back(cluster);
+			CHECK(fat_entry(cluster, 0) == fat_entry(cluster, 1));
+			cluster = fat_entry(cluster);
+		}
+		return clusters;
+	}
+
+	void raw_entry(uint32_t sector, uint16_t index, uint8_t *out) {
+		uint8_t data[512];
+		mock::disk::read(sector, data, 1);
+		memcpy(out, data + index * 32, 32);
+	}
+
+	// BUILDING THE IMAGE
+
+	// Store a file's data in the given clusters and link them up
+	void put_file(const std::vector<uint32_t>& clusters, uint32_t seed, uint32_t size) {
+		auto data = contents(seed, size);
+		data.resize(clusters.size() * cluster_bytes);
+		for (size_t i = 0; i < clusters.size(); ++i) {
+			mock::disk::write(cluster_sector(clusters[i]), data.data() + i * cluster_bytes, sectors_per_cluster);
+			set_fat_entry(clusters[i], i + 1 < clusters.size() ? clusters[i + 1] : end_of_chain);
+		}
+	}
+
+	struct DirWriter {
+		uint32_t cluster;
+		uint32_t slot = 0;
+
+		void add(const uint8_t *raw) {
+			uint8_t sector[512];
+			uint32_t at = cluster_sector(cluster) + slot / 16;
+			mock::disk::read(at, sector, 1);
+			memcpy(sector + (slot % 16) * 32, raw, 32);
+			mock::disk::write(at, sector, 1);
+			++slot;
+		}
+
+		void add(const char *name, uint8_t attributes, uint32_t first_cluster, uint32_t size) {
+			uint8_t raw[32]{};
+			memcpy(raw, name, 11);
+			raw[11] = attributes;
+			put16(raw + 20, first_cluster >> 16);
+			put16(raw + 26, first_cluster);
+			put32(raw + 28, size);
+			add(raw);
+		}
+
+		// Long name entries (last part first) followed by the short entry they belong to
+		void add(const char *long_name, const char *name, uint32_t first_cluster, uint32_t size) {
+			static const uint8_t offsets[13] = {1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30};
+			uint8_t checksum = 0;
+			for (int i = 0; i < 11; ++i) checksum = ((checksum & 1) << 7) + (checksum >> 1) + static_cast<uint8_t>(name[i]);
+
+			size_t length = strlen(long_name);
+			uint32_t parts = (length + 12) / 13;
+			for (uint32_t part = parts; part >= 1; --part) {
+				uint8_t raw[32]{};
+				raw[0] = part | (part == parts ? 0x40 : 0);
+				raw[11] = fat::Entry::AttributeLongName;
+				raw[13] = checksum;
+				for (int i = 0; i < 13; ++i) {
+					size_t at = (part - 1) * 13 + i;
+					put16(raw + offsets[i], at < length ? long_name[at] : at == length ? 0 : 0xFFFF);
+				}
+				add(raw);
+			}
+			add(name, fat::Entry::AttributeArchive, first_cluster, size);
+		}
+	};
+
+	const std::vector<uint32_t> fragmented_clusters{10, 11, 20, 21, 30};
+
+	void format() {
+		mock::disk::create(partition_start + partition_sectors);
+
+		// MBR with one FAT32 (LBA) partition
+		uint8_t sector[512]{};
+		sector[446 + 4] = 0x0C;
+		put32(sector + 446 + 8, partition_start);
+		put32(sector + 446 + 12, partition_sectors);
+		put16(sector + 510, 0xAA55);
+		mock::disk::write(0, sector, 1);
+
+		// Boot sector
+		memset(sector, 0, 512);
+		memcpy(sector, "\xEB\x58\x90MSYNTH  ", 11);
+		put16(sector + 11, 512);
+		sector[13] = sectors_per_cluster;
+		put16(sector + 14, reserved_sectors);
+		sector[16] = 2;
+		sector[21] = 0xF8;
+		put32(sector + 32, partition_sectors);
+		put32(sector + 36, fat_sectors);
+		put32(sector + 44, root_cluster);
+		put16(sector + 48, 1);
+		put16(sector + 50, 6);
+		memcpy(sector + 82, "FAT32   ", 8);
+		put16(sector + 510, 0xAA55);
+		mock::disk::write(partition_start, sector, 1);
+
+		memset(sector, 0, 512);
+		put32(sector, 0x4161'5252);
+		put32(sector + 484, 0x6141'7272);
+		put32(sector + 488, cluster_count - 12);
+		put32(sector + 492, 31);
+		put16(sector + 510, 0xAA55);
+		mock::disk::write(fsinfo_sector, sector, 1);
+
+		set_fat_entry(0, 0x0FFF'FFF8);
+		set_fat_entry(1, end_of_chain);
+		set_fat_entry(root_cluster, end_of_chain);
+		set_fat_entry(samples_cluster, end_of_chain);
+
+		DirWriter root{root_cluster};
+		root.add("MSYNTH     ", fat::Entry::AttributeVolume, 0, 0);
+		root.add("A long file name.txt", "ALONGF~1TXT", 3, 3000);
+		put_file({3, 4, 5}, 1, 3000);
+		root.add("\xE5OLD    TXT", fat::Entry::AttributeArchive, 0, 0);
+		root.add("README  TXT", fat::Entry::AttributeArchive, 6, 1000);
+		put_file({6}, 2, 1000);
+		root.add("SAMPLES    ", fat::Entry::AttributeDirectory, samples_cluster, 0);
+		root.add("FRAG    BIN", fat::Entry::AttributeArchive, 10, 5000);
+		put_file(fragmented_clusters, 3, 5000);
+		root.add("EMPTY   TXT", fat::Entry::AttributeArchive, 0, 0);
+
+		DirWriter samples{samples_cluster};
+		samples.add(".          ", fat::Entry::AttributeDirectory, samples_cluster, 0);
+		samples.add("..         ", fat::Entry::AttributeDirectory, 0, 0);
+		samples.add("KICK    WAV", fat::Entry::AttributeArchive, 8, 2048);
+		put_file({8, 9}, 4, 2048);
+
+		mock::disk::reset_stats();
+	}
+
+	// HELPERS
+
+	std::vector<fat::Entry> list(const char *path) {
+		std::vector<fat::Entry> entries;
+		fat::Dir dir;
+		if (dir.open(path) != fat::status::Ok) return entries;
+		fat::Entry entry;
+		while (dir.next(entry) == fat::status::Ok) entries.push_back(entry);
+		return entries;
+	}
+
+	bool lookup(const char *directory, const char *name, fat::Entry &found) {
+		for (const auto& entry : list(directory)) {
+			if (!strcmp(entry.name, name)) {
+				found = entry;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// Read the whole file with reads of `chunk` bytes into buffer + misalign
+	bool read_back(const char *path, const std::vector<uint8_t>& expected, uint32_t chunk, uint32_t misalign = 0) {
+		fat::File file;
+		if (file.open(path) != fat::status::Ok || file.size() != expected.size()) return false;
+
+		std::vector<uint8_t> data(expected.size() + 4);
+		uint32_t total = 0, done;
+		while (total < expected.size()) {
+			if (file.read(data.data() + misalign + total, chunk, done) != fat::status::Ok || !done) return false;
+			total += done;
+		}
+		if (file.read(data.data(), 1, done) != fat::status::EndOfFile || done) return false;
+		return memcmp(data.data() + misalign, expected.data(), expected.size()) == 0;
+	}
+
+	// TESTS
+
+	void test_mount() {
+		mock::disk::create(1024);
+		sd::card.status = sd::init_status::NotInitialized;
+		CHECK(fat::mount() == fat::status::NoCard);
+		sd::card.status = sd::init_status::Ok;
+		CHECK(fat::mount() == fat::status::NoFilesystem);
+
+		fat::File file;
+		CHECK(file.open("README.TXT") == fat::status::NotMounted);
+
+		format();
+		CHECK(fat::mount() == fat::status::Ok);
+		CHECK(fat::volume.fat_start == fat_start);
+		CHECK(fat::volume.fat_sectors == fat_sectors);
+		CHECK(fat::volume.fat_count == 2);
+		CHECK(fat::volume.data_start == data_start);
+		CHECK(fat::volume.cluster_count == cluster_count);
+		CHECK(fat::volume.cluster_shift == 1);
+		CHECK(fat::volume.root_cluster == root_cluster);
+		CHECK(fat::volume.fsinfo_sector == fsinfo_sector);
+	}
+
+	void test_directories() {
+		// The volume label and the deleted entry are skipped; the long name is used when there is one
+		auto root = list("/");
+		CHECK(root.size() == 5);
+		if (root.size() == 5) {
+			CHECK(!strcmp(root[0].name, "A long file name.txt"));
+			CHECK(!strcmp(root[0].short_name, "ALONGF~1.TXT"));
+			CHECK(root[0].first_cluster == 3 && root[0].size == 3000);
+			CHECK(!strcmp(root[1].name, "README.TXT"));
+			CHECK(!strcmp(root[2].name, "SAMPLES") && root[2].is_directory());
+			CHECK(root[2].first_cluster == samples_cluster);
+			CHECK(!strcmp(root[3].name, "FRAG.BIN") && root[3].size == 5000);
+			CHECK(!strcmp(root[4].name, "EMPTY.TXT") && root[4].first_cluster == 0);
+			CHECK(root[1].sector == cluster_sector(root_cluster) && root[1].index == 5);
+		}
+		CHECK(list("").size() == root.size());
+
+		// The end marker stays put
+		fat::Dir dir;
+		fat::Entry entry;
+		CHECK(dir.open("/") == fat::status::Ok);
+		for (size_t i = 0; i < root.size(); ++i) dir.next(entry);
+		CHECK(dir.next(entry) == fat::status::EndOfDirectory);
+		CHECK(dir.next(entry) == fat::status::EndOfDirectory);
+		CHECK(dir.rewind() == fat::status::Ok);
+		CHECK(dir.next(entry) == fat::status::Ok && !strcmp(entry.name, "A long file name.txt"));
+
+		// Names match case insensitively
+		auto samples = list("/samples");
+		CHECK(samples.size() == 3);
+		if (samples.size() == 3) {
+			CHECK(!strcmp(samples[0].name, ".") && !strcmp(samples[1].name, ".."));
+			CHECK(!strcmp(samples[2].name, "KICK.WAV") && samples[2].size == 2048);
+		}
+		CHECK(list("SAMPLES/").size() == 3);
+
+		CHECK(dir.open("README.TXT") == fat::status::NotADirectory);
+		CHECK(dir.open("nothing") == fat::status::NotFound);
+		CHECK(dir.open("nothing/else") == fat::status::NotFound);
+		CHECK(dir.open("samples/..") == fat::status::Ok);
+		CHECK(dir.next(entry) == fat::status::Ok && !strcmp(entry.name, "A long file name.txt"));
+	}
+
+	void test_read() {
+		CHECK(read_back("/a long FILE name.txt", contents(1, 3000), 333));
+		CHECK(read_back("ALONGF~1.TXT", contents(1, 3000), 3000));
+		CHECK(read_back("readme.txt", contents(2, 1000), 1000, 1));
+		CHECK(read_back("samples/kick.wav", contents(4, 2048), 512));
+		CHECK(read_back("EMPTY.TXT", {}, 1));
+
+		// Across fragments: whole sectors straight into the buffer, unaligned buffers, and odd sizes
+		auto fragmented = contents(3, 5000);
+		CHECK(read_back("FRAG.BIN", fragmented, 5000));
+		CHECK(read_back("FRAG.BIN", fragmented, 5000, 1));
+		CHECK(read_back("FRAG.BIN", fragmented, 700));
+
+		fat::File file;
+		CHECK(file.open("FRAG.BIN") == fat::status::Ok);
+		uint8_t buffer[600];
+		uint32_t done;
+		CHECK(file.seek(2000) == fat::status::Ok);
+		CHECK(file.read(buffer, 600, done) == fat::status::Ok && done == 600);
+		CHECK(memcmp(buffer, fragmented.data() + 2000, 600) == 0);
+		CHECK(file.tell() == 2600);
+		CHECK(file.seek(4900) == fat::status::Ok);
+		CHECK(file.read(buffer, 600, done) == fat::status::Ok && done == 100);
+		CHECK(memcmp(buffer, fragmented.data() + 4900, 100) == 0);
+		CHECK(file.seek(5001) == fat::status::EndOfFile);
+		CHECK(file.seek(0) == fat::status::Ok);
+		CHECK(file.read(buffer, 10, done) == fat::status::Ok && memcmp(buffer, fragmented.data(), 10) == 0);
+
+		// Extents follow the runs of clusters, and stop at the end of the file
+		fat::Extent extent;
+		CHECK(file.extent(0, extent) == fat::status::Ok);
+		CHECK(extent.sector == cluster_sector(10) && extent.length == 4);
+		CHECK(file.extent(1024, extent) == fat::status::Ok);
+		CHECK(extent.sector == cluster_sector(11) && extent.length == 2);
+		CHECK(file.extent(2048, extent) == fat::status::Ok);
+		CHECK(extent.sector == cluster_sector(20) && extent.length == 4);
+		CHECK(file.extent(4096, extent) == fat::status::Ok);
+		CHECK(extent.sector == cluster_sector(30) && extent.length == 2);
+		CHECK(file.extent(100, extent) == fat::status::EndOfFile);
+		CHECK(file.extent(5120, extent) == fat::status::EndOfFile);
+
+		CHECK(file.open("SAMPLES") == fat::status::NotAFile);
+		CHECK(file.open("README.TXT/x") == fat::status::NotADirectory);
+		CHECK(file.open("samples/snare.wav") == fat::status::NotFound);
+	}
+
+	void test_write() {
+		fat::File file;
+		CHECK(file.create("samples/new.bin") == fat::status::Ok);
+		CHECK(file.create("samples/NEW.BIN") == fat::status::AlreadyExists);
+		CHECK(file.create("samples/toolongname.bin") == fat::status::InvalidName);
+		CHECK(file.create("samples/a.b.c") == fat::status::InvalidName);
+		CHECK(file.create("nowhere/new.bin") == fat::status::NotFound);
+
+		// Partial sectors through the sector buffer, then whole sectors straight to the disk
+		auto data = contents(5, 5100);
+		alignas(4) uint8_t aligned[3000];
+		memcpy(aligned, data.data() + 2100, 3000);
+		CHECK(file.open("samples/new.bin") == fat::status::Ok);
+		for (int i = 0; i < 3; ++i) CHECK(file.write(data.data() + i * 700, 700) == fat::status::Ok);
+		CHECK(file.write(aligned, 3000) == fat::status::Ok);
+		CHECK(file.size() == 5100);
+		CHECK(file.close() == fat::status::Ok);
+
+		fat::Entry entry;
+		CHECK(lookup("samples", "NEW.BIN", entry) && entry.size == 5100);
+		{
+			// The directory entry, both FATs and FSInfo are all on the disk
+			uint8_t raw[32];
+			raw_entry(entry.sector, entry.index, raw);
+			CHECK(get32(raw + 28) == 5100);
+			CHECK(chain(entry.first_cluster).size() == 5);
+
+			uint8_t fsinfo[512];
+			mock::disk::read(fsinfo_sector, fsinfo, 1);
+			CHECK(get32(fsinfo + 488) == 0xFFFF'FFFF);
+		}
+		CHECK(read_back("samples/new.bin", data, 512));
+
+		// Appending, and overwriting in the middle
+		CHECK(file.open("samples/new.bin") == fat::status::Ok);
+		CHECK(file.seek(5100) == fat::status::Ok);
+		auto more = contents(6, 2000);
+		CHECK(file.write(more.data(), 2000) == fat::status::Ok);
+		CHECK(file.seek(10) == fat::status::Ok);
+		CHECK(file.write("hello", 5) == fat::status::Ok);
+		CHECK(file.close() == fat::status::Ok);
+
+		data.insert(data.end(), more.begin(), more.end());
+		memcpy(data.data() + 10, "hello", 5);
+		CHECK(read_back("samples/new.bin", data, 1000));
+		CHECK(lookup("samples", "NEW.BIN", entry) && chain(entry.first_cluster).size() == 7);
+
+		// Nothing else was touched
+		CHECK(read_back("FRAG.BIN", contents(3, 5000), 5000));
+		CHECK(read_back("samples/kick.wav", contents(4, 2048), 2048));
+	}
+
+	void test_reserve() {
+		fat::File file;
+		CHECK(file.create("REC.RAW") == fat::status::Ok);
+		CHECK(file.open("REC.RAW") == fat::status::Ok);
+		CHECK(file.reserve(20 * cluster_bytes) == fat::status::Ok);
+
+		// The reservation isn't in the directory entry until the file is flushed
+		fat::Entry entry;
+		CHECK(lookup("/", "REC.RAW", entry) && entry.first_cluster == 0);
+
+		// Map the whole reservation out, past the end of the file
+		uint32_t sectors = 0;
+		fat::Extent extent;
+		while (file.extent(sectors * 512, extent) == fat::status::Ok) sectors += extent.length;
+		CHECK(sectors == 20 * sectors_per_cluster);
+
+		// Write some of it straight to the disk, then carry on through write()
+		auto data = contents(7, 7 * 512 + 300);
+		uint32_t written = 0;
+		while (written < 7) {
+			CHECK(file.extent(extent) == fat::status::Ok);
+			uint32_t count = extent.length < 7 - written ? extent.length : 7 - written;
+			mock::disk::write(extent.sector, data.data() + written * 512, count);
+			CHECK(file.advance(count * 512) == fat::status::Ok);
+			written += count;
+		}
+		CHECK(file.size() == 7 * 512);
+		CHECK(file.write(data.data() + 7 * 512, 300) == fat::status::Ok);
+
+		// Closing gives back the clusters that weren't used
+		CHECK(file.flush() == fat::status::Ok);
+		CHECK(lookup("/", "REC.RAW", entry));
+		auto reserved = chain(entry.first_cluster);
+		CHECK(reserved.size() == 20);
+		CHECK(file.close() == fat::status::Ok);
+
+		CHECK(lookup("/", "REC.RAW", entry) && entry.size == data.size());
+		auto used = chain(entry.first_cluster);
+		CHECK(used.size() == 4);
+		for (size_t i = 4; i < reserved.size(); ++i) CHECK(fat_entry(reserved[i]) == 0 && fat_entry(reserved[i], 1) == 0);
+		CHECK(read_back("REC.RAW", data, 1024));
+
+		// An unused reservation frees everything
+		CHECK(file.create("EMPTY.RAW") == fat::status::Ok);
+		CHECK(file.open("EMPTY.RAW") == fat::status::Ok);
+		CHECK(file.reserve(4 * cluster_bytes) == fat::status::Ok);
+		CHECK(file.flush() == fat::status::Ok);
+		CHECK(lookup("/", "EMPTY.RAW", entry));
+		reserved = chain(entry.first_cluster);
+		CHECK(reserved.size() == 4);
+		CHECK(file.close() == fat::status::Ok);
+		CHECK(lookup("/", "EMPTY.RAW", entry) && entry.first_cluster == 0 && entry.size == 0);
+		for (auto cluster : reserved) CHECK(fat_entry(cluster) == 0);
+	}
+
+	// Filling the root directory's cluster makes it grow, reusing the deleted entry first
+	void test_directory_growth() {
+		auto before = list("/");
+		fat::File file;
+		char name[16];
+		for (int i = 0; i < 40; ++i) {
+			snprintf(name, sizeof name, "F%d.TXT", i);
+			CHECK(file.create(name) == fat::status::Ok);
+			CHECK(file.close() == fat::status::Ok);
+		}
+
+		auto after = list("/");
+		CHECK(after.size() == before.size() + 40);
+		fat::Entry first;
+		CHECK(lookup("/", "F0.TXT", first) && first.sector == cluster_sector(root_cluster) && first.index == 4);
+		CHECK(chain(root_cluster).size() == 2);
+
+		for (int i = 0; i < 40; ++i) {
+			snprintf(name, sizeof name, "f%d.txt", i);
+			CHECK(file.open(name) == fat::status::Ok && file.size() == 0);
+		}
+		CHECK(read_back("a long file name.txt", contents(1, 3000), 3000));
+	}
+}
+
+int main() {
+	test_mount();
+	test_directories();
+	test_read();
+	test_write();
+	test_directory_growth();
+	test_reserve();
+	return test::report();
+}
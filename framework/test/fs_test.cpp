@@ -0,0 +1,421 @@
+// fs.cpp on images fsgen.py made from the folder fs_tree.py writes, in every layout the firmware still has to read:
+//
+//   fs_test <version> <image> <folder>
+//
+// Every file in the folder has to be found with the right contents (by fs::get, fs::open and fs::exists), paths that
+// aren't there (or aren't paths) mustn't be, and the space used has to add up. Version 3 images are looked up through
+// their index, which has to agree with fs.h's hashes; version 2 indexes and version 1 images (which have none) have to be
+// searched.
+//
+//   fs_test write <version> <image> <folder>
+//
+// writes to the image instead: new revisions, new files and folders, removals, filling it up and compacting it (a bit at a
+// time, and into both sectors), checking after every step that the files are all still there and that nothing needed bits
+// set without an erase. Older images have to take writes to the folders they have, and become version 3 when compacted.
+//
+// fs.cpp remembers lookups until the filesystem changes, and where its free space starts until the next compaction, so
+// each image gets its own process.
+
+#include "test.h"
+#include "mock/flash.h"
+#include <fs.h>
+#include <filesystem>
+#include <map>
+#include <random>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+namespace {
+	constexpr uint32_t image_address = 0x080E'0000;
+	constexpr uint32_t spare_address = 0x080A'0000;
+	constexpr uint32_t copy_size = 0x2'0000;
+	constexpr uint32_t erased = 0xffff'ffff;
+
+	const fs::Header& header() {
+		return *reinterpret_cast<const fs::Header *>(uintptr_t(image_address));
+	}
+
+	std::string name_of(const char *field, size_t size) {
+		return std::string(field, strnlen(field, size));
+	}
+
+	// "folder/name" for everything in the folder fsgen.py was given
+	std::map<std::string, std::string> read_tree(const char *root) {
+		std::map<std::string, std::string> files;
+		for (const auto& folder : std::filesystem::directory_iterator(root)) {
+			for (const auto& file : std::filesystem::directory_iterator(folder.path())) {
+				std::string contents;
+				if (FILE *f = fopen(file.path().c_str(), "rb")) {
+					for (int c; (c = fgetc(f)) != EOF;) contents += static_cast<char>(c);
+					fclose(f);
+				}
+				files[folder.path().filename().string() + "/" + file.path().filename().string()] = contents;
+			}
+		}
+		return files;
+	}
+
+	bool has(const std::string& path, const std::string& contents) {
+		const fs::File * file = fs::get(path.c_str());
+		if (!file || file->length != contents.size()) return false;
+		if (name_of(file->name, sizeof file->name) != path.substr(path.find('/') + 1)) return false;
+		return fs::open(path.c_str()) == fs::open(*file) && memcmp(fs::open(*file), contents.data(), contents.size()) == 0 &&
+			fs::exists(path.c_str());
+	}
+
+	void test_files(const std::map<std::string, std::string>& files) {
+		for (const auto& [path, contents] : files) {
+			if (!has(path, contents)) printf("%s isn't right\n", path.c_str());
+			CHECK(has(path, contents));
+
+			std::string folder = path.substr(0, path.find('/'));
+			const fs::TopLevel * toplevel = fs::find(folder.c_str());
+			CHECK(toplevel && name_of(toplevel->name, sizeof toplevel->name) == folder);
+			CHECK(fs::find((folder + "/").c_str()) == toplevel);
+			CHECK(fs::exists((folder + "/").c_str()));
+		}
+
+		// Again, now that they've been looked up once
+		for (const auto& [path, contents] : files) CHECK(has(path, contents));
+
+		// Iterating over the folders finds the same files
+		size_t count = 0;
+		for (const auto& toplevel : header().top_level) {
+			if (!toplevel.ok() || toplevel.list_top == reinterpret_cast<fs::File *>(erased)) continue;
+			for (const auto& file : toplevel) {
+				std::string path = name_of(toplevel.name, sizeof toplevel.name) + "/" + name_of(file.name, sizeof file.name);
+				CHECK(files.count(path));
+				++count;
+			}
+		}
+		CHECK(count == files.size());
+	}
+
+	void test_missing() {
+		for (const char *path : {"fonts/font_1.fn", "fonts/font_1.fntx", "fonts/font_99.fnt", "ui/abcd", "ui/b", "nowhere/logo.img",
+				"patches/logo.img", "empty/logo.img", "abcdefghijk/logo.img", "abcdefghijklm/logo.img", "ui/0123456789abcdef",
+				"abcdefghijkl/0123456789abcdefg", "ui", "ui/", "/logo.img", "", "/", "fonts//font_1.fnt"}) {
+			if (fs::get(path)) printf("found %s\n", path);
+			CHECK(!fs::get(path));
+			CHECK(!fs::open(path));
+			// (a path without a name is the folder)
+			CHECK(fs::exists(path) == (!strcmp(path, "ui") || !strcmp(path, "ui/")));
+		}
+
+		CHECK(fs::exists("empty/"));
+		CHECK(fs::find("empty") != nullptr);
+		CHECK(!fs::find("nowhere"));
+		CHECK(!fs::find("ui/logo.img"));
+		CHECK(!fs::exists("nowhere/"));
+	}
+
+	// Nothing but the header, the index (version 2 ones were 8 bytes shorter) and the files takes up space yet
+	void test_usage(const std::map<std::string, std::string>& files, int version) {
+		uint32_t live = 0;
+		for (const auto& [path, contents] : files) live += (sizeof(fs::File) + contents.size() + 3) & ~3u;
+
+		const auto& index = *reinterpret_cast<const fs::Index *>(&header() + 1);
+		uint32_t index_size = 0;
+		if (version >= 2) index_size = fs::Index::size(index.bucket_count, index.entry_count) - (version < fs::IndexVersion ? 8 : 0);
+
+		fs::Usage usage = fs::usage();
+		CHECK(usage.live == live);
+		CHECK(usage.dead == 0);
+		CHECK(sizeof(fs::Header) + index_size + usage.live + usage.free == 0x2'0000);
+	}
+
+	// Every file in its slot, with the hash fs.h computes for its path
+	void test_index(const std::map<std::string, std::string>& files) {
+		const auto& index = *reinterpret_cast<const fs::Index *>(&header() + 1);
+		CHECK(index.ok());
+		CHECK(index.entry_count == files.size());
+		CHECK(index.complete == erased && index.generation == 0 && index.erases == 0);
+		CHECK(index.bucket_count && !(index.bucket_count & (index.bucket_count - 1)) && index.bucket_count > 1);
+
+		std::map<std::string, uint32_t> seen;
+		for (uint32_t slot = 0; slot < index.entry_count; ++slot) {
+			const auto& entry = index.entries()[slot];
+			CHECK(entry.toplevel < 16);
+			if (entry.toplevel >= 16) continue;
+
+			const fs::TopLevel& toplevel = header().top_level[entry.toplevel];
+			const fs::File& file = *entry.file;
+			std::string path = name_of(toplevel.name, sizeof toplevel.name) + "/" + name_of(file.name, sizeof file.name);
+			CHECK(files.count(path));
+			CHECK(entry.hash == fs::path_hash(path.data(), path.size()));
+			CHECK(fs::index_slot(entry.hash, index.displacement[entry.hash & (index.bucket_count - 1)], index.entry_count) == slot);
+			CHECK(fs::get(path.c_str()) == &file);
+			++seen[path];
+		}
+		CHECK(seen.size() == files.size());
+	}
+
+	// Cut every folder's chain after its first file: only an index can still find the rest. Has to run before anything else
+	// looks those files up (and so remembers them).
+	void test_chains_cut(const std::map<std::string, std::string>& files, bool indexed) {
+		std::vector<std::pair<fs::File *, fs::File *>> cut;
+		std::map<std::string, std::string> beyond;
+		for (const auto& toplevel : header().top_level) {
+			if (!toplevel.ok() || toplevel.list_top == reinterpret_cast<fs::File *>(erased)) continue;
+			auto * first = const_cast<fs::File *>(static_cast<const fs::File *>(toplevel.list_top));
+			cut.emplace_back(first, first->list_next);
+			first->list_next = reinterpret_cast<fs::File *>(erased);
+
+			std::string folder = name_of(toplevel.name, sizeof toplevel.name) + "/";
+			for (const auto& [path, contents] : files) {
+				if (path.starts_with(folder) && path != folder + name_of(first->name, sizeof first->name)) beyond[path] = contents;
+			}
+		}
+
+		uint32_t found = 0;
+		for (const auto& [path, contents] : beyond) found += has(path, contents);
+		CHECK(beyond.size() > 0);
+		CHECK(found == (indexed ? beyond.size() : 0));
+
+		for (const auto& [file, next] : cut) file->list_next = next;
+	}
+
+	// WRITING
+
+	std::map<std::string, std::string> model;
+	std::mt19937 random_bytes(1);
+
+	std::string data(size_t length) {
+		std::string result(length, 0);
+		for (auto& c : result) c = static_cast<char>(random_bytes());
+		return result;
+	}
+
+	uint32_t record_size(size_t length) {
+		return (sizeof(fs::File) + length + 3) & ~3u;
+	}
+
+	bool in_copy(const void *at, uint32_t copy) {
+		return uintptr_t(at) >= copy && uintptr_t(at) < copy + copy_size;
+	}
+
+	fs::write_status write(const std::string& path, const std::string& contents) {
+		mock::flash::snapshot();
+		auto result = fs::write(path.c_str(), contents.data(), contents.size());
+		CHECK(mock::flash::bits_set() == 0);
+		if (result == fs::write_status::Ok) model[path] = contents;
+		return result;
+	}
+
+	fs::write_status remove(const std::string& path) {
+		mock::flash::snapshot();
+		auto result = fs::remove(path.c_str());
+		CHECK(mock::flash::bits_set() == 0);
+		if (result == fs::write_status::Ok) model.erase(path);
+		return result;
+	}
+
+	fs::write_status compact(uint32_t budget = 0xffff'ffff) {
+		mock::flash::snapshot();
+		auto result = fs::compact(budget);
+		CHECK(mock::flash::bits_set() == 0);
+		return result;
+	}
+
+	// Everything written so far reads back, and nothing else is live
+	void check_model(const char *when) {
+		uint32_t wrong = 0, live = 0;
+		for (const auto& [path, contents] : model) {
+			if (!has(path, contents) && wrong++ < 3) printf("%s: %s isn't right\n", when, path.c_str());
+			live += record_size(contents.size());
+		}
+		CHECK(wrong == 0);
+		if (fs::usage().live != live) printf("%s: %u bytes live, should be %u\n", when, fs::usage().live, live);
+		CHECK(fs::usage().live == live);
+	}
+
+	const fs::Index& index_at(uint32_t copy) {
+		return *reinterpret_cast<const fs::Index *>(uintptr_t(copy) + sizeof(fs::Header));
+	}
+
+	uint32_t& word_at(uint32_t address) {
+		return *reinterpret_cast<uint32_t *>(uintptr_t(address));
+	}
+
+	// Compact a bit at a time, which leaves the old copy in use (and takes no writes) until it's done
+	void test_compact_in_steps(uint32_t to) {
+		uint32_t steps = 0;
+		fs::write_status result;
+		mock::flash::snapshot();
+		while ((result = fs::compact(512)) == fs::write_status::InProgress) {
+			CHECK(fs::compacting());
+			CHECK(fs::write("fonts/font_1.fnt", "x", 1) == fs::write_status::Busy);
+			CHECK(fs::remove("fonts/font_1.fnt") == fs::write_status::Busy);
+			if (++steps == 3) {
+				check_model("compacting");
+				CHECK(!in_copy(fs::get("fonts/font_1.fnt"), to));
+			}
+		}
+		CHECK(result == fs::write_status::Ok);
+		CHECK(mock::flash::bits_set() == 0);
+		CHECK(!fs::compacting());
+		CHECK(steps > 10);
+
+		// The old copy is retired, and the new one has everything, with an index of all of it
+		CHECK(in_copy(fs::find("fonts"), to));
+		CHECK(word_at(to == spare_address ? image_address : spare_address) == 0);
+		const auto& index = index_at(to);
+		CHECK(index.ok() && index.complete == 0xffff'ffff && index.entry_count == model.size());
+		CHECK(reinterpret_cast<const fs::Header *>(uintptr_t(to))->version == fs::IndexVersion);
+		CHECK(fs::usage().dead == 0);
+		check_model("compacted");
+	}
+
+	void test_writes(const char *image) {
+
+		// A write that was cut short after its header leaves a record nothing links to, which has to be stepped over
+		uint32_t orphan = image_address + static_cast<uint32_t>(std::filesystem::file_size(image));
+		fs::File record;
+		memset(&record, 0xff, sizeof record);
+		memcpy(record.magic, "fLeT", 4);
+		record.length = 50;
+		memcpy(reinterpret_cast<void *>(uintptr_t(orphan)), &record, sizeof record);
+		word_at(orphan + record_size(50)) = 0x1234'5678;
+
+		// A new revision, with the old one left alone
+		const fs::File * old = fs::get("fonts/font_1.fnt");
+		std::string old_contents(static_cast<const char *>(fs::open(*old)), old->length);
+		CHECK(write("fonts/font_1.fnt", data(77)) == fs::write_status::Ok);
+		CHECK(uintptr_t(fs::get("fonts/font_1.fnt")) > orphan + record_size(50));
+		CHECK(memcmp(old + 1, old_contents.data(), old_contents.size()) == 0);
+		CHECK(fs::get("fonts/font_1.fnt") == old->operator->());
+		CHECK(index_at(image_address).complete == 0xffff'ffff);
+
+		// New files aren't in the index, so it can't rule anything out any more
+		CHECK(write("patches/new.pch", data(10)) == fs::write_status::Ok);
+		CHECK(index_at(image_address).complete == 0);
+		CHECK(write("settings/a.cfg", data(3)) == fs::write_status::Ok);
+		CHECK(write("settings/b.cfg", "") == fs::write_status::Ok);
+		CHECK(write("settings/a.cfg", data(5)) == fs::write_status::Ok);
+		CHECK(write("abcdefghijkl/0123456789abcdef", data(16)) == fs::write_status::Ok);
+		CHECK(fs::find("settings") != nullptr);
+		check_model("writes");
+
+		for (const char *path : {"abcdefghijklm/x", "fonts/0123456789abcdefg", "fonts/", "/x", "fonts", ""})
+			CHECK(write(path, "x") == fs::write_status::BadPath);
+		CHECK(!fs::find("abcdefghijklm") && !fs::get("fonts/0123456789abcdef"));
+
+		// Removed files are gone until they're written again
+		CHECK(remove("ui/logo.img") == fs::write_status::Ok);
+		CHECK(!fs::get("ui/logo.img") && !fs::exists("ui/logo.img") && !fs::open("ui/logo.img"));
+		CHECK(remove("ui/logo.img") == fs::write_status::NotFound);
+		CHECK(remove("ui/nothing") == fs::write_status::NotFound);
+		CHECK(remove("settings/b.cfg") == fs::write_status::Ok);
+		check_model("removed");
+		CHECK(write("ui/logo.img", "back") == fs::write_status::Ok);
+		check_model("written again");
+
+		// Fill it up with revisions, which is all dead space once they're replaced
+		uint32_t revisions = 0;
+		while (write("patches/prg007.pch", data(2000 + revisions % 7)) == fs::write_status::Ok) ++revisions;
+		CHECK(revisions > 50);
+		CHECK(fs::usage().free < record_size(2006));
+		CHECK(fs::usage().dead > revisions * 2000 - 4000);
+		check_model("full");
+		CHECK(fs::wear().revisions_written == 9 + revisions);
+
+		// Into the spare, which is blank, so nothing's erased
+		test_compact_in_steps(spare_address);
+		CHECK(index_at(spare_address).generation == 1);
+		CHECK(!fs::get("patches/nothing.pch"));
+		CHECK(fs::exists("empty/"));
+		CHECK(mock::flash::erases(9) == 0 && mock::flash::erases(11) == 0);
+
+		// And back, which has to erase the retired copy
+		CHECK(write("settings/c.cfg", data(100)) == fs::write_status::Ok);
+		test_compact_in_steps(image_address);
+		CHECK(index_at(image_address).generation == 2);
+		CHECK(mock::flash::erases(9) == 0 && mock::flash::erases(11) == 1);
+		CHECK(compact() == fs::write_status::Ok);
+		CHECK(index_at(spare_address).generation == 3);
+		CHECK(mock::flash::erases(9) == 1 && mock::flash::erases(11) == 1);
+		check_model("compacted three times");
+
+		// The copies count their own erases
+		fs::Wear wear = fs::wear();
+		CHECK(wear.erases[0] == 1 && wear.erases[1] == 1);
+		CHECK(wear.compactions == 3);
+
+		// A compaction cut short before the old copy was retired leaves both valid: the newer one is used
+		word_at(image_address) = word_at(spare_address);
+		CHECK(in_copy(fs::find("fonts"), spare_address));
+		word_at(spare_address) = 0;
+		CHECK(in_copy(fs::find("fonts"), image_address));
+		word_at(spare_address) = word_at(image_address);
+		word_at(image_address) = 0;
+		CHECK(in_copy(fs::find("fonts"), spare_address));
+
+		// An app in the spare is never erased
+		word_at(image_address) = 0x2002'0000;
+		CHECK(compact() == fs::write_status::SpareInUse);
+		CHECK(!fs::compacting());
+		CHECK(word_at(image_address) == 0x2002'0000 && mock::flash::erases(11) == 1);
+		check_model("spare in use");
+		CHECK(write("settings/d.cfg", data(8)) == fs::write_status::Ok);
+		check_model("written after");
+	}
+
+	// Images from before folders could be created at runtime (the free slots were zeroed) still take writes to the folders
+	// they have, and are rewritten as version 3 by compaction
+	void test_old_writes(const char *image) {
+		uint32_t end = image_address + static_cast<uint32_t>(std::filesystem::file_size(image));
+
+		CHECK(write("fonts/font_1.fnt", data(77)) == fs::write_status::Ok);
+		CHECK(uintptr_t(fs::get("fonts/font_1.fnt")) == end);
+		CHECK(write("ui/new.img", data(9)) == fs::write_status::Ok);
+		CHECK(write("settings/a.cfg", data(3)) == fs::write_status::NoFolderSlot);
+		CHECK(remove("patches/prg001.pch") == fs::write_status::Ok);
+		check_model("writes");
+
+		test_compact_in_steps(spare_address);
+		CHECK(index_at(spare_address).generation == 1);
+		CHECK(write("settings/a.cfg", data(3)) == fs::write_status::Ok);
+		check_model("new folder");
+	}
+}
+
+int main(int argc, char **argv) {
+	if (argc == 5 && !strcmp(argv[1], "write")) {
+		int version = atoi(argv[2]);
+		if (!mock::flash::map() || !mock::flash::load(argv[3], image_address)) {
+			printf("couldn't put %s in the simulated flash\n", argv[3]);
+			return 2;
+		}
+		model = read_tree(argv[4]);
+		CHECK(header().version == version);
+		if (version >= fs::IndexVersion) test_writes(argv[3]);
+		else test_old_writes(argv[3]);
+		CHECK(mock::flash::violations() == 0);
+		return test::report();
+	}
+
+	if (argc != 4) {
+		printf("usage: fs_test [write] <version> <image> <folder>\n");
+		return 2;
+	}
+	int version = atoi(argv[1]);
+	if (!mock::flash::map() || !mock::flash::load(argv[2], image_address)) {
+		printf("couldn't put %s in the simulated flash\n", argv[2]);
+		return 2;
+	}
+	auto files = read_tree(argv[3]);
+
+	CHECK(fs::is_present());
+	CHECK(header().version == version);
+	CHECK(files.size() > 64);
+
+	test_chains_cut(files, version >= fs::IndexVersion);
+	if (version >= fs::IndexVersion) test_index(files);
+	test_files(files);
+	test_missing();
+	test_usage(files, version);
+	CHECK(mock::flash::violations() == 0);
+	return test::report();
+}
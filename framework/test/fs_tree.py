@@ -0,0 +1,48 @@
+#!/usr/bin/env python3
+"""
+Write the folder fs_test builds its filesystem images from (with fsgen.py).
+
+    fs_tree.py <output folder>
+
+The contents are random but always the same. There are enough files for the index to need several buckets, names as long
+as they can be, names that are prefixes of others, empty files and an empty folder.
+"""
+
+import os
+import random
+import shutil
+import sys
+
+
+def files():
+    rng = random.Random(4321)
+
+    def data(length):
+        return bytes(rng.randrange(256) for _ in range(length))
+
+    for n in range(24):
+        yield "fonts", "font_{}.fnt".format(n), data(rng.randrange(1, 300))
+    for n in range(40):
+        yield "patches", "prg{:03}.pch".format(n), data(rng.randrange(64, 200))
+    yield "ui", "logo.img", data(1500)
+    yield "ui", "a", data(1)
+    yield "ui", "ab", data(2)
+    yield "ui", "abc", b""
+    # The longest folder and file names there can be (neither is terminated in the image)
+    yield "abcdefghijkl", "0123456789abcdef", data(33)
+    yield "abcdefghijkl", "0123456789abcde", data(34)
+    yield "abcdefghijkl", "logo.img", data(35)
+
+
+def main():
+    out = sys.argv[1]
+    shutil.rmtree(out, ignore_errors=True)
+    os.makedirs(os.path.join(out, "empty"))
+    for folder, name, contents in files():
+        os.makedirs(os.path.join(out, folder), exist_ok=True)
+        with open(os.path.join(out, folder, name), "wb") as f:
+            f.write(contents)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,38 @@
+#include "disk.h"
+#include <sdcache.h>
+
+// sd::cache without the cache: everything goes straight to the disk image, so tests of the filesystem see exactly what it
+// wrote. The card is whatever the test sets sd::card.status to.
+
+sd::Card sd::card;
+
+namespace {
+	sd::cache::Stats statistics{};
+}
+
+sd::access_status sd::cache::read(uint32_t address, void * result_buffer, uint32_t length_in_sectors) {
+	return mock::disk::read(address, result_buffer, length_in_sectors) ? access_status::Ok : access_status::InvalidAddress;
+}
+
+sd::access_status sd::cache::write(uint32_t address, const void * source_buffer, uint32_t length_in_sectors) {
+	if (!mock::disk::write(address, source_buffer, length_in_sectors)) return access_status::InvalidAddress;
+	++statistics.write_backs;
+	statistics.sectors_written += length_in_sectors;
+	return access_status::Ok;
+}
+
+sd::access_status sd::cache::flush() {
+	return access_status::Ok;
+}
+
+void sd::cache::invalidate(uint32_t, uint32_t) {}
+
+void sd::cache::invalidate() {}
+
+const sd::cache::Stats& sd::cache::stats() {
+	return statistics;
+}
+
+void sd::cache::reset_stats() {
+	statistics = {};
+}
@@ -0,0 +1,66 @@
+#include "card.h"
+#include "disk.h"
+#include <sd.h>
+#include <deque>
+
+sd::Card sd::card;
+
+namespace mock::card {
+	namespace {
+		struct Request {
+			uint32_t sector, count;
+			void *buffer;
+			void (*callback)(void *, sd::access_status);
+			void *argument;
+		};
+
+		std::deque<Request> requests;
+
+		void finish() {
+			Request request = requests.front();
+			requests.pop_front();
+			bool ok = disk::read(request.sector, request.buffer, request.count);
+			request.callback(request.argument, ok ? sd::access_status::Ok : sd::access_status::InvalidAddress);
+		}
+	}
+
+	void insert() {
+		requests.clear();
+		sd::card = {};
+		sd::card.status = sd::init_status::Ok;
+		sd::card.card_type = sd::Card::CardTypeSDHC;
+		sd::card.length = uint64_t(disk::sectors()) * 512;
+		sd::card.active_state = sd::Card::ActiveStateInactive;
+	}
+
+	uint32_t pending() {
+		return requests.size();
+	}
+
+	void complete() {
+		while (!requests.empty()) finish();
+	}
+}
+
+sd::access_status sd::read(uint32_t address, void * result_buffer, uint32_t length_in_sectors) {
+	if (card.status != init_status::Ok) return access_status::NotInitialized;
+	if (mock::card::pending()) return access_status::Busy;
+	return mock::disk::read(address, result_buffer, length_in_sectors) ? access_status::Ok : access_status::InvalidAddress;
+}
+
+sd::access_status sd::read(uint32_t address, void * result_buffer, uint32_t length_in_sectors, void (*callback)(void *, access_status), void * argument) {
+	if (card.status != init_status::Ok) return access_status::NotInitialized;
+	if (mock::card::pending() == queue_length + 1) return access_status::Busy;
+	mock::card::requests.push_back({address, length_in_sectors, result_buffer, callback, argument});
+	return access_status::InProgress;
+}
+
+sd::access_status sd::write(uint32_t address, const void * source_buffer, uint32_t length_in_sectors) {
+	if (card.status != init_status::Ok) return access_status::NotInitialized;
+	if (mock::card::pending()) return access_status::Busy;
+	return mock::disk::write(address, source_buffer, length_in_sectors) ? access_status::Ok : access_status::InvalidAddress;
+}
+
+void sd::service() {
+	if (mock::card::pending()) mock::card::finish();
+}
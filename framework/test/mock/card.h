@@ -0,0 +1,18 @@
+#pragma once
+// The SD driver's access routines on top of the disk image (see disk.h), for testing what sits on top of them
+//
+// Blocking reads and writes return Busy while any asynchronous request is unfinished, like the real driver. Asynchronous
+// reads are queued and only move their data when they finish: sd::service() finishes the oldest one (standing in for the
+// time the transfer takes), or the test can finish them all with complete().
+
+#include <stdint.h>
+
+namespace mock::card {
+	// Make the disk image the card, initialized
+	void insert();
+
+	// Asynchronous requests that haven't finished
+	uint32_t pending();
+	// Finish them all, calling their callbacks
+	void complete();
+}
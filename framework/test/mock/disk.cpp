@@ -0,0 +1,50 @@
+#include "disk.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+namespace mock::disk {
+	namespace {
+		FILE *file = nullptr;
+		uint32_t size = 0;
+		Stats statistics{};
+	}
+
+	void create(uint32_t count) {
+		if (file) fclose(file);
+		file = tmpfile();
+		// Sparse, so large images cost nothing until they're written
+		if (!file || ftruncate(fileno(file), off_t(count) * 512)) {
+			perror("mock::disk::create");
+			exit(2);
+		}
+		size = count;
+		statistics = {};
+	}
+
+	uint32_t sectors() {
+		return size;
+	}
+
+	bool read(uint32_t sector, void *buffer, uint32_t count) {
+		if (sector >= size || count > size - sector) return false;
+		++statistics.reads;
+		statistics.sectors_read += count;
+		return pread(fileno(file), buffer, size_t(count) * 512, off_t(sector) * 512) == ssize_t(count) * 512;
+	}
+
+	bool write(uint32_t sector, const void *buffer, uint32_t count) {
+		if (sector >= size || count > size - sector) return false;
+		++statistics.writes;
+		statistics.sectors_written += count;
+		return pwrite(fileno(file), buffer, size_t(count) * 512, off_t(sector) * 512) == ssize_t(count) * 512;
+	}
+
+	const Stats& stats() {
+		return statistics;
+	}
+
+	void reset_stats() {
+		statistics = {};
+	}
+}
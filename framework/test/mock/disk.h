@@ -0,0 +1,24 @@
+#pragma once
+// A disk image in a (temporary) file, for the mocks that stand in for the SD card or the sector cache
+
+#include <stdint.h>
+
+namespace mock::disk {
+	// Back the disk with a new temporary file of `sectors` zeroed sectors
+	void create(uint32_t sectors);
+
+	uint32_t sectors();
+
+	// Straight to the file; false if out of range
+	bool read(uint32_t sector, void *buffer, uint32_t count);
+	bool write(uint32_t sector, const void *buffer, uint32_t count);
+
+	// Every access that went through read() and write() since create() or reset_stats()
+	struct Stats {
+		uint32_t reads, writes;
+		uint32_t sectors_read, sectors_written;
+	};
+
+	const Stats& stats();
+	void reset_stats();
+}
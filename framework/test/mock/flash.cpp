@@ -0,0 +1,110 @@
+#include "flash.h"
+#include <stm32f4xx.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <vector>
+
+namespace mock::flash {
+	Registers registers;
+
+	namespace {
+		uint8_t * const memory = reinterpret_cast<uint8_t *>(uintptr_t(base));
+
+		uint32_t erase_count[sector_count];
+		uint32_t violation_count;
+		// How far through the unlock sequence KEYR is
+		uint32_t keys;
+
+		std::vector<uint8_t> snapshot_data;
+		uint32_t snapshot_erases[sector_count];
+
+		void reset() {
+			memset(memory, 0xff, size);
+			registers = {};
+			registers.CR.value = FLASH_CR_LOCK;
+			memset(erase_count, 0, sizeof erase_count);
+			violation_count = 0;
+			keys = 0;
+		}
+	}
+
+	bool map() {
+		void *mapped = mmap(memory, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+		if (mapped != memory) {
+			if (mapped != MAP_FAILED) munmap(mapped, size);
+			return false;
+		}
+		reset();
+		return true;
+	}
+
+	bool load(const char *path, uint32_t address) {
+		reset();
+		FILE *file = fopen(path, "rb");
+		if (!file || address < base || address >= base + size) return false;
+		size_t length = fread(memory + (address - base), 1, base + size - address, file);
+		fclose(file);
+		return length != 0;
+	}
+
+	void key(uint32_t value) {
+		if (keys == 0 && value == 0x4567'0123) keys = 1;
+		else if (keys == 1 && value == 0xCDEF'89AB) {
+			registers.CR.value &= ~FLASH_CR_LOCK;
+			keys = 0;
+		}
+		else {
+			// The real one locks up until reset
+			++violation_count;
+			keys = 0;
+		}
+	}
+
+	void control(uint32_t cr) {
+		if (registers.CR.value & FLASH_CR_LOCK) {
+			if (cr != registers.CR.value) ++violation_count;
+			return;
+		}
+		registers.CR.value = cr;
+
+		if ((cr & FLASH_CR_STRT) && (cr & FLASH_CR_SER)) {
+			uint32_t sector = (cr >> FLASH_CR_SNB_Pos) & 0xf;
+			if (sector < first_sector || sector >= first_sector + sector_count) ++violation_count;
+			else {
+				memset(memory + (sector - first_sector) * sector_size, 0xff, sector_size);
+				++erase_count[sector - first_sector];
+			}
+			registers.CR.value &= ~FLASH_CR_STRT;
+		}
+	}
+
+	uint32_t erases(uint32_t sector) {
+		if (sector < first_sector || sector >= first_sector + sector_count) return 0;
+		return erase_count[sector - first_sector];
+	}
+
+	uint32_t violations() {
+		return violation_count;
+	}
+
+	void snapshot() {
+		snapshot_data.assign(memory, memory + size);
+		memcpy(snapshot_erases, erase_count, sizeof erase_count);
+	}
+
+	uint32_t bits_set() {
+		if (!(registers.CR.value & FLASH_CR_LOCK)) ++violation_count;
+
+		uint32_t count = 0;
+		if (snapshot_data.size() != size) return count;
+		for (uint32_t at = 0; at < size; at += 4) {
+			if (erase_count[at / sector_size] != snapshot_erases[at / sector_size]) continue;
+			uint32_t before, now;
+			memcpy(&before, &snapshot_data[at], 4);
+			memcpy(&now, memory + at, 4);
+			if (now & ~before) ++count;
+		}
+		return count;
+	}
+}
@@ -0,0 +1,65 @@
+#pragma once
+// Simulated flash for testing fs.cpp on the host
+//
+// Sectors 9 to 11 (0x080A0000 to 0x08100000, where the filesystem and the spare live) are mapped at their real addresses,
+// so images and the pointers in them work as they are. Programming is the library writing to those addresses directly,
+// like on the chip; the test checks it only ever cleared bits with snapshot() and bits_set(). Erases go through the
+// control register and happen as soon as STRT is set.
+//
+// Anything the real controller would refuse (erasing while locked, or a sector that isn't simulated) is counted in
+// violations, and so is leaving the controller unlocked by the time bits_set() looks.
+
+#include <stdint.h>
+
+namespace mock::flash {
+	constexpr uint32_t base = 0x080A'0000;
+	constexpr uint32_t size = 0x6'0000;
+	constexpr uint32_t first_sector = 9, sector_size = 0x2'0000, sector_count = 3;
+
+	// Map the simulated sectors, all erased. False if something else is already at those addresses.
+	bool map();
+
+	// Erase everything again and copy the file at path to address
+	bool load(const char *path, uint32_t address);
+
+	// Hooks for the registers with side effects
+	void key(uint32_t key);
+	void control(uint32_t cr);
+
+	struct KeyRegister {
+		KeyRegister& operator=(uint32_t value) {key(value); return *this;}
+	};
+
+	struct StatusRegister {
+		uint32_t value;
+		// Write one to clear, like the real one
+		StatusRegister& operator=(uint32_t flags) {value &= ~flags; return *this;}
+		operator uint32_t() const {return value;}
+	};
+
+	struct ControlRegister {
+		uint32_t value;
+		ControlRegister& operator=(uint32_t cr) {control(cr); return *this;}
+		ControlRegister& operator|=(uint32_t bits) {return *this = value | bits;}
+		ControlRegister& operator&=(uint32_t bits) {return *this = value & bits;}
+		operator uint32_t() const {return value;}
+	};
+
+	struct Registers {
+		uint32_t ACR;
+		KeyRegister KEYR;
+		uint32_t OPTKEYR;
+		StatusRegister SR;
+		ControlRegister CR;
+	};
+
+	extern Registers registers;
+
+	// Since map() (or load())
+	uint32_t erases(uint32_t sector);
+	uint32_t violations();
+
+	// Remember what's in flash now, then count the words that have had bits set since (sectors erased in between excepted)
+	void snapshot();
+	uint32_t bits_set();
+}
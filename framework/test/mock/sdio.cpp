@@ -0,0 +1,502 @@
+#include "sdio.h"
+#include <stm32f4xx.h>
+#include <string.h>
+#include <sys/mman.h>
+
+namespace mock::sdio {
+	Registers registers;
+	Dma dma;
+
+	namespace {
+		enum State : uint32_t {
+			Idle = 0,
+			Ready = 1,
+			Ident = 2,
+			Stby = 3,
+			Tran = 4,
+			Data = 5,
+			Rcv = 6,
+			Prg = 7
+		};
+
+		constexpr uint32_t rca = 0x1234;
+
+		Card config;
+		std::vector<uint8_t> storage;
+		State state;
+		bool app_cmd;
+		uint32_t op_cond_polls;
+		// Set with CMD23 for the next multi block transfer; 0 means it runs until CMD12
+		uint32_t block_count;
+		uint32_t programming;
+		bool fail_next;
+		uint32_t erase_start, erase_end;
+
+		uint32_t flags;
+		std::vector<Command> commands;
+		uint32_t violation_count;
+
+		// The data transfer in progress, if any
+		enum Kind {
+			None,
+			PolledRead,
+			PolledWrite,
+			DmaRead,
+			DmaWrite
+		};
+
+		struct {
+			Kind kind;
+			uint32_t sector, bytes;
+			bool open_ended;
+		} transfer;
+
+		// Polled reads: words the card hasn't sent yet, and the FIFO
+		std::deque<uint32_t> incoming, fifo;
+		// Polled writes: what the host has written so far
+		std::vector<uint8_t> received;
+
+		void violation() {
+			++violation_count;
+		}
+
+		void respond_short(uint32_t index, uint32_t value) {
+			registers.RESPCMD = index;
+			registers.RESP1 = value;
+			flags |= SDIO_STA_CMDREND;
+		}
+
+		// Bytes are in the order they're sent in (most significant first)
+		void respond_long(const uint8_t (&bytes)[16]) {
+			uint32_t words[4];
+			for (int i = 0; i < 4; ++i) words[i] = (bytes[i*4] << 24) | (bytes[i*4+1] << 16) | (bytes[i*4+2] << 8) | bytes[i*4+3];
+			registers.RESPCMD = 0x3f;
+			registers.RESP1 = words[0];
+			registers.RESP2 = words[1];
+			registers.RESP3 = words[2];
+			registers.RESP4 = words[3];
+			flags |= SDIO_STA_CMDREND;
+		}
+
+		uint32_t r1(State at, uint32_t errors = 0) {
+			return (at << 9) | (at != Prg && at != Rcv ? 1u << 8 : 0) | (app_cmd ? 1u << 5 : 0) | errors;
+		}
+
+		// Set a field of a register that's sent most significant byte first, by bit position (as in the spec)
+		template<size_t N>
+		void set_bits(uint8_t (&reg)[N], uint32_t position, uint32_t width, uint64_t value) {
+			for (uint32_t i = 0; i < width; ++i) {
+				uint32_t bit = position + i;
+				uint8_t &byte = reg[N - 1 - bit / 8];
+				if ((value >> i) & 1) byte |= 1 << (bit % 8);
+				else byte &= ~(1 << (bit % 8));
+			}
+		}
+
+		void send_csd() {
+			uint8_t csd[16]{};
+			set_bits(csd, 80, 4, 9); // READ_BL_LEN 512
+			if (config.high_capacity) {
+				set_bits(csd, 126, 2, 1);
+				set_bits(csd, 48, 22, config.sectors / 1024 - 1);
+			}
+			else {
+				// (C_SIZE + 1) * 2^(C_SIZE_MULT + 2) blocks
+				set_bits(csd, 62, 12, config.sectors / 512 - 1);
+				set_bits(csd, 47, 3, 7);
+			}
+			respond_long(csd);
+		}
+
+		// Start sending data through the FIFO (or DMA, if the DPSM is set up for it)
+		void send_data(const uint8_t *bytes, uint32_t length, uint32_t sector, bool open_ended) {
+			uint32_t dctrl = registers.DCTRL;
+			if (!(dctrl & SDIO_DCTRL_DTEN) || !(dctrl & SDIO_DCTRL_DTDIR)) {
+				// The DPSM wasn't waiting, so the data is lost
+				violation();
+				return;
+			}
+			if (length > registers.DLEN) length = registers.DLEN;
+
+			transfer = {PolledRead, sector, length, open_ended};
+			if (dctrl & SDIO_DCTRL_DMAEN) {
+				transfer.kind = DmaRead;
+				return;
+			}
+
+			for (uint32_t i = 0; i + 4 <= length; i += 4) {
+				uint32_t word;
+				memcpy(&word, bytes + i, 4);
+				incoming.push_back(word);
+			}
+		}
+
+		void refill() {
+			while (fifo.size() < 32 && !incoming.empty()) {
+				fifo.push_back(incoming.front());
+				incoming.pop_front();
+			}
+		}
+
+		// Called once all the data has been moved
+		void end_transfer(bool ok) {
+			bool writing = transfer.kind == PolledWrite || transfer.kind == DmaWrite;
+			flags |= ok ? SDIO_STA_DATAEND | SDIO_STA_DBCKEND : SDIO_STA_DCRCFAIL;
+
+			if (!transfer.open_ended || !ok) {
+				if (writing && (programming = config.programming_polls)) state = Prg;
+				else state = Tran;
+			}
+			transfer.kind = None;
+		}
+
+		bool valid_address(uint32_t argument, uint32_t &sector, uint32_t &errors) {
+			errors = 0;
+			if (config.high_capacity) sector = argument;
+			else {
+				sector = argument / 512;
+				if (argument % 512) errors |= 1u << 30; // ADDRESS_ERROR
+			}
+			if (sector >= config.sectors) errors |= 1u << 31; // OUT_OF_RANGE
+			return !errors;
+		}
+
+		// Start a block read or write
+		void data_command(uint32_t index, uint32_t argument) {
+			bool multiple = index == 18 || index == 25;
+			uint32_t count = multiple ? block_count : 1;
+			block_count = 0;
+
+			uint32_t sector, errors;
+			if (!valid_address(argument, sector, errors) || (count && sector + count > config.sectors)) {
+				respond_short(index, r1(state, errors ? errors : 1u << 31));
+				return;
+			}
+			respond_short(index, r1(state));
+
+			if (index == 17 || index == 18) {
+				// The transfer has to match what the card was told (with CMD23)
+				if (count && count * 512 != registers.DLEN) violation();
+				state = Data;
+				uint32_t length = registers.DLEN;
+				if (sector + length / 512 > config.sectors) length = (config.sectors - sector) * 512;
+				send_data(&storage[sector * 512], length, sector, !count);
+				refill();
+				if (transfer.kind == PolledRead && incoming.empty()) end_transfer(true);
+			}
+			else {
+				state = Rcv;
+				// Writes set up the DPSM after the command; remember the count to check it then
+				transfer = {None, sector, count * 512, !count};
+			}
+		}
+
+		void execute(uint32_t index, uint32_t argument, bool app) {
+			// Commands the card doesn't take in its current state get no response
+			auto reject = [&]{
+				violation();
+				flags |= SDIO_STA_CTIMEOUT;
+			};
+
+			State at = state;
+			switch (index) {
+				case 0:
+					state = Idle;
+					flags |= SDIO_STA_CMDSENT;
+					return;
+				case 8:
+					if (state != Idle) return reject();
+					respond_short(8, argument & 0xfff);
+					return;
+				case 55:
+					if (state != Idle && (argument >> 16) != rca) return reject();
+					app_cmd = true;
+					respond_short(55, r1(at));
+					return;
+				case 2:
+					if (state != Ready) return reject();
+					state = Ident;
+					{
+						uint8_t cid[16] = {'M', 'S', 'Y', 'N', 'T', 'H'};
+						respond_long(cid);
+					}
+					return;
+				case 3:
+					if (state != Ident && state != Stby) return reject();
+					state = Stby;
+					respond_short(3, rca << 16 | 0x0500);
+					return;
+				case 9:
+					if (state != Stby || (argument >> 16) != rca) return reject();
+					send_csd();
+					return;
+				case 7:
+					if (state != Stby || (argument >> 16) != rca) return reject();
+					state = Tran;
+					respond_short(7, r1(at));
+					return;
+				case 13:
+					if ((argument >> 16) != rca) return reject();
+					respond_short(13, r1(at));
+					if (state == Prg && --programming == 0) state = Tran;
+					return;
+				case 16:
+					if (state != Tran) return reject();
+					respond_short(16, r1(at));
+					return;
+				case 12:
+					if (state == Data) state = Tran;
+					else if (state == Rcv) state = (programming = config.programming_polls) ? Prg : Tran;
+					else return reject();
+					respond_short(12, r1(at));
+					return;
+				case 17:
+				case 18:
+				case 24:
+				case 25:
+					if (state != Tran) return reject();
+					return data_command(index, argument);
+				case 32:
+				case 33:
+					if (state != Tran) return reject();
+					respond_short(index, r1(at));
+					(index == 32 ? erase_start : erase_end) = config.high_capacity ? argument : argument / 512;
+					return;
+				case 38:
+					if (state != Tran) return reject();
+					respond_short(38, r1(at));
+					for (uint32_t s = erase_start; s <= erase_end && s < config.sectors; ++s) memset(&storage[s * 512], 0, 512);
+					state = (programming = config.programming_polls) ? Prg : Tran;
+					return;
+				default:
+					break;
+			}
+
+			if (app) switch (index) {
+				case 41: {
+					if (state != Idle) return reject();
+					bool ready = ++op_cond_polls > 2;
+					uint32_t ocr = (1u << 20) | (ready ? 1u << 31 : 0) | (ready && config.high_capacity && (argument & (1u << 30)) ? 1u << 30 : 0);
+					if (ready) state = Ready;
+					// R3 has no CRC, so the peripheral always flags it as failed
+					registers.RESPCMD = 0x3f;
+					registers.RESP1 = ocr;
+					flags |= SDIO_STA_CCRCFAIL;
+					return;
+				}
+				case 6:
+					if (state != Tran) return reject();
+					respond_short(6, r1(at));
+					return;
+				case 23:
+					if (state != Tran) return reject();
+					respond_short(23, r1(at));
+					return;
+				case 51: {
+					if (state != Tran) return reject();
+					respond_short(51, r1(at));
+					uint8_t scr[8]{};
+					set_bits(scr, 56, 4, 2); // SD_SPEC 2.00
+					set_bits(scr, 48, 4, 0b0101); // 1 and 4 bit bus
+					if (config.set_block_count) set_bits(scr, 33, 1, 1);
+					send_data(scr, sizeof scr, 0, false);
+					refill();
+					if (transfer.kind == PolledRead && incoming.empty()) transfer.kind = None;
+					return;
+				}
+				default:
+					return reject();
+			}
+
+			switch (index) {
+				case 6: {
+					if (state != Tran) return reject();
+					respond_short(6, r1(at));
+					uint8_t switch_status[64]{};
+					if (config.high_speed) {
+						switch_status[13] = 0b10;
+						switch_status[16] = 0x1;
+					}
+					else switch_status[16] = 0xf;
+					send_data(switch_status, sizeof switch_status, 0, false);
+					refill();
+					if (transfer.kind == PolledRead && incoming.empty()) transfer.kind = None;
+					return;
+				}
+				case 23:
+					if (state != Tran || !config.set_block_count) return reject();
+					block_count = argument & 0xffff;
+					respond_short(23, r1(at));
+					return;
+				default:
+					return reject();
+			}
+		}
+	}
+
+	uint32_t status() {
+		uint32_t result = flags;
+		if (!incoming.empty()) result |= SDIO_STA_RXACT;
+		if (fifo.size() >= 8) result |= SDIO_STA_RXFIFOHF;
+		if (!fifo.empty()) result |= SDIO_STA_RXDAVL;
+		if (transfer.kind == PolledWrite) result |= SDIO_STA_TXACT | SDIO_STA_TXFIFOHE;
+		return result;
+	}
+
+	void clear(uint32_t cleared) {
+		flags &= ~cleared;
+	}
+
+
+	void command(uint32_t cmd) {
+		uint32_t index = cmd & 0x3f;
+		uint32_t argument = registers.ARG;
+		bool app = app_cmd;
+		app_cmd = false;
+		commands.push_back({index, app, argument});
+
+		if (!(cmd & SDIO_CMD_CPSMEN)) return;
+
+		// Nothing else can go out while data is moving
+		if (transfer.kind != None || !incoming.empty() || !received.empty()) violation();
+
+		execute(index, argument, app);
+
+		// Without WAITRESP the CPSM doesn't wait for the response, it just says the command went out
+		if (!(cmd & SDIO_CMD_WAITRESP)) {
+			flags &= ~(SDIO_STA_CMDREND | SDIO_STA_CCRCFAIL | SDIO_STA_CTIMEOUT);
+			flags |= SDIO_STA_CMDSENT;
+		}
+	}
+
+
+	void data_control(uint32_t dctrl) {
+		if (!(dctrl & SDIO_DCTRL_DTEN)) {
+			// Disabling the DPSM drops whatever was going on
+			if (transfer.kind != None) transfer.kind = None;
+			incoming.clear();
+			fifo.clear();
+			received.clear();
+			return;
+		}
+		if (dctrl & SDIO_DCTRL_DTDIR) return;
+
+		// Host to card: the card has to be expecting data
+		if (state != Rcv || transfer.kind != None) {
+			violation();
+			return;
+		}
+		if (transfer.bytes && transfer.bytes != registers.DLEN) violation();
+		transfer.kind = (dctrl & SDIO_DCTRL_DMAEN) ? DmaWrite : PolledWrite;
+		transfer.bytes = registers.DLEN;
+	}
+
+	uint32_t fifo_read() {
+		if (fifo.empty()) {
+			violation();
+			return 0;
+		}
+		uint32_t word = fifo.front();
+		fifo.pop_front();
+
+		bool more = !incoming.empty();
+		refill();
+		if (more && incoming.empty() && transfer.kind == PolledRead) end_transfer(true);
+		return word;
+	}
+
+	void fifo_write(uint32_t word) {
+		if (transfer.kind != PolledWrite) {
+			violation();
+			return;
+		}
+		uint8_t bytes[4];
+		memcpy(bytes, &word, 4);
+		received.insert(received.end(), bytes, bytes + 4);
+
+		if (received.size() == transfer.bytes) {
+			memcpy(&storage[transfer.sector * 512], received.data(), received.size());
+			received.clear();
+			end_transfer(true);
+		}
+	}
+
+	void insert(const Card& card) {
+		config = card;
+		storage.assign(size_t(card.sectors) * 512, 0);
+		state = Idle;
+		app_cmd = false;
+		op_cond_polls = 0;
+		block_count = 0;
+		programming = 0;
+		fail_next = false;
+		erase_start = erase_end = 0;
+		flags = 0;
+		commands.clear();
+		violation_count = 0;
+		transfer = {};
+		incoming.clear();
+		fifo.clear();
+		received.clear();
+		registers = {};
+		dma = {};
+	}
+
+	uint8_t * sector(uint32_t index) {
+		return &storage[size_t(index) * 512];
+	}
+
+	const std::vector<Command>& log() {
+		return commands;
+	}
+
+	void clear_log() {
+		commands.clear();
+	}
+
+	uint32_t violations() {
+		return violation_count;
+	}
+
+	bool transfer_pending() {
+		return transfer.kind == DmaRead || transfer.kind == DmaWrite;
+	}
+
+	bool finish_transfer() {
+		if (!transfer_pending()) return false;
+
+		bool writing = transfer.kind == DmaWrite;
+		if (!dma.enabled || dma.length * 4 != transfer.bytes || dma.to_peripheral != writing) violation();
+
+		if (fail_next) {
+			fail_next = false;
+			end_transfer(false);
+			return true;
+		}
+
+		void *memory = reinterpret_cast<void *>(uintptr_t(dma.memory));
+		if (writing) memcpy(&storage[transfer.sector * 512], memory, transfer.bytes);
+		else memcpy(memory, &storage[transfer.sector * 512], transfer.bytes);
+		end_transfer(true);
+		return true;
+	}
+
+	void fail_next_transfer() {
+		fail_next = true;
+	}
+
+	void * dma_alloc(size_t size) {
+		static uint8_t *arena = nullptr;
+		static size_t used = 0;
+		constexpr size_t arena_size = 1 << 20;
+		if (!arena) {
+			arena = static_cast<uint8_t *>(mmap(nullptr, arena_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0));
+			if (arena == MAP_FAILED) return nullptr;
+		}
+		size = (size + 15) & ~size_t(15);
+		if (used + size > arena_size) return nullptr;
+		void *result = arena + used;
+		used += size;
+		return result;
+	}
+}
@@ -0,0 +1,114 @@
+#pragma once
+// Simulated SDIO peripheral with an SD card attached, for testing sd.cpp on the host
+//
+// Commands are answered as soon as they're written to CMD. Polled data goes through a FIFO like the real one (data
+// arrives as the FIFO is emptied, so DATAEND comes after the response has been handled). DMA transfers only move their data
+// when the test calls finish_transfer(), which stands in for the time the card takes; the test then runs sd::sdio_interrupt()
+// itself if the flags it unmasked are set.
+//
+// The card follows the spec's state machine closely enough to catch a driver talking to it in the wrong state: every
+// command the card would reject (or that arrives while a data transfer is still running) is counted in violations.
+//
+// DMA addresses are 32 bits, so buffers for DMA transfers have to come from dma_alloc().
+
+#include <stdint.h>
+#include <stddef.h>
+#include <deque>
+#include <vector>
+
+namespace mock::sdio {
+	// Hooks for the registers with side effects
+	uint32_t status();
+	void clear(uint32_t flags);
+	void command(uint32_t cmd);
+	void data_control(uint32_t dctrl);
+	uint32_t fifo_read();
+	void fifo_write(uint32_t word);
+
+	struct StatusRegister {
+		operator uint32_t() const {return status();}
+	};
+
+	struct ClearRegister {
+		ClearRegister& operator=(uint32_t flags) {clear(flags); return *this;}
+	};
+
+	struct CommandRegister {
+		uint32_t value;
+		CommandRegister& operator=(uint32_t cmd) {value = cmd; command(cmd); return *this;}
+		operator uint32_t() const {return value;}
+	};
+
+	struct DataControlRegister {
+		uint32_t value;
+		DataControlRegister& operator=(uint32_t dctrl) {value = dctrl; data_control(dctrl); return *this;}
+		DataControlRegister& operator|=(uint32_t bits) {return *this = value | bits;}
+		DataControlRegister& operator&=(uint32_t bits) {return *this = value & bits;}
+		operator uint32_t() const {return value;}
+	};
+
+	struct FifoRegister {
+		FifoRegister& operator=(uint32_t word) {fifo_write(word); return *this;}
+		operator uint32_t() const {return fifo_read();}
+	};
+
+	struct Registers {
+		uint32_t POWER, CLKCR, ARG;
+		CommandRegister CMD;
+		uint32_t RESPCMD, RESP1, RESP2, RESP3, RESP4;
+		uint32_t DTIMER, DLEN;
+		DataControlRegister DCTRL;
+		uint32_t DCOUNT;
+		StatusRegister STA;
+		ClearRegister ICR;
+		uint32_t MASK;
+		FifoRegister FIFO;
+	};
+
+	struct Dma {
+		uint32_t memory, length;
+		uint32_t to_peripheral;
+		bool enabled;
+	};
+
+	extern Registers registers;
+	extern Dma dma;
+
+	// What kind of card is inserted
+	struct Card {
+		uint32_t sectors = 4096;
+		bool high_capacity = true; // SDHC: block addressed, CSD version 2
+		bool set_block_count = true; // supports CMD23
+		bool high_speed = true; // supports switching to high speed with CMD6
+		// SEND_STATUS polls that still see the card programming after each write
+		uint32_t programming_polls = 2;
+	};
+
+	struct Command {
+		uint32_t index;
+		bool app; // sent after APP_CMD
+		uint32_t argument;
+	};
+
+	// Power on a fresh card (all sectors zero) and reset the peripheral
+	void insert(const Card& card);
+
+	// The card's contents
+	uint8_t * sector(uint32_t index);
+
+	// Every command sent since insert()
+	const std::vector<Command>& log();
+	void clear_log();
+	// Commands the card would have rejected, or that were sent while a transfer was running
+	uint32_t violations();
+
+	// Whether a DMA transfer is waiting for finish_transfer()
+	bool transfer_pending();
+	// Move the pending DMA transfer's data and set its flags. Returns false if there wasn't one.
+	bool finish_transfer();
+	// Make the next DMA transfer fail with a data CRC error
+	void fail_next_transfer();
+
+	// Memory below 4GB, so its address fits in the DMA registers
+	void * dma_alloc(size_t size);
+}
@@ -0,0 +1,16 @@
+#include <util.h>
+
+// Nothing in the tests runs concurrently, so waiting never changes anything; just count the time.
+namespace mock {
+	uint32_t elapsed_ms = 0;
+}
+
+void util::delay(uint32_t ms) {
+	mock::elapsed_ms += ms;
+}
+
+void util::enable_cycle_counter() {}
+
+uint32_t util::cycles() {
+	return mock::elapsed_ms * 168'000;
+}
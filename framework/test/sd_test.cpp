@@ -0,0 +1,281 @@
+// sd.cpp against a simulated card: initialization, blocking and DMA transfers, the request queue and its interaction with
+// the card programming writes, and how multi block transfers are announced (CMD23, or ACMD23 and a stop command).
+
+#include "test.h"
+#include <sd.h>
+#include <stm32f4xx.h>
+#include <string.h>
+#include <vector>
+
+using mock::sdio::Card;
+
+namespace {
+	bool start(const Card& card) {
+		mock::sdio::insert(card);
+		sd::card = {};
+		sd::init();
+		return sd::init_card() == sd::init_status::Ok;
+	}
+
+	// Let the running DMA transfer finish, then take its interrupt
+	bool run_interrupt() {
+		if (!mock::sdio::finish_transfer()) return false;
+		if (SDIO->STA & SDIO->MASK) sd::sdio_interrupt();
+		return true;
+	}
+
+	// Finish everything queued, servicing the queue while the card is busy programming
+	void run_all() {
+		for (int i = 0; i < 1000; ++i) {
+			if (!run_interrupt()) sd::service();
+		}
+	}
+
+	uint8_t * dma_buffer(uint32_t sectors) {
+		return static_cast<uint8_t *>(mock::sdio::dma_alloc(sectors * 512));
+	}
+
+	void fill(uint8_t *buffer, uint32_t sectors, uint8_t seed) {
+		for (uint32_t i = 0; i < sectors * 512; ++i) buffer[i] = static_cast<uint8_t>(i * 7 + seed + i / 512);
+	}
+
+	bool card_has(uint32_t sector, const uint8_t *data, uint32_t sectors) {
+		for (uint32_t i = 0; i < sectors; ++i) {
+			if (memcmp(mock::sdio::sector(sector + i), data + i * 512, 512)) return false;
+		}
+		return true;
+	}
+
+	uint32_t count_commands(uint32_t index, bool app = false) {
+		uint32_t count = 0;
+		for (const auto& command : mock::sdio::log()) count += command.index == index && command.app == app;
+		return count;
+	}
+
+	// Records the callbacks of async requests, in order
+	struct Completion {
+		std::vector<int> order;
+		std::vector<sd::access_status> results;
+	};
+
+	struct Request {
+		Completion *completion;
+		int id;
+	};
+
+	void completed(void *argument, sd::access_status status) {
+		auto *request = static_cast<Request *>(argument);
+		request->completion->order.push_back(request->id);
+		request->completion->results.push_back(status);
+	}
+
+	void test_init() {
+		CHECK(start({}));
+		CHECK(sd::card.card_type == sd::Card::CardTypeSDHC);
+		CHECK(sd::card.length == 4096ull * 512);
+		CHECK(sd::card.high_speed);
+		CHECK(sd::card.set_block_count);
+		CHECK(SDIO->CLKCR & SDIO_CLKCR_BYPASS);
+		CHECK(mock::sdio::violations() == 0);
+
+		Card standard;
+		standard.high_capacity = false;
+		standard.set_block_count = false;
+		standard.high_speed = false;
+		CHECK(start(standard));
+		CHECK(sd::card.card_type == sd::Card::CardTypeSDVer2OrLater);
+		CHECK(sd::card.length == 4096ull * 512);
+		CHECK(!sd::card.high_speed);
+		CHECK(!sd::card.set_block_count);
+		CHECK(!(SDIO->CLKCR & SDIO_CLKCR_BYPASS));
+		CHECK(count_commands(16) == 1);
+		CHECK(mock::sdio::violations() == 0);
+	}
+
+	// Blocking transfers, on a card with CMD23 and one without
+	void test_blocking(const Card& card) {
+		CHECK(start(card));
+		mock::sdio::clear_log();
+
+		uint8_t out[3 * 512], in[3 * 512];
+		fill(out, 3, 1);
+		CHECK(sd::write(10, out, 3) == sd::access_status::Ok);
+		CHECK(card_has(10, out, 3));
+		CHECK(sd::write(20, out, 1) == sd::access_status::Ok);
+		CHECK(card_has(20, out, 1));
+
+		memset(in, 0, sizeof in);
+		CHECK(sd::read(10, in, 3) == sd::access_status::Ok);
+		CHECK(memcmp(in, out, sizeof in) == 0);
+		memset(in, 0, sizeof in);
+		CHECK(sd::read(20, in, 1) == sd::access_status::Ok);
+		CHECK(memcmp(in, out, 512) == 0);
+
+		if (card.set_block_count) {
+			// Multi block transfers are announced with CMD23 and stop by themselves
+			CHECK(count_commands(23) == 2);
+			CHECK(count_commands(23, true) == 0);
+			CHECK(count_commands(12) == 0);
+		}
+		else {
+			// Writes get the pre-erase hint, and both need CMD12
+			CHECK(count_commands(23) == 0);
+			CHECK(count_commands(23, true) == 1);
+			CHECK(count_commands(12) == 2);
+		}
+
+		// The blocking write waited for programming to finish
+		CHECK(count_commands(13) >= 2 * card.programming_polls);
+
+		CHECK(sd::erase(10, 2) == sd::access_status::Ok);
+		uint8_t zeros[512]{};
+		CHECK(card_has(10, zeros, 1) && card_has(11, zeros, 1));
+		CHECK(card_has(12, out + 1024, 1));
+
+		CHECK(sd::read(4096, in, 1) == sd::access_status::InvalidAddress);
+		CHECK(sd::read(12, in, 1) == sd::access_status::Ok);
+		CHECK(mock::sdio::violations() == 0);
+	}
+
+	void test_async(const Card& card) {
+		CHECK(start(card));
+		mock::sdio::clear_log();
+		Completion completion;
+
+		uint8_t *source = dma_buffer(4), *target = dma_buffer(4);
+		fill(source, 4, 9);
+
+		// A multi block write, then read back
+		Request write{&completion, 1}, read{&completion, 2};
+		CHECK(sd::write(100, source, 4, completed, &write) == sd::access_status::InProgress);
+		CHECK(mock::sdio::transfer_pending());
+		CHECK(SDIO->DTIMER == (card.high_speed ? 250u * 48'000 : 250u * 24'000));
+		CHECK(run_interrupt());
+		CHECK(completion.order == std::vector<int>{1});
+		CHECK(completion.results[0] == sd::access_status::Ok);
+		CHECK(card_has(100, source, 4));
+
+		// The card is still programming, so the read waits for service()
+		CHECK(sd::read(100, target, 4, completed, &read) == sd::access_status::InProgress);
+		CHECK(!mock::sdio::transfer_pending());
+		run_all();
+		CHECK(completion.order == (std::vector<int>{1, 2}));
+		CHECK(memcmp(source, target, 4 * 512) == 0);
+
+		if (card.set_block_count) CHECK(count_commands(12) == 0);
+		else {
+			CHECK(count_commands(12) == 2);
+			CHECK(count_commands(23, true) == 1);
+		}
+		CHECK(mock::sdio::violations() == 0);
+	}
+
+	// Requests queue up behind each other and run in order
+	void test_queue() {
+		CHECK(start({}));
+		Completion completion;
+
+		constexpr int count = sd::queue_length + 1;
+		Request requests[count + 1];
+		uint8_t *buffers[count];
+		for (int i = 0; i < count; ++i) {
+			requests[i] = {&completion, i};
+			buffers[i] = dma_buffer(2);
+			fill(buffers[i], 2, static_cast<uint8_t>(i * 31));
+			// The first starts straight away, which leaves room for queue_length more
+			CHECK(sd::write(200 + i * 2, buffers[i], 2, completed, &requests[i]) == sd::access_status::InProgress);
+		}
+		requests[count] = {&completion, count};
+		CHECK(sd::write(300, buffers[0], 1, completed, &requests[count]) == sd::access_status::Busy);
+
+		// Blocking access has to wait for the queue to empty
+		uint8_t scratch[512];
+		CHECK(sd::read(0, scratch, 1) == sd::access_status::Busy);
+
+		run_all();
+		std::vector<int> expected;
+		for (int i = 0; i < count; ++i) {
+			expected.push_back(i);
+			CHECK(card_has(200 + i * 2, buffers[i], 2));
+		}
+		CHECK(completion.order == expected);
+		for (auto result : completion.results) CHECK(result == sd::access_status::Ok);
+
+		CHECK(sd::read(0, scratch, 1) == sd::access_status::Ok);
+		CHECK(mock::sdio::violations() == 0);
+	}
+
+	// Callbacks can queue the next transfer, which starts once the card is free
+	struct Chain {
+		uint8_t *buffer;
+		uint32_t next, end;
+		int finished;
+		sd::access_status result;
+	};
+
+	void chained(void *argument, sd::access_status status) {
+		auto *chain = static_cast<Chain *>(argument);
+		chain->result = status;
+		++chain->finished;
+		if (status == sd::access_status::Ok && chain->next < chain->end) {
+			uint32_t sector = chain->next++;
+			sd::read(sector, chain->buffer + (sector % 8) * 512, 1, chained, chain);
+		}
+	}
+
+	void test_chain() {
+		CHECK(start({}));
+		for (uint32_t i = 0; i < 8; ++i) fill(mock::sdio::sector(400 + i), 1, static_cast<uint8_t>(i));
+
+		Chain chain{dma_buffer(8), 401, 408, 0, sd::access_status::Ok};
+		CHECK(sd::read(400, chain.buffer, 1, chained, &chain) == sd::access_status::InProgress);
+		run_all();
+		CHECK(chain.finished == 8);
+		CHECK(chain.result == sd::access_status::Ok);
+		CHECK(card_has(400, chain.buffer, 8));
+		CHECK(SDIO->DTIMER == 100u * 48'000);
+		CHECK(mock::sdio::violations() == 0);
+	}
+
+	void test_errors() {
+		CHECK(start({}));
+		Completion completion;
+		Request first{&completion, 1}, second{&completion, 2}, third{&completion, 3};
+		uint8_t *buffer = dma_buffer(2);
+
+		// Out of range: fails straight away, and the next request still runs
+		CHECK(sd::read(4095, buffer, 2, completed, &first) == sd::access_status::InProgress);
+		CHECK(!mock::sdio::transfer_pending());
+		CHECK(completion.results.size() == 1 && completion.results[0] == sd::access_status::InvalidAddress);
+
+		mock::sdio::fail_next_transfer();
+		CHECK(sd::read(0, buffer, 2, completed, &second) == sd::access_status::InProgress);
+		CHECK(sd::read(2, buffer, 2, completed, &third) == sd::access_status::InProgress);
+		run_all();
+		CHECK(completion.order == (std::vector<int>{1, 2, 3}));
+		CHECK(completion.results.size() == 3 && completion.results[1] == sd::access_status::CRCError);
+		CHECK(completion.results.size() == 3 && completion.results[2] == sd::access_status::Ok);
+
+		// Nothing to do without a card
+		sd::card.status = sd::init_status::NotInitialized;
+		CHECK(sd::read(0, buffer, 1, completed, &first) == sd::access_status::NotInitialized);
+		CHECK(sd::write(0, buffer, 1) == sd::access_status::NotInitialized);
+	}
+}
+
+int main() {
+	Card standard;
+	standard.high_capacity = false;
+	standard.set_block_count = false;
+	standard.high_speed = false;
+
+	test_init();
+	test_blocking({});
+	test_blocking(standard);
+	test_async({});
+	test_async(standard);
+	test_queue();
+	test_chain();
+	test_errors();
+	return test::report();
+}
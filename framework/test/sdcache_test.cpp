@@ -0,0 +1,257 @@
+// sdcache.cpp on top of a card stub backed by a disk image: cache hits and LRU eviction, read-ahead (including reads that
+// have to wait for it), write-back and coalescing of adjacent sectors, and keeping the read-ahead buffers coherent with
+// changes that were written back after they were loaded.
+
+#include "test.h"
+#include "mock/card.h"
+#include "mock/disk.h"
+#include <sdcache.h>
+#include <string.h>
+
+namespace {
+	constexpr uint32_t slot_count = MSYNTH_SD_CACHE_SECTORS;
+	constexpr uint32_t read_ahead = MSYNTH_SD_READ_AHEAD;
+	constexpr uint32_t disk_sectors = 8192;
+
+	// Every sector starts out as version 0, and tests write other versions over it
+	void make(uint32_t sector, uint8_t version, uint8_t *out) {
+		for (uint32_t i = 0; i < 512; ++i) out[i] = static_cast<uint8_t>(sector * 7 + i * 13 + version * 101 + (sector >> 8));
+	}
+
+	bool disk_has(uint32_t sector, uint8_t version) {
+		uint8_t expected[512], actual[512];
+		make(sector, version, expected);
+		mock::disk::read(sector, actual, 1);
+		return memcmp(expected, actual, 512) == 0;
+	}
+
+	bool read_is(uint32_t sector, uint8_t version) {
+		uint8_t expected[512], actual[512];
+		make(sector, version, expected);
+		return sd::cache::read(sector, actual, 1) == sd::access_status::Ok && memcmp(expected, actual, 512) == 0;
+	}
+
+	sd::access_status write(uint32_t sector, uint8_t version) {
+		uint8_t data[512];
+		make(sector, version, data);
+		return sd::cache::write(sector, data, 1);
+	}
+
+	// A fresh disk and an empty cache
+	void start() {
+		mock::disk::create(disk_sectors);
+		uint8_t data[512];
+		for (uint32_t sector = 0; sector < disk_sectors; ++sector) {
+			make(sector, 0, data);
+			mock::disk::write(sector, data, 1);
+		}
+		mock::card::insert();
+		sd::cache::invalidate();
+		sd::cache::reset_stats();
+		mock::disk::reset_stats();
+	}
+
+	// Read sectors far enough apart not to look sequential, pushing everything else out of the cache
+	void evict(uint32_t from) {
+		for (uint32_t i = 0; i < slot_count; ++i) CHECK(read_is(from + i * 10, 0));
+	}
+
+	void test_hits() {
+		start();
+		for (uint32_t i = 0; i < slot_count; ++i) CHECK(read_is(100 + i * 10, 0));
+		CHECK(mock::disk::stats().reads == slot_count);
+		CHECK(sd::cache::stats().misses == slot_count);
+
+		// Everything fits, so reading any of them again doesn't touch the card
+		CHECK(read_is(100, 0));
+		CHECK(read_is(100 + (slot_count - 1) * 10, 0));
+		CHECK(mock::disk::stats().reads == slot_count);
+		CHECK(sd::cache::stats().hits == 2);
+
+		// One more pushes out the least recently used, which is now the second one
+		CHECK(read_is(1000, 0));
+		CHECK(read_is(100, 0));
+		CHECK(read_is(120, 0));
+		CHECK(mock::disk::stats().reads == slot_count + 1);
+		CHECK(read_is(110, 0));
+		CHECK(mock::disk::stats().reads == slot_count + 2);
+		CHECK(sd::cache::stats().hits == 4);
+		CHECK(sd::cache::stats().read_ahead_hits == 0);
+	}
+
+	void test_read_ahead() {
+		start();
+		CHECK(read_is(1000, 0));
+
+		// The second sequential read gets a whole buffer at once and starts loading the next one in the background
+		CHECK(read_is(1001, 0));
+		CHECK(mock::disk::stats().sectors_read == 1 + read_ahead);
+		CHECK(mock::card::pending() == 1);
+		CHECK(sd::cache::stats().read_ahead_sectors == read_ahead);
+
+		for (uint32_t sector = 1002; sector < 1001 + read_ahead; ++sector) CHECK(read_is(sector, 0));
+		CHECK(mock::disk::stats().reads == 2);
+		CHECK(mock::card::pending() == 1);
+
+		// The next buffer is still loading, so this waits for it, then starts loading the one after
+		CHECK(read_is(1001 + read_ahead, 0));
+		CHECK(mock::card::pending() == 1);
+		CHECK(sd::cache::stats().read_ahead_sectors == 2 * read_ahead);
+
+		for (uint32_t sector = 1002 + read_ahead; sector < 1001 + 5 * read_ahead; ++sector) CHECK(read_is(sector, 0));
+		CHECK(sd::cache::stats().misses == 2);
+		CHECK(sd::cache::stats().read_ahead_hits == 5 * read_ahead - 1);
+		CHECK(sd::cache::stats().hits == 0);
+
+		// A miss elsewhere has to wait for the read-ahead in flight before it can use the card
+		CHECK(mock::card::pending() == 1);
+		CHECK(read_is(5000, 0));
+		CHECK(mock::card::pending() == 0);
+
+		// Right up to the end of the card
+		CHECK(read_is(disk_sectors - 3, 0));
+		CHECK(read_is(disk_sectors - 2, 0));
+		CHECK(read_is(disk_sectors - 1, 0));
+		uint8_t data[512];
+		CHECK(sd::cache::read(disk_sectors, data, 1) != sd::access_status::Ok);
+	}
+
+	void test_write_back() {
+		start();
+
+		// Single sectors stay in the cache until they're flushed, then go out as one write
+		for (uint32_t sector = 2000; sector < 2004; ++sector) CHECK(write(sector, 1) == sd::access_status::Ok);
+		CHECK(mock::disk::stats().writes == 0);
+		CHECK(disk_has(2001, 0));
+		CHECK(read_is(2001, 1));
+		CHECK(sd::cache::flush() == sd::access_status::Ok);
+		CHECK(mock::disk::stats().writes == 1 && mock::disk::stats().sectors_written == 4);
+		CHECK(sd::cache::stats().write_backs == 1 && sd::cache::stats().sectors_written == 4);
+		for (uint32_t sector = 2000; sector < 2004; ++sector) CHECK(disk_has(sector, 1));
+		CHECK(sd::cache::flush() == sd::access_status::Ok);
+		CHECK(mock::disk::stats().writes == 1);
+
+		// Sectors that aren't next to each other are written separately
+		CHECK(write(3000, 1) == sd::access_status::Ok);
+		CHECK(write(3002, 1) == sd::access_status::Ok);
+		CHECK(sd::cache::flush() == sd::access_status::Ok);
+		CHECK(mock::disk::stats().writes == 3 && mock::disk::stats().sectors_written == 6);
+		CHECK(disk_has(3000, 1) && disk_has(3001, 0) && disk_has(3002, 1));
+
+		// A full cache's worth of adjacent sectors, written in any order
+		sd::cache::invalidate();
+		mock::disk::reset_stats();
+		for (uint32_t i = 0; i < slot_count; ++i) CHECK(write(7000 + (i * 3) % slot_count, 2) == sd::access_status::Ok);
+		CHECK(sd::cache::flush() == sd::access_status::Ok);
+		CHECK(mock::disk::stats().writes == (slot_count + read_ahead - 1) / read_ahead);
+		for (uint32_t i = 0; i < slot_count; ++i) CHECK(disk_has(7000 + i, 2));
+
+		// Evicting a dirty sector writes it back
+		sd::cache::invalidate();
+		mock::disk::reset_stats();
+		CHECK(write(6000, 1) == sd::access_status::Ok);
+		evict(6100);
+		CHECK(mock::disk::stats().writes == 1);
+		CHECK(disk_has(6000, 1));
+		CHECK(read_is(6000, 1));
+	}
+
+	// Transfers of more than one sector bypass the cache without going out of sync with it
+	void test_long_transfers() {
+		start();
+
+		CHECK(write(2100, 1) == sd::access_status::Ok);
+		uint8_t data[3 * 512], expected[512];
+		CHECK(sd::cache::read(2099, data, 3) == sd::access_status::Ok);
+		make(2099, 0, expected);
+		CHECK(memcmp(data, expected, 512) == 0);
+		make(2100, 1, expected);
+		CHECK(memcmp(data + 512, expected, 512) == 0);
+		make(2101, 0, expected);
+		CHECK(memcmp(data + 1024, expected, 512) == 0);
+		CHECK(disk_has(2100, 0));
+
+		CHECK(read_is(2200, 0));
+		for (uint32_t i = 0; i < 3; ++i) make(2199 + i, 2, data + i * 512);
+		CHECK(sd::cache::write(2199, data, 3) == sd::access_status::Ok);
+		CHECK(disk_has(2199, 2) && disk_has(2200, 2) && disk_has(2201, 2));
+		uint32_t reads = mock::disk::stats().reads;
+		CHECK(read_is(2200, 2));
+		CHECK(mock::disk::stats().reads == reads);
+
+		// The write replaced the cached change too, so it isn't written back over the new data
+		for (uint32_t i = 0; i < 3; ++i) make(2099 + i, 3, data + i * 512);
+		CHECK(sd::cache::write(2099, data, 3) == sd::access_status::Ok);
+		CHECK(sd::cache::flush() == sd::access_status::Ok);
+		CHECK(disk_has(2100, 3));
+		CHECK(read_is(2100, 3));
+	}
+
+	// Read-ahead buffers loaded while a newer version of a sector was still waiting in the cache
+	void test_stream_coherence() {
+		start();
+
+		CHECK(write(4005, 1) == sd::access_status::Ok);
+		CHECK(read_is(4000, 0));
+		CHECK(read_is(4001, 0)); // loads 4001 onwards, with the old 4005
+		CHECK(read_is(4005, 1));
+		CHECK(sd::cache::flush() == sd::access_status::Ok);
+		CHECK(disk_has(4005, 1));
+
+		// Once the cached copy is gone the read-ahead buffer has to have the new data
+		evict(7200);
+		uint32_t read_ahead_hits = sd::cache::stats().read_ahead_hits;
+		CHECK(read_is(4005, 1));
+		CHECK(sd::cache::stats().read_ahead_hits == read_ahead_hits + 1);
+
+		// The same when the sectors are written back together, through the other read-ahead buffer
+		CHECK(write(4105, 1) == sd::access_status::Ok);
+		CHECK(write(4106, 1) == sd::access_status::Ok);
+		CHECK(read_is(4100, 0));
+		CHECK(read_is(4101, 0));
+		CHECK(sd::cache::flush() == sd::access_status::Ok);
+		CHECK(disk_has(4105, 1) && disk_has(4106, 1));
+		evict(7400);
+		read_ahead_hits = sd::cache::stats().read_ahead_hits;
+		CHECK(read_is(4105, 1));
+		CHECK(read_is(4106, 1));
+		CHECK(read_is(4107, 0));
+		CHECK(sd::cache::stats().read_ahead_hits == read_ahead_hits + 3);
+
+		// Writing a sector drops it from the read-ahead buffers
+		CHECK(write(4107, 2) == sd::access_status::Ok);
+		CHECK(sd::cache::flush() == sd::access_status::Ok);
+		evict(7600);
+		CHECK(read_is(4107, 2));
+	}
+
+	void test_invalidate() {
+		start();
+
+		// Unwritten changes are dropped
+		CHECK(write(5000, 1) == sd::access_status::Ok);
+		sd::cache::invalidate(5000, 1);
+		CHECK(read_is(5000, 0));
+		CHECK(sd::cache::flush() == sd::access_status::Ok);
+		CHECK(mock::disk::stats().writes == 0);
+
+		// Changes made behind the cache's back show up once it's told about them
+		CHECK(read_is(5100, 0));
+		uint8_t data[512];
+		make(5100, 1, data);
+		mock::disk::write(5100, data, 1);
+		CHECK(read_is(5100, 0));
+		sd::cache::invalidate();
+		CHECK(read_is(5100, 1));
+	}
+}
+
+int main() {
+	test_hits();
+	test_read_ahead();
+	test_write_back();
+	test_long_transfers();
+	test_stream_coherence();
+	test_invalidate();
+	return test::report();
+}
@@ -0,0 +1,171 @@
+#pragma once
+// Host stand-in for the CMSIS device header (and the LL drivers, whose headers all just include this one)
+//
+// Only covers what the library code under test uses. Peripherals that matter to a test are simulated in mock/; the rest of
+// the setup calls do nothing.
+
+#include <stdint.h>
+#include <mock/sdio.h>
+#include <mock/flash.h>
+
+// CORE
+
+inline uint32_t mock_primask = 0;
+inline uint32_t __get_PRIMASK() {return mock_primask;}
+inline void __set_PRIMASK(uint32_t primask) {mock_primask = primask;}
+inline void __disable_irq() {mock_primask = 1;}
+inline void __enable_irq() {mock_primask = 0;}
+// Tests run "interrupts" by calling the handlers themselves, from thread mode
+inline uint32_t __get_IPSR() {return 0;}
+inline uint32_t __REV(uint32_t value) {return __builtin_bswap32(value);}
+inline void __DSB() {}
+inline void __DMB() {}
+
+enum IRQn_Type {SDIO_IRQn = 49};
+template<typename... Args> inline void NVIC_SetPriority(Args...) {}
+template<typename... Args> inline void NVIC_EnableIRQ(Args...) {}
+inline uint32_t NVIC_GetPriorityGrouping() {return 0;}
+inline uint32_t NVIC_EncodePriority(uint32_t, uint32_t, uint32_t) {return 0;}
+
+// SDIO (see mock/sdio.h)
+
+#define SDIO (&mock::sdio::registers)
+
+#define SDIO_STA_CCRCFAIL (1u << 0)
+#define SDIO_STA_DCRCFAIL (1u << 1)
+#define SDIO_STA_CTIMEOUT (1u << 2)
+#define SDIO_STA_DTIMEOUT (1u << 3)
+#define SDIO_STA_TXUNDERR (1u << 4)
+#define SDIO_STA_RXOVERR (1u << 5)
+#define SDIO_STA_CMDREND (1u << 6)
+#define SDIO_STA_CMDSENT (1u << 7)
+#define SDIO_STA_DATAEND (1u << 8)
+#define SDIO_STA_STBITERR (1u << 9)
+#define SDIO_STA_DBCKEND (1u << 10)
+#define SDIO_STA_TXACT (1u << 12)
+#define SDIO_STA_RXACT (1u << 13)
+#define SDIO_STA_TXFIFOHE (1u << 14)
+#define SDIO_STA_RXFIFOHF (1u << 15)
+#define SDIO_STA_RXDAVL (1u << 21)
+
+#define SDIO_MASK_DCRCFAILIE SDIO_STA_DCRCFAIL
+#define SDIO_MASK_DTIMEOUTIE SDIO_STA_DTIMEOUT
+#define SDIO_MASK_TXUNDERRIE SDIO_STA_TXUNDERR
+#define SDIO_MASK_RXOVERRIE SDIO_STA_RXOVERR
+#define SDIO_MASK_DATAENDIE SDIO_STA_DATAEND
+#define SDIO_MASK_STBITERRIE SDIO_STA_STBITERR
+
+#define SDIO_CMD_WAITRESP_Pos 6
+#define SDIO_CMD_WAITRESP (3u << SDIO_CMD_WAITRESP_Pos)
+#define SDIO_CMD_CPSMEN (1u << 10)
+
+#define SDIO_CLKCR_CLKDIV_Pos 0
+#define SDIO_CLKCR_CLKEN (1u << 8)
+#define SDIO_CLKCR_BYPASS (1u << 10)
+#define SDIO_CLKCR_WIDBUS_0 (1u << 11)
+
+#define SDIO_DCTRL_DTEN (1u << 0)
+#define SDIO_DCTRL_DTDIR (1u << 1)
+#define SDIO_DCTRL_DMAEN (1u << 3)
+#define SDIO_DCTRL_DBLOCKSIZE_Pos 4
+
+// DMA (only stream 3 of DMA2, the SDIO one, is simulated)
+
+#define DMA2 (&mock::sdio::dma)
+#define LL_DMA_STREAM_3 3
+#define LL_DMA_DIRECTION_PERIPH_TO_MEMORY 0u
+#define LL_DMA_DIRECTION_MEMORY_TO_PERIPH 1u
+#define LL_DMA_PRIORITY_HIGH 0
+#define LL_DMA_CHANNEL_4 0
+#define LL_DMA_MODE_PFCTRL 0
+#define LL_DMA_PDATAALIGN_WORD 0
+#define LL_DMA_MDATAALIGN_WORD 0
+#define LL_DMA_PBURST_INC4 0
+#define LL_DMA_MBURST_INC4 0
+#define LL_DMA_FIFOTHRESHOLD_FULL 0
+#define LL_DMA_MEMORY_INCREMENT 0
+#define LL_DMA_PERIPH_NOINCREMENT 0
+
+inline void LL_DMA_SetMemoryAddress(mock::sdio::Dma *dma, int, uint32_t address) {dma->memory = address;}
+inline void LL_DMA_SetDataTransferDirection(mock::sdio::Dma *dma, int, uint32_t direction) {dma->to_peripheral = direction;}
+inline void LL_DMA_SetDataLength(mock::sdio::Dma *dma, int, uint32_t words) {dma->length = words;}
+inline void LL_DMA_EnableStream(mock::sdio::Dma *dma, int) {dma->enabled = true;}
+inline void LL_DMA_DisableStream(mock::sdio::Dma *dma, int) {dma->enabled = false;}
+inline void LL_DMA_ClearFlag_TC3(mock::sdio::Dma *) {}
+inline uint32_t LL_DMA_IsActiveFlag_TE3(mock::sdio::Dma *) {return 0;}
+inline void LL_DMA_ClearFlag_TE3(mock::sdio::Dma *) {}
+template<typename... Args> inline void LL_DMA_SetStreamPriorityLevel(Args...) {}
+template<typename... Args> inline void LL_DMA_SetChannelSelection(Args...) {}
+template<typename... Args> inline void LL_DMA_SetMode(Args...) {}
+template<typename... Args> inline void LL_DMA_SetPeriphAddress(Args...) {}
+template<typename... Args> inline void LL_DMA_SetPeriphSize(Args...) {}
+template<typename... Args> inline void LL_DMA_SetMemorySize(Args...) {}
+template<typename... Args> inline void LL_DMA_SetPeriphBurstxfer(Args...) {}
+template<typename... Args> inline void LL_DMA_SetMemoryBurstxfer(Args...) {}
+template<typename... Args> inline void LL_DMA_EnableFifoMode(Args...) {}
+template<typename... Args> inline void LL_DMA_SetFIFOThreshold(Args...) {}
+template<typename... Args> inline void LL_DMA_SetMemoryIncMode(Args...) {}
+template<typename... Args> inline void LL_DMA_SetPeriphIncMode(Args...) {}
+
+// FLASH (see mock/flash.h)
+
+#define FLASH (&mock::flash::registers)
+
+#define FLASH_ACR_DCEN (1u << 10)
+#define FLASH_ACR_DCRST (1u << 12)
+
+#define FLASH_SR_SOP (1u << 1)
+#define FLASH_SR_WRPERR (1u << 4)
+#define FLASH_SR_PGAERR (1u << 5)
+#define FLASH_SR_PGPERR (1u << 6)
+#define FLASH_SR_PGSERR (1u << 7)
+#define FLASH_SR_BSY (1u << 16)
+
+#define FLASH_CR_PG (1u << 0)
+#define FLASH_CR_SER (1u << 1)
+#define FLASH_CR_SNB_Pos 3
+#define FLASH_CR_PSIZE_1 (1u << 9)
+#define FLASH_CR_STRT (1u << 16)
+#define FLASH_CR_LOCK (1u << 31)
+
+// GPIO, EXTI, clocks: nothing to simulate. The card detect pin reads as inserted (active low).
+
+#define ENABLE 1
+#define GPIOC nullptr
+#define GPIOD nullptr
+#define GPIOG nullptr
+#define LL_GPIO_PIN_0 (1u << 0)
+#define LL_GPIO_PIN_2 (1u << 2)
+#define LL_GPIO_PIN_8 (1u << 8)
+#define LL_GPIO_PIN_9 (1u << 9)
+#define LL_GPIO_PIN_10 (1u << 10)
+#define LL_GPIO_PIN_11 (1u << 11)
+#define LL_GPIO_PIN_12 (1u << 12)
+#define LL_GPIO_MODE_INPUT 0
+#define LL_GPIO_MODE_ALTERNATE 2
+#define LL_GPIO_OUTPUT_PUSHPULL 0
+#define LL_GPIO_SPEED_FREQ_LOW 0
+#define LL_GPIO_SPEED_FREQ_VERY_HIGH 3
+#define LL_GPIO_PULL_NO 0
+#define LL_GPIO_PULL_UP 1
+#define LL_GPIO_AF_12 12
+#define LL_EXTI_LINE_0 (1u << 0)
+#define LL_EXTI_MODE_IT 0
+#define LL_EXTI_TRIGGER_RISING_FALLING 3
+#define LL_SYSCFG_EXTI_PORTG 6
+#define LL_SYSCFG_EXTI_LINE0 0
+#define LL_AHB1_GRP1_PERIPH_GPIOC (1u << 2)
+#define LL_AHB1_GRP1_PERIPH_GPIOD (1u << 3)
+#define LL_AHB1_GRP1_PERIPH_GPIOG (1u << 6)
+#define LL_AHB1_GRP1_PERIPH_DMA2 (1u << 22)
+#define LL_APB2_GRP1_PERIPH_SDIO (1u << 11)
+#define LL_APB2_GRP1_PERIPH_SYSCFG (1u << 14)
+
+struct LL_GPIO_InitTypeDef {uint32_t Pin, Mode, Speed, OutputType, Pull, Alternate;};
+struct LL_EXTI_InitTypeDef {uint32_t Line_0_31; uint8_t LineCommand, Mode, Trigger;};
+template<typename... Args> inline void LL_GPIO_Init(Args...) {}
+template<typename... Args> inline void LL_EXTI_Init(Args...) {}
+template<typename... Args> inline void LL_SYSCFG_SetEXTISource(Args...) {}
+template<typename... Args> inline void LL_AHB1_GRP1_EnableClock(Args...) {}
+template<typename... Args> inline void LL_APB2_GRP1_EnableClock(Args...) {}
+template<typename... Args> inline uint32_t LL_GPIO_IsInputPinSet(Args...) {return 0;}
@@ -0,0 +1,21 @@
+#pragma once
+// Minimal checks for the host tests. A failed CHECK prints where it was and carries on; main returns test::report().
+
+#include <stdio.h>
+
+namespace test {
+	inline int failures = 0;
+
+	inline int report() {
+		if (failures) printf("%d check%s failed\n", failures, failures == 1 ? "" : "s");
+		else printf("ok\n");
+		return failures ? 1 : 0;
+	}
+}
+
+#define CHECK(condition) do { \
+		if (!(condition)) { \
+			printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+			++test::failures; \
+		} \
+	} while (0)
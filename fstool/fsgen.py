@@ -3,11 +3,88 @@ import os
 import struct
 import sys
 
-VERSION = 1
+VERSION = 3
 
 FLAG_T_SYSTEM = 1
 FLAG_T_PRIVATE = 4
 
+HEADER_SIZE = 0x188
+INDEX_ENTRY_SIZE = 12
+
+# These have to match path_hash and index_slot in fs.h
+
+def path_hash(path):
+    h = 0x811c9dc5
+    for c in path:
+        h = ((h ^ c) * 0x01000193) & 0xFFFFFFFF
+    h ^= h >> 16
+    h = (h * 0x85ebca6b) & 0xFFFFFFFF
+    h ^= h >> 13
+    h = (h * 0xc2b2ae35) & 0xFFFFFFFF
+    h ^= h >> 16
+    return h
+
+def index_slot(h, displacement, entry_count):
+    h ^= (displacement * 0x9e3779b9) & 0xFFFFFFFF
+    h ^= h >> 15
+    h = (h * 0x2c1b3c6d) & 0xFFFFFFFF
+    h ^= h >> 12
+    return h % entry_count
+
+def index_header_size(version):
+    return 20 if version >= 3 else 12
+
+def index_size(bucket_count, entry_count, version=VERSION):
+    return index_header_size(version) + 2 * (bucket_count + (bucket_count & 1)) + INDEX_ENTRY_SIZE * entry_count
+
+def build_index(hashes):
+    """Find a displacement for every bucket so that all the hashes land in different slots (hash and displace).
+    Returns the displacements, and the slot of every hash."""
+    entry_count = len(hashes)
+    bucket_count = 1
+    while bucket_count * 2 < entry_count:
+        bucket_count *= 2
+
+    while True:
+        buckets = [[] for x in range(bucket_count)]
+        for i, h in enumerate(hashes):
+            buckets[h & (bucket_count - 1)].append(i)
+
+        displacements = [0] * bucket_count
+        slots = [None] * entry_count
+        taken = set()
+        # Fullest buckets first, while there's still lots of room
+        for b in sorted(range(bucket_count), key=lambda b: -len(buckets[b])):
+            if not buckets[b]:
+                continue
+            for d in range(0x10000):
+                wanted = [index_slot(hashes[i], d, entry_count) for i in buckets[b]]
+                if len(set(wanted)) == len(wanted) and not taken.intersection(wanted):
+                    break
+            else:
+                break
+            displacements[b] = d
+            taken.update(wanted)
+            for i, slot in zip(buckets[b], wanted):
+                slots[i] = slot
+        else:
+            return displacements, slots
+
+        if bucket_count >= 0x8000:
+            print("fsgen: Couldn't build the path index")
+            exit(3)
+        bucket_count *= 2
+
+# --version 1 or 2 writes the older layouts (no index, or one without generation and erases), for testing that the firmware
+# still reads them
+version = VERSION
+if len(sys.argv) == 5 and sys.argv[1] == "--version":
+    version = int(sys.argv[2])
+    del sys.argv[1:3]
+    if version not in (1, 2, VERSION):
+        print("fsgen: Can't write version {}".format(version))
+        exit(1)
+
 if len(sys.argv) != 3:
     print("fsgen: No input dir and output bin")
     exit(1)
@@ -48,6 +125,10 @@ for toplevel in toplevel_names:
         with open(path, 'rb') as f:
             contents = f.read()
 
+        if any(f[0] == fname for f in filechain_info[toplevel]):
+            print("fsgen: Duplicate name {}/{}".format(toplevel, fname))
+            exit(2)
+
         
         if filechain_info[toplevel]:
             filechain_info[toplevel][-1][4] = False  # mark last
@@ -55,9 +136,24 @@ for toplevel in toplevel_names:
                 [fname, 0, len(contents), contents, True]
         )
 
+# Hash every path for the index
+index_paths = [
+    (ti, f) for ti, toplevel in enumerate(toplevel_names) for f in filechain_info[toplevel]
+]
+index_hashes = [path_hash("{}/{}".format(toplevel_names[ti], f[0]).encode('ascii')) for ti, f in index_paths]
+if len(set(index_hashes)) != len(index_hashes):
+    print("fsgen: Two paths have the same hash, rename one of them")
+    exit(3)
+
+index_displacements, index_slots = build_index(index_hashes)
+print("fsgen: Indexed {} files with {} buckets".format(len(index_paths), len(index_displacements)))
+
 # Create blob of resources
 datablb = bytearray()
-insertptr = 0x080E0000 + 0x188 # start of fs + size of header
+insertptr = 0x080E0000 + HEADER_SIZE # start of fs + size of header & index
+if version >= 2:
+    insertptr += index_size(len(index_displacements), len(index_paths), version)
+file_ptr = {}
 
 filechain_ptr = {
 }
@@ -67,6 +163,8 @@ for toplevel in toplevel_names:
     print("fsgen: Starting filechain {} at 0x{:08x}".format(toplevel, insertptr))
     filechain_ptr[toplevel] = insertptr if filechain_info[toplevel] else 0xFFFFFFFF
     for f in filechain_info[toplevel]:
+        file_ptr[id(f)] = insertptr
+
         # Increment the insertptr by the size of this file
         # 0x38 header + length
         insertptr += 0x24 + f[2]
@@ -92,11 +190,12 @@ for toplevel in toplevel_names:
             datablb.extend(0 for x in range(padding))
 
 # Create the main header
-header = struct.pack("<4sBBH", b"MSFS", VERSION, 1, # TODO set this properly
-    (1 << len(toplevel_names)) - 1                 # set headers
+header = struct.pack("<4sBBH", b"MSFS", version, 1, # TODO set this properly
+    0xFFFF if version >= 3 else                    # every slot can hold a folder; free ones are left erased so they can be written at runtime
+    (1 << len(toplevel_names)) - 1                 # (older images only marked the used ones, and zeroed the rest)
 )
 
-blank_toplevel = bytearray(0 for x in range(0x18))
+blank_toplevel = bytearray((0xFF if version >= 3 else 0) for x in range(0x18))
 # Write out the final image, generating the TopLevels in the process
 
 with open(sys.argv[2], 'wb') as img:
@@ -112,6 +211,26 @@ with open(sys.argv[2], 'wb') as img:
     for i in range(16 - len(toplevel_names)):
         img.write(blank_toplevel)
 
+    # Write the index
+    if version >= 3:
+        img.write(struct.pack("<4sHHIII", b"fIdX", len(index_displacements), len(index_paths), 0xFFFFFFFF,
+            0, # generation
+            0  # erases (unknown)
+        ))
+    elif version == 2:
+        img.write(struct.pack("<4sHHI", b"fIdX", len(index_displacements), len(index_paths), 0xFFFFFFFF))
+
+    if version >= 2:
+        img.write(struct.pack("<{}H".format(len(index_displacements)), *index_displacements))
+        if len(index_displacements) % 2:
+            img.write(bytes(2))
+
+        entries = [None] * len(index_paths)
+        for (ti, f), h, slot in zip(index_paths, index_hashes, index_slots):
+            entries[slot] = struct.pack("<IIB3x", h, file_ptr[id(f)], ti)
+        for entry in entries:
+            img.write(entry)
+
     # Write datablb
     img.write(datablb)
 